@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <resource.h>
+#include <preload.h>
+#include <watch.h>
+
+static int failures = 0;
+
+#define CHECK(cond, what) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL: %s\n", what); \
+            failures++; \
+        } \
+    } while(0)
+
+/**
+ * runs the manager until nothing the preload requested is loading anymore
+ */
+static void
+wait_preload(struct resource_manager *manager, struct level_preload *preload)
+{
+    unsigned int loaded, total;
+
+    while (!level_preload_ready(preload, &loaded, &total)) {
+        resource_manager_update(manager);
+        usleep(1000);
+    }
+    resource_manager_update(manager);
+    printf("  preloaded %u resources\n", total);
+}
+
+/**
+ * preloads a level, reloads its background and evicts everything again
+ */
+static void
+test_level(const char *dvd_file_name,
+           const char *data_dir,
+           const char *background,
+           unsigned int num_threads)
+{
+    int err = 0;
+
+    printf("%u threads\n", num_threads);
+
+    struct resource_manager *manager =
+      resource_manager_new(64 * 1024 * 1024, num_threads, &err);
+    CHECK(manager, "resource_manager_new");
+    if (!manager)
+        return;
+
+    struct level_preload *preload =
+      level_preload_new(manager, dvd_file_name, data_dir, &err);
+    CHECK(preload, "level_preload_new");
+    if (!preload) {
+        resource_manager_free(manager);
+        return;
+    }
+    level_preload_activate(preload);
+    wait_preload(manager, preload);
+
+    resource_handle level = level_preload_level(preload);
+    CHECK(resource_state(manager, level, NULL) == RESOURCE_STATE_READY,
+          "level is ready");
+    CHECK(resource_get(manager, level), "level resource");
+
+    if (background) {
+        resource_handle handle = level_preload_background(preload);
+        struct loader_pixmap *pixmap = resource_get(manager, handle);
+        CHECK(pixmap && pixmap->pixels, "background is decoded");
+
+        /* the old handle goes stale, the preload requests it again */
+        CHECK(resource_reload(manager, background) > 0, "background reload");
+        CHECK(resource_state(manager, handle, NULL) == RESOURCE_STATE_NONE,
+              "reloaded handle is stale");
+        wait_preload(manager, preload);
+
+        handle = level_preload_background(preload);
+        CHECK(resource_state(manager, handle, NULL) == RESOURCE_STATE_READY,
+              "reloaded background is ready");
+        pixmap = resource_get(manager, handle);
+        CHECK(pixmap && pixmap->pixels, "reloaded background is decoded");
+    }
+
+    /* nothing is acquired anymore, a zero budget evicts everything */
+    level_preload_free(preload);
+    resource_manager_set_budget(manager, 0);
+    resource_manager_update(manager);
+    CHECK(resource_manager_memory_used(manager) == 0, "eviction");
+    CHECK(resource_state(manager, level, NULL) == RESOURCE_STATE_NONE,
+          "evicted handle is stale");
+
+    resource_manager_free(manager);
+}
+
+/**
+ * writes a copy of the file at from to to
+ * returns 0 on success
+ */
+static int
+copy_file(const char *from, const char *to)
+{
+    char buffer[65536];
+    size_t len;
+    int err = 0;
+
+    FILE *in = fopen(from, "rb");
+    if (!in)
+        return -1;
+    FILE *out = fopen(to, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+
+    while ((len = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, len, out) != len)
+            err = -1;
+    }
+    if (ferror(in))
+        err = -1;
+
+    fclose(in);
+    if (fclose(out))
+        err = -1;
+    return err;
+}
+
+/**
+ * loads the background synchronously and checks it is decoded
+ */
+static resource_handle
+load_background(struct resource_manager *manager, const char *file_name)
+{
+    int err = 0;
+
+    resource_handle handle = resource_load(manager,
+                                           RESOURCE_BACKGROUND,
+                                           file_name,
+                                           RESOURCE_PRIORITY_NORMAL,
+                                           &err);
+    CHECK(handle != RESOURCE_NO_HANDLE, "resource_load");
+
+    while (resource_state(manager, handle, NULL) == RESOURCE_STATE_LOADING)
+        resource_manager_update(manager);
+    struct loader_pixmap *pixmap = resource_get(manager, handle);
+    CHECK(pixmap && pixmap->pixels, "watched background is decoded");
+
+    return handle;
+}
+
+/**
+ * watches a copy of the background, rewrites it and renames a new copy
+ * over it, both have to reload it
+ */
+static void
+test_watch(const char *background)
+{
+    char dir[] = "/tmp/assettest.XXXXXX";
+    char file_name[sizeof(dir) + 16], tmp_name[sizeof(dir) + 16];
+    int err = 0;
+
+    printf("watch\n");
+
+    if (!mkdtemp(dir)) {
+        CHECK(0, "mkdtemp");
+        return;
+    }
+    snprintf(file_name, sizeof(file_name), "%s/bg.dvm", dir);
+    snprintf(tmp_name, sizeof(tmp_name), "%s/bg.tmp", dir);
+    CHECK(copy_file(background, file_name) == 0, "copy background");
+
+    struct resource_manager *manager =
+      resource_manager_new(64 * 1024 * 1024, 0, &err);
+    CHECK(manager, "resource_manager_new");
+    struct asset_watch *watch = manager ?
+      asset_watch_new(manager, &err) : NULL;
+    CHECK(watch, "asset_watch_new");
+    if (!watch)
+        goto out;
+    CHECK(asset_watch_add(watch, file_name) == 0, "asset_watch_add");
+
+    /* nothing changed yet */
+    resource_handle handle = load_background(manager, file_name);
+    CHECK(asset_watch_dispatch(watch) == 0, "no reload without changes");
+    CHECK(resource_state(manager, handle, NULL) == RESOURCE_STATE_READY,
+          "unchanged handle stays ready");
+
+    /* rewritten in place */
+    CHECK(copy_file(background, file_name) == 0, "rewrite background");
+    CHECK(asset_watch_dispatch(watch) > 0, "rewrite reloads");
+    CHECK(resource_state(manager, handle, NULL) == RESOURCE_STATE_NONE,
+          "rewritten handle is stale");
+    handle = load_background(manager, file_name);
+
+    /* replaced by rename */
+    CHECK(copy_file(background, tmp_name) == 0, "copy new background");
+    CHECK(rename(tmp_name, file_name) == 0, "rename over background");
+    CHECK(asset_watch_dispatch(watch) > 0, "rename reloads");
+    CHECK(resource_state(manager, handle, NULL) == RESOURCE_STATE_NONE,
+          "renamed over handle is stale");
+    handle = load_background(manager, file_name);
+    CHECK(resource_state(manager, handle, NULL) == RESOURCE_STATE_READY,
+          "reloaded background is ready");
+
+out:
+    asset_watch_free(watch);
+    resource_manager_free(manager);
+    unlink(tmp_name);
+    unlink(file_name);
+    rmdir(dir);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct level_deps deps;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s level.dvd [data_dir]\n", argv[0]);
+        return 1;
+    }
+
+    const char *data_dir = argc > 2 ? argv[2] : NULL;
+    if (level_deps_read(argv[1], data_dir, &deps)) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    printf("%s: background %s, %u dvf files\n",
+           argv[1],
+           deps.background ? deps.background : "none",
+           deps.num_dvfs);
+
+    /* synchronous, then on loader threads */
+    test_level(argv[1], data_dir, deps.background, 0);
+    test_level(argv[1], data_dir, deps.background, 2);
+    if (deps.background)
+        test_watch(deps.background);
+
+    level_deps_cleanup(&deps);
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,914 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * asynchronous loader
+ * ===================
+ *
+ * Requests wait in a binary heap ordered by priority and submission order
+ * which is shared by a fixed number of worker threads. Requests below
+ * LOADER_PRIORITY_NORMAL go to a separate heap served by a background
+ * worker running at idle io and lowest cpu priority, so preloading does
+ * not compete with the game. Finished requests
+ * get pushed onto a lock-free multiple producer single consumer queue
+ * (an intrusive Vyukov queue) so the thread owning the loader can drain
+ * them once per frame without contending with the workers.
+ *
+ * A ticket belongs to the thread that submitted it. The loader hands it
+ * back exactly once through loader_poll or loader_wait, loader_ticket_free
+ * on a ticket which is still in flight cancels it and the loader frees it
+ * once it comes back.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "dvf.h"
+#include "dvm.h"
+#include "dvd.h"
+#include "pixmap.h"
+#include "trace.h"
+#include "loader.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+#define LOADER_MAX_THREADS 64
+#define LOADER_NUM_BACKGROUND_THREADS 1
+
+#define LOADER_HEAP_FOREGROUND 0
+#define LOADER_HEAP_BACKGROUND 1
+#define LOADER_NUM_HEAPS 2
+
+/* ioprio_set(2) has no glibc wrapper */
+#define LOADER_IOPRIO_WHO_PROCESS 1
+#define LOADER_IOPRIO_CLASS_IDLE 3
+#define LOADER_IOPRIO_CLASS_SHIFT 13
+
+enum loader_state {
+    LOADER_STATE_QUEUED,
+    LOADER_STATE_RUNNING,
+    LOADER_STATE_DONE
+};
+
+/**
+ * a load request
+ */
+struct loader_ticket {
+    struct loader *loader;
+    loader_func func;
+    loader_free_func free_func;
+    void *data;
+    /* data is a copy of the file name made by a loader_load_* helper */
+    int owns_data;
+    void *user_data;
+    int priority;
+    uint32_t group;
+    /* submission order, breaks ties between equal priorities */
+    uint64_t sequence;
+    /* heap and position in it while queued */
+    unsigned int heap;
+    unsigned int heap_index;
+    /* protected by the loader mutex */
+    enum loader_state state;
+    /* set from any thread, checked by the worker after running */
+    int cancelled;
+    /* only touched by the owning thread */
+    int returned;
+    int released;
+    /* written by the worker before the ticket gets queued for completion */
+    void *result;
+    int err;
+    /* completion queue link */
+    struct loader_ticket *next;
+};
+
+/**
+ * intrusive mpsc queue
+ * head is where workers push, tail is where the owner pops
+ */
+struct loader_queue {
+    struct loader_ticket *head;
+    struct loader_ticket *tail;
+    struct loader_ticket stub;
+};
+
+struct loader_heap {
+    struct loader_ticket **tickets;
+    unsigned int size;
+    unsigned int alloc;
+    /* signalled when requests get queued or the loader stops */
+    pthread_cond_t work_cond;
+};
+
+struct loader_worker {
+    struct loader *loader;
+    pthread_t thread;
+    unsigned int heap;
+};
+
+struct loader {
+    pthread_mutex_t mutex;
+    /* signalled when requests complete */
+    pthread_cond_t done_cond;
+    int stop;
+
+    struct loader_heap heaps[LOADER_NUM_HEAPS];
+    uint64_t sequence;
+    /* submitted requests which did not complete yet */
+    unsigned int num_pending;
+
+    struct loader_queue done;
+    /* completed requests which were not polled yet */
+    unsigned int num_done;
+
+    unsigned int num_workers;
+    struct loader_worker workers[LOADER_MAX_THREADS +
+                                 LOADER_NUM_BACKGROUND_THREADS];
+};
+
+static void
+loader_queue_init(struct loader_queue *queue)
+{
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+}
+
+static void
+loader_queue_push(struct loader_queue *queue, struct loader_ticket *ticket)
+{
+    __atomic_store_n(&ticket->next, NULL, __ATOMIC_RELAXED);
+    struct loader_ticket *prev =
+        __atomic_exchange_n(&queue->head, ticket, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, ticket, __ATOMIC_RELEASE);
+}
+
+/**
+ * returns NULL if the queue is empty or a push is halfway done
+ */
+static struct loader_ticket *
+loader_queue_pop(struct loader_queue *queue)
+{
+    struct loader_ticket *tail = queue->tail;
+    struct loader_ticket *next =
+        __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &queue->stub) {
+        if (!next)
+            return NULL;
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    loader_queue_push(queue, &queue->stub);
+
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static int
+loader_heap_less(struct loader_ticket *a, struct loader_ticket *b)
+{
+    if (a->priority != b->priority)
+        return a->priority > b->priority;
+    return a->sequence < b->sequence;
+}
+
+static unsigned int
+loader_heap_for(int priority)
+{
+    return priority < LOADER_PRIORITY_NORMAL ?
+        LOADER_HEAP_BACKGROUND : LOADER_HEAP_FOREGROUND;
+}
+
+static void
+loader_heap_set(struct loader_heap *heap,
+                unsigned int index,
+                struct loader_ticket *ticket)
+{
+    heap->tickets[index] = ticket;
+    ticket->heap_index = index;
+}
+
+static void
+loader_heap_sift_up(struct loader_heap *heap, unsigned int index)
+{
+    struct loader_ticket *ticket = heap->tickets[index];
+
+    while (index > 0) {
+        unsigned int parent = (index - 1) / 2;
+        if (!loader_heap_less(ticket, heap->tickets[parent]))
+            break;
+        loader_heap_set(heap, index, heap->tickets[parent]);
+        index = parent;
+    }
+    loader_heap_set(heap, index, ticket);
+}
+
+static void
+loader_heap_sift_down(struct loader_heap *heap, unsigned int index)
+{
+    struct loader_ticket *ticket = heap->tickets[index];
+
+    while (1) {
+        unsigned int child = index * 2 + 1;
+        if (child >= heap->size)
+            break;
+        if (child + 1 < heap->size &&
+            loader_heap_less(heap->tickets[child + 1], heap->tickets[child]))
+            child++;
+        if (!loader_heap_less(heap->tickets[child], ticket))
+            break;
+        loader_heap_set(heap, index, heap->tickets[child]);
+        index = child;
+    }
+    loader_heap_set(heap, index, ticket);
+}
+
+/**
+ * queues a ticket on the heap matching its priority
+ * must be called with the mutex held
+ */
+static int
+loader_heap_push(struct loader *loader, struct loader_ticket *ticket)
+{
+    ticket->heap = loader_heap_for(ticket->priority);
+    struct loader_heap *heap = &loader->heaps[ticket->heap];
+
+    if (heap->size == heap->alloc) {
+        unsigned int alloc = heap->alloc ? heap->alloc * 2 : 64;
+        struct loader_ticket **tickets =
+            realloc(heap->tickets, alloc * sizeof(*tickets));
+        if (!tickets)
+            return ENOMEM;
+        heap->tickets = tickets;
+        heap->alloc = alloc;
+    }
+
+    loader_heap_set(heap, heap->size++, ticket);
+    loader_heap_sift_up(heap, ticket->heap_index);
+    pthread_cond_signal(&heap->work_cond);
+    return 0;
+}
+
+static void
+loader_heap_remove(struct loader *loader, struct loader_ticket *ticket)
+{
+    struct loader_heap *heap = &loader->heaps[ticket->heap];
+    unsigned int index = ticket->heap_index;
+    struct loader_ticket *last = heap->tickets[--heap->size];
+
+    if (last == ticket)
+        return;
+
+    loader_heap_set(heap, index, last);
+    loader_heap_sift_up(heap, index);
+    loader_heap_sift_down(heap, last->heap_index);
+}
+
+/**
+ * hands a finished ticket back to the owner
+ * must be called with the mutex held
+ */
+static void
+loader_complete(struct loader *loader, struct loader_ticket *ticket)
+{
+    ticket->state = LOADER_STATE_DONE;
+    loader_queue_push(&loader->done, ticket);
+    loader->num_pending--;
+    loader->num_done++;
+    pthread_cond_broadcast(&loader->done_cond);
+}
+
+/**
+ * moves the calling thread to the idle io class and the lowest cpu priority
+ * failures are ignored, the requests just run at normal priority then
+ */
+static void
+loader_thread_set_background(void)
+{
+    pid_t tid = syscall(SYS_gettid);
+
+    /* linux applies nice values to single threads */
+    setpriority(PRIO_PROCESS, tid, 19);
+#ifdef SYS_ioprio_set
+    syscall(SYS_ioprio_set,
+            LOADER_IOPRIO_WHO_PROCESS,
+            tid,
+            LOADER_IOPRIO_CLASS_IDLE << LOADER_IOPRIO_CLASS_SHIFT);
+#endif
+}
+
+static void *
+loader_thread(void *data)
+{
+    struct loader_worker *worker = data;
+    struct loader *loader = worker->loader;
+    struct loader_heap *heap = &loader->heaps[worker->heap];
+
+    if (worker->heap == LOADER_HEAP_BACKGROUND) {
+        loader_thread_set_background();
+        trace_set_thread_name("loader background");
+    } else {
+        trace_set_thread_name("loader");
+    }
+
+    pthread_mutex_lock(&loader->mutex);
+    while (1) {
+        while (!loader->stop && heap->size == 0)
+            pthread_cond_wait(&heap->work_cond, &loader->mutex);
+        if (loader->stop)
+            break;
+
+        struct loader_ticket *ticket = heap->tickets[0];
+        loader_heap_remove(loader, ticket);
+        ticket->state = LOADER_STATE_RUNNING;
+        pthread_mutex_unlock(&loader->mutex);
+
+        void *result = NULL;
+        int err = 0;
+        if (!__atomic_load_n(&ticket->cancelled, __ATOMIC_ACQUIRE)) {
+            TRACE_ZONE("loader_job");
+            result = ticket->func(ticket->data, &err);
+        }
+
+        /* cancelled while running, nobody wants the result */
+        if (__atomic_load_n(&ticket->cancelled, __ATOMIC_ACQUIRE)) {
+            if (result && ticket->free_func)
+                ticket->free_func(result);
+            result = NULL;
+            err = ECANCELED;
+        }
+        else if (!result && !err) {
+            err = EIO;
+        }
+
+        ticket->result = result;
+        ticket->err = err;
+
+        pthread_mutex_lock(&loader->mutex);
+        loader_complete(loader, ticket);
+    }
+    pthread_mutex_unlock(&loader->mutex);
+
+    return NULL;
+}
+
+/**
+ * creates a loader with num_threads foreground workers and a background
+ * worker, zero picks the number of online cpus
+ *
+ * returns a struct loader on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct loader *
+loader_new(unsigned int num_threads, int *err_out)
+{
+    int err = 0;
+    unsigned int i;
+
+    if (num_threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 0 ? cpus : 1;
+    }
+    if (num_threads > LOADER_MAX_THREADS)
+        num_threads = LOADER_MAX_THREADS;
+
+    struct loader *loader = malloc(sizeof(*loader));
+    if (!loader) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(loader, 0, sizeof(*loader));
+
+    pthread_mutex_init(&loader->mutex, NULL);
+    pthread_cond_init(&loader->done_cond, NULL);
+    for (i = 0; i < LOADER_NUM_HEAPS; i++)
+        pthread_cond_init(&loader->heaps[i].work_cond, NULL);
+    loader_queue_init(&loader->done);
+
+    num_threads += LOADER_NUM_BACKGROUND_THREADS;
+    for (; loader->num_workers < num_threads; loader->num_workers++) {
+        struct loader_worker *worker = &loader->workers[loader->num_workers];
+        worker->loader = loader;
+        worker->heap = loader->num_workers < LOADER_NUM_BACKGROUND_THREADS ?
+            LOADER_HEAP_BACKGROUND : LOADER_HEAP_FOREGROUND;
+
+        err = pthread_create(&worker->thread, NULL, loader_thread, worker);
+        if (err) {
+            DEBUG_ERROR("cannot create thread: %s\n", strerror(err));
+            goto error;
+        }
+    }
+
+    return loader;
+
+error:
+    loader_free(loader);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+/**
+ * cancels everything, waits for the workers and frees all tickets which
+ * were not handed back yet
+ */
+__SYM_EXPORT__ void
+loader_free(struct loader *loader)
+{
+    unsigned int i;
+
+    if (!loader)
+        return;
+
+    pthread_mutex_lock(&loader->mutex);
+    for (i = 0; i < LOADER_NUM_HEAPS; i++) {
+        struct loader_heap *heap = &loader->heaps[i];
+        while (heap->size > 0) {
+            struct loader_ticket *ticket = heap->tickets[0];
+            loader_heap_remove(loader, ticket);
+            ticket->err = ECANCELED;
+            loader_complete(loader, ticket);
+        }
+    }
+    loader->stop = 1;
+    for (i = 0; i < LOADER_NUM_HEAPS; i++)
+        pthread_cond_broadcast(&loader->heaps[i].work_cond);
+    pthread_mutex_unlock(&loader->mutex);
+
+    for (i = 0; i < loader->num_workers; i++)
+        pthread_join(loader->workers[i].thread, NULL);
+
+    struct loader_ticket *ticket;
+    while ((ticket = loader_queue_pop(&loader->done))) {
+        ticket->returned = 1;
+        loader_ticket_free(ticket);
+    }
+
+    for (i = 0; i < LOADER_NUM_HEAPS; i++) {
+        pthread_cond_destroy(&loader->heaps[i].work_cond);
+        free(loader->heaps[i].tickets);
+    }
+    pthread_cond_destroy(&loader->done_cond);
+    pthread_mutex_destroy(&loader->mutex);
+    free(loader);
+}
+
+/**
+ * queues func(data) to run on a worker
+ * free_func releases a result which did not get taken
+ *
+ * returns a ticket on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct loader_ticket *
+loader_submit(struct loader *loader,
+              loader_func func,
+              loader_free_func free_func,
+              void *data,
+              int priority,
+              uint32_t group,
+              int *err_out)
+{
+    int err = 0;
+
+    struct loader_ticket *ticket = malloc(sizeof(*ticket));
+    if (!ticket) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(ticket, 0, sizeof(*ticket));
+    ticket->loader = loader;
+    ticket->func = func;
+    ticket->free_func = free_func;
+    ticket->data = data;
+    ticket->priority = priority;
+    ticket->group = group;
+    ticket->state = LOADER_STATE_QUEUED;
+
+    pthread_mutex_lock(&loader->mutex);
+    ticket->sequence = loader->sequence++;
+    err = loader_heap_push(loader, ticket);
+    if (!err)
+        loader->num_pending++;
+    pthread_mutex_unlock(&loader->mutex);
+
+    if (err)
+        goto error;
+
+    return ticket;
+
+error:
+    free(ticket);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+static void *
+loader_dvf_load(void *data, int *err_out)
+{
+    int err = 0;
+
+    struct dvf_file *file = dvf_file_open(data, &err);
+    if (!file)
+        goto error;
+
+    if ((err = dvf_file_init(file))) {
+        dvf_file_close(file);
+        goto error;
+    }
+
+    return file;
+
+error:
+    *err_out = err;
+    return NULL;
+}
+
+static void
+loader_dvf_free(void *result)
+{
+    dvf_file_cleanup(result);
+    dvf_file_close(result);
+}
+
+static void *
+loader_dvm_load(void *data, int *err_out)
+{
+    struct loader_pixmap *pixmap = malloc(sizeof(*pixmap));
+    if (!pixmap) {
+        *err_out = ENOMEM;
+        return NULL;
+    }
+
+    pixmap->pixels = dvm_file_get_pixmap(data,
+                                         &pixmap->width,
+                                         &pixmap->height,
+                                         err_out);
+    if (!pixmap->pixels) {
+        free(pixmap);
+        return NULL;
+    }
+
+    return pixmap;
+}
+
+static void
+loader_dvm_free(void *result)
+{
+    loader_pixmap_free(result);
+}
+
+static void *
+loader_dvd_load(void *data, int *err_out)
+{
+    return dvd_file_open(data, err_out);
+}
+
+static void
+loader_dvd_free(void *result)
+{
+    dvd_file_close(result);
+}
+
+static struct loader_ticket *
+loader_load_file(struct loader *loader,
+                 loader_func func,
+                 loader_free_func free_func,
+                 const char *file_name,
+                 int priority,
+                 uint32_t group,
+                 int *err_out)
+{
+    char *name = strdup(file_name);
+    if (!name) {
+        if (err_out)
+            *err_out = ENOMEM;
+        return NULL;
+    }
+
+    struct loader_ticket *ticket =
+        loader_submit(loader, func, free_func, name, priority, group, err_out);
+    if (!ticket) {
+        free(name);
+        return NULL;
+    }
+
+    /* the worker does not touch owns_data, setting it late is fine */
+    ticket->owns_data = 1;
+    return ticket;
+}
+
+/**
+ * opens and initializes a dvf file
+ * the result is a struct dvf_file
+ */
+__SYM_EXPORT__ struct loader_ticket *
+loader_load_dvf(struct loader *loader,
+                const char *file_name,
+                int priority,
+                uint32_t group,
+                int *err_out)
+{
+    return loader_load_file(loader, loader_dvf_load, loader_dvf_free,
+                            file_name, priority, group, err_out);
+}
+
+/**
+ * decodes the pixmap of a dvm file
+ * the result is a struct loader_pixmap
+ */
+__SYM_EXPORT__ struct loader_ticket *
+loader_load_dvm(struct loader *loader,
+                const char *file_name,
+                int priority,
+                uint32_t group,
+                int *err_out)
+{
+    return loader_load_file(loader, loader_dvm_load, loader_dvm_free,
+                            file_name, priority, group, err_out);
+}
+
+/**
+ * opens a dvd file
+ * the result is a struct dvd_file
+ */
+__SYM_EXPORT__ struct loader_ticket *
+loader_load_dvd(struct loader *loader,
+                const char *file_name,
+                int priority,
+                uint32_t group,
+                int *err_out)
+{
+    return loader_load_file(loader, loader_dvd_load, loader_dvd_free,
+                            file_name, priority, group, err_out);
+}
+
+/**
+ * changes the priority of a request which did not start yet
+ * crossing LOADER_PRIORITY_NORMAL moves it between the foreground and the
+ * background workers
+ */
+__SYM_EXPORT__ void
+loader_set_priority(struct loader *loader,
+                    struct loader_ticket *ticket,
+                    int priority)
+{
+    pthread_mutex_lock(&loader->mutex);
+    if (ticket->state == LOADER_STATE_QUEUED && ticket->priority != priority) {
+        if (loader_heap_for(priority) != ticket->heap) {
+            loader_heap_remove(loader, ticket);
+            ticket->priority = priority;
+            if (loader_heap_push(loader, ticket)) {
+                ticket->err = ENOMEM;
+                loader_complete(loader, ticket);
+            }
+        }
+        else {
+            struct loader_heap *heap = &loader->heaps[ticket->heap];
+            ticket->priority = priority;
+            loader_heap_sift_up(heap, ticket->heap_index);
+            loader_heap_sift_down(heap, ticket->heap_index);
+        }
+    }
+    pthread_mutex_unlock(&loader->mutex);
+}
+
+/**
+ * must be called with the mutex held
+ */
+static void
+loader_cancel_locked(struct loader *loader, struct loader_ticket *ticket)
+{
+    __atomic_store_n(&ticket->cancelled, 1, __ATOMIC_RELEASE);
+
+    if (ticket->state == LOADER_STATE_QUEUED) {
+        loader_heap_remove(loader, ticket);
+        ticket->err = ECANCELED;
+        loader_complete(loader, ticket);
+    }
+}
+
+/**
+ * cancels a request
+ * it still gets handed back by loader_poll, with ECANCELED unless it
+ * completed already
+ */
+__SYM_EXPORT__ void
+loader_cancel(struct loader *loader, struct loader_ticket *ticket)
+{
+    pthread_mutex_lock(&loader->mutex);
+    loader_cancel_locked(loader, ticket);
+    pthread_mutex_unlock(&loader->mutex);
+}
+
+/**
+ * cancels all queued requests of a group, e.g. when a level gets abandoned
+ * requests which are already running are not affected
+ */
+__SYM_EXPORT__ void
+loader_cancel_group(struct loader *loader, uint32_t group)
+{
+    unsigned int h, i;
+
+    pthread_mutex_lock(&loader->mutex);
+    for (h = 0; h < LOADER_NUM_HEAPS; h++) {
+        struct loader_heap *heap = &loader->heaps[h];
+        for (i = 0; i < heap->size;) {
+            struct loader_ticket *ticket = heap->tickets[i];
+            if (ticket->group == group)
+                /* the last ticket moved into slot i, look at it again */
+                loader_cancel_locked(loader, ticket);
+            else
+                i++;
+        }
+    }
+    pthread_mutex_unlock(&loader->mutex);
+}
+
+/**
+ * pops up to max_tickets completed requests without blocking
+ * must only be called by the thread owning the loader
+ *
+ * returns the number of tickets
+ */
+__SYM_EXPORT__ unsigned int
+loader_poll(struct loader *loader,
+            struct loader_ticket **tickets,
+            unsigned int max_tickets)
+{
+    unsigned int num_tickets = 0, num_popped = 0;
+    struct loader_ticket *ticket;
+
+    while (num_tickets < max_tickets &&
+           (ticket = loader_queue_pop(&loader->done))) {
+        num_popped++;
+        ticket->returned = 1;
+        if (ticket->released)
+            loader_ticket_free(ticket);
+        else
+            tickets[num_tickets++] = ticket;
+    }
+
+    if (num_popped) {
+        pthread_mutex_lock(&loader->mutex);
+        loader->num_done -= num_popped;
+        pthread_mutex_unlock(&loader->mutex);
+    }
+
+    return num_tickets;
+}
+
+/**
+ * like loader_poll but blocks until at least one request completed
+ * returns 0 only if nothing is in flight
+ */
+__SYM_EXPORT__ unsigned int
+loader_wait(struct loader *loader,
+            struct loader_ticket **tickets,
+            unsigned int max_tickets)
+{
+    unsigned int num_tickets;
+
+    while (!(num_tickets = loader_poll(loader, tickets, max_tickets))) {
+        pthread_mutex_lock(&loader->mutex);
+        while (loader->num_done == 0 && loader->num_pending > 0)
+            pthread_cond_wait(&loader->done_cond, &loader->mutex);
+        int idle = loader->num_done == 0 && loader->num_pending == 0;
+        pthread_mutex_unlock(&loader->mutex);
+
+        if (idle)
+            break;
+    }
+
+    return num_tickets;
+}
+
+/**
+ * returns the number of requests which did not complete yet
+ */
+__SYM_EXPORT__ unsigned int
+loader_num_pending(struct loader *loader)
+{
+    pthread_mutex_lock(&loader->mutex);
+    unsigned int num_pending = loader->num_pending;
+    pthread_mutex_unlock(&loader->mutex);
+
+    return num_pending;
+}
+
+/**
+ * takes the result of a completed request
+ * the caller owns it afterwards
+ *
+ * returns the result on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ void *
+loader_ticket_take(struct loader_ticket *ticket, int *err_out)
+{
+    void *result = ticket->result;
+
+    ticket->result = NULL;
+    if (!result && err_out)
+        *err_out = ticket->err;
+    return result;
+}
+
+__SYM_EXPORT__ void
+loader_ticket_set_user_data(struct loader_ticket *ticket, void *user_data)
+{
+    ticket->user_data = user_data;
+}
+
+__SYM_EXPORT__ void *
+loader_ticket_user_data(struct loader_ticket *ticket)
+{
+    return ticket->user_data;
+}
+
+__SYM_EXPORT__ uint32_t
+loader_ticket_group(struct loader_ticket *ticket)
+{
+    return ticket->group;
+}
+
+/**
+ * frees a ticket and a result which was not taken
+ * a ticket which is still in flight gets cancelled and freed once it
+ * completes
+ */
+__SYM_EXPORT__ void
+loader_ticket_free(struct loader_ticket *ticket)
+{
+    if (!ticket)
+        return;
+
+    if (!ticket->returned) {
+        ticket->released = 1;
+        loader_cancel(ticket->loader, ticket);
+        return;
+    }
+
+    if (ticket->result && ticket->free_func)
+        ticket->free_func(ticket->result);
+    if (ticket->owns_data)
+        free(ticket->data);
+    free(ticket);
+}
+
+__SYM_EXPORT__ void
+loader_pixmap_free(struct loader_pixmap *pixmap)
+{
+    if (!pixmap)
+        return;
+
+    pixmap_free(pixmap->pixels);
+    free(pixmap);
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ASSET_LOADER_H__
+#define __ASSET_LOADER_H__
+
+#include <stdint.h>
+
+/* requests with a higher priority get picked first */
+#define LOADER_PRIORITY_IDLE 0
+#define LOADER_PRIORITY_LOW 64
+#define LOADER_PRIORITY_NORMAL 128
+#define LOADER_PRIORITY_HIGH 192
+
+struct loader;
+struct loader_ticket;
+
+/**
+ * runs on a worker thread
+ * returns the loaded object or NULL and sets err
+ */
+typedef void *(*loader_func)(void *data, int *err_out);
+
+/**
+ * frees a result nobody picked up
+ */
+typedef void (*loader_free_func)(void *result);
+
+/**
+ * result of loader_load_dvm
+ */
+struct loader_pixmap {
+    void *pixels;
+    unsigned int width;
+    unsigned int height;
+};
+
+struct loader *
+loader_new(unsigned int num_threads, int *err_out);
+
+void
+loader_free(struct loader *loader);
+
+struct loader_ticket *
+loader_submit(struct loader *loader,
+              loader_func func,
+              loader_free_func free_func,
+              void *data,
+              int priority,
+              uint32_t group,
+              int *err_out);
+
+struct loader_ticket *
+loader_load_dvf(struct loader *loader,
+                const char *file_name,
+                int priority,
+                uint32_t group,
+                int *err_out);
+
+struct loader_ticket *
+loader_load_dvm(struct loader *loader,
+                const char *file_name,
+                int priority,
+                uint32_t group,
+                int *err_out);
+
+struct loader_ticket *
+loader_load_dvd(struct loader *loader,
+                const char *file_name,
+                int priority,
+                uint32_t group,
+                int *err_out);
+
+void
+loader_set_priority(struct loader *loader,
+                    struct loader_ticket *ticket,
+                    int priority);
+
+void
+loader_cancel(struct loader *loader, struct loader_ticket *ticket);
+
+void
+loader_cancel_group(struct loader *loader, uint32_t group);
+
+unsigned int
+loader_poll(struct loader *loader,
+            struct loader_ticket **tickets,
+            unsigned int max_tickets);
+
+unsigned int
+loader_wait(struct loader *loader,
+            struct loader_ticket **tickets,
+            unsigned int max_tickets);
+
+unsigned int
+loader_num_pending(struct loader *loader);
+
+void *
+loader_ticket_take(struct loader_ticket *ticket, int *err_out);
+
+void
+loader_ticket_set_user_data(struct loader_ticket *ticket, void *user_data);
+
+void *
+loader_ticket_user_data(struct loader_ticket *ticket);
+
+uint32_t
+loader_ticket_group(struct loader_ticket *ticket);
+
+void
+loader_ticket_free(struct loader_ticket *ticket);
+
+void
+loader_pixmap_free(struct loader_pixmap *pixmap);
+
+#endif /* __ASSET_LOADER_H__ */
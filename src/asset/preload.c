@@ -0,0 +1,566 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * level preloading
+ * ================
+ *
+ * A preload requests the dvd of a level and its dependencies at
+ * RESOURCE_PRIORITY_LOW and keeps them acquired. Finding the dependencies
+ * is a RESOURCE_LEVEL_DEPS job itself, level_preload_ready requests what
+ * it found once it is done. Low priority requests run on the background
+ * worker of the loader, at idle io and cpu priority, while the current
+ * level keeps playing.
+ *
+ * Switching levels means activating the preload of the next level and
+ * freeing the one of the current level afterwards. Resources both levels
+ * use stay acquired in between and are never reloaded, the rest of the
+ * old level becomes evictable.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "dvd.h"
+#include "strtab.h"
+#include "preload.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+#define LEVEL_PRELOAD_NO_ENTRY UINT32_MAX
+
+/**
+ * an acquired resource and what is needed to request it again
+ */
+struct level_preload_entry {
+    resource_handle handle;
+    enum resource_type type;
+    char *name;
+};
+
+/**
+ * preloaded level
+ */
+struct level_preload {
+    struct resource_manager *manager;
+    char *data_dir;
+    int priority;
+    /* RESOURCE_NO_HANDLE once the dependencies got requested */
+    resource_handle deps;
+    uint32_t level;
+    uint32_t background;
+    /* every acquired resource, level and background included */
+    unsigned int num_entries;
+    unsigned int alloc_entries;
+    struct level_preload_entry *entries;
+};
+
+/**
+ * builds data_dir/name, appending extension if name has none
+ * returns a malloc'd path or NULL if out of memory
+ */
+static char *
+level_deps_path(const char *data_dir,
+                const char *name,
+                size_t name_size,
+                const char *extension)
+{
+    size_t base = name_size, len;
+
+    while (base > 0 && name[base - 1] != '/')
+        base--;
+    if (memchr(name + base, '.', name_size - base))
+        extension = "";
+
+    len = (data_dir ? strlen(data_dir) + 1 : 0) + name_size +
+          strlen(extension) + 1;
+    char *path = malloc(len);
+    if (!path)
+        return NULL;
+
+    snprintf(path, len, "%s%s%.*s%s",
+             data_dir ? data_dir : "",
+             data_dir ? "/" : "",
+             (int)name_size, name,
+             extension);
+    return path;
+}
+
+/**
+ * adds a dvf for every element name not seen before
+ * names are interned into seen first, ids are handed out in order so every
+ * id above num_seen is a new name
+ */
+static int
+level_deps_add_elements(struct level_deps *deps,
+                        unsigned int *num_seen,
+                        const char *data_dir,
+                        const struct dvd_element *elements,
+                        unsigned int num_elements)
+{
+    unsigned int i;
+
+    for (i = 0; i < num_elements; i++) {
+        const char *name = elements[i].name;
+        size_t len = strnlen(name, DVD_ELEMENT_NAME_SIZE);
+
+        if (elements[i].name_id <= *num_seen)
+            continue;
+        *num_seen = elements[i].name_id;
+        if (len == 0)
+            continue;
+
+        char **dvfs = realloc(deps->dvfs,
+                              (deps->num_dvfs + 1) * sizeof(*dvfs));
+        if (!dvfs)
+            return ENOMEM;
+        deps->dvfs = dvfs;
+
+        dvfs[deps->num_dvfs] = level_deps_path(data_dir, name, len, ".dvf");
+        if (!dvfs[deps->num_dvfs])
+            return ENOMEM;
+        deps->num_dvfs++;
+    }
+
+    return 0;
+}
+
+/**
+ * collects the files a level references
+ * names are resolved relative to data_dir, or used as they are if it is
+ * NULL, BGND names get a .dvm and element names a .dvf extension if they
+ * have none. SND entries are not decoded yet so sounds are not collected.
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+level_deps_read(const char *dvd_file_name,
+                const char *data_dir,
+                struct level_deps *deps)
+{
+    int err = 0;
+    struct strtab *seen = NULL;
+    unsigned int num_seen = 0;
+    struct dvd_file *file = NULL;
+    char *name = NULL;
+    union dvd_entry entry;
+
+    memset(deps, 0, sizeof(*deps));
+
+    seen = strtab_new(&err);
+    if (!seen)
+        goto error;
+
+    name = strdup(dvd_file_name);
+    if (!name) {
+        err = ENOMEM;
+        goto error;
+    }
+
+    file = dvd_file_open(name, &err);
+    if (!file)
+        goto error;
+
+    while (dvd_file_has_next(file)) {
+        if ((err = dvd_file_get_next(file, &entry)))
+            goto error;
+
+        switch (entry.type) {
+            case DVD_ENTRY_TYPE_BGND:
+                free(deps->background);
+                deps->background =
+                    level_deps_path(data_dir,
+                                    entry.bgnd.name,
+                                    strnlen(entry.bgnd.name,
+                                            entry.bgnd.name_size),
+                                    ".dvm");
+                if (!deps->background)
+                    err = ENOMEM;
+                break;
+            case DVD_ENTRY_TYPE_ELEM:
+                if ((err = dvd_entry_elem_intern(&entry.elem, seen)))
+                    break;
+                err = level_deps_add_elements(deps, &num_seen, data_dir,
+                                              entry.elem.elements,
+                                              entry.elem.num_elements);
+                break;
+            case DVD_ENTRY_TYPE_BUIL:
+                if ((err = dvd_entry_buil_intern(&entry.buil, seen)))
+                    break;
+                err = level_deps_add_elements(deps, &num_seen, data_dir,
+                                              entry.buil.buildings,
+                                              entry.buil.num_buildings);
+                break;
+            default:
+                break;
+        }
+
+        dvd_entry_done(&entry);
+        if (err)
+            goto error;
+    }
+
+    dvd_file_close(file);
+    strtab_free(seen);
+    free(name);
+    return 0;
+
+error:
+    dvd_file_close(file);
+    strtab_free(seen);
+    free(name);
+    level_deps_cleanup(deps);
+    return err;
+}
+
+__SYM_EXPORT__ void
+level_deps_cleanup(struct level_deps *deps)
+{
+    unsigned int i;
+
+    free(deps->background);
+    for (i = 0; i < deps->num_dvfs; i++)
+        free(deps->dvfs[i]);
+    free(deps->dvfs);
+    memset(deps, 0, sizeof(*deps));
+}
+
+/**
+ * requests and acquires a resource
+ *
+ * returns the entry or LEVEL_PRELOAD_NO_ENTRY and err gets set
+ */
+static uint32_t
+level_preload_request(struct level_preload *preload,
+                      enum resource_type type,
+                      const char *name,
+                      int *err_out)
+{
+    if (preload->num_entries == preload->alloc_entries) {
+        unsigned int alloc = preload->alloc_entries ?
+                             preload->alloc_entries * 2 : 16;
+        struct level_preload_entry *entries =
+          realloc(preload->entries, alloc * sizeof(*entries));
+        if (!entries) {
+            *err_out = ENOMEM;
+            return LEVEL_PRELOAD_NO_ENTRY;
+        }
+        preload->entries = entries;
+        preload->alloc_entries = alloc;
+    }
+
+    struct level_preload_entry *entry = &preload->entries[preload->num_entries];
+    entry->type = type;
+    entry->name = strdup(name);
+    if (!entry->name) {
+        *err_out = ENOMEM;
+        return LEVEL_PRELOAD_NO_ENTRY;
+    }
+
+    entry->handle = resource_load(preload->manager,
+                                  type,
+                                  name,
+                                  preload->priority,
+                                  err_out);
+    if (entry->handle == RESOURCE_NO_HANDLE) {
+        free(entry->name);
+        return LEVEL_PRELOAD_NO_ENTRY;
+    }
+
+    resource_acquire(preload->manager, entry->handle);
+    return preload->num_entries++;
+}
+
+/**
+ * requests a dependency, named as in the level, relative to data_dir
+ */
+static int
+level_preload_request_dep(struct level_preload *preload,
+                          enum resource_type type,
+                          const char *name,
+                          uint32_t *entry)
+{
+    int err = 0;
+    size_t len = strlen(name) + 1;
+
+    if (preload->data_dir)
+        len += strlen(preload->data_dir) + 1;
+
+    char *path = malloc(len);
+    if (!path)
+        return ENOMEM;
+    snprintf(path, len, "%s%s%s",
+             preload->data_dir ? preload->data_dir : "",
+             preload->data_dir ? "/" : "",
+             name);
+
+    uint32_t index = level_preload_request(preload, type, path, &err);
+    free(path);
+    if (entry)
+        *entry = index;
+
+    return index == LEVEL_PRELOAD_NO_ENTRY ? err : 0;
+}
+
+/**
+ * requests the dependencies once the RESOURCE_LEVEL_DEPS job is done
+ *
+ * returns 0 on success
+ */
+static int
+level_preload_request_deps(struct level_preload *preload)
+{
+    int err = 0;
+    unsigned int i;
+    struct resource_manager *manager = preload->manager;
+
+    if (preload->deps == RESOURCE_NO_HANDLE)
+        return 0;
+
+    switch (resource_state(manager, preload->deps, &err)) {
+        case RESOURCE_STATE_LOADING:
+            return 0;
+        case RESOURCE_STATE_NONE:
+            /* the dvd got reloaded, the acquisition moved along */
+            preload->deps = resource_load(manager,
+                                          RESOURCE_LEVEL_DEPS,
+                                          preload->entries[preload->level].name,
+                                          preload->priority,
+                                          &err);
+            if (preload->deps == RESOURCE_NO_HANDLE)
+                return err;
+            return level_preload_request_deps(preload);
+        case RESOURCE_STATE_READY: {
+            struct level_deps *deps = resource_get(manager, preload->deps);
+
+            if (deps->background &&
+                (err = level_preload_request_dep(preload,
+                                                 RESOURCE_BACKGROUND,
+                                                 deps->background,
+                                                 &preload->background)))
+                break;
+
+            for (i = 0; !err && i < deps->num_dvfs; i++)
+                err = level_preload_request_dep(preload,
+                                                RESOURCE_DVF,
+                                                deps->dvfs[i],
+                                                NULL);
+            break;
+        }
+        default:
+            DEBUG_ERROR("cannot read the dependencies of %s (%d)\n",
+                        preload->entries[preload->level].name,
+                        err);
+            err = 0;
+            break;
+    }
+
+    resource_release(manager, preload->deps);
+    preload->deps = RESOURCE_NO_HANDLE;
+    return err;
+}
+
+/**
+ * starts loading a level and everything it references in the background
+ * the dvd is not read here, see level_preload_ready
+ *
+ * returns a struct level_preload on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct level_preload *
+level_preload_new(struct resource_manager *manager,
+                  const char *dvd_file_name,
+                  const char *data_dir,
+                  int *err_out)
+{
+    int err = 0;
+
+    struct level_preload *preload = malloc(sizeof(*preload));
+    if (!preload) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(preload, 0, sizeof(*preload));
+    preload->manager = manager;
+    preload->priority = RESOURCE_PRIORITY_LOW;
+    preload->background = LEVEL_PRELOAD_NO_ENTRY;
+
+    if (data_dir && !(preload->data_dir = strdup(data_dir))) {
+        err = ENOMEM;
+        goto error;
+    }
+
+    preload->level = level_preload_request(preload,
+                                           RESOURCE_LEVEL,
+                                           dvd_file_name,
+                                           &err);
+    if (preload->level == LEVEL_PRELOAD_NO_ENTRY)
+        goto error;
+
+    preload->deps = resource_load(manager,
+                                  RESOURCE_LEVEL_DEPS,
+                                  dvd_file_name,
+                                  preload->priority,
+                                  &err);
+    if (preload->deps == RESOURCE_NO_HANDLE)
+        goto error;
+    resource_acquire(manager, preload->deps);
+
+    /* without loader threads the job is done already */
+    if ((err = level_preload_request_deps(preload)))
+        goto error;
+
+    return preload;
+
+error:
+    level_preload_free(preload);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+/**
+ * releases everything the preload acquired
+ */
+__SYM_EXPORT__ void
+level_preload_free(struct level_preload *preload)
+{
+    unsigned int i;
+
+    if (!preload)
+        return;
+
+    if (preload->deps != RESOURCE_NO_HANDLE)
+        resource_release(preload->manager, preload->deps);
+
+    for (i = 0; i < preload->num_entries; i++) {
+        resource_release(preload->manager, preload->entries[i].handle);
+        free(preload->entries[i].name);
+    }
+
+    free(preload->entries);
+    free(preload->data_dir);
+    free(preload);
+}
+
+/**
+ * requests the dependencies once they are known and counts the resources
+ * which finished loading, failed ones included
+ * resources which got reloaded since they were requested are requested
+ * again under their new handle
+ *
+ * returns 1 if nothing is loading anymore
+ */
+__SYM_EXPORT__ int
+level_preload_ready(struct level_preload *preload,
+                    unsigned int *num_loaded,
+                    unsigned int *num_total)
+{
+    unsigned int i, loaded = 0;
+
+    if (level_preload_request_deps(preload))
+        DEBUG_ERROR("out of memory\n");
+
+    for (i = 0; i < preload->num_entries; i++) {
+        struct level_preload_entry *entry = &preload->entries[i];
+        enum resource_state state =
+          resource_state(preload->manager, entry->handle, NULL);
+
+        /* still acquired, a stale handle means it got reloaded */
+        if (state == RESOURCE_STATE_NONE) {
+            resource_handle handle = resource_load(preload->manager,
+                                                   entry->type,
+                                                   entry->name,
+                                                   preload->priority,
+                                                   NULL);
+            if (handle != RESOURCE_NO_HANDLE) {
+                entry->handle = handle;
+                state = resource_state(preload->manager, handle, NULL);
+            }
+        }
+
+        if (state != RESOURCE_STATE_LOADING)
+            loaded++;
+    }
+
+    if (num_loaded)
+        *num_loaded = loaded;
+    if (num_total)
+        *num_total = preload->num_entries;
+    return preload->deps == RESOURCE_NO_HANDLE &&
+           loaded == preload->num_entries;
+}
+
+/**
+ * makes the level the current one
+ * whatever is still queued moves to the foreground workers
+ */
+__SYM_EXPORT__ void
+level_preload_activate(struct level_preload *preload)
+{
+    unsigned int i;
+
+    preload->priority = RESOURCE_PRIORITY_NORMAL;
+
+    if (preload->deps != RESOURCE_NO_HANDLE &&
+        resource_priority(preload->manager, preload->deps) <
+        RESOURCE_PRIORITY_NORMAL)
+        resource_set_priority(preload->manager,
+                              preload->deps,
+                              RESOURCE_PRIORITY_NORMAL);
+
+    for (i = 0; i < preload->num_entries; i++) {
+        resource_handle handle = preload->entries[i].handle;
+        if (resource_priority(preload->manager, handle) <
+            RESOURCE_PRIORITY_NORMAL)
+            resource_set_priority(preload->manager,
+                                  handle,
+                                  RESOURCE_PRIORITY_NORMAL);
+    }
+}
+
+__SYM_EXPORT__ resource_handle
+level_preload_level(struct level_preload *preload)
+{
+    return preload->entries[preload->level].handle;
+}
+
+/**
+ * returns the background or RESOURCE_NO_HANDLE if the level has none or
+ * it is not known yet
+ */
+__SYM_EXPORT__ resource_handle
+level_preload_background(struct level_preload *preload)
+{
+    if (preload->background == LEVEL_PRELOAD_NO_ENTRY)
+        return RESOURCE_NO_HANDLE;
+    return preload->entries[preload->background].handle;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ASSET_PRELOAD_H__
+#define __ASSET_PRELOAD_H__
+
+#include "resource.h"
+
+/**
+ * files a level needs besides its dvd
+ */
+struct level_deps {
+    /* dvm file of the BGND entry or NULL */
+    char *background;
+    /* dvf files of the ELEM and BUIL entries, without duplicates */
+    unsigned int num_dvfs;
+    char **dvfs;
+};
+
+struct level_preload;
+
+int
+level_deps_read(const char *dvd_file_name,
+                const char *data_dir,
+                struct level_deps *deps);
+
+void
+level_deps_cleanup(struct level_deps *deps);
+
+struct level_preload *
+level_preload_new(struct resource_manager *manager,
+                  const char *dvd_file_name,
+                  const char *data_dir,
+                  int *err_out);
+
+void
+level_preload_free(struct level_preload *preload);
+
+int
+level_preload_ready(struct level_preload *preload,
+                    unsigned int *num_loaded,
+                    unsigned int *num_total);
+
+void
+level_preload_activate(struct level_preload *preload);
+
+resource_handle
+level_preload_level(struct level_preload *preload);
+
+resource_handle
+level_preload_background(struct level_preload *preload);
+
+#endif /* __ASSET_PRELOAD_H__ */
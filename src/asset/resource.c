@@ -0,0 +1,1259 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * resource manager
+ * ================
+ *
+ * Resources live in a slot array and are found by a hash of their type
+ * and name. A handle is the slot index plus the generation of the slot,
+ * the generation gets bumped whenever a slot is emptied or its resource
+ * reloaded so stale handles are detected instead of pointing to something
+ * else. Acquisitions belong to the resource and survive a reload, the
+ * handles it had before still release it.
+ *
+ * Every resource which is finished (ready or failed) and not acquired sits
+ * in one least recently used list per priority class. Over the budget
+ * resource_manager_update evicts from the tail of the lowest class first.
+ * The budget is soft, acquired and loading resources are never evicted.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "dvf.h"
+#include "dvm.h"
+#include "file.h"
+#include "pixmap.h"
+#include "dvd.h"
+#include "resource.h"
+#include "preload.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+#define RESOURCE_NUM_CLASSES 4
+#define RESOURCE_NO_SLOT UINT32_MAX
+#define RESOURCE_MAX_KEY 4096
+
+#define RESOURCE_HANDLE(INDEX, GENERATION) \
+    (((resource_handle)(GENERATION) << 32) | (INDEX))
+#define RESOURCE_HANDLE_INDEX(HANDLE) ((uint32_t)(HANDLE))
+#define RESOURCE_HANDLE_GENERATION(HANDLE) ((uint32_t)((HANDLE) >> 32))
+
+/**
+ * what a worker needs to load a resource
+ */
+struct resource_request {
+    char *name;
+    struct dvf_file *file;
+    unsigned int object;
+    unsigned int animation;
+    unsigned int frame;
+};
+
+/**
+ * a slot
+ */
+struct resource {
+    enum resource_type type;
+    enum resource_state state;
+    /* starts at 1 so no handle equals RESOURCE_NO_HANDLE */
+    uint32_t generation;
+    /* generation when the resource moved into the slot */
+    uint32_t first_generation;
+    /* NULL if the slot is free */
+    char *key;
+    /* file name, the dvf file for sprites */
+    char *name;
+    uint32_t key_hash;
+    uint32_t hash_next;
+    void *data;
+    size_t size;
+    int err;
+    int priority;
+    unsigned int pins;
+    uint64_t last_use;
+    /* load again once the current load or users are done */
+    int reload;
+    struct loader_ticket *ticket;
+    struct resource_request *request;
+    /* sprites keep their dvf acquired until they are decoded */
+    resource_handle dvf;
+    unsigned int object;
+    unsigned int animation;
+    unsigned int frame;
+    /* eviction list link, valid if in_lru */
+    int in_lru;
+    uint32_t lru_prev;
+    uint32_t lru_next;
+    uint32_t free_next;
+};
+
+struct resource_manager {
+    /* NULL if everything loads synchronously */
+    struct loader *loader;
+    size_t budget;
+    size_t used;
+    uint64_t frame;
+
+    struct resource *slots;
+    uint32_t num_slots;
+    uint32_t alloc_slots;
+    uint32_t free_slot;
+
+    uint32_t *buckets;
+    uint32_t num_buckets;
+    uint32_t num_keys;
+
+    /* most recently used first */
+    uint32_t lru_head[RESOURCE_NUM_CLASSES];
+    uint32_t lru_tail[RESOURCE_NUM_CLASSES];
+};
+
+static void *
+resource_dvf_load(void *data, int *err_out)
+{
+    struct resource_request *request = data;
+    int err = 0;
+
+    struct dvf_file *file = dvf_file_open(request->name, &err);
+    if (!file)
+        goto error;
+
+    if ((err = dvf_file_init(file))) {
+        dvf_file_close(file);
+        goto error;
+    }
+
+    return file;
+
+error:
+    *err_out = err;
+    return NULL;
+}
+
+static void
+resource_dvf_free(void *data)
+{
+    dvf_file_cleanup(data);
+    dvf_file_close(data);
+}
+
+static void *
+resource_sprite_load(void *data, int *err_out)
+{
+    struct resource_request *request = data;
+    struct dvf_object *obj;
+    struct dvf_animation *anim;
+
+    if (request->object >= dvf_file_num_objects(request->file) ||
+        !(obj = dvf_file_get_object(request->file, request->object)) ||
+        request->animation >= dvf_object_num_animations(obj) ||
+        !(anim = dvf_object_get_animation(obj, request->animation)) ||
+        request->frame >= dvf_animation_num_frames(anim)) {
+        *err_out = EINVAL;
+        return NULL;
+    }
+
+    struct dvf_frame *frame = dvf_animation_get_frame(anim, request->frame);
+    if (!dvf_frame_valid(frame)) {
+        *err_out = EILSEQ;
+        return NULL;
+    }
+
+    struct resource_sprite *sprite = malloc(sizeof(*sprite));
+    if (!sprite) {
+        *err_out = ENOMEM;
+        return NULL;
+    }
+
+    sprite->pixels = dvf_frame_pixmap(frame, &sprite->width, &sprite->height);
+    if (!sprite->pixels) {
+        free(sprite);
+        *err_out = ENOMEM;
+        return NULL;
+    }
+
+    return sprite;
+}
+
+static void
+resource_sprite_free(void *data)
+{
+    struct resource_sprite *sprite = data;
+
+    pixmap_free(sprite->pixels);
+    free(sprite);
+}
+
+static void *
+resource_background_load(void *data, int *err_out)
+{
+    struct resource_request *request = data;
+
+    struct loader_pixmap *pixmap = malloc(sizeof(*pixmap));
+    if (!pixmap) {
+        *err_out = ENOMEM;
+        return NULL;
+    }
+
+    pixmap->pixels = dvm_file_get_pixmap(request->name,
+                                         &pixmap->width,
+                                         &pixmap->height,
+                                         err_out);
+    if (!pixmap->pixels) {
+        free(pixmap);
+        return NULL;
+    }
+
+    return pixmap;
+}
+
+static void
+resource_background_free(void *data)
+{
+    loader_pixmap_free(data);
+}
+
+static void *
+resource_level_load(void *data, int *err_out)
+{
+    struct resource_request *request = data;
+
+    return dvd_file_open(request->name, err_out);
+}
+
+static void
+resource_level_free(void *data)
+{
+    dvd_file_close(data);
+}
+
+static void *
+resource_level_deps_load(void *data, int *err_out)
+{
+    struct resource_request *request = data;
+    int err;
+
+    struct level_deps *deps = malloc(sizeof(*deps));
+    if (!deps) {
+        *err_out = ENOMEM;
+        return NULL;
+    }
+
+    if ((err = level_deps_read(request->name, NULL, deps))) {
+        free(deps);
+        *err_out = err;
+        return NULL;
+    }
+
+    return deps;
+}
+
+static void
+resource_level_deps_free(void *data)
+{
+    level_deps_cleanup(data);
+    free(data);
+}
+
+static const struct {
+    loader_func load;
+    loader_free_func free;
+} resource_funcs[RESOURCE_NUM_TYPES] = {
+    [RESOURCE_DVF] = { resource_dvf_load, resource_dvf_free },
+    [RESOURCE_SPRITE] = { resource_sprite_load, resource_sprite_free },
+    [RESOURCE_BACKGROUND] = {
+        resource_background_load,
+        resource_background_free
+    },
+    [RESOURCE_LEVEL] = { resource_level_load, resource_level_free },
+    [RESOURCE_LEVEL_DEPS] = {
+        resource_level_deps_load,
+        resource_level_deps_free
+    },
+};
+
+/**
+ * returns the number of bytes a loaded resource occupies
+ */
+static size_t
+resource_data_size(enum resource_type type, void *data)
+{
+    switch (type) {
+        case RESOURCE_DVF:
+            return dvf_file_size(data);
+        case RESOURCE_SPRITE: {
+            struct resource_sprite *sprite = data;
+            return sizeof(*sprite) + (size_t)sprite->width * sprite->height * 4;
+        }
+        case RESOURCE_BACKGROUND: {
+            struct loader_pixmap *pixmap = data;
+            return sizeof(*pixmap) + (size_t)pixmap->width * pixmap->height * 2;
+        }
+        case RESOURCE_LEVEL:
+            return dvd_file_size(data);
+        case RESOURCE_LEVEL_DEPS: {
+            struct level_deps *deps = data;
+            return sizeof(*deps) + deps->num_dvfs * sizeof(*deps->dvfs);
+        }
+        default:
+            return 0;
+    }
+}
+
+static void
+resource_request_free(struct resource_request *request)
+{
+    if (!request)
+        return;
+
+    free(request->name);
+    free(request);
+}
+
+static unsigned int
+resource_class(int priority)
+{
+    if (priority < 0)
+        return 0;
+    if (priority >= RESOURCE_NUM_CLASSES * 64)
+        return RESOURCE_NUM_CLASSES - 1;
+    return priority / 64;
+}
+
+static uint32_t
+resource_hash(const char *key)
+{
+    uint32_t hash = 2166136261u;
+    for (; *key; key++)
+        hash = (hash ^ (unsigned char)*key) * 16777619u;
+    return hash;
+}
+
+static void
+resource_lru_remove(struct resource_manager *manager, uint32_t index)
+{
+    struct resource *res = &manager->slots[index];
+    unsigned int class = resource_class(res->priority);
+
+    if (!res->in_lru)
+        return;
+
+    if (res->lru_prev != RESOURCE_NO_SLOT)
+        manager->slots[res->lru_prev].lru_next = res->lru_next;
+    else
+        manager->lru_head[class] = res->lru_next;
+    if (res->lru_next != RESOURCE_NO_SLOT)
+        manager->slots[res->lru_next].lru_prev = res->lru_prev;
+    else
+        manager->lru_tail[class] = res->lru_prev;
+
+    res->in_lru = 0;
+}
+
+/**
+ * puts a resource into or out of its eviction list depending on its state
+ * a resource which is already in the list moves to the front
+ */
+static void
+resource_lru_update(struct resource_manager *manager, uint32_t index)
+{
+    struct resource *res = &manager->slots[index];
+    unsigned int class = resource_class(res->priority);
+
+    resource_lru_remove(manager, index);
+
+    if (res->pins > 0 ||
+        (res->state != RESOURCE_STATE_READY &&
+         res->state != RESOURCE_STATE_FAILED))
+        return;
+
+    res->in_lru = 1;
+    res->lru_prev = RESOURCE_NO_SLOT;
+    res->lru_next = manager->lru_head[class];
+    if (res->lru_next != RESOURCE_NO_SLOT)
+        manager->slots[res->lru_next].lru_prev = index;
+    else
+        manager->lru_tail[class] = index;
+    manager->lru_head[class] = index;
+}
+
+static int
+resource_hash_grow(struct resource_manager *manager)
+{
+    uint32_t num_buckets = manager->num_buckets ? manager->num_buckets * 2 : 64;
+    uint32_t i;
+
+    uint32_t *buckets = malloc(num_buckets * sizeof(*buckets));
+    if (!buckets)
+        return ENOMEM;
+    for (i = 0; i < num_buckets; i++)
+        buckets[i] = RESOURCE_NO_SLOT;
+
+    for (i = 0; i < manager->num_slots; i++) {
+        struct resource *res = &manager->slots[i];
+        if (!res->key)
+            continue;
+        uint32_t bucket = res->key_hash & (num_buckets - 1);
+        res->hash_next = buckets[bucket];
+        buckets[bucket] = i;
+    }
+
+    free(manager->buckets);
+    manager->buckets = buckets;
+    manager->num_buckets = num_buckets;
+    return 0;
+}
+
+static uint32_t
+resource_find(struct resource_manager *manager,
+              const char *key,
+              uint32_t key_hash)
+{
+    if (!manager->num_buckets)
+        return RESOURCE_NO_SLOT;
+
+    uint32_t index = manager->buckets[key_hash & (manager->num_buckets - 1)];
+    while (index != RESOURCE_NO_SLOT) {
+        struct resource *res = &manager->slots[index];
+        if (res->key_hash == key_hash && strcmp(res->key, key) == 0)
+            return index;
+        index = res->hash_next;
+    }
+    return RESOURCE_NO_SLOT;
+}
+
+/**
+ * takes a free slot and registers it under key
+ *
+ * returns the slot index or RESOURCE_NO_SLOT if out of memory
+ */
+static uint32_t
+resource_insert(struct resource_manager *manager,
+                enum resource_type type,
+                const char *key,
+                uint32_t key_hash,
+                const char *name,
+                int priority)
+{
+    uint32_t index;
+
+    if (manager->num_keys + 1 > manager->num_buckets &&
+        resource_hash_grow(manager))
+        return RESOURCE_NO_SLOT;
+
+    char *key_copy = strdup(key);
+    char *name_copy = strdup(name);
+    if (!key_copy || !name_copy) {
+        free(key_copy);
+        free(name_copy);
+        return RESOURCE_NO_SLOT;
+    }
+
+    if (manager->free_slot != RESOURCE_NO_SLOT) {
+        index = manager->free_slot;
+        manager->free_slot = manager->slots[index].free_next;
+    }
+    else {
+        if (manager->num_slots == manager->alloc_slots) {
+            uint32_t alloc = manager->alloc_slots ? manager->alloc_slots * 2 : 64;
+            struct resource *slots =
+                realloc(manager->slots, alloc * sizeof(*slots));
+            if (!slots) {
+                free(key_copy);
+                free(name_copy);
+                return RESOURCE_NO_SLOT;
+            }
+            manager->slots = slots;
+            manager->alloc_slots = alloc;
+        }
+        index = manager->num_slots++;
+        manager->slots[index].generation = 1;
+    }
+
+    struct resource *res = &manager->slots[index];
+    uint32_t generation = res->generation;
+    memset(res, 0, sizeof(*res));
+    res->generation = generation;
+    res->first_generation = generation;
+    res->type = type;
+    res->state = RESOURCE_STATE_LOADING;
+    res->key = key_copy;
+    res->name = name_copy;
+    res->key_hash = key_hash;
+    res->priority = priority;
+    res->last_use = manager->frame;
+    res->free_next = RESOURCE_NO_SLOT;
+
+    uint32_t bucket = key_hash & (manager->num_buckets - 1);
+    res->hash_next = manager->buckets[bucket];
+    manager->buckets[bucket] = index;
+    manager->num_keys++;
+
+    return index;
+}
+
+/**
+ * frees a finished resource and its slot, bumping the generation
+ */
+static void
+resource_unload(struct resource_manager *manager, uint32_t index)
+{
+    struct resource *res = &manager->slots[index];
+    uint32_t *link;
+
+    resource_lru_remove(manager, index);
+
+    if (res->data) {
+        resource_funcs[res->type].free(res->data);
+        manager->used -= res->size;
+    }
+
+    link = &manager->buckets[res->key_hash & (manager->num_buckets - 1)];
+    while (*link != index)
+        link = &manager->slots[*link].hash_next;
+    *link = res->hash_next;
+    manager->num_keys--;
+
+    free(res->key);
+    free(res->name);
+    res->key = NULL;
+    res->name = NULL;
+    res->data = NULL;
+    res->state = RESOURCE_STATE_NONE;
+    if (++res->generation == 0)
+        res->generation = 1;
+    res->free_next = manager->free_slot;
+    manager->free_slot = index;
+}
+
+/**
+ * returns the slot of a handle or RESOURCE_NO_SLOT if it is stale
+ */
+static uint32_t
+resource_lookup(struct resource_manager *manager, resource_handle handle)
+{
+    uint32_t index = RESOURCE_HANDLE_INDEX(handle);
+
+    if (index >= manager->num_slots ||
+        !manager->slots[index].key ||
+        manager->slots[index].generation != RESOURCE_HANDLE_GENERATION(handle))
+        return RESOURCE_NO_SLOT;
+    return index;
+}
+
+/**
+ * like resource_lookup but also accepts handles from before a reload
+ */
+static uint32_t
+resource_lookup_owner(struct resource_manager *manager, resource_handle handle)
+{
+    uint32_t index = RESOURCE_HANDLE_INDEX(handle);
+    uint32_t generation = RESOURCE_HANDLE_GENERATION(handle);
+
+    if (index >= manager->num_slots || !manager->slots[index].key)
+        return RESOURCE_NO_SLOT;
+
+    struct resource *res = &manager->slots[index];
+    if (res->first_generation <= res->generation ?
+        generation < res->first_generation || generation > res->generation :
+        /* the generation wrapped around since the resource moved in */
+        generation < res->first_generation && generation > res->generation)
+        return RESOURCE_NO_SLOT;
+    return index;
+}
+
+static void
+resource_finish(struct resource_manager *manager,
+                uint32_t index,
+                void *result,
+                int err);
+
+static int
+resource_dvf_busy(struct resource_manager *manager, uint32_t index);
+
+static void
+resource_reload_now(struct resource_manager *manager, uint32_t index);
+
+/**
+ * starts loading a slot, on a worker if there is a loader
+ */
+static int
+resource_start(struct resource_manager *manager,
+               uint32_t index,
+               struct resource_request *request)
+{
+    int err = 0;
+    struct resource *res = &manager->slots[index];
+
+    res->state = RESOURCE_STATE_LOADING;
+    res->request = request;
+
+    if (!manager->loader) {
+        void *result = resource_funcs[res->type].load(request, &err);
+        resource_finish(manager, index, result, err);
+        return 0;
+    }
+
+    res->ticket = loader_submit(manager->loader,
+                                resource_funcs[res->type].load,
+                                resource_funcs[res->type].free,
+                                request,
+                                res->priority,
+                                0,
+                                &err);
+    if (!res->ticket) {
+        resource_finish(manager, index, NULL, err);
+        return err;
+    }
+    loader_ticket_set_user_data(res->ticket, (void *)(uintptr_t)index);
+
+    return 0;
+}
+
+/**
+ * starts decoding a sprite once its dvf is ready
+ */
+static void
+resource_sprite_start(struct resource_manager *manager, uint32_t index)
+{
+    struct resource *res = &manager->slots[index];
+    uint32_t dvf = resource_lookup_owner(manager, res->dvf);
+
+    if (dvf == RESOURCE_NO_SLOT) {
+        resource_finish(manager, index, NULL, ENOENT);
+        return;
+    }
+    if (manager->slots[dvf].state == RESOURCE_STATE_LOADING)
+        return;
+    if (manager->slots[dvf].state != RESOURCE_STATE_READY) {
+        resource_finish(manager, index, NULL, manager->slots[dvf].err);
+        return;
+    }
+
+    struct resource_request *request = malloc(sizeof(*request));
+    if (!request) {
+        resource_finish(manager, index, NULL, ENOMEM);
+        return;
+    }
+    memset(request, 0, sizeof(*request));
+    request->file = manager->slots[dvf].data;
+    request->object = res->object;
+    request->animation = res->animation;
+    request->frame = res->frame;
+
+    resource_start(manager, index, request);
+}
+
+static void
+resource_finish(struct resource_manager *manager,
+                uint32_t index,
+                void *result,
+                int err)
+{
+    struct resource *res = &manager->slots[index];
+    uint32_t i;
+
+    resource_request_free(res->request);
+    res->request = NULL;
+    res->ticket = NULL;
+
+    if (res->type == RESOURCE_SPRITE) {
+        resource_handle handle = res->dvf;
+        uint32_t dvf = resource_lookup_owner(manager, handle);
+        res->dvf = RESOURCE_NO_HANDLE;
+        resource_release(manager, handle);
+
+        /* a reload of the dvf waited for this decode */
+        if (dvf != RESOURCE_NO_SLOT && manager->slots[dvf].reload &&
+            !manager->slots[dvf].request && !resource_dvf_busy(manager, dvf))
+            resource_reload_now(manager, dvf);
+        res = &manager->slots[index];
+    }
+
+    /* the file changed while it was loading */
+    if (res->reload) {
+        if (result)
+            resource_funcs[res->type].free(result);
+        resource_reload_now(manager, index);
+        return;
+    }
+
+    if (result) {
+        res->data = result;
+        res->size = resource_data_size(res->type, result);
+        res->state = RESOURCE_STATE_READY;
+        manager->used += res->size;
+    }
+    else {
+        res->err = err ? err : EIO;
+        res->state = RESOURCE_STATE_FAILED;
+    }
+
+    resource_lru_update(manager, index);
+
+    if (res->type != RESOURCE_DVF)
+        return;
+
+    /* sprites waiting for this file can be decoded now */
+    for (i = 0; i < manager->num_slots; i++) {
+        struct resource *sprite = &manager->slots[i];
+        if (sprite->key && sprite->type == RESOURCE_SPRITE &&
+            sprite->state == RESOURCE_STATE_LOADING &&
+            !sprite->request && sprite->dvf != RESOURCE_NO_HANDLE &&
+            RESOURCE_HANDLE_INDEX(sprite->dvf) == index)
+            resource_sprite_start(manager, i);
+    }
+}
+
+/**
+ * requests the dvf of a sprite and starts decoding once it is ready
+ * might grow the slot array
+ */
+static void
+resource_sprite_begin(struct resource_manager *manager, uint32_t index)
+{
+    int err = 0;
+    struct resource *res = &manager->slots[index];
+
+    res->state = RESOURCE_STATE_LOADING;
+    resource_handle dvf = resource_load(manager,
+                                        RESOURCE_DVF,
+                                        res->name,
+                                        res->priority,
+                                        &err);
+    if (dvf == RESOURCE_NO_HANDLE) {
+        resource_finish(manager, index, NULL, err);
+        return;
+    }
+
+    manager->slots[index].dvf = dvf;
+    resource_acquire(manager, dvf);
+    resource_sprite_start(manager, index);
+}
+
+/**
+ * loads the resource of a slot again
+ */
+static void
+resource_restart(struct resource_manager *manager, uint32_t index)
+{
+    struct resource *res = &manager->slots[index];
+
+    if (res->type == RESOURCE_SPRITE) {
+        resource_sprite_begin(manager, index);
+        return;
+    }
+
+    struct resource_request *request = malloc(sizeof(*request));
+    if (!request || !(request->name = strdup(res->name))) {
+        free(request);
+        resource_finish(manager, index, NULL, ENOMEM);
+        return;
+    }
+    request->file = NULL;
+
+    resource_start(manager, index, request);
+}
+
+/**
+ * returns 1 if a sprite of the dvf in the slot is being decoded
+ */
+static int
+resource_dvf_busy(struct resource_manager *manager, uint32_t index)
+{
+    uint32_t i;
+
+    for (i = 0; i < manager->num_slots; i++) {
+        struct resource *sprite = &manager->slots[i];
+        if (sprite->key && sprite->type == RESOURCE_SPRITE &&
+            sprite->request && RESOURCE_HANDLE_INDEX(sprite->dvf) == index)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * throws the data of a slot away and loads it again
+ */
+static void
+resource_reload_now(struct resource_manager *manager, uint32_t index)
+{
+    struct resource *res = &manager->slots[index];
+
+    res->reload = 0;
+    if (res->data) {
+        resource_funcs[res->type].free(res->data);
+        manager->used -= res->size;
+        res->data = NULL;
+        res->size = 0;
+    }
+
+    resource_restart(manager, index);
+}
+
+/**
+ * reloads a slot under a new generation
+ * if it is loading or a worker uses it the reload happens afterwards
+ */
+static void
+resource_reload_slot(struct resource_manager *manager, uint32_t index)
+{
+    struct resource *res = &manager->slots[index];
+    int busy = res->state == RESOURCE_STATE_LOADING ||
+               (res->type == RESOURCE_DVF && resource_dvf_busy(manager, index));
+
+    /* handles from before are stale right away, not after the reload */
+    if (!res->reload && ++res->generation == 0)
+        res->generation = 1;
+    res->reload = 1;
+
+    resource_lru_remove(manager, index);
+    res->state = RESOURCE_STATE_LOADING;
+    if (!busy)
+        resource_reload_now(manager, index);
+}
+
+/**
+ * reloads every resource which was loaded from file_name, e.g. after it
+ * changed on disk, including sprites decoded from it
+ * the mapping of the file gets invalidated, handles of the reloaded
+ * resources become stale and have to be requested again
+ *
+ * returns the number of reloaded resources
+ */
+__SYM_EXPORT__ unsigned int
+resource_reload(struct resource_manager *manager, const char *file_name)
+{
+    unsigned int num_reloaded = 0, pass;
+    uint32_t i;
+
+    mmap_file_invalidate(file_name);
+
+    /* files first so the sprites find their reloaded dvf */
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < manager->num_slots; i++) {
+            struct resource *res = &manager->slots[i];
+            if (!res->key || (res->type == RESOURCE_SPRITE) != pass ||
+                strcmp(res->name, file_name) != 0)
+                continue;
+
+            resource_reload_slot(manager, i);
+            num_reloaded++;
+        }
+    }
+
+    return num_reloaded;
+}
+
+/**
+ * creates a resource manager
+ * budget is the number of bytes loaded resources should stay below,
+ * num_threads loader threads load in the background, with zero threads
+ * everything loads synchronously
+ *
+ * returns a struct resource_manager on success, otherwise NULL and err gets
+ * set
+ */
+__SYM_EXPORT__ struct resource_manager *
+resource_manager_new(size_t budget, unsigned int num_threads, int *err_out)
+{
+    int err = 0;
+    unsigned int i;
+
+    struct resource_manager *manager = malloc(sizeof(*manager));
+    if (!manager) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(manager, 0, sizeof(*manager));
+    manager->budget = budget;
+    manager->free_slot = RESOURCE_NO_SLOT;
+    for (i = 0; i < RESOURCE_NUM_CLASSES; i++) {
+        manager->lru_head[i] = RESOURCE_NO_SLOT;
+        manager->lru_tail[i] = RESOURCE_NO_SLOT;
+    }
+
+    if ((err = resource_hash_grow(manager)))
+        goto error;
+
+    if (num_threads > 0) {
+        manager->loader = loader_new(num_threads, &err);
+        if (!manager->loader)
+            goto error;
+    }
+
+    return manager;
+
+error:
+    resource_manager_free(manager);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+/**
+ * frees all resources, handles become invalid
+ */
+__SYM_EXPORT__ void
+resource_manager_free(struct resource_manager *manager)
+{
+    uint32_t i;
+
+    if (!manager)
+        return;
+
+    /* waits for running loads and frees their results */
+    loader_free(manager->loader);
+
+    for (i = 0; i < manager->num_slots; i++) {
+        struct resource *res = &manager->slots[i];
+        if (!res->key)
+            continue;
+        resource_request_free(res->request);
+        if (res->data)
+            resource_funcs[res->type].free(res->data);
+        free(res->key);
+        free(res->name);
+    }
+
+    free(manager->buckets);
+    free(manager->slots);
+    free(manager);
+}
+
+/**
+ * evicts the least recently used resources of the lowest priority until
+ * the budget is met or nothing is left to evict
+ */
+static void
+resource_manager_trim(struct resource_manager *manager)
+{
+    unsigned int class = 0;
+
+    while (manager->used > manager->budget && class < RESOURCE_NUM_CLASSES) {
+        uint32_t index = manager->lru_tail[class];
+        if (index == RESOURCE_NO_SLOT) {
+            class++;
+            continue;
+        }
+        DEBUG_LOG("evicting %s\n", manager->slots[index].key);
+        resource_unload(manager, index);
+    }
+}
+
+/**
+ * picks up finished loads and enforces the budget
+ * should be called once per frame
+ */
+__SYM_EXPORT__ void
+resource_manager_update(struct resource_manager *manager)
+{
+    struct loader_ticket *tickets[32];
+    unsigned int num_tickets, i;
+
+    if (manager->loader) {
+        while ((num_tickets = loader_poll(manager->loader, tickets, 32))) {
+            for (i = 0; i < num_tickets; i++) {
+                int err = 0;
+                uint32_t index =
+                    (uintptr_t)loader_ticket_user_data(tickets[i]);
+                void *result = loader_ticket_take(tickets[i], &err);
+                loader_ticket_free(tickets[i]);
+                resource_finish(manager, index, result, err);
+            }
+        }
+    }
+
+    resource_manager_trim(manager);
+    manager->frame++;
+}
+
+__SYM_EXPORT__ void
+resource_manager_set_budget(struct resource_manager *manager, size_t budget)
+{
+    manager->budget = budget;
+}
+
+__SYM_EXPORT__ size_t
+resource_manager_memory_used(struct resource_manager *manager)
+{
+    return manager->used;
+}
+
+/**
+ * marks a resource as used in this frame
+ */
+static void
+resource_touch(struct resource_manager *manager, uint32_t index)
+{
+    struct resource *res = &manager->slots[index];
+
+    if (res->last_use != manager->frame) {
+        res->last_use = manager->frame;
+        if (res->in_lru)
+            resource_lru_update(manager, index);
+    }
+}
+
+/**
+ * looks up or creates a slot
+ * a failed resource gets another try
+ */
+static uint32_t
+resource_get_slot(struct resource_manager *manager,
+                  enum resource_type type,
+                  const char *key,
+                  const char *name,
+                  int priority,
+                  int *created)
+{
+    uint32_t key_hash = resource_hash(key);
+    uint32_t index = resource_find(manager, key, key_hash);
+
+    *created = 0;
+    if (index == RESOURCE_NO_SLOT) {
+        *created = 1;
+        return resource_insert(manager, type, key, key_hash, name, priority);
+    }
+
+    if (manager->slots[index].state == RESOURCE_STATE_FAILED) {
+        resource_lru_remove(manager, index);
+        *created = 1;
+    }
+
+    if (priority > manager->slots[index].priority)
+        resource_set_priority(manager,
+                              RESOURCE_HANDLE(index,
+                                              manager->slots[index].generation),
+                              priority);
+    resource_touch(manager, index);
+
+    return index;
+}
+
+/**
+ * requests a dvf file, background or level
+ * a resource which is already known is shared, its priority gets raised
+ * if needed
+ *
+ * returns a handle on success, otherwise RESOURCE_NO_HANDLE and err gets set
+ */
+__SYM_EXPORT__ resource_handle
+resource_load(struct resource_manager *manager,
+              enum resource_type type,
+              const char *name,
+              int priority,
+              int *err_out)
+{
+    int err = 0, created = 0;
+    char key[RESOURCE_MAX_KEY];
+
+    if (type == RESOURCE_SPRITE || type >= RESOURCE_NUM_TYPES) {
+        err = EINVAL;
+        goto error;
+    }
+
+    if (snprintf(key, sizeof(key), "%d:%s", type, name) >= (int)sizeof(key)) {
+        err = ENAMETOOLONG;
+        goto error;
+    }
+
+    uint32_t index =
+        resource_get_slot(manager, type, key, name, priority, &created);
+    if (index == RESOURCE_NO_SLOT) {
+        err = ENOMEM;
+        goto error;
+    }
+
+    resource_handle handle =
+        RESOURCE_HANDLE(index, manager->slots[index].generation);
+    if (created)
+        resource_restart(manager, index);
+
+    return handle;
+
+error:
+    if (err_out)
+        *err_out = err;
+    return RESOURCE_NO_HANDLE;
+}
+
+/**
+ * requests a decoded frame of a dvf file
+ * the dvf file gets loaded first if needed
+ *
+ * returns a handle on success, otherwise RESOURCE_NO_HANDLE and err gets set
+ */
+__SYM_EXPORT__ resource_handle
+resource_load_sprite(struct resource_manager *manager,
+                     const char *dvf_name,
+                     unsigned int object,
+                     unsigned int animation,
+                     unsigned int frame,
+                     int priority,
+                     int *err_out)
+{
+    int err = 0, created = 0;
+    char key[RESOURCE_MAX_KEY];
+
+    if (snprintf(key, sizeof(key), "%d:%s:%u:%u:%u",
+                 RESOURCE_SPRITE, dvf_name, object, animation, frame) >=
+        (int)sizeof(key)) {
+        err = ENAMETOOLONG;
+        goto error;
+    }
+
+    uint32_t index = resource_get_slot(manager, RESOURCE_SPRITE, key, dvf_name,
+                                       priority, &created);
+    if (index == RESOURCE_NO_SLOT) {
+        err = ENOMEM;
+        goto error;
+    }
+
+    resource_handle handle =
+        RESOURCE_HANDLE(index, manager->slots[index].generation);
+    if (!created)
+        return handle;
+
+    struct resource *res = &manager->slots[index];
+    res->object = object;
+    res->animation = animation;
+    res->frame = frame;
+    resource_sprite_begin(manager, index);
+
+    return handle;
+
+error:
+    if (err_out)
+        *err_out = err;
+    return RESOURCE_NO_HANDLE;
+}
+
+/**
+ * returns the loaded resource or NULL if it is not ready or the handle is
+ * stale, the pointer is valid until the next resource_manager_update
+ * unless the resource is acquired
+ */
+__SYM_EXPORT__ void *
+resource_get(struct resource_manager *manager, resource_handle handle)
+{
+    uint32_t index = resource_lookup(manager, handle);
+
+    if (index == RESOURCE_NO_SLOT ||
+        manager->slots[index].state != RESOURCE_STATE_READY)
+        return NULL;
+
+    resource_touch(manager, index);
+    return manager->slots[index].data;
+}
+
+/**
+ * returns the state of a resource, err gets set if it failed
+ */
+__SYM_EXPORT__ enum resource_state
+resource_state(struct resource_manager *manager,
+               resource_handle handle,
+               int *err_out)
+{
+    uint32_t index = resource_lookup(manager, handle);
+
+    if (index == RESOURCE_NO_SLOT)
+        return RESOURCE_STATE_NONE;
+
+    if (manager->slots[index].state == RESOURCE_STATE_FAILED && err_out)
+        *err_out = manager->slots[index].err;
+    return manager->slots[index].state;
+}
+
+/**
+ * keeps a resource from being evicted until resource_release
+ */
+__SYM_EXPORT__ void
+resource_acquire(struct resource_manager *manager, resource_handle handle)
+{
+    uint32_t index = resource_lookup_owner(manager, handle);
+
+    if (index == RESOURCE_NO_SLOT)
+        return;
+
+    manager->slots[index].pins++;
+    resource_lru_update(manager, index);
+}
+
+__SYM_EXPORT__ void
+resource_release(struct resource_manager *manager, resource_handle handle)
+{
+    uint32_t index = resource_lookup_owner(manager, handle);
+
+    if (index == RESOURCE_NO_SLOT || manager->slots[index].pins == 0)
+        return;
+
+    manager->slots[index].pins--;
+    resource_lru_update(manager, index);
+}
+
+/**
+ * returns the priority of a resource, 0 if the handle is stale
+ */
+__SYM_EXPORT__ int
+resource_priority(struct resource_manager *manager, resource_handle handle)
+{
+    uint32_t index = resource_lookup(manager, handle);
+
+    if (index == RESOURCE_NO_SLOT)
+        return 0;
+    return manager->slots[index].priority;
+}
+
+/**
+ * changes the priority used for loading and eviction
+ */
+__SYM_EXPORT__ void
+resource_set_priority(struct resource_manager *manager,
+                      resource_handle handle,
+                      int priority)
+{
+    uint32_t index = resource_lookup(manager, handle);
+
+    if (index == RESOURCE_NO_SLOT)
+        return;
+
+    struct resource *res = &manager->slots[index];
+    resource_lru_remove(manager, index);
+    res->priority = priority;
+    resource_lru_update(manager, index);
+
+    if (res->ticket)
+        loader_set_priority(manager->loader, res->ticket, priority);
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ASSET_RESOURCE_H__
+#define __ASSET_RESOURCE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "loader.h"
+
+/* no resource, never handed out */
+#define RESOURCE_NO_HANDLE 0
+
+/* resources with a lower priority get evicted first */
+#define RESOURCE_PRIORITY_LOW LOADER_PRIORITY_LOW
+#define RESOURCE_PRIORITY_NORMAL LOADER_PRIORITY_NORMAL
+#define RESOURCE_PRIORITY_HIGH LOADER_PRIORITY_HIGH
+
+/**
+ * resource types and what resource_get returns for them
+ */
+enum resource_type {
+    /* struct dvf_file, initialized */
+    RESOURCE_DVF,
+    /* struct resource_sprite, a decoded dvf frame */
+    RESOURCE_SPRITE,
+    /* struct loader_pixmap, a decoded dvm file */
+    RESOURCE_BACKGROUND,
+    /* struct dvd_file */
+    RESOURCE_LEVEL,
+    /* struct level_deps, the files named as the level names them */
+    RESOURCE_LEVEL_DEPS,
+    RESOURCE_NUM_TYPES
+};
+
+enum resource_state {
+    /* the handle is stale, the resource got evicted or reloaded */
+    RESOURCE_STATE_NONE,
+    RESOURCE_STATE_LOADING,
+    RESOURCE_STATE_READY,
+    RESOURCE_STATE_FAILED
+};
+
+/**
+ * a slot index and the generation of the slot
+ * a handle stays valid until the resource gets evicted or reloaded
+ */
+typedef uint64_t resource_handle;
+
+/**
+ * a decoded dvf frame, 32 bit ARGB
+ */
+struct resource_sprite {
+    void *pixels;
+    unsigned int width;
+    unsigned int height;
+};
+
+struct resource_manager;
+
+struct resource_manager *
+resource_manager_new(size_t budget, unsigned int num_threads, int *err_out);
+
+void
+resource_manager_free(struct resource_manager *manager);
+
+void
+resource_manager_update(struct resource_manager *manager);
+
+void
+resource_manager_set_budget(struct resource_manager *manager, size_t budget);
+
+size_t
+resource_manager_memory_used(struct resource_manager *manager);
+
+resource_handle
+resource_load(struct resource_manager *manager,
+              enum resource_type type,
+              const char *name,
+              int priority,
+              int *err_out);
+
+resource_handle
+resource_load_sprite(struct resource_manager *manager,
+                     const char *dvf_name,
+                     unsigned int object,
+                     unsigned int animation,
+                     unsigned int frame,
+                     int priority,
+                     int *err_out);
+
+void *
+resource_get(struct resource_manager *manager, resource_handle handle);
+
+enum resource_state
+resource_state(struct resource_manager *manager,
+               resource_handle handle,
+               int *err_out);
+
+void
+resource_acquire(struct resource_manager *manager, resource_handle handle);
+
+void
+resource_release(struct resource_manager *manager, resource_handle handle);
+
+unsigned int
+resource_reload(struct resource_manager *manager, const char *file_name);
+
+int
+resource_priority(struct resource_manager *manager, resource_handle handle);
+
+void
+resource_set_priority(struct resource_manager *manager,
+                      resource_handle handle,
+                      int priority);
+
+#endif /* __ASSET_RESOURCE_H__ */
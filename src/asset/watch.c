@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * asset hot reload
+ * ================
+ *
+ * A watch reloads resources whose files changed on disk. It watches the
+ * directories of the files with inotify because editors and tools usually
+ * replace a file by renaming a new one over it, which a watch on the file
+ * itself would not survive. Only files added with asset_watch_add are
+ * considered, everything else in the directories is ignored.
+ *
+ * asset_watch_fd can be polled together with other descriptors,
+ * asset_watch_dispatch never blocks. Several events for the same file
+ * within one dispatch cause a single reload.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+
+#include "resource.h"
+#include "watch.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+#define ASSET_WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+struct asset_watch_dir {
+    int wd;
+    char *path;
+};
+
+struct asset_watch_file {
+    /* index into dirs */
+    unsigned int dir;
+    /* name inside the directory */
+    const char *base;
+    /* name the resources were loaded with */
+    char *path;
+    int changed;
+};
+
+struct asset_watch {
+    struct resource_manager *manager;
+    int fd;
+    unsigned int num_dirs;
+    unsigned int alloc_dirs;
+    struct asset_watch_dir *dirs;
+    unsigned int num_files;
+    unsigned int alloc_files;
+    struct asset_watch_file *files;
+};
+
+__SYM_EXPORT__ struct asset_watch *
+asset_watch_new(struct resource_manager *manager, int *err_out)
+{
+    int err = 0;
+    struct asset_watch *watch = malloc(sizeof(*watch));
+    if (!watch) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(watch, 0, sizeof(*watch));
+
+    watch->manager = manager;
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) {
+        err = errno;
+        DEBUG_ERROR("cannot init inotify: %s\n", strerror(err));
+        goto error;
+    }
+
+    return watch;
+
+error:
+    free(watch);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+__SYM_EXPORT__ void
+asset_watch_free(struct asset_watch *watch)
+{
+    unsigned int i;
+
+    if (!watch)
+        return;
+
+    for (i = 0; i < watch->num_dirs; i++)
+        free(watch->dirs[i].path);
+    for (i = 0; i < watch->num_files; i++)
+        free(watch->files[i].path);
+    free(watch->dirs);
+    free(watch->files);
+    close(watch->fd);
+    free(watch);
+}
+
+/**
+ * returns the index of the watched directory path or adds a watch for it
+ * returns -1 and sets errno on failure
+ */
+static int
+asset_watch_dir(struct asset_watch *watch, const char *path, size_t len)
+{
+    unsigned int i;
+
+    for (i = 0; i < watch->num_dirs; i++) {
+        if (strlen(watch->dirs[i].path) == len &&
+            memcmp(watch->dirs[i].path, path, len) == 0)
+            return i;
+    }
+
+    if (watch->num_dirs == watch->alloc_dirs) {
+        unsigned int alloc = watch->alloc_dirs ? watch->alloc_dirs * 2 : 8;
+        struct asset_watch_dir *dirs =
+            realloc(watch->dirs, alloc * sizeof(*dirs));
+        if (!dirs)
+            return -1;
+        watch->dirs = dirs;
+        watch->alloc_dirs = alloc;
+    }
+
+    char *copy = strndup(path, len);
+    if (!copy)
+        return -1;
+
+    int wd = inotify_add_watch(watch->fd, copy, ASSET_WATCH_EVENTS);
+    if (wd < 0) {
+        free(copy);
+        return -1;
+    }
+
+    watch->dirs[watch->num_dirs].wd = wd;
+    watch->dirs[watch->num_dirs].path = copy;
+    return watch->num_dirs++;
+}
+
+/**
+ * reloads the resources loaded from file_name whenever it changes
+ * file_name has to be the name the resources were requested with
+ */
+__SYM_EXPORT__ int
+asset_watch_add(struct asset_watch *watch, const char *file_name)
+{
+    unsigned int i;
+
+    for (i = 0; i < watch->num_files; i++) {
+        if (strcmp(watch->files[i].path, file_name) == 0)
+            return 0;
+    }
+
+    if (watch->num_files == watch->alloc_files) {
+        unsigned int alloc = watch->alloc_files ? watch->alloc_files * 2 : 16;
+        struct asset_watch_file *files =
+            realloc(watch->files, alloc * sizeof(*files));
+        if (!files)
+            return ENOMEM;
+        watch->files = files;
+        watch->alloc_files = alloc;
+    }
+
+    const char *slash = strrchr(file_name, '/');
+    int dir;
+    if (!slash)
+        dir = asset_watch_dir(watch, ".", 1);
+    else if (slash == file_name)
+        dir = asset_watch_dir(watch, "/", 1);
+    else
+        dir = asset_watch_dir(watch, file_name, slash - file_name);
+    if (dir < 0) {
+        DEBUG_ERROR("cannot watch %s: %s\n", file_name, strerror(errno));
+        return errno;
+    }
+
+    char *path = strdup(file_name);
+    if (!path)
+        return ENOMEM;
+
+    struct asset_watch_file *file = &watch->files[watch->num_files++];
+    file->dir = dir;
+    file->path = path;
+    file->base = slash ? path + (slash - file_name) + 1 : path;
+    file->changed = 0;
+
+    return 0;
+}
+
+__SYM_EXPORT__ int
+asset_watch_fd(struct asset_watch *watch)
+{
+    return watch->fd;
+}
+
+/**
+ * marks the watched files an event refers to as changed
+ */
+static void
+asset_watch_event(struct asset_watch *watch, const struct inotify_event *event)
+{
+    unsigned int i;
+
+    if (event->mask & IN_Q_OVERFLOW) {
+        /* events got lost, anything might have changed */
+        for (i = 0; i < watch->num_files; i++)
+            watch->files[i].changed = 1;
+        return;
+    }
+
+    if (!event->len)
+        return;
+
+    for (i = 0; i < watch->num_files; i++) {
+        struct asset_watch_file *file = &watch->files[i];
+        if (watch->dirs[file->dir].wd == event->wd &&
+            strcmp(file->base, event->name) == 0)
+            file->changed = 1;
+    }
+}
+
+/**
+ * reads the pending events and reloads the changed files
+ * returns the number of reloaded resources
+ */
+__SYM_EXPORT__ unsigned int
+asset_watch_dispatch(struct asset_watch *watch)
+{
+    char buffer[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    unsigned int i, num_reloaded = 0;
+    ssize_t len;
+
+    while ((len = read(watch->fd, buffer, sizeof(buffer))) > 0) {
+        char *p = buffer;
+        while (p < buffer + len) {
+            const struct inotify_event *event = (void *)p;
+            asset_watch_event(watch, event);
+            p += sizeof(*event) + event->len;
+        }
+    }
+
+    for (i = 0; i < watch->num_files; i++) {
+        struct asset_watch_file *file = &watch->files[i];
+        if (!file->changed)
+            continue;
+
+        file->changed = 0;
+        DEBUG_LOG("reloading %s\n", file->path);
+        num_reloaded += resource_reload(watch->manager, file->path);
+    }
+
+    return num_reloaded;
+}
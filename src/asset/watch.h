@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __ASSET_WATCH_H__
+#define __ASSET_WATCH_H__
+
+#include "resource.h"
+
+struct asset_watch;
+
+struct asset_watch *
+asset_watch_new(struct resource_manager *manager, int *err_out);
+
+void
+asset_watch_free(struct asset_watch *watch);
+
+int
+asset_watch_add(struct asset_watch *watch, const char *file_name);
+
+int
+asset_watch_fd(struct asset_watch *watch);
+
+unsigned int
+asset_watch_dispatch(struct asset_watch *watch);
+
+#endif /* __ASSET_WATCH_H__ */
@@ -17,11 +17,378 @@
  * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * dvf viewer
+ * ==========
+ *
+ * Plays all animations of all objects of a dvf file. Every object gets one
+ * streaming texture sized to its largest frame, frames are decoded straight
+ * into it when the animation advances. Presentation is paced by vsync and
+ * the animation clock, the frame time of the last presents is shown in the
+ * top left corner. Everything is recorded into a draw list and submitted
+ * once per present.
+ *
+ * escape quits, space pauses, the right arrow skips to the next animation
+ */
+
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <SDL.h>
 
+#include "trace.h"
 #include "dvf.h"
+#include "drawlist.h"
+
+#define DVFTOOL_WINDOW_SIZE 512
+/* how long each frame of an animation is shown */
+#define DVFTOOL_FRAME_MSEC 50
+/* without vsync presents are spaced at least this far apart */
+#define DVFTOOL_MIN_PRESENT_MSEC 16
+/* presents averaged for the frame time readout */
+#define DVFTOOL_FRAME_TIMES 32
+/* size of a pixel of the readout font */
+#define DVFTOOL_FONT_SCALE 2
+
+/* draw list layers, back to front */
+#define DVFTOOL_LAYER_BACKGROUND 0
+#define DVFTOOL_LAYER_SPRITE     1
+#define DVFTOOL_LAYER_READOUT    2
+#define DVFTOOL_LAYER_TEXT       3
+
+struct player {
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    struct drawlist *drawlist;
+    /* presenting blocks until the next vertical blank */
+    int vsync;
+    int paused;
+
+    /* reused as long as frames fit in */
+    SDL_Texture *texture;
+    unsigned int texture_width;
+    unsigned int texture_height;
+
+    /* frame times in milliseconds */
+    uint64_t last_present;
+    double frame_times[DVFTOOL_FRAME_TIMES];
+    unsigned int num_frame_times;
+    double decode_time;
+};
+
+/* what the player loop should do next */
+#define PLAYER_CONTINUE 0
+#define PLAYER_SKIP     1
+#define PLAYER_QUIT     2
+
+/*
+ * 3x5 glyphs for the readout, one octal digit per row
+ */
+static const char font_chars[] = "0123456789.MSFPDEC";
+static const uint16_t font_glyphs[] = {
+    075557, 026227, 071747, 071717, 055711,
+    074717, 074757, 071111, 075757, 075717,
+    000002, 057755, 074717, 074744, 075744,
+    065556, 074747, 074447,
+};
+
+static double
+player_msec(uint64_t ticks)
+{
+    return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static void
+player_draw_text(struct player *player,
+                 int x,
+                 int y,
+                 const char *text,
+                 SDL_Color color)
+{
+    int row, column;
+
+    for (; *text; text++, x += 4 * DVFTOOL_FONT_SCALE) {
+        const char *c = strchr(font_chars, *text);
+        if (!c)
+            continue;
+
+        uint16_t glyph = font_glyphs[c - font_chars];
+        for (row = 0; row < 5; row++) {
+            for (column = 0; column < 3; column++) {
+                if (!(glyph >> ((4 - row) * 3 + (2 - column)) & 1))
+                    continue;
+
+                SDL_Rect rect = {
+                    x + column * DVFTOOL_FONT_SCALE,
+                    y + row * DVFTOOL_FONT_SCALE,
+                    DVFTOOL_FONT_SCALE,
+                    DVFTOOL_FONT_SCALE
+                };
+                drawlist_fill(player->drawlist,
+                              DVFTOOL_LAYER_TEXT,
+                              0,
+                              &rect,
+                              color);
+            }
+        }
+    }
+}
+
+static void
+player_draw_readout(struct player *player)
+{
+    char line[32];
+    double frame_time = 0;
+    unsigned int i, n = player->num_frame_times < DVFTOOL_FRAME_TIMES ?
+                        player->num_frame_times : DVFTOOL_FRAME_TIMES;
+    SDL_Rect background = { 0, 0, 17 * 4 * DVFTOOL_FONT_SCALE,
+                            13 * DVFTOOL_FONT_SCALE };
+    SDL_Color black = { 0, 0, 0, 255 }, white = { 255, 255, 255, 255 };
+
+    for (i = 0; i < n; i++)
+        frame_time += player->frame_times[i];
+    if (n)
+        frame_time /= n;
+
+    drawlist_fill(player->drawlist,
+                  DVFTOOL_LAYER_READOUT,
+                  0,
+                  &background,
+                  black);
+
+    snprintf(line,
+             sizeof(line),
+             "%.2f MS %.0f FPS",
+             frame_time,
+             frame_time > 0 ? 1000.0 / frame_time : 0.0);
+    player_draw_text(player, 2, 2, line, white);
+
+    snprintf(line, sizeof(line), "DEC %.3f MS", player->decode_time);
+    player_draw_text(player, 2, 2 + 6 * DVFTOOL_FONT_SCALE, line, white);
+}
+
+/**
+ * makes sure the streaming texture can hold every frame of obj
+ */
+static int
+player_set_object(struct player *player, struct dvf_object *obj)
+{
+    unsigned int i, j, width, height;
+    unsigned int max_width = 1, max_height = 1;
+
+    for (i = 0; i < dvf_object_num_animations(obj); i++) {
+        struct dvf_animation *anim = dvf_object_get_animation(obj, i);
+
+        for (j = 0; j < dvf_animation_num_frames(anim); j++) {
+            dvf_frame_size(dvf_animation_get_frame(anim, j), &width, &height);
+            if (width > max_width)
+                max_width = width;
+            if (height > max_height)
+                max_height = height;
+        }
+    }
+
+    if (player->texture &&
+        max_width <= player->texture_width &&
+        max_height <= player->texture_height)
+        return 0;
+
+    if (player->texture)
+        SDL_DestroyTexture(player->texture);
+
+    /* B8G8R8A8 in memory is ARGB8888 on little endian */
+    player->texture = SDL_CreateTexture(player->renderer,
+                                        SDL_PIXELFORMAT_ARGB8888,
+                                        SDL_TEXTUREACCESS_STREAMING,
+                                        max_width,
+                                        max_height);
+    if (!player->texture) {
+        fprintf(stderr, "error: cannot create texture: %s\n", SDL_GetError());
+        return ENOMEM;
+    }
+    SDL_SetTextureBlendMode(player->texture, SDL_BLENDMODE_BLEND);
+
+    player->texture_width = max_width;
+    player->texture_height = max_height;
+    return 0;
+}
+
+/**
+ * decodes the frame into the top left of the streaming texture
+ */
+static int
+player_upload_frame(struct player *player,
+                    struct dvf_frame *frame,
+                    unsigned int width,
+                    unsigned int height)
+{
+    TRACE_ZONE("upload");
+    SDL_Rect rect = { 0, 0, width, height };
+    void *pixels;
+    int pitch, err;
+
+    if (SDL_LockTexture(player->texture, &rect, &pixels, &pitch) != 0)
+        return EIO;
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    err = dvf_frame_decode(frame, pixels, pitch);
+    player->decode_time = player_msec(SDL_GetPerformanceCounter() - start);
+
+    SDL_UnlockTexture(player->texture);
+    return err;
+}
+
+static void
+player_present(struct player *player)
+{
+    if (drawlist_submit(player->drawlist, NULL))
+        fprintf(stderr, "error: cannot draw: %s\n", SDL_GetError());
+    SDL_RenderPresent(player->renderer);
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (player->last_present) {
+        player->frame_times[player->num_frame_times++ % DVFTOOL_FRAME_TIMES] =
+            player_msec(now - player->last_present);
+    }
+    player->last_present = now;
+}
+
+static int
+player_poll(struct player *player)
+{
+    SDL_Event event;
+    int action = PLAYER_CONTINUE;
+
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT)
+            return PLAYER_QUIT;
+        if (event.type != SDL_KEYDOWN)
+            continue;
+
+        switch (event.key.keysym.sym) {
+            case SDLK_ESCAPE:
+                return PLAYER_QUIT;
+            case SDLK_SPACE:
+                player->paused = !player->paused;
+                break;
+            case SDLK_RIGHT:
+                action = PLAYER_SKIP;
+                break;
+        }
+    }
+
+    return action;
+}
+
+/**
+ * shows the frame until the animation clock passes deadline, redrawing
+ * once per vertical blank
+ */
+static int
+player_show_frame(struct player *player,
+                  const SDL_Rect *obj_rect,
+                  const SDL_Rect *sprite_rect,
+                  uint32_t deadline)
+{
+    SDL_Rect screen_rect = { 0, 0, DVFTOOL_WINDOW_SIZE, DVFTOOL_WINDOW_SIZE };
+    SDL_Rect source_rect = { 0, 0, sprite_rect->w, sprite_rect->h };
+    SDL_Color sky = { 205, 235, 255, 255 };
+    SDL_Color red = { 255, 0, 0, 255 }, green = { 0, 255, 0, 255 };
+    int action;
+
+    do {
+        TRACE_ZONE("frame");
+        if ((action = player_poll(player)) != PLAYER_CONTINUE)
+            return action;
+
+        /* the outlines are untextured and go before the sprite */
+        drawlist_fill(player->drawlist,
+                      DVFTOOL_LAYER_BACKGROUND,
+                      0,
+                      &screen_rect,
+                      sky);
+        drawlist_outline(player->drawlist,
+                         DVFTOOL_LAYER_SPRITE,
+                         0,
+                         obj_rect,
+                         red);
+        drawlist_outline(player->drawlist,
+                         DVFTOOL_LAYER_SPRITE,
+                         0,
+                         sprite_rect,
+                         green);
+        drawlist_sprite(player->drawlist,
+                        DVFTOOL_LAYER_SPRITE,
+                        0,
+                        player->texture,
+                        &source_rect,
+                        sprite_rect);
+        player_draw_readout(player);
+        player_present(player);
+
+        if (!player->vsync)
+            SDL_Delay(DVFTOOL_MIN_PRESENT_MSEC);
+    } while (player->paused || !SDL_TICKS_PASSED(SDL_GetTicks(), deadline));
+
+    return PLAYER_CONTINUE;
+}
+
+static int
+player_play(struct player *player, struct dvf_file *file)
+{
+    unsigned int i, j, k;
+    int action = PLAYER_CONTINUE;
+    uint32_t deadline = SDL_GetTicks();
+
+    for (i = 0; i < dvf_file_num_objects(file); i++) {
+        struct dvf_object *obj = dvf_file_get_object(file, i);
+        unsigned int obj_width, obj_height;
+
+        if (player_set_object(player, obj))
+            return PLAYER_QUIT;
+
+        dvf_object_size(obj, &obj_width, &obj_height);
+        SDL_SetWindowTitle(player->window, dvf_object_name(obj));
+        SDL_Rect obj_rect = { 0, 0, obj_width, obj_height };
+
+        for (j = 0; j < dvf_object_num_animations(obj); j++) {
+            struct dvf_animation *anim = dvf_object_get_animation(obj, j);
+
+            for (k = 0; k < dvf_animation_num_frames(anim); k++) {
+                struct dvf_frame *frame = dvf_animation_get_frame(anim, k);
+                unsigned int width, height, wf, hf;
+
+                if (!dvf_frame_valid(frame))
+                    continue;
+
+                dvf_frame_size(frame, &width, &height);
+                dvf_frame_unknown(frame, NULL, NULL, &wf, &hf, NULL, NULL);
+                if (player_upload_frame(player, frame, width, height))
+                    continue;
+
+                SDL_Rect sprite_rect = { wf, hf, width, height };
+
+                /* advance on the animation clock, do not try to catch up */
+                deadline += DVFTOOL_FRAME_MSEC;
+                if (SDL_TICKS_PASSED(SDL_GetTicks(), deadline))
+                    deadline = SDL_GetTicks() + DVFTOOL_FRAME_MSEC;
+
+                action = player_show_frame(player,
+                                           &obj_rect,
+                                           &sprite_rect,
+                                           deadline);
+                if (action != PLAYER_CONTINUE)
+                    break;
+            }
+
+            if (action == PLAYER_QUIT)
+                return action;
+            action = PLAYER_CONTINUE;
+        }
+    }
+
+    return action;
+}
 
 int
 main(int argc, char **argv)
@@ -29,6 +396,8 @@ main(int argc, char **argv)
     int err = 0;
     char *file_name = NULL;
     struct dvf_file *file = NULL;
+    struct player player;
+    SDL_RendererInfo info;
 
     if(argc < 2) {
         fprintf(stderr, "missing paramater\n");
@@ -55,102 +424,46 @@ main(int argc, char **argv)
         return err;
     }
 
+    memset(&player, 0, sizeof(player));
+
     SDL_Init(SDL_INIT_VIDEO);
-    SDL_Window *w = SDL_CreateWindow("DVF tool",
+    player.window = SDL_CreateWindow("DVF tool",
                                      SDL_WINDOWPOS_UNDEFINED,
                                      SDL_WINDOWPOS_UNDEFINED,
-                                     512,
-                                     512,
+                                     DVFTOOL_WINDOW_SIZE,
+                                     DVFTOOL_WINDOW_SIZE,
                                      0);
-    SDL_Renderer *renderer = SDL_CreateRenderer(w, -1, SDL_RENDERER_ACCELERATED);
-
-
-    int i=0, j=0, k=0;
-    struct dvf_object *obj = NULL;
-    int num_objects = dvf_file_num_objects(file);
+    player.renderer = SDL_CreateRenderer(player.window,
+                                         -1,
+                                         SDL_RENDERER_ACCELERATED |
+                                         SDL_RENDERER_PRESENTVSYNC);
+    /* fall back to whatever renderer there is */
+    if (!player.renderer)
+        player.renderer = SDL_CreateRenderer(player.window, -1, 0);
 
-    for (i=0; i<num_objects; i++) {
-        obj = dvf_file_get_object(file, i);
+    if (player.renderer && SDL_GetRendererInfo(player.renderer, &info) == 0)
+        player.vsync = (info.flags & SDL_RENDERER_PRESENTVSYNC) != 0;
 
-        SDL_Rect sprite_rect, screen_rect, obj_rect;
-
-        int obj_width, obj_height;
-        dvf_object_size(obj, &obj_width, &obj_height);
-        //SDL_SetWindowSize(w, obj_width, obj_height);
-        SDL_SetWindowTitle(w, dvf_object_name(obj));
-
-        screen_rect.x = 0;
-        screen_rect.y = 0;
-        screen_rect.w = 512; //obj_width;
-        screen_rect.h = 512; //obj_height;
-
-        obj_rect.x = 0;
-        obj_rect.y = 0;
-        obj_rect.w = obj_width; //obj_width;
-        obj_rect.h = obj_height; //obj_height;
-
-        struct dvf_animation *anim = NULL;
-        for (j=0; j<dvf_object_num_animations(obj); j++) {
-            anim = dvf_object_get_animation(obj, j);;
-
-            struct dvf_frame *frame = NULL;
-            unsigned int width, height;
-            void *pixmap;
-            for (k=0; k<dvf_animation_num_frames(anim); k++) {
-                frame = dvf_animation_get_frame(anim, k);
-                    pixmap = dvf_frame_pixmap(frame, &width, &height);
-
-                int wf, hf;
-                dvf_frame_unknown(frame, NULL, NULL, &wf, &hf, NULL, NULL);
+    if (player.renderer)
+        player.drawlist = drawlist_new(player.renderer, &err);
 
-                SDL_Surface *surface =
-                  SDL_CreateRGBSurface(0,
-                                       width,
-                                       height,
-                                       32,
-                                       0x00ff0000,
-                                       0x0000ff00,
-                                       0x000000ff,
-                                       0xff000000);
-                surface->pixels = pixmap;
-
-                SDL_Texture *tex = SDL_CreateTextureFromSurface(renderer,
-                                                                surface);
-                SDL_FreeSurface(surface);
-
-                sprite_rect.x = wf;
-                sprite_rect.y = hf;
-                sprite_rect.w = width;
-                sprite_rect.h = height;
-
-                SDL_RenderClear(renderer);
-                SDL_SetRenderDrawColor(renderer, 205, 235, 255, 255);
-                SDL_RenderFillRect(renderer, &screen_rect);
-                SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-                SDL_RenderDrawRect(renderer, &obj_rect);
-                SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-                SDL_RenderDrawRect(renderer, &sprite_rect);
-                SDL_RenderCopy(renderer, tex, NULL, &sprite_rect);
-                SDL_RenderPresent(renderer);
-
-                SDL_DestroyTexture(tex);
-
-                SDL_Delay(50);
-
-                SDL_Event event;
-                while (SDL_PollEvent(&event)) {
-                    if (event.type == SDL_QUIT) {
-                        goto quit;
-                    }
-                }
-            }
+    if (player.drawlist)
+        player_play(&player, file);
+    else if (player.renderer)
+        fprintf(stderr,
+                "error: cannot create draw list: %s (%d)\n",
+                strerror(err),
+                err);
+    else
+        fprintf(stderr, "error: cannot create renderer: %s\n", SDL_GetError());
 
-        }
-    }
+    drawlist_free(player.drawlist);
 
-quit:
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(w);
+    if (player.texture)
+        SDL_DestroyTexture(player.texture);
+    if (player.renderer)
+        SDL_DestroyRenderer(player.renderer);
+    SDL_DestroyWindow(player.window);
     SDL_Quit();
 
     dvf_file_cleanup(file);
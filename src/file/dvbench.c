@@ -0,0 +1,453 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * decoder benchmarks
+ * ==================
+ *
+ * Times the decoders on the given files, by extension:
+ *
+ *   .dvf  dvf_file_init and dvf_frame_pixmap for every frame
+ *   .dvm  dvm_file_get_pixmap, reported per payload compression
+ *   .dvd  a walk over all entries including open and close
+ *
+ * Every benchmark runs the warmup repetitions first and discards them.
+ * Results are printed as percentiles in microseconds and can be written
+ * as JSON to compare runs. The shared pixmap cache is disabled so the
+ * decoders actually run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "file.h"
+#include "stats.h"
+#include "pixmap.h"
+#include "dvf.h"
+#include "dvm.h"
+#include "dvd.h"
+
+#define BENCH_WARMUP 3
+#define BENCH_REPETITIONS 20
+
+struct bench_result {
+    const char *name;
+    const char *file_name;
+    unsigned int num_samples;
+    unsigned int alloc_samples;
+    uint64_t *samples;
+};
+
+static struct {
+    unsigned int warmup;
+    unsigned int repetitions;
+    unsigned int num_results;
+    struct bench_result *results;
+} bench = {
+    .warmup = BENCH_WARMUP,
+    .repetitions = BENCH_REPETITIONS,
+};
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-w warmup] [-r repetitions] [-o json file] "
+            "<files...>\n"
+            "benchmarks .dvf, .dvm and .dvd files\n",
+            name);
+}
+
+static struct bench_result *
+bench_result_new(const char *name, const char *file_name)
+{
+    struct bench_result *results = realloc(bench.results,
+                                           sizeof(*results) *
+                                           (bench.num_results + 1));
+    if (!results)
+        return NULL;
+    bench.results = results;
+
+    struct bench_result *result = &results[bench.num_results++];
+    memset(result, 0, sizeof(*result));
+    result->name = name;
+    result->file_name = file_name;
+    return result;
+}
+
+static int
+bench_result_add(struct bench_result *result, uint64_t nsec)
+{
+    if (result->num_samples == result->alloc_samples) {
+        unsigned int alloc = result->alloc_samples ?
+                             result->alloc_samples * 2 : 64;
+        uint64_t *samples = realloc(result->samples,
+                                    sizeof(*samples) * alloc);
+        if (!samples)
+            return ENOMEM;
+        result->samples = samples;
+        result->alloc_samples = alloc;
+    }
+
+    result->samples[result->num_samples++] = nsec;
+    return 0;
+}
+
+static int
+bench_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * nearest rank percentile of sorted samples
+ */
+static uint64_t
+bench_percentile(const struct bench_result *result, unsigned int percent)
+{
+    return result->samples[(result->num_samples - 1) * percent / 100];
+}
+
+static uint64_t
+bench_mean(const struct bench_result *result)
+{
+    uint64_t sum = 0;
+    unsigned int i;
+
+    for (i = 0; i < result->num_samples; i++)
+        sum += result->samples[i];
+    return sum / result->num_samples;
+}
+
+static int
+bench_dvf(const char *file_name)
+{
+    int err = 0;
+    unsigned int rep, i, j, k;
+    struct dvf_file *file = NULL;
+
+    struct bench_result *init = bench_result_new("dvf_file_init", file_name);
+    if (!init)
+        return ENOMEM;
+
+    for (rep = 0; rep < bench.warmup + bench.repetitions; rep++) {
+        file = dvf_file_open((char *)file_name, &err);
+        if (!file)
+            return err;
+
+        uint64_t start = file_stats_now();
+        err = dvf_file_init(file);
+        uint64_t end = file_stats_now();
+        if (err)
+            goto exit;
+        if (rep >= bench.warmup && (err = bench_result_add(init, end - start)))
+            goto exit;
+
+        dvf_file_cleanup(file);
+        dvf_file_close(file);
+        file = NULL;
+    }
+
+    struct bench_result *pixmap = bench_result_new("dvf_frame_pixmap",
+                                                   file_name);
+    if (!pixmap)
+        return ENOMEM;
+
+    file = dvf_file_open((char *)file_name, &err);
+    if (!file)
+        return err;
+    if ((err = dvf_file_init(file)))
+        goto exit;
+
+    for (rep = 0; rep < bench.warmup + bench.repetitions; rep++) {
+        for (i = 0; i < dvf_file_num_objects(file); i++) {
+            struct dvf_object *obj = dvf_file_get_object(file, i);
+
+            for (j = 0; j < dvf_object_num_animations(obj); j++) {
+                struct dvf_animation *anim = dvf_object_get_animation(obj, j);
+
+                for (k = 0; k < dvf_animation_num_frames(anim); k++) {
+                    struct dvf_frame *frame = dvf_animation_get_frame(anim, k);
+                    unsigned int width, height;
+
+                    if (!dvf_frame_valid(frame))
+                        continue;
+
+                    uint64_t start = file_stats_now();
+                    void *pixels = dvf_frame_pixmap(frame, &width, &height);
+                    uint64_t end = file_stats_now();
+                    if (!pixels) {
+                        err = ENOMEM;
+                        goto exit;
+                    }
+                    pixmap_free(pixels);
+
+                    if (rep >= bench.warmup &&
+                        (err = bench_result_add(pixmap, end - start)))
+                        goto exit;
+                }
+            }
+        }
+    }
+
+exit:
+    if (file) {
+        dvf_file_cleanup(file);
+        dvf_file_close(file);
+    }
+    return err;
+}
+
+static int
+bench_dvm(const char *file_name)
+{
+    int err = 0;
+    unsigned int rep, width, height;
+    struct dvm_file_info info;
+
+    if ((err = dvm_file_info(file_name, &info)))
+        return err;
+
+    struct bench_result *result =
+        bench_result_new(info.compression == DVM_COMPRESSION_BZIP2 ?
+                         "dvm_pixmap_bzip2" :
+                         info.compression == DVM_COMPRESSION_ZLIB ?
+                         "dvm_pixmap_zlib" : "dvm_pixmap",
+                         file_name);
+    if (!result)
+        return ENOMEM;
+
+    for (rep = 0; rep < bench.warmup + bench.repetitions; rep++) {
+        uint64_t start = file_stats_now();
+        void *pixels = dvm_file_get_pixmap(file_name, &width, &height, &err);
+        uint64_t end = file_stats_now();
+        if (!pixels)
+            return err;
+        pixmap_free(pixels);
+
+        if (rep >= bench.warmup && (err = bench_result_add(result, end - start)))
+            return err;
+    }
+
+    return 0;
+}
+
+static int
+bench_dvd(const char *file_name)
+{
+    int err = 0;
+    unsigned int rep;
+    union dvd_entry entry;
+
+    struct bench_result *result = bench_result_new("dvd_walk", file_name);
+    if (!result)
+        return ENOMEM;
+
+    for (rep = 0; rep < bench.warmup + bench.repetitions; rep++) {
+        uint64_t start = file_stats_now();
+        struct dvd_file *file = dvd_file_open((char *)file_name, &err);
+        if (!file)
+            return err;
+
+        while (dvd_file_has_next(file)) {
+            if ((err = dvd_file_get_next(file, &entry)))
+                break;
+            dvd_entry_done(&entry);
+        }
+        dvd_file_close(file);
+        uint64_t end = file_stats_now();
+        if (err)
+            return err;
+
+        if (rep >= bench.warmup && (err = bench_result_add(result, end - start)))
+            return err;
+    }
+
+    return 0;
+}
+
+static void
+bench_print(void)
+{
+    unsigned int i;
+
+    printf("%-18s %8s %10s %10s %10s %10s %10s %10s\n",
+           "benchmark", "samples", "min", "mean", "p50", "p90", "p99", "max");
+
+    for (i = 0; i < bench.num_results; i++) {
+        struct bench_result *result = &bench.results[i];
+        if (!result->num_samples)
+            continue;
+
+        printf("%-18s %8u %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f  %s\n",
+               result->name,
+               result->num_samples,
+               result->samples[0] / 1000.0,
+               bench_mean(result) / 1000.0,
+               bench_percentile(result, 50) / 1000.0,
+               bench_percentile(result, 90) / 1000.0,
+               bench_percentile(result, 99) / 1000.0,
+               result->samples[result->num_samples - 1] / 1000.0,
+               result->file_name);
+    }
+    printf("times in microseconds\n");
+}
+
+static void
+bench_write_string(FILE *out, const char *string)
+{
+    fputc('"', out);
+    for (; *string; string++) {
+        if (*string == '"' || *string == '\\')
+            fputc('\\', out);
+        fputc(*string, out);
+    }
+    fputc('"', out);
+}
+
+static int
+bench_write_json(const char *file_name)
+{
+    unsigned int i;
+    int first = 1;
+
+    FILE *out = fopen(file_name, "w");
+    if (!out)
+        return errno;
+
+    fprintf(out,
+            "{\n  \"warmup\": %u,\n  \"repetitions\": %u,\n"
+            "  \"results\": [",
+            bench.warmup,
+            bench.repetitions);
+
+    for (i = 0; i < bench.num_results; i++) {
+        struct bench_result *result = &bench.results[i];
+        if (!result->num_samples)
+            continue;
+
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"file\": ",
+                first ? "" : ",",
+                result->name);
+        bench_write_string(out, result->file_name);
+        fprintf(out,
+                ", \"samples\": %u, \"min_ns\": %llu, \"mean_ns\": %llu, "
+                "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, "
+                "\"max_ns\": %llu}",
+                result->num_samples,
+                (unsigned long long)result->samples[0],
+                (unsigned long long)bench_mean(result),
+                (unsigned long long)bench_percentile(result, 50),
+                (unsigned long long)bench_percentile(result, 90),
+                (unsigned long long)bench_percentile(result, 99),
+                (unsigned long long)result->samples[result->num_samples - 1]);
+        first = 0;
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (fclose(out) != 0)
+        return errno;
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt, err = 0, i;
+    const char *json_file_name = NULL;
+
+    while ((opt = getopt(argc, argv, "w:r:o:")) != -1) {
+        switch (opt) {
+            case 'w':
+                bench.warmup = atoi(optarg);
+                break;
+            case 'r':
+                bench.repetitions = atoi(optarg);
+                break;
+            case 'o':
+                json_file_name = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EINVAL;
+        }
+    }
+
+    if (optind >= argc || bench.repetitions == 0) {
+        usage(argv[0]);
+        return EINVAL;
+    }
+
+    pixmap_cache_set_dir(NULL);
+
+    for (i = optind; i < argc; i++) {
+        const char *file_name = argv[i];
+        const char *extension = strrchr(file_name, '.');
+
+        if (!extension) {
+            fprintf(stderr, "skipping %s: unknown type\n", file_name);
+            continue;
+        }
+
+        if (strcasecmp(extension, ".dvf") == 0)
+            err = bench_dvf(file_name);
+        else if (strcasecmp(extension, ".dvm") == 0)
+            err = bench_dvm(file_name);
+        else if (strcasecmp(extension, ".dvd") == 0)
+            err = bench_dvd(file_name);
+        else
+            fprintf(stderr, "skipping %s: unknown type\n", file_name);
+
+        if (err) {
+            fprintf(stderr,
+                    "error: cannot benchmark %s: %s (%d)\n",
+                    file_name,
+                    strerror(err),
+                    err);
+            return err;
+        }
+    }
+
+    for (i = 0; i < (int)bench.num_results; i++) {
+        struct bench_result *result = &bench.results[i];
+        qsort(result->samples,
+              result->num_samples,
+              sizeof(*result->samples),
+              bench_compare);
+    }
+
+    bench_print();
+
+    if (json_file_name && (err = bench_write_json(json_file_name))) {
+        fprintf(stderr,
+                "error: cannot write %s: %s (%d)\n",
+                json_file_name,
+                strerror(err),
+                err);
+        return err;
+    }
+
+    return 0;
+}
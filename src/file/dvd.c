@@ -30,16 +30,13 @@
 #include <endian.h>
 
 #include "file.h"
+#include "stats.h"
+#include "trace.h"
 #include "dvd.h"
 
-#define DEBUG 1
-#if DEBUG
-  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
-  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
-#else
-  #define DEBUG_LOG(...)
-  #define DEBUG_ERROR(...)
-#endif
+/* runtime log levels, see stats.h */
+#define DEBUG_LOG(...) FILE_LOG(FILE_LOG_DEBUG, __VA_ARGS__)
+#define DEBUG_ERROR(...) FILE_LOG(FILE_LOG_ERROR, "error: " __VA_ARGS__)
 
 #define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
 #define __PACKED__ __attribute__ ((__packed__))
@@ -74,6 +71,77 @@ struct __PACKED__ dvd_misc_header {
     uint32_t version;
 };
 
+/**
+ * dvd SGHT header
+ */
+struct __PACKED__ dvd_sght_header {
+    /* version */
+    uint32_t version;
+    /* grid width in cells */
+    uint16_t width;
+    /* grid height in cells */
+    uint16_t height;
+    /* followed by width * height bytes, one per cell */
+};
+
+/**
+ * dvd ELEM and BUIL header
+ */
+struct __PACKED__ dvd_elem_header {
+    /* version */
+    uint32_t version;
+    /* number of records */
+    uint32_t num_elements;
+};
+
+/**
+ * dvd ELEM and BUIL record
+ */
+struct __PACKED__ dvd_elem_record {
+    /* name of the element */
+    uint8_t name[DVD_ELEMENT_NAME_SIZE];
+    /* position on the map */
+    int32_t x;
+    int32_t y;
+    /* bounding box */
+    uint16_t width;
+    uint16_t height;
+    /* unknown */
+    uint32_t unknown0;
+};
+
+/**
+ * dvd SCRP header
+ */
+struct __PACKED__ dvd_scrp_header {
+    /* version */
+    uint32_t version;
+    /* number of triggers */
+    uint32_t num_triggers;
+    /* followed by the triggers, see script.c */
+};
+
+/**
+ * dvd DLGS header
+ */
+struct __PACKED__ dvd_dlgs_header {
+    /* version */
+    uint32_t version;
+    /* number of dialogs */
+    uint32_t num_dialogs;
+};
+
+/**
+ * dvd DLGS record
+ */
+struct __PACKED__ dvd_dlgs_record {
+    /* dialog id */
+    uint32_t id;
+    /* text size */
+    uint16_t len;
+    /* followed by the text */
+};
+
 /**
  * dvd BGND header
  */
@@ -97,6 +165,51 @@ struct __PACKED__ dvd_bgnd_header_p2 {
 };
 
 
+/**
+ * returns a pointer to size bytes at offset within the data of the current
+ * entry or NULL if the range is not part of the entry
+ */
+static void *
+dvd_entry_data(struct dvd_file *file,
+               struct dvd_entry_header *header,
+               unsigned int offset,
+               unsigned int size)
+{
+    if (offset + size > le32toh(header->size))
+        return NULL;
+    return mmap_file_ptr_offset(file->file,
+                                file->offset + sizeof(*header) + offset,
+                                size);
+}
+
+/**
+ * allocates an array of num entries, at least one, and counts it as heap
+ */
+static void *
+dvd_array_alloc(size_t entry_size, unsigned int num)
+{
+    size_t size = entry_size * (num ? num : 1);
+    void *array = malloc(size);
+
+    if (array)
+        file_stats_add(FILE_STAT_HEAP_BYTES, size);
+    return array;
+}
+
+/**
+ * frees an array from dvd_array_alloc
+ */
+static void
+dvd_array_free(void *array, size_t entry_size, unsigned int num)
+{
+    if (!array)
+        return;
+
+    file_stats_add(FILE_STAT_HEAP_BYTES,
+                   -(int64_t)(entry_size * (num ? num : 1)));
+    free(array);
+}
+
 /**
  * 
  */
@@ -131,6 +244,39 @@ dvd_entry_bgnd_init(struct dvd_file *file,
                     struct dvd_entry_bgnd *bgnd)
 {
     bgnd->type = DVD_ENTRY_TYPE_BGND;
+
+    struct dvd_bgnd_header *bgnd_header =
+      dvd_entry_data(file, header, 0, sizeof(*bgnd_header));
+    if (!bgnd_header) {
+        DEBUG_ERROR("bgnd entry is malformed\n");
+        return EILSEQ;
+    }
+
+    bgnd->version = le32toh(bgnd_header->version);
+    bgnd->name_size = le16toh(bgnd_header->name_size);
+    bgnd->name = dvd_entry_data(file,
+                                header,
+                                sizeof(*bgnd_header),
+                                bgnd->name_size);
+    if (!bgnd->name) {
+        DEBUG_ERROR("bgnd entry is malformed\n");
+        return EILSEQ;
+    }
+
+    struct dvd_bgnd_header_p2 *bgnd_header_p2 =
+      dvd_entry_data(file,
+                     header,
+                     sizeof(*bgnd_header) + bgnd->name_size,
+                     sizeof(*bgnd_header_p2));
+    if (bgnd_header_p2) {
+        bgnd->width = le16toh(bgnd_header_p2->map_width);
+        bgnd->height = le16toh(bgnd_header_p2->map_height);
+    }
+    else {
+        bgnd->width = 0;
+        bgnd->height = 0;
+    }
+
     return 0;
 }
 
@@ -144,9 +290,13 @@ dvd_entry_move_init(struct dvd_file *file,
 {
     move->type = DVD_ENTRY_TYPE_MOVE;
 
-    unsigned int offs = 0;
-    uint32_t *version = mmap_file_ptr_offset(file->file, file->offset + offs, sizeof(*version));
-    printf("move version %d\n", *version);
+    /* the rest of the entry is not decoded yet */
+    uint32_t *version = dvd_entry_data(file, header, 0, sizeof(*version));
+    if (!version) {
+        DEBUG_ERROR("move entry is malformed\n");
+        return EILSEQ;
+    }
+    DEBUG_LOG("move version %u\n", le32toh(*version));
 
     return 0;
 }
@@ -160,6 +310,26 @@ dvd_entry_sght_init(struct dvd_file *file,
                     struct dvd_entry_sght *sght)
 {
     sght->type = DVD_ENTRY_TYPE_SGHT;
+
+    struct dvd_sght_header *sght_header =
+      dvd_entry_data(file, header, 0, sizeof(*sght_header));
+    if (!sght_header) {
+        DEBUG_ERROR("sght entry is malformed\n");
+        return EILSEQ;
+    }
+
+    sght->version = le32toh(sght_header->version);
+    sght->width = le16toh(sght_header->width);
+    sght->height = le16toh(sght_header->height);
+    sght->cells = dvd_entry_data(file,
+                                 header,
+                                 sizeof(*sght_header),
+                                 sght->width * sght->height);
+    if (!sght->cells) {
+        DEBUG_ERROR("sght entry is malformed\n");
+        return EILSEQ;
+    }
+
     return 0;
 }
 
@@ -187,6 +357,66 @@ dvd_entry_ways_init(struct dvd_file *file,
     return 0;
 }
 
+/**
+ * decodes the records shared by ELEM and BUIL entries into a newly
+ * allocated array
+ */
+static int
+dvd_entry_elements_init(struct dvd_file *file,
+                        struct dvd_entry_header *header,
+                        unsigned int *version,
+                        unsigned int *num_elements,
+                        struct dvd_element **elements)
+{
+    unsigned int i, offset;
+
+    *num_elements = 0;
+    *elements = NULL;
+
+    struct dvd_elem_header *elem_header =
+      dvd_entry_data(file, header, 0, sizeof(*elem_header));
+    if (!elem_header) {
+        DEBUG_ERROR("element entry is malformed\n");
+        return EILSEQ;
+    }
+    offset = sizeof(*elem_header);
+
+    *version = le32toh(elem_header->version);
+    unsigned int num = le32toh(elem_header->num_elements);
+    if (num > le32toh(header->size) / sizeof(struct dvd_elem_record)) {
+        DEBUG_ERROR("element entry is malformed\n");
+        return EILSEQ;
+    }
+
+    struct dvd_element *elems = dvd_array_alloc(sizeof(*elems), num);
+    if (!elems) {
+        DEBUG_ERROR("out of memory\n");
+        return ENOMEM;
+    }
+
+    for (i = 0; i < num; i++) {
+        struct dvd_elem_record *record =
+          dvd_entry_data(file, header, offset, sizeof(*record));
+        if (!record) {
+            DEBUG_ERROR("element entry is malformed\n");
+            dvd_array_free(elems, sizeof(*elems), num);
+            return EILSEQ;
+        }
+        offset += sizeof(*record);
+
+        elems[i].name = (const char *)record->name;
+        elems[i].name_id = STRTAB_NO_ID;
+        elems[i].x = (int32_t)le32toh(record->x);
+        elems[i].y = (int32_t)le32toh(record->y);
+        elems[i].width = le16toh(record->width);
+        elems[i].height = le16toh(record->height);
+    }
+
+    *num_elements = num;
+    *elements = elems;
+    return 0;
+}
+
 /**
  * 
  */
@@ -196,7 +426,11 @@ dvd_entry_elem_init(struct dvd_file *file,
                     struct dvd_entry_elem *elem)
 {
     elem->type = DVD_ENTRY_TYPE_ELEM;
-    return 0;
+    return dvd_entry_elements_init(file,
+                                   header,
+                                   &elem->version,
+                                   &elem->num_elements,
+                                   &elem->elements);
 }
 
 /**
@@ -304,7 +538,11 @@ dvd_entry_buil_init(struct dvd_file *file,
                     struct dvd_entry_buil *buil)
 {
     buil->type = DVD_ENTRY_TYPE_BUIL;
-    return 0;
+    return dvd_entry_elements_init(file,
+                                   header,
+                                   &buil->version,
+                                   &buil->num_buildings,
+                                   &buil->buildings);
 }
 
 /**
@@ -316,6 +554,23 @@ dvd_entry_scrp_init(struct dvd_file *file,
                     struct dvd_entry_scrp *scrp)
 {
     scrp->type = DVD_ENTRY_TYPE_SCRP;
+
+    struct dvd_scrp_header *scrp_header =
+      dvd_entry_data(file, header, 0, sizeof(*scrp_header));
+    if (!scrp_header) {
+        DEBUG_ERROR("scrp entry is malformed\n");
+        return EILSEQ;
+    }
+
+    scrp->version = le32toh(scrp_header->version);
+    scrp->num_triggers = le32toh(scrp_header->num_triggers);
+    scrp->size = le32toh(header->size) - sizeof(*scrp_header);
+    scrp->data = dvd_entry_data(file, header, sizeof(*scrp_header), scrp->size);
+    if (!scrp->data) {
+        DEBUG_ERROR("scrp entry is malformed\n");
+        return EILSEQ;
+    }
+
     return 0;
 }
 
@@ -343,6 +598,13 @@ dvd_entry_cart_init(struct dvd_file *file,
     return 0;
 }
 
+static int
+dvd_dialog_cmp(const void *a, const void *b)
+{
+    const struct dvd_dialog *da = a, *db = b;
+    return (da->id > db->id) - (da->id < db->id);
+}
+
 /**
  * 
  */
@@ -352,7 +614,57 @@ dvd_entry_dlgs_init(struct dvd_file *file,
                     struct dvd_entry_dlgs *dlgs)
 {
     dlgs->type = DVD_ENTRY_TYPE_DLGS;
+    dlgs->num_dialogs = 0;
+    dlgs->dialogs = NULL;
+
+    unsigned int i, offset;
+    struct dvd_dlgs_header *dlgs_header =
+      dvd_entry_data(file, header, 0, sizeof(*dlgs_header));
+    if (!dlgs_header) {
+        DEBUG_ERROR("dlgs entry is malformed\n");
+        return EILSEQ;
+    }
+    offset = sizeof(*dlgs_header);
+
+    dlgs->version = le32toh(dlgs_header->version);
+    unsigned int num = le32toh(dlgs_header->num_dialogs);
+    if (num > le32toh(header->size) / sizeof(struct dvd_dlgs_record)) {
+        DEBUG_ERROR("dlgs entry is malformed\n");
+        return EILSEQ;
+    }
+
+    struct dvd_dialog *dialogs = dvd_array_alloc(sizeof(*dialogs), num);
+    if (!dialogs) {
+        DEBUG_ERROR("out of memory\n");
+        return ENOMEM;
+    }
+
+    for (i = 0; i < num; i++) {
+        struct dvd_dlgs_record *record =
+          dvd_entry_data(file, header, offset, sizeof(*record));
+        if (!record)
+            goto malformed;
+        offset += sizeof(*record);
+
+        dialogs[i].id = le32toh(record->id);
+        dialogs[i].len = le16toh(record->len);
+        dialogs[i].text = dvd_entry_data(file, header, offset, dialogs[i].len);
+        dialogs[i].string = STRTAB_NO_ID;
+        if (!dialogs[i].text)
+            goto malformed;
+        offset += dialogs[i].len;
+    }
+
+    qsort(dialogs, num, sizeof(*dialogs), dvd_dialog_cmp);
+
+    dlgs->num_dialogs = num;
+    dlgs->dialogs = dialogs;
     return 0;
+
+malformed:
+    DEBUG_ERROR("dlgs entry is malformed\n");
+    dvd_array_free(dialogs, sizeof(*dialogs), num);
+    return EILSEQ;
 }
 
 /**
@@ -364,6 +676,130 @@ dvd_entry_misc_cleanup(struct dvd_entry_misc *misc)
     return 0;
 }
 
+/**
+ * 
+ */
+int
+dvd_entry_elem_cleanup(struct dvd_entry_elem *elem)
+{
+    dvd_array_free(elem->elements,
+                   sizeof(*elem->elements),
+                   elem->num_elements);
+    elem->elements = NULL;
+    return 0;
+}
+
+/**
+ * 
+ */
+int
+dvd_entry_buil_cleanup(struct dvd_entry_buil *buil)
+{
+    dvd_array_free(buil->buildings,
+                   sizeof(*buil->buildings),
+                   buil->num_buildings);
+    buil->buildings = NULL;
+    return 0;
+}
+
+/**
+ * 
+ */
+int
+dvd_entry_dlgs_cleanup(struct dvd_entry_dlgs *dlgs)
+{
+    dvd_array_free(dlgs->dialogs,
+                   sizeof(*dlgs->dialogs),
+                   dlgs->num_dialogs);
+    dlgs->dialogs = NULL;
+    return 0;
+}
+
+/**
+ * returns the dialog with the id or NULL
+ */
+__SYM_EXPORT__ const struct dvd_dialog *
+dvd_entry_dlgs_find(const struct dvd_entry_dlgs *dlgs, uint32_t id)
+{
+    unsigned int lo = 0, hi = dlgs->num_dialogs;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (dlgs->dialogs[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < dlgs->num_dialogs && dlgs->dialogs[lo].id == id)
+        return &dlgs->dialogs[lo];
+    return NULL;
+}
+
+/**
+ * interns the texts of all dialogs and sets their string ids
+ * the table references the mapping of the dvd file
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+dvd_entry_dlgs_intern(struct dvd_entry_dlgs *dlgs, struct strtab *tab)
+{
+    unsigned int i;
+
+    for (i = 0; i < dlgs->num_dialogs; i++) {
+        dlgs->dialogs[i].string = strtab_intern(tab,
+                                                dlgs->dialogs[i].text,
+                                                dlgs->dialogs[i].len);
+        if (dlgs->dialogs[i].string == STRTAB_NO_ID)
+            return ENOMEM;
+    }
+
+    return 0;
+}
+
+static int
+dvd_elements_intern(struct dvd_element *elements,
+                    unsigned int num_elements,
+                    struct strtab *tab)
+{
+    unsigned int i;
+
+    for (i = 0; i < num_elements; i++) {
+        elements[i].name_id = strtab_intern_fixed(tab,
+                                                  elements[i].name,
+                                                  DVD_ELEMENT_NAME_SIZE);
+        if (elements[i].name_id == STRTAB_NO_ID)
+            return ENOMEM;
+    }
+
+    return 0;
+}
+
+/**
+ * interns the names of all elements and sets their name ids, equal names
+ * of different files get the same id if they share the table
+ * the table references the mapping of the dvd file
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+dvd_entry_elem_intern(struct dvd_entry_elem *elem, struct strtab *tab)
+{
+    return dvd_elements_intern(elem->elements, elem->num_elements, tab);
+}
+
+/**
+ * interns the names of all buildings, see dvd_entry_elem_intern
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+dvd_entry_buil_intern(struct dvd_entry_buil *buil, struct strtab *tab)
+{
+    return dvd_elements_intern(buil->buildings, buil->num_buildings, tab);
+}
+
 /**
  * 
  */
@@ -374,6 +810,15 @@ dvd_entry_done(union dvd_entry *entry)
         case DVD_ENTRY_TYPE_MISC:
             dvd_entry_misc_cleanup(&entry->misc);
             break;
+        case DVD_ENTRY_TYPE_ELEM:
+            dvd_entry_elem_cleanup(&entry->elem);
+            break;
+        case DVD_ENTRY_TYPE_BUIL:
+            dvd_entry_buil_cleanup(&entry->buil);
+            break;
+        case DVD_ENTRY_TYPE_DLGS:
+            dvd_entry_dlgs_cleanup(&entry->dlgs);
+            break;
     }
 }
 
@@ -384,6 +829,8 @@ __SYM_EXPORT__ int
 dvd_file_get_next(struct dvd_file *file,
                   union dvd_entry *entry)
 {
+    TRACE_ZONE("dvd_file_get_next");
+    uint64_t start = file_stats_now();
     int err = 0;
 
     struct dvd_entry_header *header =
@@ -403,17 +850,37 @@ dvd_file_get_next(struct dvd_file *file,
         case DVD_ENTRY_TYPE_MISC:
             err = dvd_entry_misc_init(file, header, &entry->misc);
             break;
+        case DVD_ENTRY_TYPE_BGND:
+            err = dvd_entry_bgnd_init(file, header, &entry->bgnd);
+            break;
         case DVD_ENTRY_TYPE_MOVE:
             err = dvd_entry_move_init(file, header, &entry->move);
             break;
+        case DVD_ENTRY_TYPE_SGHT:
+            err = dvd_entry_sght_init(file, header, &entry->sght);
+            break;
+        case DVD_ENTRY_TYPE_ELEM:
+            err = dvd_entry_elem_init(file, header, &entry->elem);
+            break;
+        case DVD_ENTRY_TYPE_BUIL:
+            err = dvd_entry_buil_init(file, header, &entry->buil);
+            break;
+        case DVD_ENTRY_TYPE_SCRP:
+            err = dvd_entry_scrp_init(file, header, &entry->scrp);
+            break;
+        case DVD_ENTRY_TYPE_DLGS:
+            err = dvd_entry_dlgs_init(file, header, &entry->dlgs);
+            break;
         default:
             err = dvd_entry_unknown_init(file, header, &entry->unknown);
             break;
     }
 
     file->offset += header->size + sizeof(*header);
+    file_stats_add(FILE_STAT_DVD_ENTRIES, 1);
 
 exit:
+    file_stats_add(FILE_STAT_DVD_PARSE_NSEC, file_stats_now() - start);
     return err;
 }
 
@@ -446,8 +913,12 @@ dvd_file_open(char *file_name, int *err_out)
         goto error;
     }
     memset(file, 0, sizeof(*file));
+    file_stats_add(FILE_STAT_HEAP_BYTES, sizeof(*file));
 
-    file->file = mmap_file_open(file_name, &err);
+    /* entries are read one after another */
+    file->file = mmap_file_open(file_name,
+                                MMAP_FILE_SEQUENTIAL | MMAP_FILE_WILLNEED,
+                                &err);
     if (!file->file) {
         DEBUG_ERROR("cannot open file %s: %s (%d)\n",
                     file_name,
@@ -481,9 +952,293 @@ dvd_file_close(struct dvd_file *file)
     if (file->file)
         mmap_file_close(file->file);
 
+    file_stats_add(FILE_STAT_HEAP_BYTES, -(int64_t)sizeof(*file));
     free(file);
 
     return 0;
 }
 
+/**
+ * returns the size of the mapped file in bytes
+ */
+__SYM_EXPORT__ unsigned long
+dvd_file_size(struct dvd_file *file)
+{
+    return mmap_file_size(file->file);
+}
+
+
+
+/**
+ * dvd file writer
+ * entries are written one after another as they are added
+ */
+struct dvd_writer {
+    FILE *out;
+    /* first error, later writes are skipped */
+    int err;
+};
+
+/**
+ * appends size bytes to the current entry
+ */
+static int
+dvd_writer_data(struct dvd_writer *writer, const void *data, size_t size)
+{
+    if (!writer->err && size && fwrite(data, 1, size, writer->out) != size)
+        writer->err = EIO;
+    return writer->err;
+}
+
+/**
+ * starts an entry of type with size bytes of data
+ */
+static int
+dvd_writer_begin(struct dvd_writer *writer, uint32_t type, size_t size)
+{
+    if (size > UINT32_MAX) {
+        writer->err = writer->err ? writer->err : EOVERFLOW;
+        return writer->err;
+    }
+
+    struct dvd_entry_header header;
+    uint32_t le_type = htole32(type);
+    memcpy(header.type, &le_type, sizeof(header.type));
+    header.size = htole32(size);
+    return dvd_writer_data(writer, &header, sizeof(header));
+}
+
+/**
+ * creates a dvd file
+ *
+ * returns a struct dvd_writer on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct dvd_writer *
+dvd_writer_open(const char *file_name, int *err_out)
+{
+    int err = 0;
+    struct dvd_writer *writer = calloc(1, sizeof(*writer));
+    if (!writer) {
+        err = ENOMEM;
+        goto error;
+    }
+
+    writer->out = fopen(file_name, "wb");
+    if (!writer->out) {
+        err = errno;
+        goto error;
+    }
+
+    return writer;
+
+error:
+    free(writer);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+/**
+ * finishes the file
+ *
+ * returns 0 if all entries were written
+ */
+__SYM_EXPORT__ int
+dvd_writer_close(struct dvd_writer *writer)
+{
+    int err = writer->err;
+
+    if (fclose(writer->out) != 0 && !err)
+        err = errno;
+    free(writer);
+    return err;
+}
+
+/**
+ * writes an entry of type with size bytes of raw data
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+dvd_writer_entry(struct dvd_writer *writer,
+                 uint32_t type,
+                 const void *data,
+                 unsigned int size)
+{
+    dvd_writer_begin(writer, type, size);
+    return dvd_writer_data(writer, data, size);
+}
+
+__SYM_EXPORT__ int
+dvd_writer_misc(struct dvd_writer *writer, unsigned int version)
+{
+    struct dvd_misc_header misc_header;
+    misc_header.version = htole32(version);
+    return dvd_writer_entry(writer,
+                            DVD_ENTRY_TYPE_MISC,
+                            &misc_header,
+                            sizeof(misc_header));
+}
+
+/**
+ * writes a BGND entry for the width x height background name
+ */
+__SYM_EXPORT__ int
+dvd_writer_bgnd(struct dvd_writer *writer,
+                unsigned int version,
+                const char *name,
+                unsigned int width,
+                unsigned int height)
+{
+    size_t name_size = strlen(name);
+    struct dvd_bgnd_header bgnd_header;
+    struct dvd_bgnd_header_p2 bgnd_header_p2;
+
+    if (name_size > UINT16_MAX)
+        return EINVAL;
+
+    bgnd_header.version = htole32(version);
+    bgnd_header.name_size = htole16(name_size);
+    memset(&bgnd_header_p2, 0, sizeof(bgnd_header_p2));
+    bgnd_header_p2.map_width = htole16(width);
+    bgnd_header_p2.map_height = htole16(height);
+    bgnd_header_p2.bpp = htole32(2);
+
+    dvd_writer_begin(writer,
+                     DVD_ENTRY_TYPE_BGND,
+                     sizeof(bgnd_header) + name_size + sizeof(bgnd_header_p2));
+    dvd_writer_data(writer, &bgnd_header, sizeof(bgnd_header));
+    dvd_writer_data(writer, name, name_size);
+    return dvd_writer_data(writer, &bgnd_header_p2, sizeof(bgnd_header_p2));
+}
+
+/**
+ * writes a SGHT entry with width * height cells
+ */
+__SYM_EXPORT__ int
+dvd_writer_sght(struct dvd_writer *writer,
+                unsigned int version,
+                unsigned int width,
+                unsigned int height,
+                const uint8_t *cells)
+{
+    struct dvd_sght_header sght_header;
+
+    if (width > UINT16_MAX || height > UINT16_MAX)
+        return EINVAL;
+
+    sght_header.version = htole32(version);
+    sght_header.width = htole16(width);
+    sght_header.height = htole16(height);
+
+    dvd_writer_begin(writer,
+                     DVD_ENTRY_TYPE_SGHT,
+                     sizeof(sght_header) + (size_t)width * height);
+    dvd_writer_data(writer, &sght_header, sizeof(sght_header));
+    return dvd_writer_data(writer, cells, (size_t)width * height);
+}
+
+/**
+ * writes an ELEM or BUIL entry, type is DVD_ENTRY_TYPE_ELEM or
+ * DVD_ENTRY_TYPE_BUIL
+ * names longer than DVD_ELEMENT_NAME_SIZE get truncated
+ */
+__SYM_EXPORT__ int
+dvd_writer_elements(struct dvd_writer *writer,
+                    uint32_t type,
+                    unsigned int version,
+                    const struct dvd_element *elements,
+                    unsigned int num_elements)
+{
+    unsigned int i;
+    struct dvd_elem_header elem_header;
+
+    if (type != DVD_ENTRY_TYPE_ELEM && type != DVD_ENTRY_TYPE_BUIL)
+        return EINVAL;
+
+    elem_header.version = htole32(version);
+    elem_header.num_elements = htole32(num_elements);
+
+    dvd_writer_begin(writer,
+                     type,
+                     sizeof(elem_header) +
+                     (size_t)num_elements * sizeof(struct dvd_elem_record));
+    dvd_writer_data(writer, &elem_header, sizeof(elem_header));
+
+    for (i = 0; i < num_elements; i++) {
+        struct dvd_elem_record record;
+        memset(&record, 0, sizeof(record));
+        memcpy(record.name,
+               elements[i].name,
+               strnlen(elements[i].name, sizeof(record.name)));
+        record.x = htole32(elements[i].x);
+        record.y = htole32(elements[i].y);
+        record.width = htole16(elements[i].width);
+        record.height = htole16(elements[i].height);
 
+        if (dvd_writer_data(writer, &record, sizeof(record)))
+            break;
+    }
+
+    return writer->err;
+}
+
+/**
+ * writes a SCRP entry, data holds num_triggers triggers, see script.c
+ */
+__SYM_EXPORT__ int
+dvd_writer_scrp(struct dvd_writer *writer,
+                unsigned int version,
+                unsigned int num_triggers,
+                const void *data,
+                unsigned int size)
+{
+    struct dvd_scrp_header scrp_header;
+
+    scrp_header.version = htole32(version);
+    scrp_header.num_triggers = htole32(num_triggers);
+
+    dvd_writer_begin(writer,
+                     DVD_ENTRY_TYPE_SCRP,
+                     sizeof(scrp_header) + (size_t)size);
+    dvd_writer_data(writer, &scrp_header, sizeof(scrp_header));
+    return dvd_writer_data(writer, data, size);
+}
+
+/**
+ * writes a DLGS entry with the id and text of each dialog
+ */
+__SYM_EXPORT__ int
+dvd_writer_dlgs(struct dvd_writer *writer,
+                unsigned int version,
+                const struct dvd_dialog *dialogs,
+                unsigned int num_dialogs)
+{
+    unsigned int i;
+    size_t size = sizeof(struct dvd_dlgs_header);
+    struct dvd_dlgs_header dlgs_header;
+
+    for (i = 0; i < num_dialogs; i++) {
+        if (dialogs[i].len > UINT16_MAX)
+            return EINVAL;
+        size += sizeof(struct dvd_dlgs_record) + dialogs[i].len;
+    }
+
+    dlgs_header.version = htole32(version);
+    dlgs_header.num_dialogs = htole32(num_dialogs);
+
+    dvd_writer_begin(writer, DVD_ENTRY_TYPE_DLGS, size);
+    dvd_writer_data(writer, &dlgs_header, sizeof(dlgs_header));
+
+    for (i = 0; i < num_dialogs; i++) {
+        struct dvd_dlgs_record record;
+        record.id = htole32(dialogs[i].id);
+        record.len = htole16(dialogs[i].len);
+
+        dvd_writer_data(writer, &record, sizeof(record));
+        if (dvd_writer_data(writer, dialogs[i].text, dialogs[i].len))
+            break;
+    }
+
+    return writer->err;
+}
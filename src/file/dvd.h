@@ -22,6 +22,8 @@
 
 #include <stdint.h>
 
+#include "strtab.h"
+
 #define DVD_ENTRY_TYPE(A, B, C, D) \
     (D << 24 | C << 16 | B << 8 | A << 0)
 /**
@@ -61,6 +63,13 @@ struct dvd_entry_misc {
 
 struct dvd_entry_bgnd {
     uint32_t type;
+    unsigned int version;
+    /* name of the background, not null terminated, references the mapping */
+    const char *name;
+    unsigned int name_size;
+    /* size of the background map */
+    unsigned int width;
+    unsigned int height;
 };
 
 struct dvd_entry_move {
@@ -69,6 +78,13 @@ struct dvd_entry_move {
 
 struct dvd_entry_sght {
     uint32_t type;
+    unsigned int version;
+    /* size of the sight grid in cells */
+    unsigned int width;
+    unsigned int height;
+    /* width * height cells, non zero cells block sight
+     * the reference becomes invalid when the dvd file gets closed */
+    const uint8_t *cells;
 };
 
 struct dvd_entry_mask {
@@ -79,8 +95,30 @@ struct dvd_entry_ways {
     uint32_t type;
 };
 
+/**
+ * a placed map element or building
+ */
+/* element names are only null terminated if they are shorter */
+#define DVD_ELEMENT_NAME_SIZE 32
+
+struct dvd_element {
+    /* name of the element, references the mapping */
+    const char *name;
+    /* set by dvd_entry_elem_intern and dvd_entry_buil_intern */
+    strtab_id name_id;
+    /* position on the map */
+    int x;
+    int y;
+    /* bounding box */
+    unsigned int width;
+    unsigned int height;
+};
+
 struct dvd_entry_elem {
     uint32_t type;
+    unsigned int version;
+    unsigned int num_elements;
+    struct dvd_element *elements;
 };
 
 struct dvd_entry_fxbk {
@@ -117,10 +155,18 @@ struct dvd_entry_ai {
 
 struct dvd_entry_buil {
     uint32_t type;
+    unsigned int version;
+    unsigned int num_buildings;
+    struct dvd_element *buildings;
 };
 
 struct dvd_entry_scrp {
     uint32_t type;
+    unsigned int version;
+    unsigned int num_triggers;
+    /* the triggers, references the mapping */
+    const uint8_t *data;
+    unsigned int size;
 };
 
 struct dvd_entry_jump {
@@ -131,15 +177,37 @@ struct dvd_entry_cart {
     uint32_t type;
 };
 
+/**
+ * a dialog text
+ */
+struct dvd_dialog {
+    uint32_t id;
+    /* not null terminated, references the mapping */
+    const char *text;
+    unsigned int len;
+    /* set by dvd_entry_dlgs_intern */
+    strtab_id string;
+};
+
 struct dvd_entry_dlgs {
     uint32_t type;
+    unsigned int version;
+    /* sorted by id */
+    unsigned int num_dialogs;
+    struct dvd_dialog *dialogs;
 };
 
 union dvd_entry {
     uint32_t type;
     struct dvd_entry_unknown unknown;
     struct dvd_entry_misc misc;
+    struct dvd_entry_bgnd bgnd;
     struct dvd_entry_move move;
+    struct dvd_entry_sght sght;
+    struct dvd_entry_elem elem;
+    struct dvd_entry_buil buil;
+    struct dvd_entry_scrp scrp;
+    struct dvd_entry_dlgs dlgs;
 };
 
 struct dvd_file;
@@ -154,10 +222,76 @@ dvd_file_get_next(struct dvd_file *file,
 void
 dvd_entry_done(union dvd_entry *entry);
 
+const struct dvd_dialog *
+dvd_entry_dlgs_find(const struct dvd_entry_dlgs *dlgs, uint32_t id);
+
+int
+dvd_entry_dlgs_intern(struct dvd_entry_dlgs *dlgs, struct strtab *tab);
+
+int
+dvd_entry_elem_intern(struct dvd_entry_elem *elem, struct strtab *tab);
+
+int
+dvd_entry_buil_intern(struct dvd_entry_buil *buil, struct strtab *tab);
+
 struct dvd_file *
 dvd_file_open(char *file_name, int *err_out);
 
 int
 dvd_file_close(struct dvd_file *file);
 
+unsigned long
+dvd_file_size(struct dvd_file *file);
+
+struct dvd_writer;
+
+struct dvd_writer *
+dvd_writer_open(const char *file_name, int *err_out);
+
+int
+dvd_writer_close(struct dvd_writer *writer);
+
+int
+dvd_writer_entry(struct dvd_writer *writer,
+                 uint32_t type,
+                 const void *data,
+                 unsigned int size);
+
+int
+dvd_writer_misc(struct dvd_writer *writer, unsigned int version);
+
+int
+dvd_writer_bgnd(struct dvd_writer *writer,
+                unsigned int version,
+                const char *name,
+                unsigned int width,
+                unsigned int height);
+
+int
+dvd_writer_sght(struct dvd_writer *writer,
+                unsigned int version,
+                unsigned int width,
+                unsigned int height,
+                const uint8_t *cells);
+
+int
+dvd_writer_elements(struct dvd_writer *writer,
+                    uint32_t type,
+                    unsigned int version,
+                    const struct dvd_element *elements,
+                    unsigned int num_elements);
+
+int
+dvd_writer_scrp(struct dvd_writer *writer,
+                unsigned int version,
+                unsigned int num_triggers,
+                const void *data,
+                unsigned int size);
+
+int
+dvd_writer_dlgs(struct dvd_writer *writer,
+                unsigned int version,
+                const struct dvd_dialog *dialogs,
+                unsigned int num_dialogs);
+
 #endif /* __DVD_FILE_H__ */
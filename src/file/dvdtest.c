@@ -1,16 +1,59 @@
 
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <file.h>
 #include <dvd.h>
+#include <stats.h>
+
+/**
+ * drops the file from the page cache so the next open is cold
+ */
+static void
+drop_cache(const char *file_name)
+{
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
 
 int
 main(int argc, char **argv)
 {
-    if(argc < 2)
+    int i, cold = 0, stats = 0;
+    char *file_name = NULL;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-advice") == 0)
+            mmap_file_set_advice_enabled(0);
+        else if (strcmp(argv[i], "--cold") == 0)
+            cold = 1;
+        else if (strcmp(argv[i], "--stats") == 0)
+            stats = 1;
+        else if (strcmp(argv[i], "--verbose") == 0)
+            file_log_set_level(FILE_LOG_DEBUG);
+        else
+            file_name = argv[i];
+    }
+
+    if(!file_name)
         return 1;
 
+    if (cold)
+        drop_cache(file_name);
+
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+
     int err = 0;
     union dvd_entry entry;
-    struct dvd_file *file = dvd_file_open(argv[1], &err);
+    struct dvd_file *file = dvd_file_open(file_name, &err);
+    if (!file)
+        return 1;
 
     while (dvd_file_has_next(file)) {
         dvd_file_get_next(file, &entry);
@@ -28,6 +71,19 @@ main(int argc, char **argv)
     }
     dvd_file_close(file);
 
+    getrusage(RUSAGE_SELF, &after);
+    printf("faults: %ld major, %ld minor\n",
+           after.ru_majflt - before.ru_majflt,
+           after.ru_minflt - before.ru_minflt);
+
+    if (stats) {
+        struct file_stats snapshot;
+        file_stats_snapshot(&snapshot);
+        for (i = 0; i < FILE_NUM_STATS; i++)
+            printf("%s: %llu\n",
+                   file_stat_name(i),
+                   (unsigned long long)snapshot.values[i]);
+    }
+
     return 0;
 }
-
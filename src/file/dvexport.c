@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * headless bulk exporter
+ * ======================
+ *
+ * Writes every frame of the given dvf files and every given dvm map as
+ * png, without any window:
+ *
+ *   <out dir>/<dvf>/<object index>_<object>/
+ *       <animation index>_<animation>_<frame>.png
+ *   <out dir>/<dvm>.png
+ *
+ * The files are parsed up front, then decoding, encoding and writing of
+ * the images is spread over a pool of threads taking jobs off a shared
+ * counter. Throughput is reported when all jobs are done.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include "stats.h"
+#include "trace.h"
+#include "pixmap.h"
+#include "png.h"
+#include "dvf.h"
+#include "dvm.h"
+
+#define EXPORT_PATH_SIZE 4096
+#define EXPORT_MAX_THREADS 64
+
+struct export_job {
+    /* either a frame or a dvm file to export */
+    struct dvf_frame *frame;
+    const char *dvm_file_name;
+    char *path;
+};
+
+static struct {
+    int level;
+    unsigned int num_jobs;
+    unsigned int alloc_jobs;
+    struct export_job *jobs;
+    unsigned int num_files;
+    struct dvf_file **files;
+    /* output names handed out so far, relative to the out dir */
+    unsigned int num_names;
+    char **names;
+
+    /* shared between the workers */
+    unsigned int next_job;
+    unsigned long frames;
+    unsigned long maps;
+    unsigned long pixels;
+    unsigned long bytes;
+    unsigned long failed;
+    /* frames with malformed sprites */
+    unsigned long skipped;
+} export = {
+    .level = Z_DEFAULT_COMPRESSION,
+};
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-j threads] [-z level] <out dir> <files...>\n"
+            "exports all frames of .dvf files and all .dvm maps as png\n",
+            name);
+}
+
+static int
+export_mkdir(const char *path)
+{
+    if (mkdir(path, 0777) < 0 && errno != EEXIST)
+        return errno;
+    return 0;
+}
+
+/**
+ * copies the first size bytes of name, replacing everything that could
+ * confuse a file system
+ */
+static void
+export_sanitize(char *dest, const char *name, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size && name[i]; i++) {
+        char c = name[i];
+        int keep = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                   (c >= '0' && c <= '9') || c == '-' || c == '_';
+        dest[i] = keep ? c : '_';
+    }
+    dest[i] = '\0';
+}
+
+/**
+ * returns the file name without directory and extension
+ */
+static void
+export_base_name(char *dest, const char *file_name)
+{
+    const char *base = strrchr(file_name, '/');
+    base = base ? base + 1 : file_name;
+
+    const char *extension = strrchr(base, '.');
+    size_t len = extension ? (size_t)(extension - base) : strlen(base);
+    if (len > 255)
+        len = 255;
+
+    memcpy(dest, base, len);
+    dest[len] = '\0';
+}
+
+/**
+ * builds a name for base in the out dir which no other input got, inputs
+ * with the same base name from different directories get a _2, _3 ...
+ * suffix in the order they are given
+ */
+static int
+export_unique_name(char *dest,
+                   size_t size,
+                   const char *base,
+                   const char *extension)
+{
+    unsigned int i, n;
+
+    for (n = 1;; n++) {
+        int len = n == 1 ? snprintf(dest, size, "%s%s", base, extension)
+                         : snprintf(dest, size, "%s_%u%s", base, n, extension);
+        if (len >= (int)size)
+            return ENAMETOOLONG;
+
+        for (i = 0; i < export.num_names; i++) {
+            if (strcmp(export.names[i], dest) == 0)
+                break;
+        }
+        if (i == export.num_names)
+            break;
+    }
+
+    char **names = realloc(export.names,
+                           sizeof(*names) * (export.num_names + 1));
+    if (!names)
+        return ENOMEM;
+    export.names = names;
+
+    names[export.num_names] = strdup(dest);
+    if (!names[export.num_names])
+        return ENOMEM;
+    export.num_names++;
+
+    return 0;
+}
+
+static int
+export_add_job(struct dvf_frame *frame,
+               const char *dvm_file_name,
+               const char *path)
+{
+    if (export.num_jobs == export.alloc_jobs) {
+        unsigned int alloc = export.alloc_jobs ? export.alloc_jobs * 2 : 256;
+        struct export_job *jobs = realloc(export.jobs, sizeof(*jobs) * alloc);
+        if (!jobs)
+            return ENOMEM;
+        export.jobs = jobs;
+        export.alloc_jobs = alloc;
+    }
+
+    struct export_job *job = &export.jobs[export.num_jobs];
+    job->frame = frame;
+    job->dvm_file_name = dvm_file_name;
+    job->path = strdup(path);
+    if (!job->path)
+        return ENOMEM;
+
+    export.num_jobs++;
+    return 0;
+}
+
+/**
+ * parses a dvf file and queues all of its valid frames
+ */
+static int
+export_add_dvf(const char *out_dir, const char *file_name)
+{
+    int err = 0;
+    unsigned int i, j, k;
+    char base[256], unique[300], name[33], path[EXPORT_PATH_SIZE];
+
+    struct dvf_file **files = realloc(export.files,
+                                      sizeof(*files) * (export.num_files + 1));
+    if (!files)
+        return ENOMEM;
+    export.files = files;
+
+    struct dvf_file *file = dvf_file_open((char *)file_name, &err);
+    if (!file)
+        return err;
+    if ((err = dvf_file_init(file))) {
+        dvf_file_close(file);
+        return err;
+    }
+    export.files[export.num_files++] = file;
+
+    export_base_name(base, file_name);
+    if ((err = export_unique_name(unique, sizeof(unique), base, "")))
+        return err;
+    if (snprintf(path, sizeof(path), "%s/%s", out_dir, unique) >=
+        (int)sizeof(path))
+        return ENAMETOOLONG;
+    if ((err = export_mkdir(path)))
+        return err;
+
+    for (i = 0; i < dvf_file_num_objects(file); i++) {
+        struct dvf_object *obj = dvf_file_get_object(file, i);
+        char object_dir[EXPORT_PATH_SIZE];
+
+        export_sanitize(name, dvf_object_name(obj), 32);
+        if (snprintf(object_dir,
+                     sizeof(object_dir),
+                     "%s/%s/%03u_%s",
+                     out_dir,
+                     unique,
+                     i,
+                     name) >= (int)sizeof(object_dir))
+            return ENAMETOOLONG;
+        if ((err = export_mkdir(object_dir)))
+            return err;
+
+        for (j = 0; j < dvf_object_num_animations(obj); j++) {
+            struct dvf_animation *anim = dvf_object_get_animation(obj, j);
+
+            export_sanitize(name, dvf_animation_name(anim), 32);
+            for (k = 0; k < dvf_animation_num_frames(anim); k++) {
+                struct dvf_frame *frame = dvf_animation_get_frame(anim, k);
+
+                if (!dvf_frame_valid(frame)) {
+                    export.skipped++;
+                    continue;
+                }
+
+                if (snprintf(path,
+                             sizeof(path),
+                             "%s/%03u_%s_%03u.png",
+                             object_dir,
+                             j,
+                             name,
+                             k) >= (int)sizeof(path))
+                    return ENAMETOOLONG;
+                if ((err = export_add_job(frame, NULL, path)))
+                    return err;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+export_add_dvm(const char *out_dir, const char *file_name)
+{
+    int err = 0;
+    char base[256], unique[300], path[EXPORT_PATH_SIZE];
+
+    export_base_name(base, file_name);
+    if ((err = export_unique_name(unique, sizeof(unique), base, ".png")))
+        return err;
+    if (snprintf(path, sizeof(path), "%s/%s", out_dir, unique) >=
+        (int)sizeof(path))
+        return ENAMETOOLONG;
+    return export_add_job(NULL, file_name, path);
+}
+
+static int
+export_run_job(struct export_job *job)
+{
+    TRACE_ZONE("export_job");
+    int err = 0;
+    unsigned int width, height;
+    unsigned long size = 0;
+
+    if (job->frame) {
+        void *pixels = dvf_frame_pixmap(job->frame, &width, &height);
+        if (!pixels)
+            return ENOMEM;
+
+        err = png_write(job->path,
+                        pixels,
+                        width,
+                        height,
+                        width * 4,
+                        PNG_FORMAT_B8G8R8A8,
+                        export.level,
+                        &size);
+        pixmap_free(pixels);
+        if (!err)
+            __atomic_fetch_add(&export.frames, 1, __ATOMIC_RELAXED);
+    }
+    else {
+        void *pixels = dvm_file_get_pixmap(job->dvm_file_name,
+                                           &width,
+                                           &height,
+                                           &err);
+        if (!pixels)
+            return err;
+
+        err = png_write(job->path,
+                        pixels,
+                        width,
+                        height,
+                        width * 2,
+                        PNG_FORMAT_R5G6B5,
+                        export.level,
+                        &size);
+        pixmap_free(pixels);
+        if (!err)
+            __atomic_fetch_add(&export.maps, 1, __ATOMIC_RELAXED);
+    }
+
+    if (!err) {
+        __atomic_fetch_add(&export.pixels,
+                           (unsigned long)width * height,
+                           __ATOMIC_RELAXED);
+        __atomic_fetch_add(&export.bytes, size, __ATOMIC_RELAXED);
+    }
+    return err;
+}
+
+static void *
+export_thread(void *data)
+{
+    unsigned int job;
+
+    trace_set_thread_name("export");
+
+    while ((job = __atomic_fetch_add(&export.next_job,
+                                     1,
+                                     __ATOMIC_RELAXED)) < export.num_jobs) {
+        int err = export_run_job(&export.jobs[job]);
+        if (err) {
+            fprintf(stderr,
+                    "error: cannot export %s: %s (%d)\n",
+                    export.jobs[job].path,
+                    strerror(err),
+                    err);
+            __atomic_fetch_add(&export.failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt, err = 0, i;
+    unsigned int num_threads = 0, started, t;
+    pthread_t threads[EXPORT_MAX_THREADS];
+
+    while ((opt = getopt(argc, argv, "j:z:")) != -1) {
+        switch (opt) {
+            case 'j':
+                num_threads = atoi(optarg);
+                break;
+            case 'z':
+                export.level = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return EINVAL;
+        }
+    }
+
+    if (optind + 1 >= argc || export.level < -1 || export.level > 9) {
+        usage(argv[0]);
+        return EINVAL;
+    }
+
+    if (num_threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 0 ? cpus : 1;
+    }
+    if (num_threads > EXPORT_MAX_THREADS)
+        num_threads = EXPORT_MAX_THREADS;
+
+    const char *out_dir = argv[optind];
+    if ((err = export_mkdir(out_dir))) {
+        fprintf(stderr,
+                "error: cannot create %s: %s (%d)\n",
+                out_dir,
+                strerror(err),
+                err);
+        return err;
+    }
+
+    for (i = optind + 1; i < argc; i++) {
+        const char *extension = strrchr(argv[i], '.');
+
+        if (extension && strcasecmp(extension, ".dvf") == 0)
+            err = export_add_dvf(out_dir, argv[i]);
+        else if (extension && strcasecmp(extension, ".dvm") == 0)
+            err = export_add_dvm(out_dir, argv[i]);
+        else
+            fprintf(stderr, "skipping %s: unknown type\n", argv[i]);
+
+        if (err) {
+            fprintf(stderr,
+                    "error: cannot read %s: %s (%d)\n",
+                    argv[i],
+                    strerror(err),
+                    err);
+            return err;
+        }
+    }
+
+    uint64_t start = file_stats_now();
+
+    for (t = 0; t < num_threads; t++) {
+        if ((err = pthread_create(&threads[t], NULL, export_thread, NULL))) {
+            fprintf(stderr, "error: cannot create thread: %s\n", strerror(err));
+            break;
+        }
+    }
+    /* whatever threads could be started finish all jobs */
+    started = t;
+    if (started == 0) {
+        export_thread(NULL);
+        started = 1;
+    }
+    while (t > 0)
+        pthread_join(threads[--t], NULL);
+
+    double seconds = (file_stats_now() - start) / 1e9;
+
+    printf("exported %lu frames and %lu maps with %u threads in %.3f s\n",
+           export.frames,
+           export.maps,
+           started,
+           seconds);
+    if (seconds > 0) {
+        printf("%.1f frames/s, %.1f Mpixel/s, %.1f MB/s written\n",
+               export.frames / seconds,
+               export.pixels / seconds / 1e6,
+               export.bytes / seconds / 1e6);
+    }
+    if (export.skipped)
+        printf("%lu malformed frames skipped\n", export.skipped);
+    if (export.failed)
+        printf("%lu images failed\n", export.failed);
+
+    for (i = 0; i < (int)export.num_jobs; i++)
+        free(export.jobs[i].path);
+    free(export.jobs);
+    for (i = 0; i < (int)export.num_files; i++) {
+        dvf_file_cleanup(export.files[i]);
+        dvf_file_close(export.files[i]);
+    }
+    free(export.files);
+    for (i = 0; i < (int)export.num_names; i++)
+        free(export.names[i]);
+    free(export.names);
+
+    return export.failed ? EIO : 0;
+}
@@ -52,16 +52,14 @@
 #include <endian.h>
 
 #include "file.h"
+#include "stats.h"
+#include "trace.h"
+#include "pixmap.h"
 #include "dvf.h"
 
-#define DEBUG 1
-#if DEBUG
-  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
-  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
-#else
-  #define DEBUG_LOG(...)
-  #define DEBUG_ERROR(...)
-#endif
+/* runtime log levels, see stats.h */
+#define DEBUG_LOG(...) FILE_LOG(FILE_LOG_DEBUG, __VA_ARGS__)
+#define DEBUG_ERROR(...) FILE_LOG(FILE_LOG_ERROR, "error: " __VA_ARGS__)
 
 #define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
 #define __PACKED__ __attribute__ ((__packed__))
@@ -72,16 +70,22 @@
 struct dvf_frame {
     struct dvf_file_object_animation_frame *frame;
     struct dvf_file_sprite_header *sprite;
+    /* mapping the sprite lives in */
+    struct mmap_file *file;
+    /* the sprite passed dvf_sprite_validate */
+    int valid;
 };
 
 struct dvf_animation {
     struct dvf_file_object_animation *animation;
+    strtab_id name_id;
     unsigned int num_frames;
     struct dvf_frame **frames;
 };
 
 struct dvf_object {
     struct dvf_file_object *object;
+    strtab_id name_id;
     unsigned int num_animations;
     struct dvf_animation **animations;
 };
@@ -93,6 +97,8 @@ struct dvf_object {
 struct dvf_file {
     /* */
     struct mmap_file *file;
+    /* bytes allocated for the handle and its lookup tables */
+    unsigned long heap_size;
     /* objects lookup table */
     unsigned int num_objects;
     struct dvf_object **objects;
@@ -106,6 +112,8 @@ struct __PACKED__ dvf_file_header {
     uint16_t magic;
 };
 #define DVF_FILE_MAGIC 512
+/* how far dvf_file_init prefetches ahead of the sprite walk */
+#define DVF_PREFETCH_WINDOW (256 * 1024)
 
 /**
  * dvf sprites header
@@ -201,6 +209,21 @@ struct __PACKED__ dvf_file_object_animation_frame {
     uint16_t unknown5;
 };
 
+/**
+ * zeroed allocation accounted to the heap size of file
+ */
+static void *
+dvf_file_alloc(struct dvf_file *file, size_t size)
+{
+    void *data = calloc(1, size);
+
+    if (data) {
+        file->heap_size += size;
+        file_stats_add(FILE_STAT_HEAP_BYTES, size);
+    }
+    return data;
+}
+
 __SYM_EXPORT__ unsigned int
 dvf_file_num_objects(struct dvf_file *file)
 {
@@ -225,6 +248,16 @@ dvf_object_name(struct dvf_object *obj)
     return obj->object->name;
 }
 
+/**
+ * returns the interned name of the object
+ * STRTAB_NO_ID unless dvf_file_intern_names was called
+ */
+__SYM_EXPORT__ strtab_id
+dvf_object_name_id(struct dvf_object *obj)
+{
+    return obj->name_id;
+}
+
 /**
  * returns the number of perspectives the object can be displayed in
  */
@@ -296,6 +329,16 @@ dvf_animation_name(struct dvf_animation *anim)
     return anim->animation->name;
 }
 
+/**
+ * returns the interned name of the animation
+ * STRTAB_NO_ID unless dvf_file_intern_names was called
+ */
+__SYM_EXPORT__ strtab_id
+dvf_animation_name_id(struct dvf_animation *anim)
+{
+    return anim->name_id;
+}
+
 /**
  * returns the perspective of the animation
  */
@@ -342,108 +385,266 @@ dvf_frame_unknown(struct dvf_frame *frame,
         *u5 = frame->frame->unknown5;
 }
 
+/**
+ * checks once that every row of a sprite stays within its data and width
+ * sprites passing it get decoded without any further checks
+ *
+ * returns 1 if the sprite is valid
+ */
+static int
+dvf_sprite_validate(struct dvf_file_sprite_header *sprite)
+{
+    unsigned int width = le16toh(sprite->width);
+    unsigned int height = le16toh(sprite->height);
+    unsigned long end = sizeof(*sprite) + le32toh(sprite->size);
+    unsigned long offset = sizeof(*sprite);
+    unsigned int i;
+
+    for (i = 0; i < height; i++) {
+        if (offset + 4 > end)
+            return 0;
+
+        int num_transparent_pixels =
+            (int16_t)le16toh(DVF_SPRITE_TYPE_AT_OFFSET(sprite,
+                                                       uint16_t,
+                                                       offset));
+        int num_total_pixels =
+            (int16_t)le16toh(DVF_SPRITE_TYPE_AT_OFFSET(sprite,
+                                                       uint16_t,
+                                                       offset + 2)) + 1;
+        offset += 4;
+
+        if (num_total_pixels == -1)
+            continue;
+
+        if (num_transparent_pixels < 0 ||
+            num_total_pixels < num_transparent_pixels ||
+            num_total_pixels > (int)width)
+            return 0;
+
+        offset += 2 * (num_total_pixels - num_transparent_pixels);
+        if (offset > end)
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * converts a R5G6B5 sprite color to B8G8R8A8
+ * 0x1f is a half transparent shadow, 0x7C0 is transparent
+ */
+static inline void
+dvf_sprite_color(uint16_t color, uint8_t *pixel)
+{
+    if (color == 0x1f) {
+        pixel[0] = 0;
+        pixel[1] = 0;
+        pixel[2] = 0;
+        pixel[3] = 127;
+    } else if (color == 0x7C0) {
+        pixel[0] = 0;
+        pixel[1] = 0;
+        pixel[2] = 0;
+        pixel[3] = 0;
+    } else {
+        unsigned int r = (color >> 11) & 0x1f;
+        unsigned int g = (color >> 5) & 0x3f;
+        unsigned int b = color & 0x1f;
+
+        pixel[0] = b * 8 + b / 4;
+        pixel[1] = g * 4 + g / 16;
+        pixel[2] = r * 8 + r / 4;
+        pixel[3] = 255;
+    }
+}
+
+/**
+ * decodes a validated sprite, rows are pitch bytes apart
+ * reads the sprite without bounds checks, see dvf_sprite_validate
+ */
+static void
+dvf_sprite_decode(struct dvf_file_sprite_header *sprite,
+                  uint8_t *pixels,
+                  unsigned int pitch)
+{
+    uint64_t start = file_stats_now();
+    unsigned int width = le16toh(sprite->width);
+    unsigned int height = le16toh(sprite->height);
+    const uint8_t *data = (const uint8_t *)sprite + sizeof(*sprite);
+    unsigned int i;
+    int j;
+
+    for (i = 0; i < height; i++) {
+        uint8_t *row = pixels + (size_t)pitch * i;
+        int num_transparent_pixels =
+            (int16_t)le16toh(*(const uint16_t *)data);
+        int num_total_pixels =
+            (int16_t)le16toh(*(const uint16_t *)(data + 2)) + 1;
+        data += 4;
+
+        /* if num_total_pixels equals -1, the complete line is transparent */
+        if (num_total_pixels == -1) {
+            memset(row, 0, width * 4);
+            continue;
+        }
+
+        memset(row, 0, num_transparent_pixels * 4);
+        for (j = num_transparent_pixels; j < num_total_pixels; j++) {
+            dvf_sprite_color(le16toh(*(const uint16_t *)data), row + j * 4);
+            data += 2;
+        }
+        memset(row + num_total_pixels * 4,
+               0,
+               (width - num_total_pixels) * 4);
+    }
+
+    file_stats_add(FILE_STAT_SPRITES_DECODED, 1);
+    file_stats_add(FILE_STAT_DVF_DECODE_NSEC, file_stats_now() - start);
+}
+
+/**
+ * returns the size of the frame's sprite in pixels
+ */
+__SYM_EXPORT__ void
+dvf_frame_size(struct dvf_frame *frame,
+               unsigned int *width,
+               unsigned int *height)
+{
+    *width = le16toh(frame->sprite->width);
+    *height = le16toh(frame->sprite->height);
+}
+
+/**
+ * returns 1 if the sprite of the frame passed validation
+ */
+__SYM_EXPORT__ int
+dvf_frame_valid(struct dvf_frame *frame)
+{
+    return frame->valid;
+}
+
+/**
+ * decodes the frame as B8G8R8A8 into pixels, rows are pitch bytes apart
+ * pixels has to hold dvf_frame_size pixels
+ *
+ * returns 0 on success, EILSEQ if the sprite is malformed
+ */
+__SYM_EXPORT__ int
+dvf_frame_decode(struct dvf_frame *frame, void *pixels, unsigned int pitch)
+{
+    TRACE_ZONE("dvf_frame_decode");
+    if (!frame->valid)
+        return EILSEQ;
+
+    dvf_sprite_decode(frame->sprite, pixels, pitch);
+    return 0;
+}
+
+/**
+ * returns the id of the sprite the frame shows, frames can share sprites
+ */
+__SYM_EXPORT__ unsigned int
+dvf_frame_sprite_id(struct dvf_frame *frame)
+{
+    return le16toh(frame->frame->sprite_id);
+}
+
+/**
+ * gathers how the sprite of the frame is encoded
+ *
+ * returns 0 on success, EILSEQ if the sprite is malformed
+ */
+__SYM_EXPORT__ int
+dvf_frame_sprite_stats(struct dvf_frame *frame, struct dvf_sprite_stats *stats)
+{
+    struct dvf_file_sprite_header *sprite = frame->sprite;
+    const uint8_t *data = (const uint8_t *)sprite + sizeof(*sprite);
+    unsigned int i, bucket;
+    int j;
+
+    if (!frame->valid)
+        return EILSEQ;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->width = le16toh(sprite->width);
+    stats->height = le16toh(sprite->height);
+
+    for (i = 0; i < stats->height; i++) {
+        int num_transparent_pixels =
+            (int16_t)le16toh(*(const uint16_t *)data);
+        int num_total_pixels =
+            (int16_t)le16toh(*(const uint16_t *)(data + 2)) + 1;
+        data += 4;
+
+        if (num_total_pixels == -1) {
+            stats->transparent_rows++;
+            continue;
+        }
+
+        unsigned int run = num_total_pixels - num_transparent_pixels;
+        for (bucket = 0;
+             bucket < DVF_SPRITE_STATS_BUCKETS - 1 && run >> (bucket + 1);
+             bucket++)
+            ;
+        stats->run_lengths[bucket]++;
+        stats->encoded_pixels += run;
+
+        for (j = num_transparent_pixels; j < num_total_pixels; j++) {
+            uint16_t color = le16toh(*(const uint16_t *)data);
+            if (color == 0x1f)
+                stats->shadow_pixels++;
+            else if (color == 0x7C0)
+                stats->transparent_pixels++;
+            data += 2;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * returns a B8G8R8A8 pixmap of the frame or NULL if an error occured
- * the caller has to free the buffer
+ * the caller has to free the pixmap with pixmap_free
  */
 __SYM_EXPORT__ void *
 dvf_frame_pixmap(struct dvf_frame *frame,
                  unsigned int *width,
                  unsigned int *height)
 {
+    TRACE_ZONE("dvf_frame_pixmap");
     struct dvf_file_sprite_header *sprite = frame->sprite;
+    struct mmap_file_identity source;
+
+    if (!frame->valid)
+        return NULL;
 
-    uint8_t *image = malloc(le16toh(sprite->width) *
-                            le16toh(sprite->height) * 4);
+    mmap_file_identity(frame->file, sprite, &source);
+    uint8_t *image = pixmap_cache_lookup(&source,
+                                         PIXMAP_KIND_DVF_FRAME,
+                                         width,
+                                         height);
+    if (image)
+        return image;
+
+    image = pixmap_alloc(le16toh(sprite->width), le16toh(sprite->height), 4);
 
     if (!image)
         return NULL;
 
-    unsigned int offset = sizeof(*sprite), i = 0, j = 0;
-    int16_t num_transparent_pixels;
-    int16_t num_total_pixels;
-    uint16_t color;
-
-    for(i=0; i<le16toh(sprite->height); i++) {
-        num_transparent_pixels = DVF_SPRITE_TYPE_AT_OFFSET(sprite,
-                                                           int16_t,
-                                                           offset);
-        offset += 2;
-        num_total_pixels = DVF_SPRITE_TYPE_AT_OFFSET(sprite,
-                                                     int16_t,
-                                                     offset) + 1;
-        offset += 2;
-
-        /* if num_total_pixels equals -1, the complete line is transparent */
-        if (num_total_pixels == -1) {
-            for (j=0; j<le16toh(sprite->width); j++) {
-                image[le16toh(sprite->width) * i * 4 + j * 4 + 0] = 0;
-                image[le16toh(sprite->width) * i * 4 + j * 4 + 1] = 0;
-                image[le16toh(sprite->width) * i * 4 + j * 4 + 2] = 0;
-                image[le16toh(sprite->width) * i * 4 + j * 4 + 3] = 0;
-            }
-        }
-        else {
-            for (j=0; j<num_transparent_pixels; j++) {
-                image[le16toh(sprite->width) * i * 4 + j * 4 + 0] = 0;
-                image[le16toh(sprite->width) * i * 4 + j * 4 + 1] = 0;
-                image[le16toh(sprite->width) * i * 4 + j * 4 + 2] = 0;
-                image[le16toh(sprite->width) * i * 4 + j * 4 + 3] = 0;
-            }
-            for (j=0; j < num_total_pixels - num_transparent_pixels; j++) {
-                color = DVF_SPRITE_TYPE_AT_OFFSET(sprite, uint16_t, offset);
-                offset += 2;
-                if (color == 0x1f) {
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 0] = 0;
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 1] = 0;
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 2] = 0;
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 3] = 127;
-                } else if (color == 0x7C0) {
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 0] = 0;
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 1] = 0;
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 2] = 0;
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 3] = 0;
-                } else {
-                    int bits[4];
-                    bits[2] = ((color) % 16);
-                    bits[3] = ((color/0x10) % 16);
-                    bits[0] = ((color/0x100) % 16);
-                    bits[1] = ((color/0x1000) % 16);
-
-                    int colormap[3];
-                    colormap[0] = bits[0] > 7 ? 1 : 0;
-	                colormap[0] += bits[1] * 2;
-	                colormap[1] = (bits[0] % 8) * 8;
-	                colormap[1] += bits[3]/2;
-	                colormap[2] = bits[3] % 2 == 1 ? bits[2] + 16 : bits[2];
-	                colormap[0] = colormap[0] * 8 + (colormap[0]/4);
-	                colormap[1] = colormap[1] * 4 + (colormap[1]/16);
-	                colormap[2] = colormap[2] * 8 + (colormap[2]/4);
-
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 0] = colormap[2];
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 1] = colormap[1];
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 2] = colormap[0];
-                    image[le16toh(sprite->width) * i * 4 + num_transparent_pixels * 4 + j * 4 + 3] = 255;
-                }
-            }
-            for (j=0; j < le16toh(sprite->width) - num_total_pixels; j++) {
-                image[le16toh(sprite->width) * i * 4 + num_total_pixels * 4 + j * 4 + 0] = 0;
-                image[le16toh(sprite->width) * i * 4 + num_total_pixels * 4 + j * 4 + 1] = 0;
-                image[le16toh(sprite->width) * i * 4 + num_total_pixels * 4 + j * 4 + 2] = 0;
-                image[le16toh(sprite->width) * i * 4 + num_total_pixels * 4 + j * 4 + 3] = 0;
-            }
-        }
-    }
+    dvf_sprite_decode(sprite, image, le16toh(sprite->width) * 4);
 
     *width = le16toh(sprite->width);
     *height = le16toh(sprite->height);
 
-    return image;
+    return pixmap_cache_store(&source, PIXMAP_KIND_DVF_FRAME, image);
 }
 
 __SYM_EXPORT__ int
 dvf_file_init(struct dvf_file *file)
 {
+    TRACE_ZONE("dvf_file_init");
+    uint64_t start = file_stats_now();
     int err = 0;
     int i = 0, j = 0, k = 0;
     unsigned long offset = 0;
@@ -477,18 +678,34 @@ dvf_file_init(struct dvf_file *file)
     {
     int num_sprites = le32toh(sprites_header->num_sprites);
     struct dvf_file_sprite_header *sprites[num_sprites];
+    uint8_t valid[num_sprites];
 
     struct dvf_file_sprite_header *sprite = NULL;
+    unsigned long prefetched = 0;
     for (i=0; i<le32toh(sprites_header->num_sprites); i++) {
+        /* keep the kernel a window ahead of the header walk */
+        if (offset >= prefetched) {
+            mmap_file_prefetch(file->file, offset, DVF_PREFETCH_WINDOW);
+            prefetched = offset + DVF_PREFETCH_WINDOW / 2;
+        }
+
         sprite = mmap_file_ptr_offset(file->file, offset, sizeof(*sprite));
         if (!sprite) {
             DEBUG_ERROR("file is malformed\n");
             err = EILSEQ;
             goto error;
         }
-        offset += sizeof(*sprite) + le32toh(sprite->size);
-
         sprites[i] = sprite;
+        /* validated once here so decoding needs no checks */
+        valid[i] = mmap_file_ptr_offset(file->file,
+                                        offset,
+                                        sizeof(*sprite) +
+                                        le32toh(sprite->size)) &&
+                   dvf_sprite_validate(sprite);
+        if (!valid[i])
+            DEBUG_ERROR("sprite %d is malformed\n", i);
+
+        offset += sizeof(*sprite) + le32toh(sprite->size);
     }
 
     struct dvf_file_objects_header *objects_header =
@@ -501,7 +718,8 @@ dvf_file_init(struct dvf_file *file)
     offset += sizeof(*objects_header);
 
     file->num_objects = le16toh(objects_header->num_objects);
-    file->objects = malloc(sizeof(*file->objects) * file->num_objects);
+    file->objects = dvf_file_alloc(file,
+                                   sizeof(*file->objects) * file->num_objects);
     if (!file->objects) {
         DEBUG_ERROR("out of memory\n");
         err = ENOMEM;
@@ -519,7 +737,7 @@ dvf_file_init(struct dvf_file *file)
         }
         offset += sizeof(*object);
 
-        struct dvf_object *obj = malloc(sizeof(*obj));
+        struct dvf_object *obj = dvf_file_alloc(file, sizeof(*obj));
         if (!obj) {
             DEBUG_ERROR("out of memory\n");
             err = ENOMEM;
@@ -531,7 +749,7 @@ dvf_file_init(struct dvf_file *file)
         obj->object = object;
         obj->num_animations = le16toh(object->num_animations) *
                               le16toh(object->num_perspectives);
-        obj->animations = malloc(sizeof(*obj->animations) *
+        obj->animations = dvf_file_alloc(file, sizeof(*obj->animations) *
                                  obj->num_animations);
         if (!obj->animations) {
             DEBUG_ERROR("out of memory\n");
@@ -559,7 +777,7 @@ dvf_file_init(struct dvf_file *file)
             }
             offset += sizeof(*animation);
 
-            struct dvf_animation *anim = malloc(sizeof(*anim));
+            struct dvf_animation *anim = dvf_file_alloc(file, sizeof(*anim));
             if (!anim) {
                 DEBUG_ERROR("out of memory\n");
                 err = ENOMEM;
@@ -570,7 +788,9 @@ dvf_file_init(struct dvf_file *file)
             obj->animations[j] = anim;
             anim->animation = animation;
             anim->num_frames = le16toh(animation->num_frames);
-            anim->frames = malloc(sizeof(*anim->frames) * anim->num_frames);
+            anim->frames = dvf_file_alloc(file,
+                                          sizeof(*anim->frames) *
+                                          anim->num_frames);
             if (!anim->frames) {
                 DEBUG_ERROR("out of memory\n");
                 err = ENOMEM;
@@ -598,7 +818,8 @@ dvf_file_init(struct dvf_file *file)
                 }
                 offset += sizeof(*frame);
 
-                struct dvf_frame *dvf_frame = malloc(sizeof(*dvf_frame));
+                struct dvf_frame *dvf_frame = dvf_file_alloc(file,
+                                                             sizeof(*dvf_frame));
                 if (!dvf_frame) {
                     DEBUG_ERROR("out of memory\n");
                     err = ENOMEM;
@@ -616,6 +837,8 @@ dvf_file_init(struct dvf_file *file)
                     goto error;
                 }
                 dvf_frame->sprite = sprites[le16toh(frame->sprite_id)];
+                dvf_frame->file = file->file;
+                dvf_frame->valid = valid[le16toh(frame->sprite_id)];
 
                 DEBUG_LOG("    frame %d\n", k);
                 DEBUG_LOG("      sprite_id: %d\n", le16toh(frame->sprite_id));
@@ -630,13 +853,50 @@ dvf_file_init(struct dvf_file *file)
     }
     }
 
+    file_stats_add(FILE_STAT_DVF_INIT_NSEC, file_stats_now() - start);
     return 0;
 
 error:
     dvf_file_cleanup(file);
+    file_stats_add(FILE_STAT_DVF_INIT_NSEC, file_stats_now() - start);
     return err;
 }
 
+/**
+ * interns the names of all objects and animations
+ * the table references the mapping, the file has to stay open while the
+ * table is in use
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+dvf_file_intern_names(struct dvf_file *file, struct strtab *tab)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < file->num_objects; i++) {
+        struct dvf_object *obj = file->objects[i];
+
+        obj->name_id = strtab_intern_fixed(tab,
+                                           (const char *)obj->object->name,
+                                           sizeof(obj->object->name));
+        if (obj->name_id == STRTAB_NO_ID)
+            return ENOMEM;
+
+        for (j = 0; j < obj->num_animations; j++) {
+            struct dvf_animation *anim = obj->animations[j];
+
+            anim->name_id = strtab_intern_fixed(tab,
+                                                (const char *)anim->animation->name,
+                                                sizeof(anim->animation->name));
+            if (anim->name_id == STRTAB_NO_ID)
+                return ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
 __SYM_EXPORT__ int
 dvf_file_cleanup(struct dvf_file *file)
 {
@@ -676,6 +936,15 @@ dvf_file_cleanup(struct dvf_file *file)
     }
 
     free(file->objects);
+    file->objects = NULL;
+    file->num_objects = 0;
+
+    /* only the handle itself is left */
+    file_stats_add(FILE_STAT_HEAP_BYTES,
+                   -(int64_t)(file->heap_size - sizeof(*file)));
+    file->heap_size = sizeof(*file);
+
+    return 0;
 }
 
 /**
@@ -694,8 +963,13 @@ dvf_file_open(char *file_name, int *err_out)
         goto error;
     }
     memset(file, 0, sizeof(*file));
+    file->heap_size = sizeof(*file);
+    file_stats_add(FILE_STAT_HEAP_BYTES, sizeof(*file));
 
-    file->file = mmap_file_open(file_name, &err);
+    /* dvf_file_init walks the whole file once */
+    file->file = mmap_file_open(file_name,
+                                MMAP_FILE_SEQUENTIAL | MMAP_FILE_WILLNEED,
+                                &err);
     if (!file->file) {
         DEBUG_ERROR("cannot open file %s: %s (%d)\n",
                     file_name,
@@ -729,9 +1003,405 @@ dvf_file_close(struct dvf_file *file)
     if (file->file)
         mmap_file_close(file->file);
 
+    file_stats_add(FILE_STAT_HEAP_BYTES, -(int64_t)file->heap_size);
     free(file);
 
     return 0;
 }
 
+/**
+ * returns the size of the mapped file in bytes
+ */
+__SYM_EXPORT__ unsigned long
+dvf_file_size(struct dvf_file *file)
+{
+    return mmap_file_size(file->file);
+}
+
+/**
+ * returns the bytes allocated for the handle and its lookup tables
+ */
+__SYM_EXPORT__ unsigned long
+dvf_file_heap_size(struct dvf_file *file)
+{
+    return file->heap_size;
+}
+
+
+
+/**
+ * an object being written, its animations are kept in the order they
+ * were added
+ */
+struct dvf_writer_object {
+    struct dvf_file_object object;
+    unsigned int num_animations;
+    struct dvf_file_object_animation *animations;
+    /* sprite ids of all frames of all animations, back to back */
+    unsigned int num_frames;
+    uint16_t *frames;
+};
+
+/**
+ * dvf file writer
+ * sprites and objects are collected in memory and written at once
+ */
+struct dvf_writer {
+    unsigned int num_sprites;
+    unsigned int max_width;
+    unsigned int max_height;
+    /* sprite headers and rows as they end up in the file */
+    char *sprites;
+    size_t sprites_size;
+    size_t sprites_alloc;
+
+    unsigned int num_objects;
+    struct dvf_writer_object *objects;
+};
+
+/* object records in the original files carry these, meaning unknown */
+#define DVF_WRITER_UNKNOWN0 70
+#define DVF_WRITER_UNKNOWN1 71
+
+/**
+ * makes room for size more sprite bytes
+ */
+static char *
+dvf_writer_grow(struct dvf_writer *writer, size_t size)
+{
+    if (writer->sprites_size + size > writer->sprites_alloc) {
+        size_t alloc = writer->sprites_alloc ? writer->sprites_alloc : 4096;
+        while (alloc < writer->sprites_size + size)
+            alloc *= 2;
+
+        char *sprites = realloc(writer->sprites, alloc);
+        if (!sprites)
+            return NULL;
+        writer->sprites = sprites;
+        writer->sprites_alloc = alloc;
+    }
+
+    char *data = writer->sprites + writer->sprites_size;
+    writer->sprites_size += size;
+    return data;
+}
+
+/**
+ * converts a B8G8R8A8 pixel to a R5G6B5 sprite color, the inverse of
+ * dvf_sprite_color
+ * opaque colors that collide with the two special values are nudged
+ */
+static uint16_t
+dvf_writer_color(const uint8_t *pixel)
+{
+    if (pixel[3] == 0)
+        return 0x7C0;
+    if (pixel[3] != 255)
+        return 0x1f;
+
+    uint16_t color = (pixel[2] >> 3) << 11 |
+                     (pixel[1] >> 2) << 5 |
+                     (pixel[0] >> 3);
+    if (color == 0x1f)
+        return 0x1e;
+    if (color == 0x7C0)
+        return 0x7E0;
+    return color;
+}
+
+/**
+ * returns a new, empty dvf writer
+ */
+__SYM_EXPORT__ struct dvf_writer *
+dvf_writer_new(int *err_out)
+{
+    struct dvf_writer *writer = calloc(1, sizeof(*writer));
+
+    if (!writer && err_out)
+        *err_out = ENOMEM;
+    return writer;
+}
+
+__SYM_EXPORT__ void
+dvf_writer_free(struct dvf_writer *writer)
+{
+    unsigned int i;
+
+    if (!writer)
+        return;
+
+    for (i = 0; i < writer->num_objects; i++) {
+        free(writer->objects[i].animations);
+        free(writer->objects[i].frames);
+    }
+    free(writer->objects);
+    free(writer->sprites);
+    free(writer);
+}
+
+/**
+ * encodes a B8G8R8A8 image as sprite, rows are pitch bytes apart
+ * fully transparent pixels at the ends of a row are left out, alpha values
+ * other than 0 and 255 become the half transparent shadow
+ * the id to reference the sprite with gets stored in sprite_id
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+dvf_writer_add_sprite(struct dvf_writer *writer,
+                      const void *pixels,
+                      unsigned int width,
+                      unsigned int height,
+                      unsigned int pitch,
+                      unsigned int *sprite_id)
+{
+    unsigned int i, j;
+
+    /* frames reference sprites by 16 bit ids */
+    if (writer->num_sprites > UINT16_MAX)
+        return EOVERFLOW;
+    if (width > INT16_MAX || height > UINT16_MAX)
+        return EINVAL;
+
+    /* out of memory half way drops the partial sprite again */
+    size_t header_offset = writer->sprites_size;
+    if (!dvf_writer_grow(writer, sizeof(struct dvf_file_sprite_header)))
+        goto nomem;
+
+    for (i = 0; i < height; i++) {
+        const uint8_t *row = (const uint8_t *)pixels + (size_t)pitch * i;
+        int first = -1, last = -1;
+
+        for (j = 0; j < width; j++) {
+            if (row[j * 4 + 3] != 0) {
+                if (first < 0)
+                    first = j;
+                last = j;
+            }
+        }
+
+        uint16_t *data = (uint16_t *)dvf_writer_grow(writer, 4);
+        if (!data)
+            goto nomem;
+
+        /* a total of -1 marks a completely transparent row */
+        if (first < 0) {
+            data[0] = htole16(0);
+            data[1] = htole16((uint16_t)-2);
+            continue;
+        }
+
+        data[0] = htole16(first);
+        data[1] = htole16(last);
+
+        data = (uint16_t *)dvf_writer_grow(writer, 2 * (last - first + 1));
+        if (!data)
+            goto nomem;
+        for (j = first; j <= last; j++)
+            *data++ = htole16(dvf_writer_color(row + j * 4));
+    }
+
+    struct dvf_file_sprite_header *sprite =
+        (struct dvf_file_sprite_header *)(writer->sprites + header_offset);
+    sprite->size = htole32(writer->sprites_size - header_offset -
+                           sizeof(*sprite));
+    sprite->width = htole16(width);
+    sprite->height = htole16(height);
+    sprite->unknown1 = htole16(1);
+
+    if (width > writer->max_width)
+        writer->max_width = width;
+    if (height > writer->max_height)
+        writer->max_height = height;
+
+    *sprite_id = writer->num_sprites++;
+    return 0;
+
+nomem:
+    writer->sprites_size = header_offset;
+    return ENOMEM;
+}
+
+/**
+ * adds an object displayed in num_perspectives perspectives
+ * its animations have to be added for every perspective
+ * the id to add animations with gets stored in object_id
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+dvf_writer_add_object(struct dvf_writer *writer,
+                      const char *name,
+                      unsigned int num_perspectives,
+                      unsigned int width,
+                      unsigned int height,
+                      unsigned int *object_id)
+{
+    if (writer->num_objects >= UINT16_MAX || num_perspectives == 0)
+        return EINVAL;
+
+    struct dvf_writer_object *objects =
+        realloc(writer->objects,
+                sizeof(*objects) * (writer->num_objects + 1));
+    if (!objects)
+        return ENOMEM;
+    writer->objects = objects;
+
+    struct dvf_writer_object *obj = &objects[writer->num_objects];
+    memset(obj, 0, sizeof(*obj));
+    memcpy(obj->object.name, name, strnlen(name, sizeof(obj->object.name)));
+    obj->object.num_perspectives = htole16(num_perspectives);
+    obj->object.max_width = htole16(width);
+    obj->object.max_height = htole16(height);
+    obj->object.unknown0 = htole32(DVF_WRITER_UNKNOWN0);
+    obj->object.unknown1 = htole32(DVF_WRITER_UNKNOWN1);
+
+    *object_id = writer->num_objects++;
+    return 0;
+}
+
+/**
+ * adds an animation of an object in one perspective
+ * the frames show the sprites sprite_ids[0..num_frames)
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+dvf_writer_add_animation(struct dvf_writer *writer,
+                         unsigned int object_id,
+                         const char *name,
+                         unsigned int perspective_id,
+                         unsigned int animation_id,
+                         const unsigned int *sprite_ids,
+                         unsigned int num_frames)
+{
+    unsigned int i;
+
+    if (object_id >= writer->num_objects || num_frames > UINT16_MAX)
+        return EINVAL;
+    for (i = 0; i < num_frames; i++) {
+        if (sprite_ids[i] >= writer->num_sprites)
+            return EINVAL;
+    }
+
+    struct dvf_writer_object *obj = &writer->objects[object_id];
+    struct dvf_file_object_animation *animations =
+        realloc(obj->animations,
+                sizeof(*animations) * (obj->num_animations + 1));
+    if (!animations)
+        return ENOMEM;
+    obj->animations = animations;
+
+    uint16_t *frames = realloc(obj->frames,
+                               sizeof(*frames) *
+                               (obj->num_frames + num_frames + 1));
+    if (!frames)
+        return ENOMEM;
+    obj->frames = frames;
+
+    struct dvf_file_object_animation *animation =
+        &animations[obj->num_animations++];
+    memset(animation, 0, sizeof(*animation));
+    animation->num_frames = htole16(num_frames);
+    animation->unknown0 = htole16(num_frames ? num_frames - 1 : 0);
+    animation->unknown2 = obj->object.unknown0;
+    animation->unknown3 = obj->object.unknown1;
+    animation->perspective_id = htole16(perspective_id);
+    animation->animation_id = htole16(animation_id);
+    memcpy(animation->name, name, strnlen(name, sizeof(animation->name)));
+
+    for (i = 0; i < num_frames; i++)
+        frames[obj->num_frames++] = sprite_ids[i];
+
+    return 0;
+}
+
+/**
+ * writes everything added so far as dvf file
+ * every object needs the same number of animations in each perspective
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+dvf_writer_write(struct dvf_writer *writer, const char *file_name)
+{
+    int err = 0;
+    unsigned int i, j, k, frame = 0;
+    FILE *out = NULL;
+
+    for (i = 0; i < writer->num_objects; i++) {
+        struct dvf_writer_object *obj = &writer->objects[i];
+        unsigned int num_perspectives = le16toh(obj->object.num_perspectives);
+
+        if (obj->num_animations % num_perspectives != 0 ||
+            obj->num_animations / num_perspectives > UINT16_MAX) {
+            DEBUG_ERROR("object %d has an animation count of %d for %d "
+                        "perspectives\n",
+                        i,
+                        obj->num_animations,
+                        num_perspectives);
+            return EINVAL;
+        }
+        obj->object.num_animations =
+            htole16(obj->num_animations / num_perspectives);
+    }
 
+    struct dvf_file_header file_header;
+    file_header.magic = htole16(DVF_FILE_MAGIC);
+
+    struct dvf_file_sprites_header sprites_header;
+    memset(&sprites_header, 0, sizeof(sprites_header));
+    sprites_header.num_sprites = htole32(writer->num_sprites);
+    sprites_header.max_width = htole16(writer->max_width);
+    sprites_header.max_height = htole16(writer->max_height);
+
+    struct dvf_file_objects_header objects_header;
+    objects_header.num_objects = htole16(writer->num_objects);
+
+    out = fopen(file_name, "wb");
+    if (!out)
+        return errno;
+
+    if (fwrite(&file_header, sizeof(file_header), 1, out) != 1 ||
+        fwrite(&sprites_header, sizeof(sprites_header), 1, out) != 1 ||
+        fwrite(writer->sprites, 1, writer->sprites_size, out) !=
+            writer->sprites_size ||
+        fwrite(&objects_header, sizeof(objects_header), 1, out) != 1) {
+        err = EIO;
+        goto exit;
+    }
+
+    for (i = 0; i < writer->num_objects; i++) {
+        struct dvf_writer_object *obj = &writer->objects[i];
+
+        if (fwrite(&obj->object, sizeof(obj->object), 1, out) != 1) {
+            err = EIO;
+            goto exit;
+        }
+
+        for (j = 0, frame = 0; j < obj->num_animations; j++) {
+            struct dvf_file_object_animation *animation = &obj->animations[j];
+
+            if (fwrite(animation, sizeof(*animation), 1, out) != 1) {
+                err = EIO;
+                goto exit;
+            }
+
+            for (k = 0; k < le16toh(animation->num_frames); k++) {
+                struct dvf_file_object_animation_frame record;
+                memset(&record, 0, sizeof(record));
+                record.sprite_id = htole16(obj->frames[frame++]);
+
+                if (fwrite(&record, sizeof(record), 1, out) != 1) {
+                    err = EIO;
+                    goto exit;
+                }
+            }
+        }
+    }
+
+exit:
+    if (fclose(out) != 0 && !err)
+        err = errno;
+    return err;
+}
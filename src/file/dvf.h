@@ -20,23 +20,54 @@
 #ifndef __DVF_FILE_H__
 #define __DVF_FILE_H__
 
+#include "strtab.h"
+
 struct dvf_file;
 struct dvf_object;
 struct dvf_animation;
 struct dvf_frame;
 
+/* bucket i counts rows with 2^i to 2^(i+1)-1 encoded pixels, 0 in bucket 0 */
+#define DVF_SPRITE_STATS_BUCKETS 16
+
+/**
+ * how a sprite is encoded, see dvf_frame_sprite_stats
+ */
+struct dvf_sprite_stats {
+    unsigned int width;
+    unsigned int height;
+    /* rows without any encoded pixel */
+    unsigned int transparent_rows;
+    /* pixels stored in the sprite, the rest of every row is transparent */
+    unsigned long encoded_pixels;
+    /* encoded pixels with the shadow and the transparent color */
+    unsigned long shadow_pixels;
+    unsigned long transparent_pixels;
+    /* histogram of encoded pixels per row */
+    unsigned int run_lengths[DVF_SPRITE_STATS_BUCKETS];
+};
+
 struct dvf_file *
 dvf_file_open(char *file_name, int *err);
 
 int
 dvf_file_close(struct dvf_file *file);
 
+unsigned long
+dvf_file_size(struct dvf_file *file);
+
+unsigned long
+dvf_file_heap_size(struct dvf_file *file);
+
 int
 dvf_file_init(struct dvf_file *file);
 
 int
 dvf_file_cleanup(struct dvf_file *file);
 
+int
+dvf_file_intern_names(struct dvf_file *file, struct strtab *tab);
+
 
 unsigned int
 dvf_file_num_objects(struct dvf_file *file);
@@ -47,6 +78,9 @@ dvf_file_get_object(struct dvf_file *file, unsigned int index);
 const char *
 dvf_object_name(struct dvf_object *obj);
 
+strtab_id
+dvf_object_name_id(struct dvf_object *obj);
+
 unsigned int
 dvf_object_num_perspectives(struct dvf_object *obj);
 
@@ -74,6 +108,9 @@ dvf_animation_id(struct dvf_animation *anim);
 const char *
 dvf_animation_name(struct dvf_animation *anim);
 
+strtab_id
+dvf_animation_name_id(struct dvf_animation *anim);
+
 unsigned int
 dvf_animation_perspective(struct dvf_animation *anim);
 
@@ -92,9 +129,63 @@ dvf_frame_unknown(struct dvf_frame *frame,
                   unsigned int *u4,
                   unsigned int *u5);
 
+void
+dvf_frame_size(struct dvf_frame *frame,
+               unsigned int *width,
+               unsigned int *height);
+
+int
+dvf_frame_valid(struct dvf_frame *frame);
+
+unsigned int
+dvf_frame_sprite_id(struct dvf_frame *frame);
+
+int
+dvf_frame_sprite_stats(struct dvf_frame *frame, struct dvf_sprite_stats *stats);
+
+int
+dvf_frame_decode(struct dvf_frame *frame, void *pixels, unsigned int pitch);
+
+/* release with pixmap_free, see pixmap.h */
 void *
 dvf_frame_pixmap(struct dvf_frame *frame,
                  unsigned int *width,
                  unsigned int *height);
 
+struct dvf_writer;
+
+struct dvf_writer *
+dvf_writer_new(int *err_out);
+
+void
+dvf_writer_free(struct dvf_writer *writer);
+
+int
+dvf_writer_add_sprite(struct dvf_writer *writer,
+                      const void *pixels,
+                      unsigned int width,
+                      unsigned int height,
+                      unsigned int pitch,
+                      unsigned int *sprite_id);
+
+int
+dvf_writer_add_object(struct dvf_writer *writer,
+                      const char *name,
+                      unsigned int num_perspectives,
+                      unsigned int width,
+                      unsigned int height,
+                      unsigned int *object_id);
+
+int
+dvf_writer_add_animation(struct dvf_writer *writer,
+                         unsigned int object_id,
+                         const char *name,
+                         unsigned int perspective_id,
+                         unsigned int animation_id,
+                         const unsigned int *sprite_ids,
+                         unsigned int num_frames);
+
+int
+dvf_writer_write(struct dvf_writer *writer, const char *file_name);
+
 #endif /* __DVF_FILE_H__ */
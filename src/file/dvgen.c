@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * synthetic corpus generator
+ * ==========================
+ *
+ * Writes a dvf, dvm and dvd file shaped like the original game data so
+ * the decoders can be benchmarked and scaled without it:
+ *
+ *   <dir>/<name>.dvf  sprites of random size and transparency, grouped
+ *                     into objects with one animation per perspective
+ *   <dir>/<name>.dvm  a tiled background map with some noise
+ *   <dir>/<name>.dvd  MISC, BGND, SGHT, ELEM, BUIL, SCRP and DLGS entries
+ *
+ * The same seed and parameters always give the same files.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "dvf.h"
+#include "dvm.h"
+#include "dvd.h"
+
+#define GEN_PATH_SIZE 4096
+/* sight cells are this many pixels wide and high */
+#define GEN_SIGHT_CELL 16
+
+struct gen_params {
+    uint32_t seed;
+    unsigned int num_sprites;
+    unsigned int min_size;
+    unsigned int max_size;
+    /* percentage of transparent pixels per sprite row */
+    unsigned int transparency;
+    unsigned int num_objects;
+    unsigned int num_perspectives;
+    unsigned int map_width;
+    unsigned int map_height;
+    int compression;
+    unsigned int num_elements;
+    unsigned int num_dialogs;
+};
+
+static uint32_t gen_state;
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options] <out dir> [name]\n"
+            "  -s seed          random seed (1)\n"
+            "  -n sprites       number of sprites (256)\n"
+            "  -z min:max       sprite edge length in pixels (16:128)\n"
+            "  -t percent       transparent pixels per sprite row (40)\n"
+            "  -o objects       number of objects (8)\n"
+            "  -p perspectives  perspectives per object (8)\n"
+            "  -m WxH           map size in pixels (1024x768)\n"
+            "  -c bzip2|zlib    map compression (zlib)\n"
+            "  -e elements      number of map elements (200)\n"
+            "  -d dialogs       number of dialogs (100)\n"
+            "writes <out dir>/<name>.dvf, .dvm and .dvd, name defaults to "
+            "synth\n",
+            name);
+}
+
+/**
+ * xorshift32, independent of the libc so corpora are reproducible
+ */
+static uint32_t
+gen_random(void)
+{
+    gen_state ^= gen_state << 13;
+    gen_state ^= gen_state >> 17;
+    gen_state ^= gen_state << 5;
+    return gen_state;
+}
+
+/**
+ * returns a random number in [min, max]
+ */
+static unsigned int
+gen_range(unsigned int min, unsigned int max)
+{
+    return min + gen_random() % (max - min + 1);
+}
+
+static void
+gen_path(char *path, const char *dir, const char *name, const char *extension)
+{
+    snprintf(path, GEN_PATH_SIZE, "%s/%s.%s", dir, name, extension);
+}
+
+/**
+ * fills a B8G8R8A8 sprite with an opaque body, some shadow pixels and
+ * transparent ends in every row
+ */
+static void
+gen_sprite(const struct gen_params *params,
+           uint8_t *pixels,
+           unsigned int width,
+           unsigned int height)
+{
+    unsigned int x, y;
+    uint8_t body[3] = { gen_random(), gen_random(), gen_random() };
+
+    memset(pixels, 0, (size_t)width * height * 4);
+
+    for (y = 0; y < height; y++) {
+        uint8_t *row = pixels + (size_t)y * width * 4;
+        unsigned int jitter = width / 8;
+        int transparent = (int)(width * params->transparency / 100) +
+                          (int)gen_range(0, 2 * jitter) - (int)jitter;
+
+        if (transparent >= (int)width)
+            continue;
+        if (transparent < 0)
+            transparent = 0;
+
+        unsigned int lead = gen_range(0, transparent);
+        unsigned int end = width - (transparent - lead);
+
+        for (x = lead; x < end; x++) {
+            uint8_t *pixel = row + x * 4;
+
+            if (gen_random() % 20 == 0) {
+                pixel[3] = 127;
+                continue;
+            }
+            pixel[0] = body[0] + (gen_random() & 15);
+            pixel[1] = body[1] + (gen_random() & 15);
+            pixel[2] = body[2] + (gen_random() & 15);
+            pixel[3] = 255;
+        }
+    }
+}
+
+static int
+gen_dvf(const struct gen_params *params, const char *file_name)
+{
+    int err = 0;
+    unsigned int i, j, k, sprite_id, object_id;
+    uint8_t *pixels = NULL;
+    unsigned int *sprite_ids = NULL;
+
+    struct dvf_writer *writer = dvf_writer_new(&err);
+    if (!writer)
+        return err;
+
+    pixels = malloc((size_t)params->max_size * params->max_size * 4);
+    if (!pixels) {
+        err = ENOMEM;
+        goto exit;
+    }
+
+    for (i = 0; i < params->num_sprites; i++) {
+        unsigned int width = gen_range(params->min_size, params->max_size);
+        unsigned int height = gen_range(params->min_size, params->max_size);
+
+        gen_sprite(params, pixels, width, height);
+        err = dvf_writer_add_sprite(writer,
+                                    pixels,
+                                    width,
+                                    height,
+                                    width * 4,
+                                    &sprite_id);
+        if (err)
+            goto exit;
+    }
+
+    /* the sprites are dealt out in order, wrapping if there are too few */
+    unsigned int num_frames = params->num_sprites /
+                              (params->num_objects * params->num_perspectives);
+    if (num_frames == 0)
+        num_frames = 1;
+
+    sprite_ids = malloc(sizeof(*sprite_ids) * num_frames);
+    if (!sprite_ids) {
+        err = ENOMEM;
+        goto exit;
+    }
+
+    for (i = 0, sprite_id = 0; i < params->num_objects; i++) {
+        char name[32];
+
+        snprintf(name, sizeof(name), "object%u", i);
+        err = dvf_writer_add_object(writer,
+                                    name,
+                                    params->num_perspectives,
+                                    params->max_size,
+                                    params->max_size,
+                                    &object_id);
+        if (err)
+            goto exit;
+
+        for (j = 0; j < params->num_perspectives; j++) {
+            for (k = 0; k < num_frames; k++)
+                sprite_ids[k] = sprite_id++ % params->num_sprites;
+
+            err = dvf_writer_add_animation(writer,
+                                           object_id,
+                                           "idle",
+                                           j,
+                                           0,
+                                           sprite_ids,
+                                           num_frames);
+            if (err)
+                goto exit;
+        }
+    }
+
+    err = dvf_writer_write(writer, file_name);
+
+exit:
+    free(sprite_ids);
+    free(pixels);
+    dvf_writer_free(writer);
+    return err;
+}
+
+/**
+ * writes a map of flat R5G6B5 tiles with noise in the low bits
+ */
+static int
+gen_dvm(const struct gen_params *params, const char *file_name)
+{
+    int err = 0;
+    unsigned int x, y;
+    uint16_t tiles[64];
+
+    uint16_t *pixels = malloc((size_t)params->map_width *
+                              params->map_height *
+                              sizeof(*pixels));
+    if (!pixels)
+        return ENOMEM;
+
+    for (x = 0; x < 64; x++)
+        tiles[x] = gen_random();
+
+    for (y = 0; y < params->map_height; y++) {
+        for (x = 0; x < params->map_width; x++) {
+            uint16_t tile = tiles[(y / 64 * 7 + x / 64) % 64];
+            pixels[(size_t)y * params->map_width + x] =
+                htole16(tile ^ (gen_random() & 0x0841));
+        }
+    }
+
+    err = dvm_file_write(file_name,
+                         pixels,
+                         params->map_width,
+                         params->map_height,
+                         params->compression);
+    free(pixels);
+    return err;
+}
+
+static int
+gen_dvd(const struct gen_params *params,
+        const char *name,
+        const char *file_name)
+{
+    int err = 0;
+    unsigned int i, j;
+    char (*names)[DVD_ELEMENT_NAME_SIZE] = NULL;
+    struct dvd_element *elements = NULL;
+    struct dvd_dialog *dialogs = NULL;
+    char *texts = NULL;
+    uint8_t *cells = NULL;
+
+    struct dvd_writer *writer = dvd_writer_open(file_name, &err);
+    if (!writer)
+        return err;
+
+    unsigned int sight_width = (params->map_width + GEN_SIGHT_CELL - 1) /
+                               GEN_SIGHT_CELL;
+    unsigned int sight_height = (params->map_height + GEN_SIGHT_CELL - 1) /
+                                GEN_SIGHT_CELL;
+    unsigned int num_buildings = params->num_elements / 10;
+    unsigned int num_elements = params->num_elements + num_buildings;
+
+    cells = malloc((size_t)sight_width * sight_height);
+    names = calloc(num_elements ? num_elements : 1, sizeof(*names));
+    elements = calloc(num_elements ? num_elements : 1, sizeof(*elements));
+    dialogs = calloc(params->num_dialogs ? params->num_dialogs : 1,
+                     sizeof(*dialogs));
+    texts = malloc((size_t)params->num_dialogs * 256);
+    if (!cells || !names || !elements || !dialogs ||
+        (!texts && params->num_dialogs)) {
+        err = ENOMEM;
+        goto exit;
+    }
+
+    for (i = 0; i < sight_width * sight_height; i++)
+        cells[i] = gen_random() % 10 == 0;
+
+    for (i = 0; i < num_elements; i++) {
+        snprintf(names[i],
+                 sizeof(names[i]),
+                 "object%u",
+                 i % (params->num_objects ? params->num_objects : 1));
+        elements[i].name = names[i];
+        elements[i].x = gen_range(0, params->map_width - 1);
+        elements[i].y = gen_range(0, params->map_height - 1);
+        elements[i].width = gen_range(params->min_size, params->max_size);
+        elements[i].height = gen_range(params->min_size, params->max_size);
+    }
+
+    for (i = 0; i < params->num_dialogs; i++) {
+        char *text = texts + (size_t)i * 256;
+        unsigned int len = gen_range(20, 255);
+
+        for (j = 0; j < len; j++)
+            text[j] = gen_random() % 6 == 0 ? ' ' : 'a' + gen_random() % 26;
+
+        dialogs[i].id = 1000 + i;
+        dialogs[i].text = text;
+        dialogs[i].len = len;
+    }
+
+    dvd_writer_misc(writer, 1);
+    dvd_writer_bgnd(writer, 1, name, params->map_width, params->map_height);
+    dvd_writer_sght(writer, 1, sight_width, sight_height, cells);
+    dvd_writer_elements(writer,
+                        DVD_ENTRY_TYPE_ELEM,
+                        1,
+                        elements,
+                        params->num_elements);
+    dvd_writer_elements(writer,
+                        DVD_ENTRY_TYPE_BUIL,
+                        1,
+                        elements + params->num_elements,
+                        num_buildings);
+    dvd_writer_scrp(writer, 1, 0, NULL, 0);
+    dvd_writer_dlgs(writer, 1, dialogs, params->num_dialogs);
+
+exit:
+    if (writer) {
+        int close_err = dvd_writer_close(writer);
+        err = err ? err : close_err;
+    }
+    free(texts);
+    free(dialogs);
+    free(elements);
+    free(names);
+    free(cells);
+    return err;
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt, err = 0;
+    char path[GEN_PATH_SIZE];
+    struct gen_params params = {
+        .seed = 1,
+        .num_sprites = 256,
+        .min_size = 16,
+        .max_size = 128,
+        .transparency = 40,
+        .num_objects = 8,
+        .num_perspectives = 8,
+        .map_width = 1024,
+        .map_height = 768,
+        .compression = DVM_COMPRESSION_ZLIB,
+        .num_elements = 200,
+        .num_dialogs = 100,
+    };
+
+    while ((opt = getopt(argc, argv, "s:n:z:t:o:p:m:c:e:d:")) != -1) {
+        switch (opt) {
+            case 's':
+                params.seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                params.num_sprites = strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+                if (sscanf(optarg,
+                           "%u:%u",
+                           &params.min_size,
+                           &params.max_size) != 2)
+                    goto invalid;
+                break;
+            case 't':
+                params.transparency = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                params.num_objects = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                params.num_perspectives = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                if (sscanf(optarg,
+                           "%ux%u",
+                           &params.map_width,
+                           &params.map_height) != 2)
+                    goto invalid;
+                break;
+            case 'c':
+                if (strcasecmp(optarg, "bzip2") == 0)
+                    params.compression = DVM_COMPRESSION_BZIP2;
+                else if (strcasecmp(optarg, "zlib") == 0)
+                    params.compression = DVM_COMPRESSION_ZLIB;
+                else
+                    goto invalid;
+                break;
+            case 'e':
+                params.num_elements = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                params.num_dialogs = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                goto invalid;
+        }
+    }
+
+    if (optind >= argc ||
+        params.num_sprites == 0 ||
+        params.min_size == 0 ||
+        params.min_size > params.max_size ||
+        params.transparency > 100 ||
+        params.num_objects == 0 ||
+        params.num_perspectives == 0 ||
+        params.map_width == 0 ||
+        params.map_height == 0)
+        goto invalid;
+
+    const char *dir = argv[optind];
+    const char *name = optind + 1 < argc ? argv[optind + 1] : "synth";
+    gen_state = params.seed ? params.seed : 1;
+
+    gen_path(path, dir, name, "dvf");
+    if ((err = gen_dvf(&params, path)))
+        goto error;
+    gen_path(path, dir, name, "dvm");
+    if ((err = gen_dvm(&params, path)))
+        goto error;
+    gen_path(path, dir, name, "dvd");
+    if ((err = gen_dvd(&params, name, path)))
+        goto error;
+
+    return 0;
+
+invalid:
+    usage(argv[0]);
+    return EINVAL;
+
+error:
+    fprintf(stderr,
+            "error: cannot write %s: %s (%d)\n",
+            path,
+            strerror(err),
+            err);
+    return err;
+}
@@ -41,16 +41,14 @@
 #include <zlib.h>
 
 #include "file.h"
+#include "stats.h"
+#include "trace.h"
+#include "pixmap.h"
 #include "dvm.h"
 
-#define DEBUG 1
-#if DEBUG
-  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
-  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
-#else
-  #define DEBUG_LOG(...)
-  #define DEBUG_ERROR(...)
-#endif
+/* runtime log levels, see stats.h */
+#define DEBUG_LOG(...) FILE_LOG(FILE_LOG_DEBUG, __VA_ARGS__)
+#define DEBUG_ERROR(...) FILE_LOG(FILE_LOG_ERROR, "error: " __VA_ARGS__)
 
 #define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
 #define __PACKED__ __attribute__ ((__packed__))
@@ -62,16 +60,70 @@ __PACKED__ struct dvm_file_header {
     uint32_t file_length;
 };
 
+/**
+ * detects the compression of the payload by its magic
+ */
+static int
+dvm_compression(const char *source, unsigned int len)
+{
+    /* bzip2 magick */
+    if (len >= 2 && source[0] == 0x42 && source[1] == 0x5A)
+        return DVM_COMPRESSION_BZIP2;
+    /* zlib magick */
+    if (len >= 1 && source[0] == 0x78)
+        return DVM_COMPRESSION_ZLIB;
+    return DVM_COMPRESSION_UNKNOWN;
+}
+
+/**
+ * reads the header of a dvm file without decompressing it
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+dvm_file_info(const char *file_name, struct dvm_file_info *info)
+{
+    int err = 0;
+
+    struct mmap_file *file = mmap_file_open(file_name, 0, &err);
+    if (!file)
+        return err;
+
+    struct dvm_file_header *header = mmap_file_ptr_offset(file,
+                                                          0,
+                                                          sizeof(*header));
+    const char *source = header ?
+        mmap_file_ptr_offset(file,
+                             sizeof(*header),
+                             le32toh(header->file_length)) :
+        NULL;
+    if (!source) {
+        DEBUG_ERROR("file is malformed\n");
+        mmap_file_close(file);
+        return EILSEQ;
+    }
+
+    info->width = le16toh(header->map_width);
+    info->height = le16toh(header->map_height);
+    info->compressed_size = le32toh(header->file_length);
+    info->compression = dvm_compression(source, info->compressed_size);
+
+    mmap_file_close(file);
+    return 0;
+}
+
 __SYM_EXPORT__ void *
 dvm_file_get_pixmap(const char *file_name,
                     unsigned int *width,
                     unsigned int *height,
                     int *err_out)
 {
+    TRACE_ZONE("dvm_file_get_pixmap");
     int err = 0, decompress_res = 0;
     char *dest_buf = NULL;
 
-    struct mmap_file *file = mmap_file_open(file_name, &err);
+    /* no hints yet, a cache hit only touches the header */
+    struct mmap_file *file = mmap_file_open(file_name, 0, &err);
     if (!file) {
         DEBUG_ERROR("cannot opem file\n");
         goto error;
@@ -86,14 +138,27 @@ dvm_file_get_pixmap(const char *file_name,
         goto error;
     }
 
+    struct mmap_file_identity source;
+    mmap_file_identity(file, header, &source);
+    dest_buf = pixmap_cache_lookup(&source, PIXMAP_KIND_DVM, width, height);
+    if (dest_buf) {
+        mmap_file_close(file);
+        return dest_buf;
+    }
 
     unsigned int map_width = le16toh(header->map_width);
     unsigned int map_height = le16toh(header->map_height);
     unsigned int map_bpp = 2; //e32toh(header->bpp);
     unsigned int map_size = le32toh(header->file_length);
 
+    /* the whole payload gets decompressed right away, read it ahead */
+    mmap_file_advise(file,
+                     0,
+                     mmap_file_size(file),
+                     MMAP_FILE_SEQUENTIAL | MMAP_FILE_WILLNEED);
+
     unsigned int dest_len = map_width * map_height * map_bpp;
-    dest_buf = malloc(dest_len);
+    dest_buf = pixmap_alloc(map_width, map_height, map_bpp);
     if (!dest_buf) {
         DEBUG_ERROR("out of memory\n");
         err = ENOMEM;
@@ -109,8 +174,10 @@ dvm_file_get_pixmap(const char *file_name,
         goto error;
     }
 
-    /* check for bzip2 magick */
-    if (source_buf[0] == 0x42 && source_buf[1] == 0x5A) {
+    uint64_t start = file_stats_now();
+    int compression = dvm_compression(source_buf, source_len);
+
+    if (compression == DVM_COMPRESSION_BZIP2) {
         decompress_res = BZ2_bzBuffToBuffDecompress(dest_buf,
                                                     &dest_len,
                                                     source_buf,
@@ -124,8 +191,7 @@ dvm_file_get_pixmap(const char *file_name,
             goto error;
         }
     }
-    /* check for zlib magick */
-    else if (source_buf[0] == 0x78) {
+    else if (compression == DVM_COMPRESSION_ZLIB) {
         z_stream strm  = {0};
         strm.total_in  = strm.avail_in  = source_len;
         strm.total_out = strm.avail_out = dest_len;
@@ -161,17 +227,110 @@ dvm_file_get_pixmap(const char *file_name,
         goto error;
     }
 
+    file_stats_add(FILE_STAT_BYTES_DECOMPRESSED, dest_len);
+    file_stats_add(FILE_STAT_DVM_DECODE_NSEC, file_stats_now() - start);
+
+    mmap_file_close(file);
     *width = map_width;
     *height = map_height;
-    return dest_buf;
+    return pixmap_cache_store(&source, PIXMAP_KIND_DVM, dest_buf);
 
 error:
     if (file)
         mmap_file_close(file);
     if (dest_buf)
-        free(dest_buf);
+        pixmap_free(dest_buf);
     if (err_out)
         *err_out = err;
     return NULL;
 }
 
+
+/**
+ * writes a width x height R5G6B5 pixmap as dvm file, the payload gets
+ * compressed with compression, one of DVM_COMPRESSION_BZIP2 and
+ * DVM_COMPRESSION_ZLIB
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+dvm_file_write(const char *file_name,
+               const void *pixels,
+               unsigned int width,
+               unsigned int height,
+               int compression)
+{
+    int err = 0, compress_res = 0;
+    char *dest_buf = NULL;
+    FILE *out = NULL;
+
+    if (width > UINT16_MAX || height > UINT16_MAX)
+        return EINVAL;
+
+    unsigned int source_len = width * height * 2;
+    /* worst cases of both, see their documentation */
+    unsigned int dest_len = source_len + source_len / 100 + 600;
+    if (compression == DVM_COMPRESSION_ZLIB &&
+        compressBound(source_len) > dest_len)
+        dest_len = compressBound(source_len);
+
+    dest_buf = malloc(dest_len);
+    if (!dest_buf)
+        return ENOMEM;
+
+    if (compression == DVM_COMPRESSION_BZIP2) {
+        compress_res = BZ2_bzBuffToBuffCompress(dest_buf,
+                                                &dest_len,
+                                                (char *)pixels,
+                                                source_len,
+                                                9,
+                                                0,
+                                                0);
+        if (compress_res != BZ_OK) {
+            DEBUG_ERROR("compression using bzip2 failed %d\n", compress_res);
+            err = EIO;
+            goto exit;
+        }
+    }
+    else if (compression == DVM_COMPRESSION_ZLIB) {
+        uLongf zlib_len = dest_len;
+        compress_res = compress2((Bytef *)dest_buf,
+                                 &zlib_len,
+                                 pixels,
+                                 source_len,
+                                 Z_DEFAULT_COMPRESSION);
+        if (compress_res != Z_OK) {
+            DEBUG_ERROR("deflate failed: %d\n", compress_res);
+            err = EIO;
+            goto exit;
+        }
+        dest_len = zlib_len;
+    }
+    else {
+        err = EINVAL;
+        goto exit;
+    }
+
+    struct dvm_file_header header;
+    header.map_width = htole16(width);
+    header.map_height = htole16(height);
+    header.bpp = htole32(2);
+    header.file_length = htole32(dest_len);
+
+    out = fopen(file_name, "wb");
+    if (!out) {
+        err = errno;
+        goto exit;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fwrite(dest_buf, 1, dest_len, out) != dest_len)
+        err = EIO;
+
+    if (fclose(out) != 0 && !err)
+        err = errno;
+
+exit:
+    free(dest_buf);
+    return err;
+}
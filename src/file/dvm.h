@@ -20,10 +20,34 @@
 #ifndef __DVM_FILE_H__
 #define __DVM_FILE_H__
 
+#define DVM_COMPRESSION_UNKNOWN 0
+#define DVM_COMPRESSION_BZIP2   1
+#define DVM_COMPRESSION_ZLIB    2
+
+struct dvm_file_info {
+    unsigned int width;
+    unsigned int height;
+    /* size of the compressed payload in bytes */
+    unsigned long compressed_size;
+    /* DVM_COMPRESSION_* */
+    int compression;
+};
+
+int
+dvm_file_info(const char *file_name, struct dvm_file_info *info);
+
+/* release with pixmap_free, see pixmap.h */
 void *
 dvm_file_get_pixmap(const char *file_name,
                     unsigned int *width,
                     unsigned int *height,
                     int *err_out);
 
+int
+dvm_file_write(const char *file_name,
+               const void *pixels,
+               unsigned int width,
+               unsigned int height,
+               int compression);
+
 #endif /* __DVM_FILE_H__ */
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pack.h"
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-C dir] <pack file> [files...]\n"
+            "       %s -l <pack file>\n"
+            "without files the names are read from stdin, one per line\n",
+            name, name);
+}
+
+static int
+list(const char *file_name)
+{
+    int err = 0;
+    unsigned int i;
+
+    struct pack *pack = pack_open(file_name, &err);
+    if (!pack) {
+        fprintf(stderr,
+                "error: cannot open pack %s: %s (%d)\n",
+                file_name,
+                strerror(err),
+                err);
+        return err;
+    }
+
+    for (i = 0; i < pack_num_entries(pack); i++) {
+        printf("%10lu %s\n",
+               pack_entry_size(pack, i),
+               pack_entry_name(pack, i, NULL));
+    }
+
+    pack_close(pack);
+    return 0;
+}
+
+static void
+free_names(char **names, unsigned int num_names)
+{
+    unsigned int i;
+
+    for (i = 0; i < num_names; i++)
+        free(names[i]);
+    free(names);
+}
+
+/**
+ * reads newline separated names from stdin
+ *
+ * returns the names, NULL if there are none or on error, then err gets set
+ */
+static char **
+read_names(unsigned int *num_names, int *err_out)
+{
+    char line[4096];
+    char **names = NULL;
+    unsigned int num = 0, alloc = 0;
+    int err = 0;
+
+    while (fgets(line, sizeof(line), stdin)) {
+        size_t len = strcspn(line, "\r\n");
+        if (len == 0)
+            continue;
+        line[len] = '\0';
+
+        if (num == alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            char **tmp = realloc(names, alloc * sizeof(*names));
+            if (!tmp) {
+                err = ENOMEM;
+                goto error;
+            }
+            names = tmp;
+        }
+        if (!(names[num] = strdup(line))) {
+            err = ENOMEM;
+            goto error;
+        }
+        num++;
+    }
+
+    *num_names = num;
+    return names;
+
+error:
+    free_names(names, num);
+    *num_names = 0;
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    int err = 0, arg = 1;
+    const char *base_dir = NULL;
+
+    if (argc > 2 && strcmp(argv[1], "-l") == 0)
+        return list(argv[2]);
+
+    if (argc > 2 && strcmp(argv[1], "-C") == 0) {
+        base_dir = argv[2];
+        arg = 3;
+    }
+
+    if (arg >= argc) {
+        usage(argv[0]);
+        return EINVAL;
+    }
+
+    const char *out_file_name = argv[arg++];
+    const char *const *names = (const char *const *)&argv[arg];
+    unsigned int num_names = argc - arg;
+    char **stdin_names = NULL;
+
+    if (num_names == 0) {
+        stdin_names = read_names(&num_names, &err);
+        if (err) {
+            fprintf(stderr, "error: out of memory\n");
+            return err;
+        }
+        names = (const char *const *)stdin_names;
+    }
+
+    err = pack_write(out_file_name, base_dir, names, num_names);
+    free_names(stdin_names, stdin_names ? num_names : 0);
+    if (err) {
+        fprintf(stderr,
+                "error: cannot write pack %s: %s (%d)\n",
+                out_file_name,
+                strerror(err),
+                err);
+        return err;
+    }
+
+    return 0;
+}
@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * asset corpus profiler
+ * =====================
+ *
+ * Walks directories with the dvf, dvm and dvd parsers and reports how the
+ * data is actually encoded:
+ *
+ *   dvf  sprite sizes, rows without pixels, encoded pixels per row, use of
+ *        the shadow and transparent colors and frames sharing a sprite
+ *   dvm  payload compression and ratio
+ *   dvd  entries by type
+ *
+ * Sizes and run lengths are histograms with power of two buckets. The
+ * report goes to stdout and optionally as JSON to a file.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <ftw.h>
+
+#include "dvf.h"
+#include "dvm.h"
+#include "dvd.h"
+
+#define PROF_BUCKETS DVF_SPRITE_STATS_BUCKETS
+/* sprite ids are 16 bit */
+#define PROF_MAX_SPRITES 65536
+
+struct prof_histogram {
+    const char *name;
+    unsigned long counts[PROF_BUCKETS];
+};
+
+static const struct {
+    uint32_t type;
+    const char *name;
+} prof_dvd_types[] = {
+    { DVD_ENTRY_TYPE_MISC, "MISC" },
+    { DVD_ENTRY_TYPE_BGND, "BGND" },
+    { DVD_ENTRY_TYPE_MOVE, "MOVE" },
+    { DVD_ENTRY_TYPE_SGHT, "SGHT" },
+    { DVD_ENTRY_TYPE_ELEM, "ELEM" },
+    { DVD_ENTRY_TYPE_BUIL, "BUIL" },
+    { DVD_ENTRY_TYPE_SCRP, "SCRP" },
+    { DVD_ENTRY_TYPE_DLGS, "DLGS" },
+    { DVD_ENTRY_TYPE_UNKN, "other" },
+};
+#define PROF_DVD_TYPES (sizeof(prof_dvd_types) / sizeof(prof_dvd_types[0]))
+
+static const char *prof_compressions[] = { "unknown", "bzip2", "zlib" };
+#define PROF_COMPRESSIONS \
+    (sizeof(prof_compressions) / sizeof(prof_compressions[0]))
+
+static struct {
+    unsigned int errors;
+
+    unsigned int dvf_files;
+    unsigned long objects;
+    unsigned long animations;
+    unsigned long frames;
+    unsigned long invalid_frames;
+    /* frames showing a sprite an earlier frame of the file shows */
+    unsigned long shared_frames;
+    /* everything below counts every sprite once */
+    unsigned long sprites;
+    unsigned long pixels;
+    unsigned long rows;
+    unsigned long transparent_rows;
+    unsigned long encoded_pixels;
+    unsigned long shadow_pixels;
+    unsigned long transparent_pixels;
+    struct prof_histogram widths;
+    struct prof_histogram heights;
+    struct prof_histogram run_lengths;
+
+    unsigned int dvm_files[PROF_COMPRESSIONS];
+    unsigned long dvm_pixels[PROF_COMPRESSIONS];
+    unsigned long dvm_compressed[PROF_COMPRESSIONS];
+
+    unsigned int dvd_files;
+    unsigned long dvd_entries[PROF_DVD_TYPES];
+} prof = {
+    .widths = { .name = "sprite width" },
+    .heights = { .name = "sprite height" },
+    .run_lengths = { .name = "encoded pixels per row" },
+};
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-o json file] <dirs or files...>\n"
+            "profiles the .dvf, .dvm and .dvd files found\n",
+            name);
+}
+
+static unsigned int
+prof_bucket(unsigned long value)
+{
+    unsigned int bucket = 0;
+
+    while (bucket < PROF_BUCKETS - 1 && value >> (bucket + 1))
+        bucket++;
+    return bucket;
+}
+
+static int
+prof_dvf(const char *file_name)
+{
+    int err = 0;
+    unsigned int i, j, k, b;
+    struct dvf_sprite_stats stats;
+
+    uint8_t *seen = calloc(PROF_MAX_SPRITES / 8, 1);
+    if (!seen)
+        return ENOMEM;
+
+    struct dvf_file *file = dvf_file_open((char *)file_name, &err);
+    if (!file)
+        goto exit;
+    if ((err = dvf_file_init(file)))
+        goto exit;
+
+    prof.dvf_files++;
+    prof.objects += dvf_file_num_objects(file);
+
+    for (i = 0; i < dvf_file_num_objects(file); i++) {
+        struct dvf_object *obj = dvf_file_get_object(file, i);
+        prof.animations += dvf_object_num_animations(obj);
+
+        for (j = 0; j < dvf_object_num_animations(obj); j++) {
+            struct dvf_animation *anim = dvf_object_get_animation(obj, j);
+            prof.frames += dvf_animation_num_frames(anim);
+
+            for (k = 0; k < dvf_animation_num_frames(anim); k++) {
+                struct dvf_frame *frame = dvf_animation_get_frame(anim, k);
+                unsigned int id = dvf_frame_sprite_id(frame);
+
+                if (seen[id / 8] & (1 << id % 8)) {
+                    prof.shared_frames++;
+                    continue;
+                }
+                seen[id / 8] |= 1 << id % 8;
+
+                if (dvf_frame_sprite_stats(frame, &stats) != 0) {
+                    prof.invalid_frames++;
+                    continue;
+                }
+
+                prof.sprites++;
+                prof.pixels += (unsigned long)stats.width * stats.height;
+                prof.rows += stats.height;
+                prof.transparent_rows += stats.transparent_rows;
+                prof.encoded_pixels += stats.encoded_pixels;
+                prof.shadow_pixels += stats.shadow_pixels;
+                prof.transparent_pixels += stats.transparent_pixels;
+                prof.widths.counts[prof_bucket(stats.width)]++;
+                prof.heights.counts[prof_bucket(stats.height)]++;
+                for (b = 0; b < PROF_BUCKETS; b++)
+                    prof.run_lengths.counts[b] += stats.run_lengths[b];
+            }
+        }
+    }
+
+exit:
+    if (file) {
+        dvf_file_cleanup(file);
+        dvf_file_close(file);
+    }
+    free(seen);
+    return err;
+}
+
+static int
+prof_dvm(const char *file_name)
+{
+    int err = 0;
+    struct dvm_file_info info;
+
+    if ((err = dvm_file_info(file_name, &info)))
+        return err;
+
+    if (info.compression < 0 || info.compression >= (int)PROF_COMPRESSIONS)
+        info.compression = DVM_COMPRESSION_UNKNOWN;
+
+    prof.dvm_files[info.compression]++;
+    prof.dvm_pixels[info.compression] +=
+        (unsigned long)info.width * info.height;
+    prof.dvm_compressed[info.compression] += info.compressed_size;
+    return 0;
+}
+
+static int
+prof_dvd(const char *file_name)
+{
+    int err = 0;
+    unsigned int i;
+    union dvd_entry entry;
+
+    struct dvd_file *file = dvd_file_open((char *)file_name, &err);
+    if (!file)
+        return err;
+
+    prof.dvd_files++;
+    while (dvd_file_has_next(file)) {
+        if ((err = dvd_file_get_next(file, &entry)))
+            break;
+
+        for (i = 0; i < PROF_DVD_TYPES - 1; i++) {
+            if (prof_dvd_types[i].type == entry.unknown.type)
+                break;
+        }
+        prof.dvd_entries[i]++;
+        dvd_entry_done(&entry);
+    }
+
+    dvd_file_close(file);
+    return err;
+}
+
+static int
+prof_visit(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    int err = 0;
+    const char *extension = strrchr(path, '.');
+
+    if (flag != FTW_F || !extension)
+        return 0;
+
+    if (strcasecmp(extension, ".dvf") == 0)
+        err = prof_dvf(path);
+    else if (strcasecmp(extension, ".dvm") == 0)
+        err = prof_dvm(path);
+    else if (strcasecmp(extension, ".dvd") == 0)
+        err = prof_dvd(path);
+
+    if (err) {
+        fprintf(stderr,
+                "warning: cannot profile %s: %s (%d)\n",
+                path,
+                strerror(err),
+                err);
+        prof.errors++;
+    }
+
+    /* keep walking, broken files are part of the picture */
+    return 0;
+}
+
+static double
+prof_percent(unsigned long part, unsigned long total)
+{
+    return total ? 100.0 * part / total : 0.0;
+}
+
+static void
+prof_print_histogram(const struct prof_histogram *histogram)
+{
+    unsigned long total = 0;
+    unsigned int i, last = 0;
+
+    for (i = 0; i < PROF_BUCKETS; i++) {
+        total += histogram->counts[i];
+        if (histogram->counts[i])
+            last = i;
+    }
+
+    printf("\n%s\n", histogram->name);
+    for (i = 0; i <= last && total; i++) {
+        unsigned int lo = i ? 1u << i : 0;
+        unsigned int hi = (1u << (i + 1)) - 1;
+        double percent = prof_percent(histogram->counts[i], total);
+
+        printf("  %6u - %-6u %10lu %6.2f%% ",
+               lo,
+               hi,
+               histogram->counts[i],
+               percent);
+        for (int bar = 0; bar < (int)(percent / 2); bar++)
+            putchar('#');
+        putchar('\n');
+    }
+}
+
+static void
+prof_print(void)
+{
+    unsigned int i;
+
+    printf("dvf files          %10u\n", prof.dvf_files);
+    printf("  objects          %10lu\n", prof.objects);
+    printf("  animations       %10lu\n", prof.animations);
+    printf("  frames           %10lu\n", prof.frames);
+    printf("  shared frames    %10lu %6.2f%%\n",
+           prof.shared_frames,
+           prof_percent(prof.shared_frames, prof.frames));
+    printf("  invalid sprites  %10lu\n", prof.invalid_frames);
+    printf("  sprites          %10lu\n", prof.sprites);
+    printf("  pixels           %10lu\n", prof.pixels);
+    printf("  encoded pixels   %10lu %6.2f%% of pixels\n",
+           prof.encoded_pixels,
+           prof_percent(prof.encoded_pixels, prof.pixels));
+    printf("    shadow 0x1f    %10lu %6.2f%%\n",
+           prof.shadow_pixels,
+           prof_percent(prof.shadow_pixels, prof.encoded_pixels));
+    printf("    transp. 0x7C0  %10lu %6.2f%%\n",
+           prof.transparent_pixels,
+           prof_percent(prof.transparent_pixels, prof.encoded_pixels));
+    printf("  rows             %10lu\n", prof.rows);
+    printf("    transparent    %10lu %6.2f%%\n",
+           prof.transparent_rows,
+           prof_percent(prof.transparent_rows, prof.rows));
+
+    prof_print_histogram(&prof.widths);
+    prof_print_histogram(&prof.heights);
+    prof_print_histogram(&prof.run_lengths);
+
+    printf("\ndvm files\n");
+    for (i = 0; i < PROF_COMPRESSIONS; i++) {
+        if (!prof.dvm_files[i])
+            continue;
+        printf("  %-8s %8u files %12lu pixels %12lu bytes, ratio %.2f\n",
+               prof_compressions[i],
+               prof.dvm_files[i],
+               prof.dvm_pixels[i],
+               prof.dvm_compressed[i],
+               prof.dvm_compressed[i] ?
+                   2.0 * prof.dvm_pixels[i] / prof.dvm_compressed[i] : 0.0);
+    }
+
+    printf("\ndvd files          %10u\n", prof.dvd_files);
+    for (i = 0; i < PROF_DVD_TYPES; i++) {
+        if (prof.dvd_entries[i])
+            printf("  %-16s %10lu\n",
+                   prof_dvd_types[i].name,
+                   prof.dvd_entries[i]);
+    }
+
+    if (prof.errors)
+        printf("\n%u files could not be profiled\n", prof.errors);
+}
+
+static void
+prof_write_histogram(FILE *out,
+                     const char *key,
+                     const struct prof_histogram *histogram)
+{
+    unsigned int i;
+
+    fprintf(out, "    \"%s\": [", key);
+    for (i = 0; i < PROF_BUCKETS; i++)
+        fprintf(out, "%s%lu", i ? ", " : "", histogram->counts[i]);
+    fprintf(out, "]");
+}
+
+static int
+prof_write_json(const char *file_name)
+{
+    unsigned int i;
+
+    FILE *out = fopen(file_name, "w");
+    if (!out)
+        return errno;
+
+    fprintf(out,
+            "{\n  \"errors\": %u,\n  \"dvf\": {\n"
+            "    \"files\": %u,\n    \"objects\": %lu,\n"
+            "    \"animations\": %lu,\n    \"frames\": %lu,\n"
+            "    \"shared_frames\": %lu,\n    \"invalid_sprites\": %lu,\n"
+            "    \"sprites\": %lu,\n    \"pixels\": %lu,\n"
+            "    \"encoded_pixels\": %lu,\n    \"shadow_pixels\": %lu,\n"
+            "    \"transparent_pixels\": %lu,\n    \"rows\": %lu,\n"
+            "    \"transparent_rows\": %lu,\n",
+            prof.errors,
+            prof.dvf_files,
+            prof.objects,
+            prof.animations,
+            prof.frames,
+            prof.shared_frames,
+            prof.invalid_frames,
+            prof.sprites,
+            prof.pixels,
+            prof.encoded_pixels,
+            prof.shadow_pixels,
+            prof.transparent_pixels,
+            prof.rows,
+            prof.transparent_rows);
+    prof_write_histogram(out, "widths", &prof.widths);
+    fprintf(out, ",\n");
+    prof_write_histogram(out, "heights", &prof.heights);
+    fprintf(out, ",\n");
+    prof_write_histogram(out, "run_lengths", &prof.run_lengths);
+
+    fprintf(out, "\n  },\n  \"dvm\": {");
+    for (i = 0; i < PROF_COMPRESSIONS; i++) {
+        fprintf(out,
+                "%s\n    \"%s\": {\"files\": %u, \"pixels\": %lu, "
+                "\"compressed_bytes\": %lu}",
+                i ? "," : "",
+                prof_compressions[i],
+                prof.dvm_files[i],
+                prof.dvm_pixels[i],
+                prof.dvm_compressed[i]);
+    }
+
+    fprintf(out, "\n  },\n  \"dvd\": {\n    \"files\": %u", prof.dvd_files);
+    for (i = 0; i < PROF_DVD_TYPES; i++) {
+        fprintf(out,
+                ",\n    \"%s\": %lu",
+                prof_dvd_types[i].name,
+                prof.dvd_entries[i]);
+    }
+    fprintf(out, "\n  }\n}\n");
+
+    if (fclose(out) != 0)
+        return errno;
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt, err = 0, i;
+    const char *json_file_name = NULL;
+
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+            case 'o':
+                json_file_name = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EINVAL;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EINVAL;
+    }
+
+    for (i = optind; i < argc; i++) {
+        if (nftw(argv[i], prof_visit, 16, FTW_PHYS) != 0) {
+            err = errno;
+            fprintf(stderr,
+                    "error: cannot walk %s: %s (%d)\n",
+                    argv[i],
+                    strerror(err),
+                    err);
+            return err;
+        }
+    }
+
+    prof_print();
+
+    if (json_file_name && (err = prof_write_json(json_file_name))) {
+        fprintf(stderr,
+                "error: cannot write %s: %s (%d)\n",
+                json_file_name,
+                strerror(err),
+                err);
+        return err;
+    }
+
+    return 0;
+}
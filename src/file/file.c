@@ -22,10 +22,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <assert.h>
 #include <stdint.h>
 #include <endian.h>
+#include <pthread.h>
+
+#include "file.h"
+#include "stats.h"
+#include "trace.h"
+#include "pack.h"
 
 #define DEBUG 0
 #if DEBUG
@@ -38,6 +46,8 @@
 
 /**
  * memory mapped file
+ * mappings are shared process wide, every mmap_file_open of an already
+ * mapped file returns the same struct with a higher refcount
  */
 struct mmap_file {
     /* file name */
@@ -46,10 +56,62 @@ struct mmap_file {
     off_t size;
     /* read only mmap mapping of the file */
     void *mapping;
-    /* read only fd */ 
+    /* read only fd, closed once the file is mapped */ 
     int fd;
+    /* views point into the mapping of their parent */
+    struct mmap_file *parent;
+    /* set if the file can be found in the cache */
+    int cached;
+    /* identity of the file in the cache */
+    dev_t dev;
+    ino_t ino;
+    /* modification time, nanoseconds since the epoch */
+    uint64_t mtime;
+    unsigned int name_hash;
+    /* number of mmap_file_open calls without a mmap_file_close */
+    unsigned int refcount;
+    /* MMAP_FILE_* hints already applied to the whole mapping */
+    unsigned int flags;
+    /* cache bucket chains */
+    struct mmap_file *name_next;
+    struct mmap_file *inode_next;
+    /* keep-alive list of unreferenced files, most recently closed first */
+    struct mmap_file *idle_prev;
+    struct mmap_file *idle_next;
+};
+
+#define MMAP_FILE_CACHE_BUCKETS 256
+
+/**
+ * registry of all mapped files
+ */
+struct mmap_file_cache {
+    pthread_mutex_t mutex;
+    struct mmap_file *by_name[MMAP_FILE_CACHE_BUCKETS];
+    struct mmap_file *by_inode[MMAP_FILE_CACHE_BUCKETS];
+    struct mmap_file *idle_head;
+    struct mmap_file *idle_tail;
+    unsigned int num_idle;
+    /* number of unreferenced files that stay mapped */
+    unsigned int keep_alive;
+};
+
+static struct mmap_file_cache mmap_file_cache = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
 };
 
+/* hints can be turned off to measure their effect */
+static int mmap_file_advice_enabled = 1;
+
+/**
+ * enables or disables all access pattern hints
+ */
+void
+mmap_file_set_advice_enabled(int enabled)
+{
+    mmap_file_advice_enabled = enabled;
+}
+
 /**
  *
  */
@@ -63,6 +125,57 @@ mmap_file_ptr_offset(struct mmap_file *file,
     return (void *)((char *)file->mapping + offset);
 }
 
+/**
+ * gives the kernel a hint about how a range of the file will be accessed
+ * the range gets extended to page boundaries, errors are ignored
+ */
+void
+mmap_file_advise(struct mmap_file *file,
+                 unsigned int offset,
+                 unsigned int size,
+                 unsigned int flags)
+{
+    static long page_size = 0;
+
+    if (!mmap_file_advice_enabled || offset >= file->size)
+        return;
+
+    if (!page_size)
+        page_size = sysconf(_SC_PAGESIZE);
+
+    if (size > file->size - offset)
+        size = file->size - offset;
+
+    /* views do not necessarily start at a page boundary */
+    uintptr_t begin = (uintptr_t)file->mapping + offset;
+    uintptr_t start = begin / page_size * page_size;
+    size_t len = begin + size - start;
+    void *addr = (void *)start;
+
+    if (flags & MMAP_FILE_SEQUENTIAL)
+        madvise(addr, len, MADV_SEQUENTIAL);
+    if (flags & MMAP_FILE_RANDOM)
+        madvise(addr, len, MADV_RANDOM);
+    if (flags & MMAP_FILE_WILLNEED)
+        madvise(addr, len, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    if (flags & MMAP_FILE_HUGEPAGES)
+        madvise(addr, len, MADV_HUGEPAGE);
+#endif
+}
+
+/**
+ * starts reading a range of the file in the background so a parser can
+ * warm the next region before it gets there
+ */
+void
+mmap_file_prefetch(struct mmap_file *file,
+                   unsigned int offset,
+                   unsigned int size)
+{
+    mmap_file_advise(file, offset, size, MMAP_FILE_WILLNEED);
+}
+
 /**
  *
  */
@@ -72,23 +185,485 @@ mmap_file_name(struct mmap_file *file)
     return file->name;
 }
 
+/**
+ *
+ */
+unsigned long
+mmap_file_size(struct mmap_file *file)
+{
+    return file->size;
+}
+
+/**
+ * identifies the contents at ptr inside the mapping of file, independent
+ * of the process and the name the file was opened with
+ * views resolve to the file they are part of
+ */
+void
+mmap_file_identity(struct mmap_file *file,
+                   const void *ptr,
+                   struct mmap_file_identity *id)
+{
+    struct mmap_file *root = file;
+
+    while (root->parent)
+        root = root->parent;
+
+    id->dev = root->dev;
+    id->ino = root->ino;
+    id->mtime = root->mtime;
+    id->size = root->size;
+    id->offset = (const char *)ptr - (const char *)root->mapping;
+}
+
+static unsigned int
+mmap_file_hash_name(const char *name)
+{
+    unsigned int hash = 2166136261u;
+    for (; *name; name++)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
+}
+
+static unsigned int
+mmap_file_hash_inode(dev_t dev, ino_t ino)
+{
+    uint64_t hash = ((uint64_t)dev * 0x9e3779b97f4a7c15ull) ^ (uint64_t)ino;
+    return (unsigned int)(hash ^ (hash >> 32)) % MMAP_FILE_CACHE_BUCKETS;
+}
+
+static void
+mmap_file_idle_remove(struct mmap_file *file)
+{
+    struct mmap_file_cache *cache = &mmap_file_cache;
+
+    if (file->idle_prev)
+        file->idle_prev->idle_next = file->idle_next;
+    else
+        cache->idle_head = file->idle_next;
+    if (file->idle_next)
+        file->idle_next->idle_prev = file->idle_prev;
+    else
+        cache->idle_tail = file->idle_prev;
+
+    file->idle_prev = file->idle_next = NULL;
+    cache->num_idle--;
+}
+
+static void
+mmap_file_idle_push(struct mmap_file *file)
+{
+    struct mmap_file_cache *cache = &mmap_file_cache;
+
+    file->idle_prev = NULL;
+    file->idle_next = cache->idle_head;
+    if (cache->idle_head)
+        cache->idle_head->idle_prev = file;
+    else
+        cache->idle_tail = file;
+    cache->idle_head = file;
+    cache->num_idle++;
+}
+
+static void
+mmap_file_cache_insert(struct mmap_file *file)
+{
+    struct mmap_file_cache *cache = &mmap_file_cache;
+    unsigned int name_bucket = file->name_hash % MMAP_FILE_CACHE_BUCKETS;
+    unsigned int inode_bucket = mmap_file_hash_inode(file->dev, file->ino);
+
+    file->cached = 1;
+    file->name_next = cache->by_name[name_bucket];
+    cache->by_name[name_bucket] = file;
+
+    /* views share the inode of their parent */
+    if (file->parent)
+        return;
+    file->inode_next = cache->by_inode[inode_bucket];
+    cache->by_inode[inode_bucket] = file;
+}
+
+static void
+mmap_file_cache_remove(struct mmap_file *file)
+{
+    struct mmap_file_cache *cache = &mmap_file_cache;
+    struct mmap_file **link;
+
+    link = &cache->by_name[file->name_hash % MMAP_FILE_CACHE_BUCKETS];
+    while (*link && *link != file)
+        link = &(*link)->name_next;
+    if (*link)
+        *link = file->name_next;
+
+    link = &cache->by_inode[mmap_file_hash_inode(file->dev, file->ino)];
+    while (*link && *link != file)
+        link = &(*link)->inode_next;
+    if (*link)
+        *link = file->inode_next;
+}
+
+static struct mmap_file *
+mmap_file_cache_find_name(const char *name, unsigned int name_hash)
+{
+    struct mmap_file *file =
+        mmap_file_cache.by_name[name_hash % MMAP_FILE_CACHE_BUCKETS];
+
+    for (; file; file = file->name_next) {
+        if (file->name_hash == name_hash && strcmp(file->name, name) == 0)
+            return file;
+    }
+    return NULL;
+}
+
+static struct mmap_file *
+mmap_file_cache_find_inode(dev_t dev, ino_t ino)
+{
+    struct mmap_file *file =
+        mmap_file_cache.by_inode[mmap_file_hash_inode(dev, ino)];
+
+    for (; file; file = file->inode_next) {
+        if (file->dev == dev && file->ino == ino && !file->parent)
+            return file;
+    }
+    return NULL;
+}
+
+/**
+ * takes a reference to a cached file
+ * must be called with the cache mutex held, the returned hints the file
+ * did not get yet have to be applied with mmap_file_advise after unlocking
+ */
+static unsigned int
+mmap_file_ref(struct mmap_file *file, unsigned int flags)
+{
+    unsigned int advise = 0;
+
+    if (file->refcount++ == 0)
+        mmap_file_idle_remove(file);
+
+    if (mmap_file_advice_enabled && (flags & ~file->flags)) {
+        advise = flags & ~file->flags;
+        file->flags |= flags;
+    }
+
+    return advise;
+}
+
+static void
+mmap_file_destroy(struct mmap_file *file)
+{
+    if (file->name)
+        free(file->name);
+
+    if (file->mapping && !file->parent) {
+        assert(file->size > 0);
+        munmap(file->mapping, file->size);
+        file_stats_add(FILE_STAT_MAPPED_FILES, -1);
+        file_stats_add(FILE_STAT_MAPPED_BYTES, -(int64_t)file->size);
+    }
+
+    if(file->fd >= 0)
+        close(file->fd);
+
+    free(file);
+}
+
+static void
+mmap_file_cache_trim(unsigned int keep);
+
+/**
+ * drops a reference
+ * must be called with the cache mutex held
+ */
+static void
+mmap_file_unref(struct mmap_file *file)
+{
+    assert(file->refcount > 0);
+    if (--file->refcount > 0)
+        return;
+
+    if (file->cached) {
+        mmap_file_idle_push(file);
+        mmap_file_cache_trim(mmap_file_cache.keep_alive);
+        return;
+    }
+
+    struct mmap_file *parent = file->parent;
+    mmap_file_destroy(file);
+    if (parent)
+        mmap_file_unref(parent);
+}
+
+/**
+ * unmaps unreferenced files until at most keep files are left
+ * must be called with the cache mutex held
+ */
+static void
+mmap_file_cache_trim(unsigned int keep)
+{
+    struct mmap_file_cache *cache = &mmap_file_cache;
+
+    while (cache->num_idle > keep) {
+        struct mmap_file *file = cache->idle_tail;
+        struct mmap_file *parent = file->parent;
+        mmap_file_idle_remove(file);
+        mmap_file_cache_remove(file);
+        mmap_file_destroy(file);
+        /* might put the parent on the idle list */
+        if (parent)
+            mmap_file_unref(parent);
+    }
+}
+
+/**
+ * sets how many unreferenced files stay mapped
+ * reopening one of them by name does not need a syscall, files changed on
+ * disk have to be dropped with mmap_file_invalidate
+ */
+void
+mmap_file_set_keep_alive(unsigned int num_files)
+{
+    pthread_mutex_lock(&mmap_file_cache.mutex);
+    mmap_file_cache.keep_alive = num_files;
+    mmap_file_cache_trim(num_files);
+    pthread_mutex_unlock(&mmap_file_cache.mutex);
+}
+
+/**
+ * unmaps all unreferenced files
+ */
+void
+mmap_file_cache_flush(void)
+{
+    pthread_mutex_lock(&mmap_file_cache.mutex);
+    mmap_file_cache_trim(0);
+    pthread_mutex_unlock(&mmap_file_cache.mutex);
+}
+
+/**
+ * drops a file from the cache, it gets unmapped once the last reference
+ * is gone
+ * must be called with the cache mutex held
+ */
+static void
+mmap_file_cache_detach(struct mmap_file *file)
+{
+    mmap_file_cache_remove(file);
+    file->cached = 0;
+
+    if (file->refcount == 0) {
+        struct mmap_file *parent = file->parent;
+        mmap_file_idle_remove(file);
+        mmap_file_destroy(file);
+        if (parent)
+            mmap_file_unref(parent);
+    }
+}
+
+/**
+ * finds the mapping of an inode which was just stat'ed under another name
+ * a mapping whose size or modification time differs got changed in place
+ * since and is detached
+ * must be called with the cache mutex held
+ */
+static struct mmap_file *
+mmap_file_cache_find_current(struct mmap_file *file)
+{
+    struct mmap_file *cached = mmap_file_cache_find_inode(file->dev,
+                                                          file->ino);
+
+    if (cached && (cached->mtime != file->mtime ||
+                   cached->size != file->size)) {
+        mmap_file_cache_detach(cached);
+        cached = NULL;
+    }
+    return cached;
+}
+
+/**
+ * forgets the mapping of a file which changed on disk
+ * the next mmap_file_open maps it again, open references keep the old
+ * mapping. Other names of the same file are forgotten as well.
+ *
+ * returns 1 if the file was mapped
+ */
+int
+mmap_file_invalidate(const char *file_name)
+{
+    unsigned int name_hash = mmap_file_hash_name(file_name);
+    unsigned int i;
+
+    pthread_mutex_lock(&mmap_file_cache.mutex);
+    struct mmap_file *file = mmap_file_cache_find_name(file_name, name_hash);
+    if (!file) {
+        pthread_mutex_unlock(&mmap_file_cache.mutex);
+        return 0;
+    }
+
+    dev_t dev = file->dev;
+    ino_t ino = file->ino;
+    int is_view = file->parent != NULL;
+    mmap_file_cache_detach(file);
+
+    /* a file changed in place keeps its inode */
+    for (i = 0; !is_view && i < MMAP_FILE_CACHE_BUCKETS; i++) {
+        struct mmap_file *next, *alias = mmap_file_cache.by_name[i];
+        for (; alias; alias = next) {
+            next = alias->name_next;
+            if (alias->dev == dev && alias->ino == ino && !alias->parent)
+                mmap_file_cache_detach(alias);
+        }
+    }
+    pthread_mutex_unlock(&mmap_file_cache.mutex);
+
+    return 1;
+}
+
+/**
+ * creates a view of size bytes at offset into parent
+ * a named view gets cached like a file and is returned by mmap_file_open,
+ * the view holds a reference to parent
+ *
+ * returns a struct mmap_file on success, otherwise NULL and err gets set
+ */
+struct mmap_file *
+mmap_file_open_range(struct mmap_file *parent,
+                     unsigned long offset,
+                     unsigned long size,
+                     const char *name,
+                     unsigned int flags,
+                     int *err_out)
+{
+    int err = 0, named = name != NULL;
+    unsigned int name_hash = 0;
+    struct mmap_file *file = NULL;
+
+    if (offset > (unsigned long)parent->size ||
+        size > (unsigned long)parent->size - offset) {
+        DEBUG_ERROR("view is out of range\n");
+        err = EINVAL;
+        goto error;
+    }
+
+    if (!mmap_file_advice_enabled)
+        flags = 0;
+
+    /* a view is already in memory, populating means reading ahead */
+    if (flags & MMAP_FILE_POPULATE)
+        flags = (flags & ~MMAP_FILE_POPULATE) | MMAP_FILE_WILLNEED;
+
+    if (named)
+        name_hash = mmap_file_hash_name(name);
+    else
+        name = parent->name;
+
+    file = malloc(sizeof(*file));
+    if (!file) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(file, 0, sizeof(*file));
+    file->fd = -1;
+    file->name_hash = name_hash;
+    file->refcount = 1;
+    file->flags = flags;
+    file->dev = parent->dev;
+    file->ino = parent->ino;
+    file->parent = parent;
+    file->size = size;
+    file->mapping = (char *)parent->mapping + offset;
+
+    file->name = strdup(name);
+    if (!file->name) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+
+    pthread_mutex_lock(&mmap_file_cache.mutex);
+    struct mmap_file *cached = NULL;
+    unsigned int advise = 0;
+    if (named) {
+        cached = mmap_file_cache_find_name(name, name_hash);
+        if (cached)
+            advise = mmap_file_ref(cached, flags);
+        else
+            mmap_file_cache_insert(file);
+    }
+    if (!cached)
+        mmap_file_ref(parent, 0);
+    pthread_mutex_unlock(&mmap_file_cache.mutex);
+
+    if (cached) {
+        mmap_file_destroy(file);
+        mmap_file_advise(cached, 0, cached->size, advise);
+        return cached;
+    }
+
+    mmap_file_advise(file, 0, file->size, flags);
+
+    return file;
+
+error:
+    if (file)
+        mmap_file_destroy(file);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
 /**
  * mmap a file
+ * flags are MMAP_FILE_* hints about how the file will be accessed
+ * files which are already mapped are shared, a file found by name is
+ * reused without looking at the disk until mmap_file_invalidate drops it,
+ * a different name for the same file is found by its device and inode
+ * unless its size or modification time changed
  * 
  * returns a struct mmap_file on success, otherwise NULL and err gets set
  */
 struct mmap_file *
-mmap_file_open(const char *file_name, int *err_out)
+mmap_file_open(const char *file_name, unsigned int flags, int *err_out)
 {
+    TRACE_ZONE("mmap_file_open");
     int err = 0;
+    unsigned int name_hash = mmap_file_hash_name(file_name);
+    unsigned int advise = 0;
+    struct mmap_file *file = NULL, *cached = NULL;
+
+    if (!mmap_file_advice_enabled)
+        flags = 0;
+
+    pthread_mutex_lock(&mmap_file_cache.mutex);
+    cached = mmap_file_cache_find_name(file_name, name_hash);
+    if (cached)
+        advise = mmap_file_ref(cached, flags);
+    pthread_mutex_unlock(&mmap_file_cache.mutex);
+    if (cached) {
+        mmap_file_advise(cached, 0, cached->size, advise);
+        return cached;
+    }
 
-    struct mmap_file *file = malloc(sizeof(*file));
+    /* mounted packs hide files of the same name */
+    file = pack_mount_open(file_name, flags, &err);
+    if (file)
+        return file;
+    if (err != ENOENT)
+        goto error;
+    err = 0;
+
+    file = malloc(sizeof(*file));
     if (!file) {
         DEBUG_ERROR("out of memory\n");
         err = ENOMEM;
         goto error;
     }
     memset(file, 0, sizeof(*file));
+    file->fd = -1;
+    file->name_hash = name_hash;
+    file->refcount = 1;
+    file->flags = flags;
 
     file->name = strdup(file_name);
     if (!file->name) {
@@ -107,37 +682,82 @@ mmap_file_open(const char *file_name, int *err_out)
     struct stat file_stat;
     if (fstat(file->fd, &file_stat) < 0) {
         DEBUG_ERROR("fstat failed: %s (%d)\n", strerror(errno), errno);
-        close(file->fd);
         err = errno;
         goto error;
     }
-
+    file->dev = file_stat.st_dev;
+    file->ino = file_stat.st_ino;
     file->size = file_stat.st_size;
+    file->mtime = (uint64_t)file_stat.st_mtim.tv_sec * 1000000000ull +
+                  file_stat.st_mtim.tv_nsec;
+
+    /* mapped under another name, unless it changed in place since */
+    pthread_mutex_lock(&mmap_file_cache.mutex);
+    cached = mmap_file_cache_find_current(file);
+    if (cached)
+        advise = mmap_file_ref(cached, flags);
+    pthread_mutex_unlock(&mmap_file_cache.mutex);
+    if (cached) {
+        mmap_file_destroy(file);
+        mmap_file_advise(cached, 0, cached->size, advise);
+        return cached;
+    }
+
+    if (flags & MMAP_FILE_SEQUENTIAL)
+        posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
     file->mapping = mmap(NULL,
                          file_stat.st_size,
                          PROT_READ,
-                         MAP_PRIVATE,
+                         MAP_PRIVATE |
+                           (flags & MMAP_FILE_POPULATE ? MAP_POPULATE : 0),
                          file->fd,
                          0);
 
     if (file->mapping == MAP_FAILED) {
         DEBUG_ERROR("mmaped failed: %s (%d)\n", strerror(errno), errno);
-        close(file->fd);
+        file->mapping = NULL;
         err = errno;
         goto error;
     }
+    file_stats_add(FILE_STAT_FILES_MAPPED, 1);
+    file_stats_add(FILE_STAT_MAPPED_FILES, 1);
+    file_stats_add(FILE_STAT_MAPPED_BYTES, file->size);
+
+    /* the mapping keeps the file alive */
+    close(file->fd);
+    file->fd = -1;
+
+    mmap_file_advise(file, 0, file->size, flags);
+
+    pthread_mutex_lock(&mmap_file_cache.mutex);
+    /* another thread might have mapped it in the meantime */
+    cached = mmap_file_cache_find_current(file);
+    if (cached)
+        advise = mmap_file_ref(cached, flags);
+    else
+        mmap_file_cache_insert(file);
+    pthread_mutex_unlock(&mmap_file_cache.mutex);
+    if (cached) {
+        mmap_file_destroy(file);
+        mmap_file_advise(cached, 0, cached->size, advise);
+        return cached;
+    }
 
     return file;
 
 error:
-    mmap_file_close(file);
+    if (file)
+        mmap_file_destroy(file);
     if (err_out)
         *err_out = err;
     return NULL;
 }
 
 /**
- * munmaps a file
+ * drops a reference to a file
+ * the file gets munmaped once the last reference is gone and it does not
+ * fit into the keep-alive list
  *
  * returns 0 on success
  */
@@ -147,18 +767,9 @@ mmap_file_close(struct mmap_file *file)
     if (!file)
         return 0;
 
-    if (file->name)
-        free(file->name);
-
-    if (file->mapping) {
-        assert(file->size > 0);
-        munmap(file->mapping, file->size);
-    }
-
-    if(file->fd > 0)
-        close(file->fd);
-
-    free(file);
+    pthread_mutex_lock(&mmap_file_cache.mutex);
+    mmap_file_unref(file);
+    pthread_mutex_unlock(&mmap_file_cache.mutex);
 
     return 0;
 }
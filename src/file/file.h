@@ -20,10 +20,38 @@
 #ifndef __FILE_FILE_H__
 #define __FILE_FILE_H__
 
+#include <stdint.h>
+
+/* access pattern hints for mmap_file_open and mmap_file_advise */
+#define MMAP_FILE_SEQUENTIAL (1 << 0)
+#define MMAP_FILE_RANDOM     (1 << 1)
+#define MMAP_FILE_WILLNEED   (1 << 2)
+#define MMAP_FILE_POPULATE   (1 << 3)
+#define MMAP_FILE_HUGEPAGES  (1 << 4)
+
 struct mmap_file;
 
+/**
+ * where some data comes from, see mmap_file_identity
+ */
+struct mmap_file_identity {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t mtime;
+    uint64_t size;
+    uint64_t offset;
+};
+
 struct mmap_file *
-mmap_file_open(const char *file_name, int *err_out);
+mmap_file_open(const char *file_name, unsigned int flags, int *err_out);
+
+struct mmap_file *
+mmap_file_open_range(struct mmap_file *parent,
+                     unsigned long offset,
+                     unsigned long size,
+                     const char *name,
+                     unsigned int flags,
+                     int *err_out);
 
 int
 mmap_file_close(struct mmap_file *file);
@@ -31,9 +59,40 @@ mmap_file_close(struct mmap_file *file);
 const char *
 mmap_file_name(struct mmap_file *file);
 
+unsigned long
+mmap_file_size(struct mmap_file *file);
+
 void *
 mmap_file_ptr_offset(struct mmap_file *file,
                      unsigned int offset,
                      unsigned int size);
 
+void
+mmap_file_identity(struct mmap_file *file,
+                   const void *ptr,
+                   struct mmap_file_identity *id);
+
+void
+mmap_file_advise(struct mmap_file *file,
+                 unsigned int offset,
+                 unsigned int size,
+                 unsigned int flags);
+
+void
+mmap_file_prefetch(struct mmap_file *file,
+                   unsigned int offset,
+                   unsigned int size);
+
+void
+mmap_file_set_advice_enabled(int enabled);
+
+void
+mmap_file_set_keep_alive(unsigned int num_files);
+
+void
+mmap_file_cache_flush(void);
+
+int
+mmap_file_invalidate(const char *file_name);
+
 #endif /* __FILE_FILE_H__ */
@@ -0,0 +1,640 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * pack file format
+ * ================
+ *
+ * struct pack_header header;
+ * struct pack_entry entries[header.num_entries];
+ * char names[header.names_size];
+ * for(header.num_entries) {
+ *   padding to PACK_ALIGN;
+ *   binary data[entry.size];
+ * }
+ *
+ * All numbers are little endian. The directory is sorted by the 64 bit
+ * FNV-1a hash of the entry names and names are null terminated. The data
+ * of every entry starts at a page boundary so a view of an entry can be
+ * handed to the parsers like a mapping of a loose file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "file.h"
+#include "pack.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+#define __PACKED__ __attribute__ ((__packed__))
+
+#define PACK_MAGIC "DSPNPACK"
+#define PACK_MAX_MOUNTS 16
+
+/**
+ * pack file header
+ */
+struct __PACKED__ pack_header {
+    uint8_t magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+    /* offset of the names from the start of the file */
+    uint64_t names_offset;
+    uint64_t names_size;
+    uint64_t file_size;
+};
+
+/**
+ * pack directory entry
+ */
+struct __PACKED__ pack_entry {
+    /* FNV-1a hash of the name */
+    uint64_t hash;
+    /* offset of the data from the start of the file */
+    uint64_t offset;
+    uint64_t size;
+    /* offset into the names */
+    uint32_t name_offset;
+    /* name length without the null terminator */
+    uint32_t name_size;
+};
+
+/**
+ * pack
+ * read only, everything points into the mapping
+ */
+struct pack {
+    struct mmap_file *file;
+    unsigned int num_entries;
+    const struct pack_entry *entries;
+    const char *names;
+};
+
+/**
+ * a pack hiding loose files below prefix
+ */
+struct pack_mount {
+    struct pack *pack;
+    char *prefix;
+    size_t prefix_len;
+};
+
+static pthread_mutex_t pack_mounts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pack_mount pack_mounts[PACK_MAX_MOUNTS];
+static unsigned int pack_num_mounts = 0;
+
+static uint64_t
+pack_hash(const char *name, size_t len)
+{
+    uint64_t hash = 14695981039346656037ull;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)name[i]) * 1099511628211ull;
+    return hash;
+}
+
+/**
+ * opens a pack
+ * the directory gets validated once, entries can be used unchecked after
+ *
+ * returns a struct pack on success, otherwise NULL and err gets set
+ */
+struct pack *
+pack_open(const char *file_name, int *err_out)
+{
+    int err = 0;
+    unsigned int i;
+
+    struct pack *pack = malloc(sizeof(*pack));
+    if (!pack) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(pack, 0, sizeof(*pack));
+
+    /* entries get looked up in no particular order */
+    pack->file = mmap_file_open(file_name, MMAP_FILE_RANDOM, &err);
+    if (!pack->file) {
+        DEBUG_ERROR("cannot open file %s: %s (%d)\n",
+                    file_name,
+                    strerror(err),
+                    err);
+        goto error;
+    }
+
+    unsigned long file_size = mmap_file_size(pack->file);
+    const struct pack_header *header =
+        mmap_file_ptr_offset(pack->file, 0, sizeof(*header));
+    if (!header ||
+        memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) != 0 ||
+        le32toh(header->version) != PACK_VERSION ||
+        le64toh(header->file_size) != file_size) {
+        DEBUG_ERROR("file is not a pack or has the wrong version\n");
+        err = EILSEQ;
+        goto error;
+    }
+
+    pack->num_entries = le32toh(header->num_entries);
+    uint64_t names_offset = le64toh(header->names_offset);
+    uint64_t names_size = le64toh(header->names_size);
+    uint64_t directory_size =
+        (uint64_t)pack->num_entries * sizeof(struct pack_entry);
+
+    if (sizeof(*header) + directory_size > names_offset ||
+        names_offset > file_size ||
+        names_size > file_size - names_offset) {
+        DEBUG_ERROR("directory is out of range\n");
+        err = EILSEQ;
+        goto error;
+    }
+
+    pack->entries = mmap_file_ptr_offset(pack->file,
+                                         sizeof(*header),
+                                         directory_size);
+    pack->names = mmap_file_ptr_offset(pack->file, names_offset, names_size);
+
+    /* the directory is needed right away */
+    mmap_file_prefetch(pack->file, 0, names_offset + names_size);
+
+    for (i = 0; i < pack->num_entries; i++) {
+        const struct pack_entry *entry = &pack->entries[i];
+        uint64_t offset = le64toh(entry->offset);
+        uint64_t size = le64toh(entry->size);
+        uint64_t name_offset = le32toh(entry->name_offset);
+        uint64_t name_size = le32toh(entry->name_size);
+
+        if (offset > file_size || size > file_size - offset ||
+            name_offset + name_size >= names_size ||
+            pack->names[name_offset + name_size] != '\0' ||
+            pack_hash(pack->names + name_offset, name_size) !=
+                le64toh(entry->hash) ||
+            (i > 0 && le64toh(entry->hash) < le64toh(entry[-1].hash))) {
+            DEBUG_ERROR("entry %u is malformed\n", i);
+            err = EILSEQ;
+            goto error;
+        }
+    }
+
+    return pack;
+
+error:
+    pack_close(pack);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+/**
+ * closes a pack
+ * views of entries stay valid
+ */
+void
+pack_close(struct pack *pack)
+{
+    if (!pack)
+        return;
+
+    if (pack->file)
+        mmap_file_close(pack->file);
+
+    free(pack);
+}
+
+unsigned int
+pack_num_entries(struct pack *pack)
+{
+    return pack->num_entries;
+}
+
+/**
+ * returns the null terminated name of an entry
+ */
+const char *
+pack_entry_name(struct pack *pack, unsigned int entry, unsigned int *len)
+{
+    const struct pack_entry *e = &pack->entries[entry];
+
+    if (len)
+        *len = le32toh(e->name_size);
+    return pack->names + le32toh(e->name_offset);
+}
+
+unsigned long
+pack_entry_size(struct pack *pack, unsigned int entry)
+{
+    return le64toh(pack->entries[entry].size);
+}
+
+/**
+ * looks up an entry by name
+ *
+ * returns 1 and sets entry if found, otherwise 0
+ */
+int
+pack_find(struct pack *pack, const char *name, unsigned int *entry)
+{
+    size_t len = strlen(name);
+    uint64_t hash = pack_hash(name, len);
+    unsigned int low = 0, high = pack->num_entries;
+
+    while (low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        if (le64toh(pack->entries[mid].hash) < hash)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    for (; low < pack->num_entries; low++) {
+        const struct pack_entry *e = &pack->entries[low];
+        if (le64toh(e->hash) != hash)
+            break;
+        if (le32toh(e->name_size) == len &&
+            memcmp(pack->names + le32toh(e->name_offset), name, len) == 0) {
+            *entry = low;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static struct mmap_file *
+pack_view(struct pack *pack,
+          unsigned int entry,
+          const char *name,
+          unsigned int flags,
+          int *err_out)
+{
+    const struct pack_entry *e = &pack->entries[entry];
+
+    return mmap_file_open_range(pack->file,
+                                le64toh(e->offset),
+                                le64toh(e->size),
+                                name,
+                                flags,
+                                err_out);
+}
+
+/**
+ * returns a view of an entry which can be used like a mapping of the
+ * original file, it has to be closed with mmap_file_close
+ */
+struct mmap_file *
+pack_open_entry(struct pack *pack,
+                unsigned int entry,
+                unsigned int flags,
+                int *err_out)
+{
+    return pack_view(pack, entry, NULL, flags, err_out);
+}
+
+/**
+ * mounts a pack so mmap_file_open finds its entries
+ * a file prefix/name opens the entry name, packs mounted later win
+ *
+ * returns 0 on success
+ */
+int
+pack_mount(const char *file_name, const char *prefix)
+{
+    int err = 0;
+    struct pack *pack = NULL;
+    char *prefix_copy = NULL;
+
+    if (!prefix)
+        prefix = "";
+
+    pack = pack_open(file_name, &err);
+    if (!pack)
+        goto error;
+
+    prefix_copy = strdup(prefix);
+    if (!prefix_copy) {
+        err = ENOMEM;
+        goto error;
+    }
+
+    pthread_mutex_lock(&pack_mounts_mutex);
+    if (pack_num_mounts == PACK_MAX_MOUNTS) {
+        pthread_mutex_unlock(&pack_mounts_mutex);
+        DEBUG_ERROR("too many packs mounted\n");
+        err = ENOSPC;
+        goto error;
+    }
+    struct pack_mount *mount = &pack_mounts[pack_num_mounts++];
+    mount->pack = pack;
+    mount->prefix = prefix_copy;
+    mount->prefix_len = strlen(prefix_copy);
+    pthread_mutex_unlock(&pack_mounts_mutex);
+
+    return 0;
+
+error:
+    free(prefix_copy);
+    pack_close(pack);
+    return err;
+}
+
+/**
+ * unmounts all packs
+ * files opened from them stay valid
+ */
+void
+pack_unmount_all(void)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&pack_mounts_mutex);
+    for (i = 0; i < pack_num_mounts; i++) {
+        pack_close(pack_mounts[i].pack);
+        free(pack_mounts[i].prefix);
+    }
+    pack_num_mounts = 0;
+    pthread_mutex_unlock(&pack_mounts_mutex);
+
+    /* closed views in the keep-alive list would still be found by name */
+    mmap_file_cache_flush();
+}
+
+/**
+ * opens a file from the mounted packs
+ * used by mmap_file_open
+ *
+ * returns a view on success, otherwise NULL and err gets set, ENOENT if
+ * no mounted pack contains the file
+ */
+struct mmap_file *
+pack_mount_open(const char *file_name, unsigned int flags, int *err_out)
+{
+    struct mmap_file *file = NULL;
+    int err = ENOENT;
+    unsigned int i, entry;
+
+    pthread_mutex_lock(&pack_mounts_mutex);
+    for (i = pack_num_mounts; i-- > 0;) {
+        struct pack_mount *mount = &pack_mounts[i];
+        const char *name = file_name;
+
+        if (mount->prefix_len) {
+            if (strncmp(name, mount->prefix, mount->prefix_len) != 0 ||
+                name[mount->prefix_len] != '/')
+                continue;
+            name += mount->prefix_len + 1;
+        }
+
+        if (pack_find(mount->pack, name, &entry)) {
+            file = pack_view(mount->pack, entry, file_name, flags, &err);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pack_mounts_mutex);
+
+    if (!file && err_out)
+        *err_out = err;
+    return file;
+}
+
+struct pack_write_entry {
+    const char *name;
+    size_t name_size;
+    uint64_t hash;
+    uint64_t size;
+    uint64_t offset;
+    uint32_t name_offset;
+};
+
+static int
+pack_write_entry_compare(const void *a, const void *b)
+{
+    const struct pack_write_entry *ea = *(const struct pack_write_entry **)a;
+    const struct pack_write_entry *eb = *(const struct pack_write_entry **)b;
+
+    if (ea->hash != eb->hash)
+        return ea->hash < eb->hash ? -1 : 1;
+    return strcmp(ea->name, eb->name);
+}
+
+static int
+pack_write_padding(FILE *out, uint64_t *offset, uint64_t align)
+{
+    static const char zero[PACK_ALIGN];
+    uint64_t pad = (align - *offset % align) % align;
+
+    if (pad && fwrite(zero, 1, pad, out) != pad)
+        return EIO;
+    *offset += pad;
+    return 0;
+}
+
+static int
+pack_write_path(char *path,
+                size_t path_size,
+                const char *base_dir,
+                const char *name)
+{
+    int len = base_dir ?
+        snprintf(path, path_size, "%s/%s", base_dir, name) :
+        snprintf(path, path_size, "%s", name);
+    return len < 0 || (size_t)len >= path_size ? ENAMETOOLONG : 0;
+}
+
+/**
+ * writes a pack containing the files base_dir/names[i]
+ * the entries get the names as given, their data is laid out in the
+ * given order so files used together can be kept together
+ *
+ * returns 0 on success
+ */
+int
+pack_write(const char *out_file_name,
+           const char *base_dir,
+           const char *const *names,
+           unsigned int num_names)
+{
+    int err = 0;
+    unsigned int i;
+    char path[4096];
+    char buffer[64 * 1024];
+    FILE *out = NULL, *in = NULL;
+    struct pack_write_entry *entries = NULL;
+    struct pack_write_entry **sorted = NULL;
+
+    entries = calloc(num_names ? num_names : 1, sizeof(*entries));
+    sorted = calloc(num_names ? num_names : 1, sizeof(*sorted));
+    if (!entries || !sorted) {
+        err = ENOMEM;
+        goto error;
+    }
+
+    uint64_t names_size = 0;
+    for (i = 0; i < num_names; i++) {
+        struct pack_write_entry *entry = &entries[i];
+        struct stat file_stat;
+
+        if ((err = pack_write_path(path, sizeof(path), base_dir, names[i])))
+            goto error;
+        if (stat(path, &file_stat) < 0) {
+            DEBUG_ERROR("cannot stat %s: %s\n", path, strerror(errno));
+            err = errno;
+            goto error;
+        }
+
+        entry->name = names[i];
+        entry->name_size = strlen(names[i]);
+        entry->hash = pack_hash(entry->name, entry->name_size);
+        entry->size = file_stat.st_size;
+        entry->name_offset = names_size;
+        names_size += entry->name_size + 1;
+        sorted[i] = entry;
+
+        if (names_size > UINT32_MAX) {
+            err = EOVERFLOW;
+            goto error;
+        }
+    }
+
+    qsort(sorted, num_names, sizeof(*sorted), pack_write_entry_compare);
+
+    for (i = 1; i < num_names; i++) {
+        if (pack_write_entry_compare(&sorted[i - 1], &sorted[i]) == 0) {
+            DEBUG_ERROR("%s is packed twice\n", sorted[i]->name);
+            err = EEXIST;
+            goto error;
+        }
+    }
+
+    uint64_t names_offset = sizeof(struct pack_header) +
+                            (uint64_t)num_names * sizeof(struct pack_entry);
+    uint64_t offset = names_offset + names_size;
+    for (i = 0; i < num_names; i++) {
+        offset = (offset + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+        entries[i].offset = offset;
+        offset += entries[i].size;
+    }
+
+    struct pack_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = htole32(PACK_VERSION);
+    header.num_entries = htole32(num_names);
+    header.names_offset = htole64(names_offset);
+    header.names_size = htole64(names_size);
+    header.file_size = htole64(offset);
+
+    out = fopen(out_file_name, "wb");
+    if (!out) {
+        err = errno;
+        goto error;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, out) != 1) {
+        err = EIO;
+        goto error;
+    }
+
+    for (i = 0; i < num_names; i++) {
+        struct pack_entry entry;
+        entry.hash = htole64(sorted[i]->hash);
+        entry.offset = htole64(sorted[i]->offset);
+        entry.size = htole64(sorted[i]->size);
+        entry.name_offset = htole32(sorted[i]->name_offset);
+        entry.name_size = htole32(sorted[i]->name_size);
+        if (fwrite(&entry, sizeof(entry), 1, out) != 1) {
+            err = EIO;
+            goto error;
+        }
+    }
+
+    for (i = 0; i < num_names; i++) {
+        if (fwrite(entries[i].name, 1, entries[i].name_size + 1, out) !=
+            entries[i].name_size + 1) {
+            err = EIO;
+            goto error;
+        }
+    }
+
+    offset = names_offset + names_size;
+    for (i = 0; i < num_names; i++) {
+        if ((err = pack_write_padding(out, &offset, PACK_ALIGN)))
+            goto error;
+
+        pack_write_path(path, sizeof(path), base_dir, names[i]);
+        in = fopen(path, "rb");
+        if (!in) {
+            err = errno;
+            goto error;
+        }
+
+        uint64_t left = entries[i].size;
+        while (left > 0) {
+            size_t chunk = left < sizeof(buffer) ? left : sizeof(buffer);
+            if (fread(buffer, 1, chunk, in) != chunk ||
+                fwrite(buffer, 1, chunk, out) != chunk) {
+                /* the file changed while packing */
+                err = EIO;
+                goto error;
+            }
+            left -= chunk;
+        }
+        offset += entries[i].size;
+
+        fclose(in);
+        in = NULL;
+    }
+
+    if (fclose(out) != 0) {
+        out = NULL;
+        err = EIO;
+        goto error;
+    }
+    out = NULL;
+
+    free(sorted);
+    free(entries);
+    return 0;
+
+error:
+    if (in)
+        fclose(in);
+    if (out) {
+        fclose(out);
+        remove(out_file_name);
+    }
+    free(sorted);
+    free(entries);
+    return err;
+}
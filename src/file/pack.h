@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FILE_PACK_H__
+#define __FILE_PACK_H__
+
+#include "file.h"
+
+/* bump whenever the layout of a pack changes */
+#define PACK_VERSION 1
+/* entries start at multiples of this */
+#define PACK_ALIGN 4096
+
+struct pack;
+
+struct pack *
+pack_open(const char *file_name, int *err_out);
+
+void
+pack_close(struct pack *pack);
+
+unsigned int
+pack_num_entries(struct pack *pack);
+
+const char *
+pack_entry_name(struct pack *pack, unsigned int entry, unsigned int *len);
+
+unsigned long
+pack_entry_size(struct pack *pack, unsigned int entry);
+
+int
+pack_find(struct pack *pack, const char *name, unsigned int *entry);
+
+struct mmap_file *
+pack_open_entry(struct pack *pack,
+                unsigned int entry,
+                unsigned int flags,
+                int *err_out);
+
+int
+pack_mount(const char *file_name, const char *prefix);
+
+void
+pack_unmount_all(void);
+
+struct mmap_file *
+pack_mount_open(const char *file_name, unsigned int flags, int *err_out);
+
+int
+pack_write(const char *out_file_name,
+           const char *base_dir,
+           const char *const *names,
+           unsigned int num_names);
+
+#endif /* __FILE_PACK_H__ */
@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * pixmaps
+ * =======
+ *
+ * Decoded pixmaps carry a small header in front of the pixels which tells
+ * pixmap_free how to release them. Every pixmap returned by the file
+ * decoders has to be released with pixmap_free.
+ *
+ * Shared pixmap cache
+ * -------------------
+ *
+ * Processes working on the same game data can share decoded pixmaps
+ * instead of decoding them again. The cache is opt-in: it is enabled by
+ * pixmap_cache_set_dir or by setting the DESPANDOS_PIXMAP_CACHE
+ * environment variable to a directory, usually on a tmpfs like /dev/shm.
+ *
+ * Every pixmap is a file in that directory, named after a hash of the
+ * source file identity (device, inode, mtime, size and offset) so changed
+ * files never hit stale pixmaps. The header repeats the identity and gets
+ * checked against the lookup to rule out hash collisions. A pixmap is
+ * written to a temporary file and renamed into place once complete, the
+ * files are read-only and get mapped private, so readers never see
+ * partial or changing pixels and no lock or registry process is needed.
+ * Writing to a cached pixmap only copies the touched pages.
+ *
+ * The directory is bounded by pixmap_cache_set_limit. A lookup bumps the
+ * access time of the file and every store evicts the least recently used
+ * files until the cache fits again, pixmaps which are still mapped stay
+ * valid.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "file.h"
+#include "stats.h"
+#include "pixmap.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+#define PIXMAP_MAGIC "DSPNPXMP"
+#define PIXMAP_FILE_PREFIX "despandos-"
+/* the cache directory, the file name and the suffix of temporary files */
+#define PIXMAP_PATH_SIZE (PATH_MAX + 64)
+
+/**
+ * in front of every pixmap, its size keeps the pixels aligned
+ */
+struct pixmap_header {
+    char magic[8];
+    /* only set for cached pixmaps */
+    struct mmap_file_identity source;
+    uint16_t kind;
+    uint16_t bpp;
+    uint32_t width;
+    uint32_t height;
+    /* the pixmap is a mapping of a cached file instead of a malloc'd buffer */
+    uint32_t shared;
+};
+
+_Static_assert(sizeof(struct pixmap_header) == 64,
+               "pixels have to stay aligned");
+
+static struct {
+    pthread_once_t once;
+    pthread_mutex_t mutex;
+    int enabled;
+    char dir[PATH_MAX];
+    /* bytes the files in dir should stay below */
+    size_t limit;
+    /* what this process thinks dir holds, other writers and overwritten
+     * files make it drift, every trim recounts it */
+    uint64_t bytes;
+    int bytes_known;
+} pixmap_cache = {
+    .once = PTHREAD_ONCE_INIT,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .limit = PIXMAP_CACHE_DEFAULT_LIMIT,
+};
+
+/**
+ * a file in the cache directory, see pixmap_cache_trim
+ */
+struct pixmap_cache_file {
+    char name[64];
+    off_t size;
+    struct timespec atime;
+};
+
+static struct pixmap_header *
+pixmap_header(void *pixels)
+{
+    return (struct pixmap_header *)((char *)pixels - sizeof(struct pixmap_header));
+}
+
+static size_t
+pixmap_size(const struct pixmap_header *header)
+{
+    return sizeof(*header) +
+           (size_t)header->width * header->height * header->bpp;
+}
+
+/**
+ * allocates an uninitialized pixmap with bpp bytes per pixel
+ */
+__SYM_EXPORT__ void *
+pixmap_alloc(unsigned int width, unsigned int height, unsigned int bpp)
+{
+    struct pixmap_header *header =
+        malloc(sizeof(*header) + (size_t)width * height * bpp);
+    if (!header)
+        return NULL;
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, PIXMAP_MAGIC, sizeof(header->magic));
+    header->bpp = bpp;
+    header->width = width;
+    header->height = height;
+    file_stats_add(FILE_STAT_PIXMAP_BYTES, pixmap_size(header));
+
+    return header + 1;
+}
+
+__SYM_EXPORT__ void
+pixmap_free(void *pixels)
+{
+    if (!pixels)
+        return;
+
+    struct pixmap_header *header = pixmap_header(pixels);
+    if (header->shared) {
+        munmap(header, pixmap_size(header));
+    } else {
+        file_stats_add(FILE_STAT_PIXMAP_BYTES, -(int64_t)pixmap_size(header));
+        free(header);
+    }
+}
+
+static void
+pixmap_cache_init(void)
+{
+    const char *dir = getenv("DESPANDOS_PIXMAP_CACHE");
+
+    if (dir && *dir)
+        pixmap_cache_set_dir(dir);
+}
+
+/**
+ * enables the shared pixmap cache in dir, NULL disables it
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+pixmap_cache_set_dir(const char *dir)
+{
+    if (dir && strlen(dir) >= sizeof(pixmap_cache.dir))
+        return ENAMETOOLONG;
+
+    pthread_mutex_lock(&pixmap_cache.mutex);
+    pixmap_cache.enabled = dir != NULL;
+    if (dir)
+        strcpy(pixmap_cache.dir, dir);
+    pixmap_cache.bytes_known = 0;
+    pthread_mutex_unlock(&pixmap_cache.mutex);
+
+    return 0;
+}
+
+/**
+ * builds the path of the cached pixmap
+ * returns 0 if the cache is disabled
+ */
+static int
+pixmap_cache_path(const struct mmap_file_identity *source,
+                  unsigned int kind,
+                  char path[PIXMAP_PATH_SIZE])
+{
+    const unsigned char *bytes = (const unsigned char *)source;
+    uint64_t hash = 14695981039346656037ull;
+    unsigned int i;
+    int enabled;
+
+    pthread_once(&pixmap_cache.once, pixmap_cache_init);
+
+    for (i = 0; i < sizeof(*source); i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    hash = (hash ^ kind) * 1099511628211ull;
+
+    pthread_mutex_lock(&pixmap_cache.mutex);
+    enabled = pixmap_cache.enabled;
+    if (enabled)
+        snprintf(path, PIXMAP_PATH_SIZE, "%s/" PIXMAP_FILE_PREFIX "%016llx",
+                 pixmap_cache.dir, (unsigned long long)hash);
+    pthread_mutex_unlock(&pixmap_cache.mutex);
+
+    return enabled;
+}
+
+/**
+ * maps the cached pixmap decoded from source
+ * returns NULL if there is none or the cache is disabled
+ */
+__SYM_EXPORT__ void *
+pixmap_cache_lookup(const struct mmap_file_identity *source,
+                    unsigned int kind,
+                    unsigned int *width,
+                    unsigned int *height)
+{
+    char path[PIXMAP_PATH_SIZE];
+    struct stat file_stat;
+
+    if (!pixmap_cache_path(source, kind, path))
+        return NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &file_stat) < 0 ||
+        file_stat.st_size < (off_t)sizeof(struct pixmap_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    /* copy-on-write, callers may draw into their pixmap */
+    struct pixmap_header *header = mmap(NULL,
+                                        file_stat.st_size,
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE,
+                                        fd,
+                                        0);
+    if (header == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    /* mapping does not count as access, eviction goes by atime */
+    const struct timespec times[2] = {
+        { .tv_nsec = UTIME_NOW },
+        { .tv_nsec = UTIME_OMIT },
+    };
+    futimens(fd, times);
+    close(fd);
+
+    if (memcmp(header->magic, PIXMAP_MAGIC, sizeof(header->magic)) != 0 ||
+        memcmp(&header->source, source, sizeof(*source)) != 0 ||
+        header->kind != kind || !header->shared ||
+        pixmap_size(header) != (size_t)file_stat.st_size) {
+        DEBUG_ERROR("%s does not match\n", path);
+        munmap(header, file_stat.st_size);
+        return NULL;
+    }
+
+    DEBUG_LOG("pixmap cache hit %s\n", path);
+    file_stats_add(FILE_STAT_PIXMAP_CACHE_HITS, 1);
+    *width = header->width;
+    *height = header->height;
+    return header + 1;
+}
+
+static int
+pixmap_cache_file_compare(const void *a, const void *b)
+{
+    const struct pixmap_cache_file *fa = a, *fb = b;
+
+    if (fa->atime.tv_sec != fb->atime.tv_sec)
+        return fa->atime.tv_sec < fb->atime.tv_sec ? -1 : 1;
+    if (fa->atime.tv_nsec != fb->atime.tv_nsec)
+        return fa->atime.tv_nsec < fb->atime.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/**
+ * removes the least recently used pixmaps until the directory fits into
+ * limit bytes, temporary files of other writers are left alone
+ * returns the bytes left in the directory
+ */
+static uint64_t
+pixmap_cache_trim(const char *dir, size_t limit)
+{
+    struct pixmap_cache_file *files = NULL;
+    unsigned int num_files = 0, alloc_files = 0, i;
+    uint64_t total = 0;
+    struct dirent *entry;
+    struct stat file_stat;
+
+    DIR *d = opendir(dir);
+    if (!d)
+        return 0;
+
+    while ((entry = readdir(d))) {
+        if (strncmp(entry->d_name, PIXMAP_FILE_PREFIX,
+                    strlen(PIXMAP_FILE_PREFIX)) != 0 ||
+            strchr(entry->d_name, '.') ||
+            strlen(entry->d_name) >= sizeof(files->name) ||
+            fstatat(dirfd(d), entry->d_name, &file_stat, 0) < 0)
+            continue;
+
+        if (num_files == alloc_files) {
+            unsigned int alloc = alloc_files ? alloc_files * 2 : 64;
+            struct pixmap_cache_file *tmp = realloc(files,
+                                                    sizeof(*tmp) * alloc);
+            if (!tmp)
+                goto out;
+            files = tmp;
+            alloc_files = alloc;
+        }
+
+        strcpy(files[num_files].name, entry->d_name);
+        files[num_files].size = file_stat.st_size;
+        files[num_files].atime = file_stat.st_atim;
+        total += file_stat.st_size;
+        num_files++;
+    }
+
+    if (total <= limit)
+        goto out;
+
+    qsort(files, num_files, sizeof(*files), pixmap_cache_file_compare);
+    for (i = 0; i < num_files && total > limit; i++) {
+        if (unlinkat(dirfd(d), files[i].name, 0) < 0)
+            continue;
+        DEBUG_LOG("evicted %s\n", files[i].name);
+        total -= files[i].size;
+    }
+
+out:
+    free(files);
+    closedir(d);
+    return total;
+}
+
+/**
+ * sets how many bytes of pixmaps the cache directory may hold
+ */
+__SYM_EXPORT__ void
+pixmap_cache_set_limit(size_t max_bytes)
+{
+    pthread_mutex_lock(&pixmap_cache.mutex);
+    pixmap_cache.limit = max_bytes;
+    /* the next store checks against the new limit */
+    pixmap_cache.bytes_known = 0;
+    pthread_mutex_unlock(&pixmap_cache.mutex);
+}
+
+/**
+ * puts a pixmap from pixmap_alloc into the cache
+ * returns the cached copy and frees pixels, or pixels if the cache is
+ * disabled or storing failed
+ */
+__SYM_EXPORT__ void *
+pixmap_cache_store(const struct mmap_file_identity *source,
+                   unsigned int kind,
+                   void *pixels)
+{
+    char path[PIXMAP_PATH_SIZE], tmp_path[PIXMAP_PATH_SIZE + 8];
+    char dir[PATH_MAX];
+    struct pixmap_header *header = pixmap_header(pixels);
+    size_t size = pixmap_size(header), limit;
+    void *mapping = MAP_FAILED;
+    int trim;
+
+    if (!pixmap_cache_path(source, kind, path))
+        return pixels;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        DEBUG_ERROR("cannot create %s: %s\n", tmp_path, strerror(errno));
+        return pixels;
+    }
+
+    if (ftruncate(fd, size) < 0)
+        goto error;
+
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+        goto error;
+
+    memcpy(mapping, header, size);
+    struct pixmap_header *shared = mapping;
+    shared->source = *source;
+    shared->kind = kind;
+    shared->shared = 1;
+
+    if (fchmod(fd, 0444) < 0 ||
+        rename(tmp_path, path) < 0)
+        goto error;
+
+    /* the same private mapping a lookup would return */
+    munmap(mapping, size);
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return pixels;
+    shared = mapping;
+
+    /* the directory is only scanned once the estimate is over the limit */
+    pthread_mutex_lock(&pixmap_cache.mutex);
+    pixmap_cache.bytes += size;
+    trim = !pixmap_cache.bytes_known ||
+           pixmap_cache.bytes > pixmap_cache.limit;
+    strcpy(dir, pixmap_cache.dir);
+    limit = pixmap_cache.limit;
+    pthread_mutex_unlock(&pixmap_cache.mutex);
+
+    if (trim) {
+        uint64_t bytes = pixmap_cache_trim(dir, limit);
+
+        pthread_mutex_lock(&pixmap_cache.mutex);
+        pixmap_cache.bytes = bytes;
+        pixmap_cache.bytes_known = 1;
+        pthread_mutex_unlock(&pixmap_cache.mutex);
+    }
+
+    pixmap_free(pixels);
+    return shared + 1;
+
+error:
+    DEBUG_ERROR("cannot store %s: %s\n", path, strerror(errno));
+    if (mapping != MAP_FAILED)
+        munmap(mapping, size);
+    unlink(tmp_path);
+    close(fd);
+    return pixels;
+}
+
+/**
+ * removes all cached pixmaps, mapped ones stay valid
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+pixmap_cache_clear(void)
+{
+    char dir[PATH_MAX];
+    struct dirent *entry;
+
+    pthread_once(&pixmap_cache.once, pixmap_cache_init);
+
+    pthread_mutex_lock(&pixmap_cache.mutex);
+    int enabled = pixmap_cache.enabled;
+    strcpy(dir, pixmap_cache.dir);
+    pthread_mutex_unlock(&pixmap_cache.mutex);
+    if (!enabled)
+        return 0;
+
+    DIR *d = opendir(dir);
+    if (!d)
+        return errno;
+
+    while ((entry = readdir(d))) {
+        if (strncmp(entry->d_name, PIXMAP_FILE_PREFIX,
+                    strlen(PIXMAP_FILE_PREFIX)) == 0)
+            unlinkat(dirfd(d), entry->d_name, 0);
+    }
+    closedir(d);
+
+    pthread_mutex_lock(&pixmap_cache.mutex);
+    pixmap_cache.bytes = 0;
+    pixmap_cache.bytes_known = 1;
+    pthread_mutex_unlock(&pixmap_cache.mutex);
+
+    return 0;
+}
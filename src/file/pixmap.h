@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __FILE_PIXMAP_H__
+#define __FILE_PIXMAP_H__
+
+#include <stddef.h>
+
+#include "file.h"
+
+/* what a cached pixmap was decoded from */
+#define PIXMAP_KIND_DVF_FRAME 1
+#define PIXMAP_KIND_DVM       2
+
+/* default size limit of the shared pixmap cache */
+#define PIXMAP_CACHE_DEFAULT_LIMIT (256ul * 1024 * 1024)
+
+/*
+ * pixmaps returned by the decoders can be written, a pixmap from the
+ * shared cache is a private copy-on-write mapping so writes never reach
+ * the cache or other processes
+ */
+void *
+pixmap_alloc(unsigned int width, unsigned int height, unsigned int bpp);
+
+void
+pixmap_free(void *pixels);
+
+int
+pixmap_cache_set_dir(const char *dir);
+
+void *
+pixmap_cache_lookup(const struct mmap_file_identity *source,
+                    unsigned int kind,
+                    unsigned int *width,
+                    unsigned int *height);
+
+void *
+pixmap_cache_store(const struct mmap_file_identity *source,
+                   unsigned int kind,
+                   void *pixels);
+
+void
+pixmap_cache_set_limit(size_t max_bytes);
+
+int
+pixmap_cache_clear(void);
+
+#endif /* __FILE_PIXMAP_H__ */
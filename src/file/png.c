@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * png encoder
+ * ===========
+ *
+ * Writes 8 bit RGBA or RGB images without filtering. Rows are converted
+ * and deflated one at a time and the output is streamed to the file in
+ * IDAT chunks, so the whole compressed image never sits in memory.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <zlib.h>
+
+#include "png.h"
+
+#define PNG_CHUNK_SIZE (64 * 1024)
+
+struct png_writer {
+    FILE *out;
+    /* first error, later writes are skipped */
+    int err;
+    unsigned long size;
+    z_stream strm;
+    uint8_t chunk[PNG_CHUNK_SIZE];
+};
+
+static void
+png_write_data(struct png_writer *writer, const void *data, size_t len)
+{
+    if (!writer->err && len && fwrite(data, 1, len, writer->out) != len)
+        writer->err = EIO;
+    writer->size += len;
+}
+
+static void
+png_write_u32(struct png_writer *writer, uint32_t value)
+{
+    uint8_t data[4] = { value >> 24, value >> 16, value >> 8, value };
+    png_write_data(writer, data, sizeof(data));
+}
+
+static void
+png_write_chunk(struct png_writer *writer,
+                const char *type,
+                const void *data,
+                uint32_t len)
+{
+    uLong crc = crc32(0, (const Bytef *)type, 4);
+    if (len)
+        crc = crc32(crc, data, len);
+
+    png_write_u32(writer, len);
+    png_write_data(writer, type, 4);
+    png_write_data(writer, data, len);
+    png_write_u32(writer, crc);
+}
+
+/**
+ * deflates the pending input, every full chunk becomes an IDAT
+ */
+static int
+png_deflate(struct png_writer *writer, int flush)
+{
+    int res;
+
+    do {
+        res = deflate(&writer->strm, flush);
+        if (res == Z_STREAM_ERROR)
+            return EIO;
+
+        if (writer->strm.avail_out == 0 || res == Z_STREAM_END) {
+            png_write_chunk(writer,
+                            "IDAT",
+                            writer->chunk,
+                            PNG_CHUNK_SIZE - writer->strm.avail_out);
+            writer->strm.next_out = writer->chunk;
+            writer->strm.avail_out = PNG_CHUNK_SIZE;
+        }
+    } while (writer->strm.avail_in ||
+             (flush == Z_FINISH && res != Z_STREAM_END));
+
+    return writer->err;
+}
+
+/**
+ * converts one row to the png pixel layout, preceded by the filter type
+ */
+static void
+png_convert_row(uint8_t *dest,
+                const uint8_t *src,
+                unsigned int width,
+                int format)
+{
+    unsigned int i;
+
+    /* no filter */
+    *dest++ = 0;
+
+    if (format == PNG_FORMAT_B8G8R8A8) {
+        for (i = 0; i < width; i++, src += 4, dest += 4) {
+            dest[0] = src[2];
+            dest[1] = src[1];
+            dest[2] = src[0];
+            dest[3] = src[3];
+        }
+    }
+    else {
+        for (i = 0; i < width; i++, src += 2, dest += 3) {
+            unsigned int color = src[0] | src[1] << 8;
+            unsigned int r = (color >> 11) & 0x1f;
+            unsigned int g = (color >> 5) & 0x3f;
+            unsigned int b = color & 0x1f;
+
+            dest[0] = r * 8 + r / 4;
+            dest[1] = g * 4 + g / 16;
+            dest[2] = b * 8 + b / 4;
+        }
+    }
+}
+
+/**
+ * writes a png of width x height pixels in format, rows are pitch bytes
+ * apart, level is the zlib compression level
+ * the size of the file gets stored in size_out if it is not NULL
+ *
+ * returns 0 on success
+ */
+int
+png_write(const char *file_name,
+          const void *pixels,
+          unsigned int width,
+          unsigned int height,
+          unsigned int pitch,
+          int format,
+          int level,
+          unsigned long *size_out)
+{
+    static const uint8_t signature[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+    };
+    int err = 0;
+    unsigned int i;
+    uint8_t *row = NULL;
+
+    if (format != PNG_FORMAT_B8G8R8A8 && format != PNG_FORMAT_R5G6B5)
+        return EINVAL;
+
+    unsigned int channels = format == PNG_FORMAT_B8G8R8A8 ? 4 : 3;
+    size_t row_size = 1 + (size_t)width * channels;
+
+    struct png_writer *writer = calloc(1, sizeof(*writer));
+    row = malloc(row_size);
+    if (!writer || !row) {
+        free(writer);
+        free(row);
+        return ENOMEM;
+    }
+
+    if (deflateInit(&writer->strm, level) != Z_OK) {
+        free(writer);
+        free(row);
+        return ENOMEM;
+    }
+    writer->strm.next_out = writer->chunk;
+    writer->strm.avail_out = PNG_CHUNK_SIZE;
+
+    writer->out = fopen(file_name, "wb");
+    if (!writer->out) {
+        err = errno;
+        goto exit;
+    }
+
+    uint8_t ihdr[13] = {
+        width >> 24, width >> 16, width >> 8, width,
+        height >> 24, height >> 16, height >> 8, height,
+        /* bit depth, color type RGBA or RGB, compression, filter, interlace */
+        8, channels == 4 ? 6 : 2, 0, 0, 0
+    };
+    png_write_data(writer, signature, sizeof(signature));
+    png_write_chunk(writer, "IHDR", ihdr, sizeof(ihdr));
+
+    for (i = 0; i < height && !err; i++) {
+        png_convert_row(row,
+                        (const uint8_t *)pixels + (size_t)pitch * i,
+                        width,
+                        format);
+        writer->strm.next_in = row;
+        writer->strm.avail_in = row_size;
+        err = png_deflate(writer, Z_NO_FLUSH);
+    }
+
+    if (!err)
+        err = png_deflate(writer, Z_FINISH);
+    png_write_chunk(writer, "IEND", NULL, 0);
+
+    err = err ? err : writer->err;
+    if (fclose(writer->out) != 0 && !err)
+        err = errno;
+    if (!err && size_out)
+        *size_out = writer->size;
+
+exit:
+    deflateEnd(&writer->strm);
+    free(writer);
+    free(row);
+    return err;
+}
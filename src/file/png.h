@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __FILE_PNG_H__
+#define __FILE_PNG_H__
+
+/* pixel formats png_write accepts, see dvf_frame_pixmap and dvm */
+#define PNG_FORMAT_B8G8R8A8 0
+#define PNG_FORMAT_R5G6B5   1
+
+int
+png_write(const char *file_name,
+          const void *pixels,
+          unsigned int width,
+          unsigned int height,
+          unsigned int pitch,
+          int format,
+          int level,
+          unsigned long *size_out);
+
+#endif /* __FILE_PNG_H__ */
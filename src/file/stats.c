@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * counters and logging
+ * ====================
+ *
+ * The file library keeps process-wide counters of what it maps, decodes
+ * and allocates. Updating one is a single relaxed atomic add so they are
+ * always on. file_stats_snapshot copies all of them, file_stats_reset
+ * zeroes the counters but keeps the gauges of live memory.
+ *
+ * Log output goes through FILE_LOG which only costs a predictable branch
+ * while the level is disabled. The level defaults to FILE_LOG_ERROR and
+ * can be changed with file_log_set_level or the DESPANDOS_LOG_LEVEL
+ * environment variable (none, error, info or debug).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "stats.h"
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+uint64_t file_stats_values[FILE_NUM_STATS];
+int file_log_level = FILE_LOG_ERROR;
+
+static const char *file_stat_names[FILE_NUM_STATS] = {
+    [FILE_STAT_MAPPED_FILES] = "mapped_files",
+    [FILE_STAT_MAPPED_BYTES] = "mapped_bytes",
+    [FILE_STAT_HEAP_BYTES] = "heap_bytes",
+    [FILE_STAT_PIXMAP_BYTES] = "pixmap_bytes",
+    [FILE_STAT_FILES_MAPPED] = "files_mapped",
+    [FILE_STAT_BYTES_DECOMPRESSED] = "bytes_decompressed",
+    [FILE_STAT_SPRITES_DECODED] = "sprites_decoded",
+    [FILE_STAT_PIXMAP_CACHE_HITS] = "pixmap_cache_hits",
+    [FILE_STAT_DVD_ENTRIES] = "dvd_entries",
+    [FILE_STAT_DVF_INIT_NSEC] = "dvf_init_nsec",
+    [FILE_STAT_DVF_DECODE_NSEC] = "dvf_decode_nsec",
+    [FILE_STAT_DVM_DECODE_NSEC] = "dvm_decode_nsec",
+    [FILE_STAT_DVD_PARSE_NSEC] = "dvd_parse_nsec",
+};
+
+static const char *file_log_level_names[] = {
+    [FILE_LOG_NONE] = "none",
+    [FILE_LOG_ERROR] = "error",
+    [FILE_LOG_INFO] = "info",
+    [FILE_LOG_DEBUG] = "debug",
+};
+
+__attribute__ ((constructor)) static void
+file_log_init(void)
+{
+    const char *level = getenv("DESPANDOS_LOG_LEVEL");
+    unsigned int i;
+
+    if (!level)
+        return;
+
+    for (i = 0; i <= FILE_LOG_DEBUG; i++) {
+        if (strcmp(level, file_log_level_names[i]) == 0)
+            file_log_level = i;
+    }
+}
+
+/**
+ * returns a monotonic timestamp in nanoseconds
+ */
+__SYM_EXPORT__ uint64_t
+file_stats_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+__SYM_EXPORT__ void
+file_stats_snapshot(struct file_stats *stats)
+{
+    unsigned int i;
+
+    for (i = 0; i < FILE_NUM_STATS; i++)
+        stats->values[i] = __atomic_load_n(&file_stats_values[i],
+                                           __ATOMIC_RELAXED);
+}
+
+__SYM_EXPORT__ void
+file_stats_reset(void)
+{
+    unsigned int i;
+
+    for (i = FILE_STAT_FIRST_COUNTER; i < FILE_NUM_STATS; i++)
+        __atomic_store_n(&file_stats_values[i], 0, __ATOMIC_RELAXED);
+}
+
+__SYM_EXPORT__ const char *
+file_stat_name(enum file_stat stat)
+{
+    return file_stat_names[stat];
+}
+
+__SYM_EXPORT__ void
+file_log_set_level(int level)
+{
+    file_log_level = level;
+}
+
+/**
+ * errors go to stderr, everything else to stdout
+ */
+__SYM_EXPORT__ void
+file_log(int level, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(level == FILE_LOG_ERROR ? stderr : stdout, format, args);
+    va_end(args);
+}
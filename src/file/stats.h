@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __FILE_STATS_H__
+#define __FILE_STATS_H__
+
+#include <stdint.h>
+
+/* levels for file_log_set_level, every level includes the ones before */
+#define FILE_LOG_NONE  0
+#define FILE_LOG_ERROR 1
+#define FILE_LOG_INFO  2
+/* every sprite, frame and entry, slow */
+#define FILE_LOG_DEBUG 3
+
+enum file_stat {
+    /* gauges of what is alive right now, file_stats_reset keeps them */
+    FILE_STAT_MAPPED_FILES,
+    FILE_STAT_MAPPED_BYTES,
+    /* allocations of dvf and dvd handles and entries */
+    FILE_STAT_HEAP_BYTES,
+    /* malloc'd pixmaps */
+    FILE_STAT_PIXMAP_BYTES,
+
+    /* counters */
+    FILE_STAT_FILES_MAPPED,
+    FILE_STAT_BYTES_DECOMPRESSED,
+    FILE_STAT_SPRITES_DECODED,
+    FILE_STAT_PIXMAP_CACHE_HITS,
+    FILE_STAT_DVD_ENTRIES,
+    FILE_STAT_DVF_INIT_NSEC,
+    FILE_STAT_DVF_DECODE_NSEC,
+    FILE_STAT_DVM_DECODE_NSEC,
+    FILE_STAT_DVD_PARSE_NSEC,
+
+    FILE_NUM_STATS
+};
+
+#define FILE_STAT_FIRST_COUNTER FILE_STAT_FILES_MAPPED
+
+struct file_stats {
+    uint64_t values[FILE_NUM_STATS];
+};
+
+extern uint64_t file_stats_values[FILE_NUM_STATS];
+extern int file_log_level;
+
+/**
+ * adds delta to a stat, safe from any thread
+ */
+static inline void
+file_stats_add(enum file_stat stat, int64_t delta)
+{
+    __atomic_fetch_add(&file_stats_values[stat],
+                       (uint64_t)delta,
+                       __ATOMIC_RELAXED);
+}
+
+/**
+ * logs if level is enabled, the arguments are not evaluated otherwise
+ */
+#define FILE_LOG(LEVEL, ...) \
+    do { \
+        if (__builtin_expect(file_log_level >= (LEVEL), 0)) \
+            file_log((LEVEL), __VA_ARGS__); \
+    } while(0)
+
+uint64_t
+file_stats_now(void);
+
+void
+file_stats_snapshot(struct file_stats *stats);
+
+void
+file_stats_reset(void);
+
+const char *
+file_stat_name(enum file_stat stat);
+
+void
+file_log_set_level(int level);
+
+void
+file_log(int level, const char *format, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+#endif /* __FILE_STATS_H__ */
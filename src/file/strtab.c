@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * string table
+ * ============
+ *
+ * Interns strings without copying them. Every string is a reference into
+ * memory owned by someone else, usually the mapping of a file, together
+ * with its length and hash. Equal strings get the same id so they can be
+ * compared as integers. The table is not thread safe.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "strtab.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+struct strtab_string {
+    const char *str;
+    uint32_t len;
+    uint32_t hash;
+};
+
+/**
+ * string table
+ */
+struct strtab {
+    /* strings[0] is unused, ids index into strings */
+    unsigned int num_strings;
+    unsigned int alloc_strings;
+    struct strtab_string *strings;
+    /* open addressing, ids or STRTAB_NO_ID for empty buckets */
+    unsigned int table_size;
+    strtab_id *table;
+};
+
+static uint32_t
+strtab_hash_string(const char *str, unsigned int len)
+{
+    uint32_t hash = 2166136261u;
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * creates an empty string table
+ *
+ * returns a struct strtab on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct strtab *
+strtab_new(int *err_out)
+{
+    int err = 0;
+    struct strtab *tab = malloc(sizeof(*tab));
+    if (!tab) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(tab, 0, sizeof(*tab));
+
+    tab->num_strings = 1;
+    tab->alloc_strings = 64;
+    tab->strings = malloc(sizeof(*tab->strings) * tab->alloc_strings);
+    tab->table_size = 128;
+    tab->table = calloc(tab->table_size, sizeof(*tab->table));
+    if (!tab->strings || !tab->table) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(&tab->strings[0], 0, sizeof(tab->strings[0]));
+
+    return tab;
+
+error:
+    strtab_free(tab);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+__SYM_EXPORT__ void
+strtab_free(struct strtab *tab)
+{
+    if (!tab)
+        return;
+
+    free(tab->strings);
+    free(tab->table);
+    free(tab);
+}
+
+static int
+strtab_grow(struct strtab *tab)
+{
+    unsigned int size = tab->table_size * 2, i;
+    strtab_id *table = calloc(size, sizeof(*table));
+    if (!table)
+        return ENOMEM;
+
+    for (i = 1; i < tab->num_strings; i++) {
+        uint32_t bucket = tab->strings[i].hash & (size - 1);
+        while (table[bucket])
+            bucket = (bucket + 1) & (size - 1);
+        table[bucket] = i;
+    }
+
+    free(tab->table);
+    tab->table = table;
+    tab->table_size = size;
+    return 0;
+}
+
+/**
+ * returns the bucket holding the string or the empty bucket it belongs in
+ */
+static uint32_t
+strtab_find(struct strtab *tab, const char *str, unsigned int len, uint32_t hash)
+{
+    uint32_t bucket = hash & (tab->table_size - 1);
+
+    while (tab->table[bucket]) {
+        struct strtab_string *s = &tab->strings[tab->table[bucket]];
+        if (s->hash == hash && s->len == len && !memcmp(s->str, str, len))
+            break;
+        bucket = (bucket + 1) & (tab->table_size - 1);
+    }
+
+    return bucket;
+}
+
+/**
+ * returns the id of the string, adding a reference to it if needed
+ * str has to stay valid as long as the table is in use
+ *
+ * returns STRTAB_NO_ID if out of memory
+ */
+__SYM_EXPORT__ strtab_id
+strtab_intern(struct strtab *tab, const char *str, unsigned int len)
+{
+    uint32_t hash = strtab_hash_string(str, len);
+    uint32_t bucket = strtab_find(tab, str, len, hash);
+
+    if (tab->table[bucket])
+        return tab->table[bucket];
+
+    if (tab->num_strings == tab->alloc_strings) {
+        unsigned int alloc = tab->alloc_strings * 2;
+        struct strtab_string *strings = realloc(tab->strings,
+                                                sizeof(*strings) * alloc);
+        if (!strings)
+            return STRTAB_NO_ID;
+        tab->strings = strings;
+        tab->alloc_strings = alloc;
+    }
+
+    if (tab->num_strings * 4 >= tab->table_size * 3) {
+        if (strtab_grow(tab))
+            return STRTAB_NO_ID;
+        bucket = strtab_find(tab, str, len, hash);
+    }
+
+    strtab_id id = tab->num_strings++;
+    tab->strings[id].str = str;
+    tab->strings[id].len = len;
+    tab->strings[id].hash = hash;
+    tab->table[bucket] = id;
+
+    return id;
+}
+
+/**
+ * interns a string stored in a fixed size field which is null terminated
+ * unless it fills the whole field
+ */
+__SYM_EXPORT__ strtab_id
+strtab_intern_fixed(struct strtab *tab, const char *str, unsigned int size)
+{
+    return strtab_intern(tab, str, strnlen(str, size));
+}
+
+/**
+ * returns the id of the string or STRTAB_NO_ID if it was never interned
+ */
+__SYM_EXPORT__ strtab_id
+strtab_lookup(struct strtab *tab, const char *str, unsigned int len)
+{
+    uint32_t hash = strtab_hash_string(str, len);
+    return tab->table[strtab_find(tab, str, len, hash)];
+}
+
+/**
+ * returns a reference to the string, it is not null terminated
+ */
+__SYM_EXPORT__ const char *
+strtab_string(struct strtab *tab, strtab_id id, unsigned int *len)
+{
+    if (id == STRTAB_NO_ID || id >= tab->num_strings)
+        return NULL;
+
+    if (len)
+        *len = tab->strings[id].len;
+    return tab->strings[id].str;
+}
+
+/**
+ * returns the precomputed hash of the string
+ */
+__SYM_EXPORT__ uint32_t
+strtab_hash(struct strtab *tab, strtab_id id)
+{
+    if (id == STRTAB_NO_ID || id >= tab->num_strings)
+        return 0;
+    return tab->strings[id].hash;
+}
+
+__SYM_EXPORT__ unsigned int
+strtab_num_strings(struct strtab *tab)
+{
+    return tab->num_strings - 1;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FILE_STRTAB_H__
+#define __FILE_STRTAB_H__
+
+#include <stdint.h>
+
+/* id of no string, valid ids start at 1 */
+#define STRTAB_NO_ID 0
+
+typedef uint32_t strtab_id;
+
+struct strtab;
+
+struct strtab *
+strtab_new(int *err_out);
+
+void
+strtab_free(struct strtab *tab);
+
+strtab_id
+strtab_intern(struct strtab *tab, const char *str, unsigned int len);
+
+strtab_id
+strtab_intern_fixed(struct strtab *tab, const char *str, unsigned int size);
+
+strtab_id
+strtab_lookup(struct strtab *tab, const char *str, unsigned int len);
+
+const char *
+strtab_string(struct strtab *tab, strtab_id id, unsigned int *len);
+
+uint32_t
+strtab_hash(struct strtab *tab, strtab_id id);
+
+unsigned int
+strtab_num_strings(struct strtab *tab);
+
+#endif /* __FILE_STRTAB_H__ */
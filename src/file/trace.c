@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * trace zones
+ * ===========
+ *
+ * TRACE_ZONE records how long the rest of a block takes. Every thread
+ * writes its zones into its own ring buffer without locking, the buffer
+ * is allocated and registered the first time the thread records a zone.
+ * Once a ring is full the oldest zones get overwritten.
+ *
+ * trace_write dumps all rings as Chrome trace-event JSON which can be
+ * loaded into chrome://tracing or Perfetto. Setting DESPANDOS_TRACE to a
+ * file name enables tracing at startup and writes the trace at exit.
+ *
+ * While tracing is disabled a zone costs a single branch.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "stats.h"
+#include "trace.h"
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+/* zones per thread, a power of two */
+#define TRACE_RING_SIZE 16384
+#define TRACE_THREAD_NAME_SIZE 32
+
+struct trace_event {
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+};
+
+struct trace_ring {
+    /* number of zones ever written, the owning thread is the only writer */
+    uint64_t head;
+    /* head plus the zone being written right now */
+    uint64_t claimed;
+    pid_t tid;
+    char thread_name[TRACE_THREAD_NAME_SIZE];
+    struct trace_ring *next;
+    struct trace_event events[TRACE_RING_SIZE];
+};
+
+int trace_enabled;
+
+static struct {
+    pthread_mutex_t mutex;
+    struct trace_ring *rings;
+    char *exit_file_name;
+} trace = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread struct trace_ring *trace_thread_ring;
+
+static void
+trace_exit(void)
+{
+    trace_write(trace.exit_file_name);
+}
+
+__attribute__ ((constructor)) static void
+trace_init(void)
+{
+    const char *file_name = getenv("DESPANDOS_TRACE");
+
+    if (!file_name || !*file_name)
+        return;
+
+    trace.exit_file_name = strdup(file_name);
+    if (trace.exit_file_name && atexit(trace_exit) == 0)
+        trace_enabled = 1;
+}
+
+/**
+ * returns the ring of the calling thread, NULL if out of memory
+ */
+static struct trace_ring *
+trace_ring(void)
+{
+    if (trace_thread_ring)
+        return trace_thread_ring;
+
+    struct trace_ring *ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+    ring->tid = syscall(SYS_gettid);
+
+    /* rings outlive their threads so the trace can still be written */
+    pthread_mutex_lock(&trace.mutex);
+    ring->next = trace.rings;
+    trace.rings = ring;
+    pthread_mutex_unlock(&trace.mutex);
+
+    trace_thread_ring = ring;
+    return ring;
+}
+
+__SYM_EXPORT__ struct trace_zone
+trace_zone_begin(const char *name)
+{
+    struct trace_zone zone = { name, 0 };
+
+    if (__builtin_expect(trace_enabled, 0))
+        zone.start = file_stats_now();
+    return zone;
+}
+
+__SYM_EXPORT__ void
+trace_zone_end(struct trace_zone *zone)
+{
+    if (__builtin_expect(!zone->start, 1))
+        return;
+
+    uint64_t end = file_stats_now();
+    struct trace_ring *ring = trace_ring();
+    if (!ring)
+        return;
+
+    uint64_t head = ring->head;
+    struct trace_event *event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    /* lets trace_write skip the slot if it copies it meanwhile */
+    __atomic_store_n(&ring->claimed, head + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    event->name = zone->name;
+    event->start = zone->start;
+    event->duration = end - zone->start;
+    /* publishes the event to trace_write */
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+__SYM_EXPORT__ void
+trace_set_enabled(int enabled)
+{
+    trace_enabled = enabled;
+}
+
+/**
+ * names the calling thread in the trace
+ * ignored while tracing is disabled
+ */
+__SYM_EXPORT__ void
+trace_set_thread_name(const char *name)
+{
+    if (!trace_enabled)
+        return;
+
+    struct trace_ring *ring = trace_ring();
+    if (!ring)
+        return;
+
+    pthread_mutex_lock(&trace.mutex);
+    snprintf(ring->thread_name, sizeof(ring->thread_name), "%s", name);
+    pthread_mutex_unlock(&trace.mutex);
+}
+
+static void
+trace_write_ring(FILE *out, struct trace_ring *ring, pid_t pid, int *first)
+{
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t i = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+    if (ring->thread_name[0]) {
+        fprintf(out,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                *first ? "" : ",\n",
+                pid,
+                ring->tid,
+                ring->thread_name);
+        *first = 0;
+    }
+
+    for (; i < head; i++) {
+        struct trace_event event = ring->events[i & (TRACE_RING_SIZE - 1)];
+
+        /* the owner might have overwritten it while it was copied */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t claimed = __atomic_load_n(&ring->claimed, __ATOMIC_RELAXED);
+        if (claimed > TRACE_RING_SIZE && i < claimed - TRACE_RING_SIZE)
+            continue;
+
+        fprintf(out,
+                "%s{\"name\":\"%s\",\"cat\":\"despandos\",\"ph\":\"X\","
+                "\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,"
+                "\"pid\":%d,\"tid\":%d}",
+                *first ? "" : ",\n",
+                event.name,
+                (unsigned long long)(event.start / 1000),
+                (unsigned long long)(event.start % 1000),
+                (unsigned long long)(event.duration / 1000),
+                (unsigned long long)(event.duration % 1000),
+                pid,
+                ring->tid);
+        *first = 0;
+    }
+}
+
+/**
+ * writes the zones of all threads as Chrome trace-event JSON
+ * threads can keep recording meanwhile
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+trace_write(const char *file_name)
+{
+    struct trace_ring *ring;
+    int first = 1, err = 0;
+
+    FILE *out = fopen(file_name, "w");
+    if (!out)
+        return errno;
+
+    pid_t pid = getpid();
+    fprintf(out, "{\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&trace.mutex);
+    for (ring = trace.rings; ring; ring = ring->next)
+        trace_write_ring(out, ring, pid, &first);
+    pthread_mutex_unlock(&trace.mutex);
+
+    fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    if (ferror(out))
+        err = EIO;
+    if (fclose(out) != 0 && !err)
+        err = errno;
+    return err;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __FILE_TRACE_H__
+#define __FILE_TRACE_H__
+
+#include <stdint.h>
+
+/**
+ * a running zone, see TRACE_ZONE
+ */
+struct trace_zone {
+    const char *name;
+    /* 0 if tracing was disabled when the zone began */
+    uint64_t start;
+};
+
+extern int trace_enabled;
+
+struct trace_zone
+trace_zone_begin(const char *name);
+
+void
+trace_zone_end(struct trace_zone *zone);
+
+/**
+ * traces the rest of the enclosing block as name, name has to be a
+ * string literal or otherwise outlive the trace
+ */
+#define TRACE_ZONE(NAME) \
+    struct trace_zone TRACE_CONCAT(trace_zone_, __LINE__) \
+        __attribute__ ((cleanup (trace_zone_end))) = \
+        trace_zone_begin(NAME)
+
+#define TRACE_CONCAT_(A, B) A##B
+#define TRACE_CONCAT(A, B) TRACE_CONCAT_(A, B)
+
+void
+trace_set_enabled(int enabled);
+
+void
+trace_set_thread_name(const char *name);
+
+int
+trace_write(const char *file_name);
+
+#endif /* __FILE_TRACE_H__ */
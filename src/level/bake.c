@@ -0,0 +1,992 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * baked level file format
+ * =======================
+ *
+ * struct bake_file_header header;
+ * struct bake_file_section sections[header.num_sections];
+ * for(header.num_sections) {
+ *   padding to BAKE_ALIGN;
+ *   binary section[section.size];
+ * }
+ *
+ * A baked level is a cache, everything is stored in host byte order and
+ * header.byte_order tells if the file can be used. The header records the
+ * size and modification time of the dvd and dvm it was baked from, a
+ * level whose sources changed since is stale. Sections reference each
+ * other by offset only, opening a baked level maps the file and creates a
+ * few small structs pointing into the mapping, nothing gets copied.
+ *
+ * sections
+ * ========
+ * SGHT: serialized struct sight_map
+ * ELEM: struct bake_elements_header, struct baked_element[num]
+ * BUIL: struct bake_elements_header, struct baked_element[num]
+ * SIDX: serialized struct spatial_index over ELEM and BUIL
+ * BGND: struct bake_bgnd_header, uint64_t tile_offsets[tiles_x * tiles_y],
+ *       R5G6B5 tiles of tile_size * tile_size pixels
+ * STRS: null terminated strings referenced by the other sections
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "file.h"
+#include "strtab.h"
+#include "pixmap.h"
+#include "dvm.h"
+#include "bake.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+#define BAKE_MAGIC "DSPNBAKE"
+#define BAKE_BYTE_ORDER 0x01020304
+#define BAKE_ALIGN 64
+#define BAKE_TILE_SIZE 256
+#define BAKE_NO_STRING UINT32_MAX
+
+#define BAKE_SECTION_SIDX DVD_ENTRY_TYPE('S','I','D','X')
+#define BAKE_SECTION_STRS DVD_ENTRY_TYPE('S','T','R','S')
+#define BAKE_MAX_SECTIONS 6
+
+/**
+ * identity of a file a level was baked from, all zero if there was none
+ */
+struct bake_source {
+    uint64_t size;
+    /* modification time in nanoseconds */
+    uint64_t mtime;
+};
+
+/**
+ * baked file header
+ */
+struct bake_file_header {
+    uint8_t magic[8];
+    uint32_t version;
+    /* BAKE_BYTE_ORDER as written by the baking host */
+    uint32_t byte_order;
+    uint32_t num_sections;
+    uint32_t padding;
+    uint64_t file_size;
+    struct bake_source dvd;
+    struct bake_source dvm;
+};
+
+/**
+ * baked file section table entry
+ */
+struct bake_file_section {
+    /* section type, a DVD_ENTRY_TYPE */
+    uint32_t type;
+    uint32_t padding;
+    /* offset from the start of the file */
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct bake_elements_header {
+    uint32_t num_elements;
+    uint32_t padding;
+};
+
+struct bake_bgnd_header {
+    /* offset into STRS or BAKE_NO_STRING */
+    uint32_t name;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tile_size;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    /* followed by the tile offsets relative to the start of the section */
+};
+
+/**
+ * growable buffer used while baking
+ */
+struct bake_buffer {
+    char *data;
+    size_t size;
+    size_t alloc;
+};
+
+struct bake_section {
+    uint32_t type;
+    struct bake_buffer buffer;
+};
+
+/**
+ * baking state
+ */
+struct bake_context {
+    unsigned int num_sections;
+    struct bake_section sections[BAKE_MAX_SECTIONS];
+    /* spatial items of all elements and buildings */
+    unsigned int num_items;
+    unsigned int alloc_items;
+    struct spatial_item *items;
+    unsigned int num_elements;
+    unsigned int num_buildings;
+    uint32_t bgnd_name;
+    /* element names, every name is stored once in STRS */
+    struct strtab *names;
+    unsigned int alloc_name_offsets;
+    uint32_t *name_offsets;
+    struct bake_source dvd;
+    struct bake_source dvm;
+};
+
+/**
+ * baked level
+ * read only, everything points into the mapping
+ */
+struct baked_level {
+    struct mmap_file *file;
+    const struct bake_file_header *header;
+    const struct bake_file_section *sections;
+    struct sight_map *sight;
+    struct spatial_index *spatial;
+    unsigned int num_elements;
+    const struct baked_element *elements;
+    unsigned int num_buildings;
+    const struct baked_element *buildings;
+    const char *strs;
+    unsigned int strs_size;
+    const char *bgnd_name;
+    const struct bake_bgnd_header *bgnd;
+    const uint64_t *tile_offsets;
+};
+
+/**
+ * appends size zeroed bytes to the buffer
+ * returns a pointer to them or NULL if out of memory
+ */
+static void *
+bake_buffer_append(struct bake_buffer *buffer, size_t size)
+{
+    if (buffer->size + size > buffer->alloc) {
+        size_t alloc = buffer->alloc ? buffer->alloc : 4096;
+        while (alloc < buffer->size + size)
+            alloc *= 2;
+
+        char *data = realloc(buffer->data, alloc);
+        if (!data)
+            return NULL;
+        buffer->data = data;
+        buffer->alloc = alloc;
+    }
+
+    void *ptr = buffer->data + buffer->size;
+    memset(ptr, 0, size);
+    buffer->size += size;
+    return ptr;
+}
+
+static int
+bake_buffer_align(struct bake_buffer *buffer, size_t align)
+{
+    size_t pad = (align - buffer->size % align) % align;
+    if (pad && !bake_buffer_append(buffer, pad))
+        return ENOMEM;
+    return 0;
+}
+
+/**
+ * returns the buffer of the section, creating it on first use
+ */
+static struct bake_buffer *
+bake_section(struct bake_context *ctx, uint32_t type)
+{
+    unsigned int i;
+
+    for (i = 0; i < ctx->num_sections; i++) {
+        if (ctx->sections[i].type == type)
+            return &ctx->sections[i].buffer;
+    }
+
+    if (ctx->num_sections == BAKE_MAX_SECTIONS)
+        return NULL;
+
+    struct bake_section *section = &ctx->sections[ctx->num_sections++];
+    memset(section, 0, sizeof(*section));
+    section->type = type;
+    return &section->buffer;
+}
+
+/**
+ * copies a string of at most len bytes to STRS
+ * returns the offset or BAKE_NO_STRING if out of memory
+ */
+static uint32_t
+bake_string(struct bake_context *ctx, const char *str, size_t len)
+{
+    struct bake_buffer *strs = bake_section(ctx, BAKE_SECTION_STRS);
+    if (!strs)
+        return BAKE_NO_STRING;
+
+    len = strnlen(str, len);
+    uint32_t offset = strs->size;
+    char *dest = bake_buffer_append(strs, len + 1);
+    if (!dest)
+        return BAKE_NO_STRING;
+    memcpy(dest, str, len);
+
+    return offset;
+}
+
+/**
+ * returns the STRS offset of an interned element name, copying it once
+ * returns BAKE_NO_STRING if out of memory
+ */
+static uint32_t
+bake_element_name(struct bake_context *ctx, const struct dvd_element *element)
+{
+    strtab_id id = element->name_id;
+
+    if (id >= ctx->alloc_name_offsets) {
+        unsigned int alloc = id + 64, i;
+        uint32_t *offsets = realloc(ctx->name_offsets,
+                                    sizeof(*offsets) * alloc);
+        if (!offsets)
+            return BAKE_NO_STRING;
+        for (i = ctx->alloc_name_offsets; i < alloc; i++)
+            offsets[i] = BAKE_NO_STRING;
+        ctx->name_offsets = offsets;
+        ctx->alloc_name_offsets = alloc;
+    }
+
+    if (ctx->name_offsets[id] == BAKE_NO_STRING)
+        ctx->name_offsets[id] = bake_string(ctx,
+                                            element->name,
+                                            DVD_ELEMENT_NAME_SIZE);
+    return ctx->name_offsets[id];
+}
+
+static int
+bake_sght(struct bake_context *ctx, const struct dvd_entry_sght *sght)
+{
+    int err = 0;
+    struct bake_buffer *buffer = bake_section(ctx, DVD_ENTRY_TYPE_SGHT);
+    if (!buffer)
+        return ENOMEM;
+
+    struct sight_map *map = sight_map_new_from_sght(sght, &err);
+    if (!map)
+        return err;
+
+    /* only the last SGHT entry counts */
+    buffer->size = 0;
+    void *data = bake_buffer_append(buffer, sight_map_serialized_size(map));
+    if (data)
+        sight_map_serialize(map, data);
+    sight_map_free(map);
+
+    return data ? 0 : ENOMEM;
+}
+
+static int
+bake_elements(struct bake_context *ctx,
+              uint32_t type,
+              const struct dvd_element *elements,
+              unsigned int num_elements,
+              unsigned int *num_total)
+{
+    unsigned int i;
+    struct bake_buffer *buffer = bake_section(ctx, type);
+    if (!buffer)
+        return ENOMEM;
+
+    if (!buffer->size && !bake_buffer_append(buffer,
+                                             sizeof(struct bake_elements_header)))
+        return ENOMEM;
+
+    if (ctx->num_items + num_elements > ctx->alloc_items) {
+        unsigned int alloc = ctx->num_items + num_elements + 64;
+        struct spatial_item *items = realloc(ctx->items,
+                                             sizeof(*items) * alloc);
+        if (!items)
+            return ENOMEM;
+        ctx->items = items;
+        ctx->alloc_items = alloc;
+    }
+
+    for (i = 0; i < num_elements; i++) {
+        const struct dvd_element *element = &elements[i];
+        struct baked_element *baked = bake_buffer_append(buffer,
+                                                         sizeof(*baked));
+        if (!baked)
+            return ENOMEM;
+
+        baked->name = bake_element_name(ctx, element);
+        if (baked->name == BAKE_NO_STRING)
+            return ENOMEM;
+        baked->x = element->x;
+        baked->y = element->y;
+        baked->width = element->width;
+        baked->height = element->height;
+
+        struct spatial_item *item = &ctx->items[ctx->num_items++];
+        item->x0 = element->x;
+        item->y0 = element->y;
+        item->x1 = element->x + (element->width ? element->width : 1);
+        item->y1 = element->y + (element->height ? element->height : 1);
+        item->id = type == DVD_ENTRY_TYPE_BUIL ? SPATIAL_ID_BUIL(*num_total + i)
+                                               : SPATIAL_ID_ELEM(*num_total + i);
+    }
+
+    *num_total += num_elements;
+    ((struct bake_elements_header *)buffer->data)->num_elements = *num_total;
+
+    return 0;
+}
+
+static int
+bake_spatial(struct bake_context *ctx)
+{
+    int err = 0;
+    struct bake_buffer *buffer = bake_section(ctx, BAKE_SECTION_SIDX);
+    if (!buffer)
+        return ENOMEM;
+
+    struct spatial_index *index = spatial_index_new(ctx->items,
+                                                    ctx->num_items,
+                                                    &err);
+    if (!index)
+        return err;
+
+    void *data = bake_buffer_append(buffer,
+                                    spatial_index_serialized_size(index));
+    if (data)
+        spatial_index_serialize(index, data);
+    spatial_index_free(index);
+
+    return data ? 0 : ENOMEM;
+}
+
+/**
+ * decodes the background and splits it into tiles
+ */
+static int
+bake_background(struct bake_context *ctx, const char *dvm_file_name)
+{
+    int err = 0;
+    unsigned int width = 0, height = 0, tiles_x = 0, tiles_y = 0;
+    unsigned int tx, ty, y, i;
+    uint16_t *pixmap = NULL;
+
+    struct bake_buffer *buffer = bake_section(ctx, DVD_ENTRY_TYPE_BGND);
+    if (!buffer)
+        return ENOMEM;
+
+    if (dvm_file_name) {
+        pixmap = dvm_file_get_pixmap(dvm_file_name, &width, &height, &err);
+        if (!pixmap)
+            return err;
+        tiles_x = (width + BAKE_TILE_SIZE - 1) / BAKE_TILE_SIZE;
+        tiles_y = (height + BAKE_TILE_SIZE - 1) / BAKE_TILE_SIZE;
+    }
+
+    struct bake_bgnd_header *header = bake_buffer_append(buffer,
+                                                         sizeof(*header));
+    if (!header ||
+        !bake_buffer_append(buffer, sizeof(uint64_t) * tiles_x * tiles_y)) {
+        err = ENOMEM;
+        goto exit;
+    }
+
+    header = (struct bake_bgnd_header *)buffer->data;
+    header->name = ctx->bgnd_name;
+    header->width = width;
+    header->height = height;
+    header->tile_size = BAKE_TILE_SIZE;
+    header->tiles_x = tiles_x;
+    header->tiles_y = tiles_y;
+
+    for (ty = 0; ty < tiles_y; ty++) {
+        for (tx = 0; tx < tiles_x; tx++) {
+            if (bake_buffer_align(buffer, BAKE_ALIGN)) {
+                err = ENOMEM;
+                goto exit;
+            }
+
+            uint64_t offset = buffer->size;
+            uint16_t *tile = bake_buffer_append(buffer,
+                                                sizeof(*tile) *
+                                                BAKE_TILE_SIZE *
+                                                BAKE_TILE_SIZE);
+            if (!tile) {
+                err = ENOMEM;
+                goto exit;
+            }
+
+            i = ty * tiles_x + tx;
+            ((uint64_t *)(buffer->data + sizeof(*header)))[i] = offset;
+
+            unsigned int x0 = tx * BAKE_TILE_SIZE;
+            unsigned int y0 = ty * BAKE_TILE_SIZE;
+            unsigned int w = width - x0 < BAKE_TILE_SIZE ? width - x0
+                                                         : BAKE_TILE_SIZE;
+            for (y = 0; y < BAKE_TILE_SIZE && y0 + y < height; y++) {
+                memcpy(tile + y * BAKE_TILE_SIZE,
+                       pixmap + (y0 + y) * width + x0,
+                       sizeof(*tile) * w);
+            }
+        }
+    }
+
+exit:
+    pixmap_free(pixmap);
+    return err;
+}
+
+static int
+bake_write(struct bake_context *ctx, const char *out_file_name)
+{
+    struct bake_file_header header;
+    struct bake_file_section table[BAKE_MAX_SECTIONS];
+    static const char zero[BAKE_ALIGN];
+    uint64_t offset;
+    unsigned int i;
+    int err = 0;
+
+    memset(&header, 0, sizeof(header));
+    memset(table, 0, sizeof(table));
+
+    offset = sizeof(header) + sizeof(table[0]) * ctx->num_sections;
+    for (i = 0; i < ctx->num_sections; i++) {
+        offset = (offset + BAKE_ALIGN - 1) / BAKE_ALIGN * BAKE_ALIGN;
+        table[i].type = ctx->sections[i].type;
+        table[i].offset = offset;
+        table[i].size = ctx->sections[i].buffer.size;
+        offset += table[i].size;
+    }
+
+    memcpy(header.magic, BAKE_MAGIC, sizeof(header.magic));
+    header.version = BAKE_VERSION;
+    header.byte_order = BAKE_BYTE_ORDER;
+    header.num_sections = ctx->num_sections;
+    header.file_size = offset;
+    header.dvd = ctx->dvd;
+    header.dvm = ctx->dvm;
+
+    FILE *out = fopen(out_file_name, "wb");
+    if (!out) {
+        DEBUG_ERROR("cannot open %s: %s\n", out_file_name, strerror(errno));
+        return errno;
+    }
+
+    offset = sizeof(header) + sizeof(table[0]) * ctx->num_sections;
+    if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fwrite(table, sizeof(table[0]), ctx->num_sections, out) !=
+          ctx->num_sections) {
+        err = EIO;
+        goto exit;
+    }
+
+    for (i = 0; i < ctx->num_sections; i++) {
+        if (fwrite(zero, 1, table[i].offset - offset, out) !=
+              table[i].offset - offset ||
+            fwrite(ctx->sections[i].buffer.data, 1, table[i].size, out) !=
+              table[i].size) {
+            err = EIO;
+            goto exit;
+        }
+        offset = table[i].offset + table[i].size;
+    }
+
+exit:
+    if (fclose(out) && !err)
+        err = EIO;
+    if (err)
+        remove(out_file_name);
+    return err;
+}
+
+/**
+ * gets the identity of a source file, a NULL file name has an all zero one
+ */
+static int
+bake_source_get(const char *file_name, struct bake_source *source)
+{
+    struct stat file_stat;
+
+    memset(source, 0, sizeof(*source));
+    if (!file_name)
+        return 0;
+
+    if (stat(file_name, &file_stat) < 0)
+        return errno;
+
+    source->size = file_stat.st_size;
+    source->mtime = (uint64_t)file_stat.st_mtim.tv_sec * 1000000000ull +
+                    file_stat.st_mtim.tv_nsec;
+    return 0;
+}
+
+/**
+ * decodes a level and writes everything derived from it to out_file_name
+ * dvm_file_name can be NULL, the background tiles are left out then
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+bake_level(char *dvd_file_name,
+           const char *dvm_file_name,
+           const char *out_file_name)
+{
+    int err = 0;
+    unsigned int i;
+    union dvd_entry entry;
+    struct bake_context ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.bgnd_name = BAKE_NO_STRING;
+
+    /* taken before reading, a change while baking makes the level stale */
+    if ((err = bake_source_get(dvd_file_name, &ctx.dvd)) ||
+        (err = bake_source_get(dvm_file_name, &ctx.dvm)))
+        return err;
+
+    struct dvd_file *file = dvd_file_open(dvd_file_name, &err);
+    if (!file)
+        return err;
+
+    /* references the mapping, it has to go before the file */
+    ctx.names = strtab_new(&err);
+    if (!ctx.names) {
+        dvd_file_close(file);
+        return err;
+    }
+
+    while (!err && dvd_file_has_next(file)) {
+        if ((err = dvd_file_get_next(file, &entry)))
+            break;
+
+        switch (entry.type) {
+            case DVD_ENTRY_TYPE_SGHT:
+                err = bake_sght(&ctx, &entry.sght);
+                break;
+            case DVD_ENTRY_TYPE_ELEM:
+                if ((err = dvd_entry_elem_intern(&entry.elem, ctx.names)))
+                    break;
+                err = bake_elements(&ctx,
+                                    DVD_ENTRY_TYPE_ELEM,
+                                    entry.elem.elements,
+                                    entry.elem.num_elements,
+                                    &ctx.num_elements);
+                break;
+            case DVD_ENTRY_TYPE_BUIL:
+                if ((err = dvd_entry_buil_intern(&entry.buil, ctx.names)))
+                    break;
+                err = bake_elements(&ctx,
+                                    DVD_ENTRY_TYPE_BUIL,
+                                    entry.buil.buildings,
+                                    entry.buil.num_buildings,
+                                    &ctx.num_buildings);
+                break;
+            case DVD_ENTRY_TYPE_BGND:
+                ctx.bgnd_name = bake_string(&ctx,
+                                            entry.bgnd.name,
+                                            entry.bgnd.name_size);
+                if (ctx.bgnd_name == BAKE_NO_STRING)
+                    err = ENOMEM;
+                break;
+        }
+
+        dvd_entry_done(&entry);
+    }
+
+    strtab_free(ctx.names);
+    dvd_file_close(file);
+
+    if (!err)
+        err = bake_spatial(&ctx);
+    if (!err)
+        err = bake_background(&ctx, dvm_file_name);
+    if (!err)
+        err = bake_write(&ctx, out_file_name);
+
+    for (i = 0; i < ctx.num_sections; i++)
+        free(ctx.sections[i].buffer.data);
+    free(ctx.items);
+    free(ctx.name_offsets);
+
+    return err;
+}
+
+/**
+ * returns a pointer to the section and its size or NULL if the level has
+ * no such section
+ */
+static const void *
+baked_level_section(struct baked_level *level,
+                    uint32_t type,
+                    unsigned int *size)
+{
+    unsigned int i;
+
+    for (i = 0; i < level->header->num_sections; i++) {
+        const struct bake_file_section *section = &level->sections[i];
+
+        if (section->type != type)
+            continue;
+        if (section->offset % BAKE_ALIGN || section->size > UINT32_MAX)
+            return NULL;
+        *size = section->size;
+        return mmap_file_ptr_offset(level->file, section->offset, *size);
+    }
+
+    return NULL;
+}
+
+/**
+ * points num_elements and elements at the elements of a section
+ */
+static int
+baked_level_find_elements(struct baked_level *level,
+                          uint32_t type,
+                          unsigned int *num_elements,
+                          const struct baked_element **elements)
+{
+    unsigned int size = 0;
+    const struct bake_elements_header *header =
+      baked_level_section(level, type, &size);
+
+    *num_elements = 0;
+    *elements = NULL;
+    if (!header)
+        return 0;
+
+    if (size < sizeof(*header) ||
+        (size - sizeof(*header)) / sizeof(struct baked_element) <
+          header->num_elements)
+        return EILSEQ;
+
+    *num_elements = header->num_elements;
+    *elements = (const struct baked_element *)(header + 1);
+    return 0;
+}
+
+/**
+ * returns 1 if the file still has the identity source recorded
+ */
+static int
+baked_level_source_current(const struct bake_source *source,
+                           const char *file_name)
+{
+    struct bake_source current;
+
+    /* baked without it, or nothing to compare with */
+    if (!file_name || (!source->size && !source->mtime))
+        return 1;
+
+    if (bake_source_get(file_name, &current))
+        return 0;
+
+    return current.size == source->size && current.mtime == source->mtime;
+}
+
+/**
+ * maps a baked level
+ * if dvd_file_name or dvm_file_name are given the level has to be baked
+ * from them as they are now, a level baked from older versions fails
+ * with ESTALE
+ *
+ * returns a struct baked_level on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct baked_level *
+baked_level_open(const char *file_name,
+                 const char *dvd_file_name,
+                 const char *dvm_file_name,
+                 int *err_out)
+{
+    int err = 0;
+    unsigned int size = 0, i;
+    const void *data;
+
+    struct baked_level *level = malloc(sizeof(*level));
+    if (!level) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(level, 0, sizeof(*level));
+
+    /* tiles and sections get accessed in any order */
+    level->file = mmap_file_open(file_name,
+                                 MMAP_FILE_RANDOM | MMAP_FILE_WILLNEED,
+                                 &err);
+    if (!level->file)
+        goto error;
+
+    const struct bake_file_header *header =
+      mmap_file_ptr_offset(level->file, 0, sizeof(*header));
+    if (!header ||
+        memcmp(header->magic, BAKE_MAGIC, sizeof(header->magic)) ||
+        header->byte_order != BAKE_BYTE_ORDER ||
+        header->file_size < sizeof(*header) ||
+        header->file_size > UINT32_MAX ||
+        !mmap_file_ptr_offset(level->file, 0, header->file_size)) {
+        DEBUG_ERROR("%s is not a baked level\n", file_name);
+        err = EILSEQ;
+        goto error;
+    }
+    if (header->version != BAKE_VERSION) {
+        DEBUG_ERROR("%s has version %u, expected %u\n",
+                    file_name,
+                    header->version,
+                    BAKE_VERSION);
+        err = EILSEQ;
+        goto error;
+    }
+    level->header = header;
+
+    /* num_sections comes from the file, bound it by the file size */
+    if (header->num_sections >
+        (header->file_size - sizeof(*header)) /
+          sizeof(struct bake_file_section)) {
+        DEBUG_ERROR("%s has a broken section table\n", file_name);
+        err = EILSEQ;
+        goto error;
+    }
+    level->sections = mmap_file_ptr_offset(level->file,
+                                           sizeof(*header),
+                                           sizeof(*level->sections) *
+                                           (size_t)header->num_sections);
+    if (!level->sections) {
+        err = EILSEQ;
+        goto error;
+    }
+
+    if (!baked_level_source_current(&header->dvd, dvd_file_name) ||
+        !baked_level_source_current(&header->dvm, dvm_file_name)) {
+        DEBUG_LOG("%s is stale\n", file_name);
+        err = ESTALE;
+        goto error;
+    }
+
+    level->strs = baked_level_section(level,
+                                      BAKE_SECTION_STRS,
+                                      &level->strs_size);
+    if (level->strs &&
+        (!level->strs_size || level->strs[level->strs_size - 1] != '\0')) {
+        err = EILSEQ;
+        goto error;
+    }
+
+    if ((data = baked_level_section(level, DVD_ENTRY_TYPE_SGHT, &size))) {
+        level->sight = sight_map_new_from_serialized(data, size, &err);
+        if (!level->sight)
+            goto error;
+    }
+
+    if ((data = baked_level_section(level, BAKE_SECTION_SIDX, &size))) {
+        level->spatial = spatial_index_new_from_serialized(data, size, &err);
+        if (!level->spatial)
+            goto error;
+    }
+
+    if ((err = baked_level_find_elements(level,
+                                         DVD_ENTRY_TYPE_ELEM,
+                                         &level->num_elements,
+                                         &level->elements)) ||
+        (err = baked_level_find_elements(level,
+                                         DVD_ENTRY_TYPE_BUIL,
+                                         &level->num_buildings,
+                                         &level->buildings)))
+        goto error;
+
+    const struct bake_bgnd_header *bgnd =
+      baked_level_section(level, DVD_ENTRY_TYPE_BGND, &size);
+    if (bgnd) {
+        uint64_t tile_bytes = sizeof(uint16_t) * bgnd->tile_size *
+                              bgnd->tile_size;
+        uint64_t num_tiles = (uint64_t)bgnd->tiles_x * bgnd->tiles_y;
+
+        if (size < sizeof(*bgnd) ||
+            (size - sizeof(*bgnd)) / sizeof(uint64_t) < num_tiles ||
+            (bgnd->name != BAKE_NO_STRING && bgnd->name >= level->strs_size)) {
+            err = EILSEQ;
+            goto error;
+        }
+
+        level->tile_offsets = (const uint64_t *)(bgnd + 1);
+        for (i = 0; i < num_tiles; i++) {
+            if (level->tile_offsets[i] > size ||
+                size - level->tile_offsets[i] < tile_bytes) {
+                err = EILSEQ;
+                goto error;
+            }
+        }
+
+        level->bgnd = bgnd;
+        if (bgnd->name != BAKE_NO_STRING)
+            level->bgnd_name = level->strs + bgnd->name;
+    }
+
+    return level;
+
+error:
+    baked_level_close(level);
+    if (err_out)
+        *err_out = err ? err : EILSEQ;
+    return NULL;
+}
+
+/**
+ * unmaps a baked level
+ * all references handed out become invalid
+ */
+__SYM_EXPORT__ void
+baked_level_close(struct baked_level *level)
+{
+    if (!level)
+        return;
+
+    sight_map_free(level->sight);
+    spatial_index_free(level->spatial);
+    if (level->file)
+        mmap_file_close(level->file);
+    free(level);
+}
+
+/**
+ * returns the sight map of the level or NULL if it has none
+ * the map is owned by the level
+ */
+__SYM_EXPORT__ struct sight_map *
+baked_level_sight(struct baked_level *level)
+{
+    return level->sight;
+}
+
+/**
+ * returns the spatial index over elements and buildings or NULL
+ * the index is owned by the level
+ */
+__SYM_EXPORT__ struct spatial_index *
+baked_level_spatial(struct baked_level *level)
+{
+    return level->spatial;
+}
+
+__SYM_EXPORT__ unsigned int
+baked_level_num_elements(struct baked_level *level)
+{
+    return level->num_elements;
+}
+
+/**
+ * returns the elements, they point into the mapping
+ */
+__SYM_EXPORT__ const struct baked_element *
+baked_level_elements(struct baked_level *level)
+{
+    return level->elements;
+}
+
+__SYM_EXPORT__ unsigned int
+baked_level_num_buildings(struct baked_level *level)
+{
+    return level->num_buildings;
+}
+
+/**
+ * returns the buildings, they point into the mapping
+ */
+__SYM_EXPORT__ const struct baked_element *
+baked_level_buildings(struct baked_level *level)
+{
+    return level->buildings;
+}
+
+/**
+ * returns the name of an element or building or NULL if it is broken
+ * names are checked here instead of when opening, so that does not have
+ * to touch every element
+ */
+__SYM_EXPORT__ const char *
+baked_level_element_name(struct baked_level *level,
+                         const struct baked_element *element)
+{
+    if (element->name >= level->strs_size)
+        return NULL;
+    return level->strs + element->name;
+}
+
+/**
+ * returns the name of the background or NULL
+ */
+__SYM_EXPORT__ const char *
+baked_level_background_name(struct baked_level *level)
+{
+    return level->bgnd_name;
+}
+
+/**
+ * returns 1 and the size of the background if the level has background
+ * tiles, 0 otherwise
+ */
+__SYM_EXPORT__ int
+baked_level_background_size(struct baked_level *level,
+                            unsigned int *width,
+                            unsigned int *height,
+                            unsigned int *tile_size)
+{
+    if (!level->bgnd || !level->bgnd->tiles_x || !level->bgnd->tiles_y)
+        return 0;
+
+    *width = level->bgnd->width;
+    *height = level->bgnd->height;
+    *tile_size = level->bgnd->tile_size;
+    return 1;
+}
+
+/**
+ * returns the R5G6B5 pixels of a background tile, tile_size * tile_size
+ * pixels in rows of tile_size pixels, or NULL if the tile does not exist
+ */
+__SYM_EXPORT__ const uint16_t *
+baked_level_background_tile(struct baked_level *level,
+                            unsigned int tile_x,
+                            unsigned int tile_y)
+{
+    if (!level->bgnd ||
+        tile_x >= level->bgnd->tiles_x ||
+        tile_y >= level->bgnd->tiles_y)
+        return NULL;
+
+    return (const uint16_t *)((const char *)level->bgnd +
+        level->tile_offsets[tile_y * level->bgnd->tiles_x + tile_x]);
+}
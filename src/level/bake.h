@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LEVEL_BAKE_H__
+#define __LEVEL_BAKE_H__
+
+#include <stdint.h>
+
+#include "dvd.h"
+#include "sight.h"
+#include "spatial.h"
+
+/* bump whenever the layout of a baked level changes */
+#define BAKE_VERSION 2
+
+struct baked_level;
+
+/**
+ * an element or building as stored in the baked level
+ */
+struct baked_element {
+    /* pass to baked_level_element_name */
+    uint32_t name;
+    int32_t x;
+    int32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+int
+bake_level(char *dvd_file_name,
+           const char *dvm_file_name,
+           const char *out_file_name);
+
+struct baked_level *
+baked_level_open(const char *file_name,
+                 const char *dvd_file_name,
+                 const char *dvm_file_name,
+                 int *err_out);
+
+void
+baked_level_close(struct baked_level *level);
+
+struct sight_map *
+baked_level_sight(struct baked_level *level);
+
+struct spatial_index *
+baked_level_spatial(struct baked_level *level);
+
+unsigned int
+baked_level_num_elements(struct baked_level *level);
+
+const struct baked_element *
+baked_level_elements(struct baked_level *level);
+
+unsigned int
+baked_level_num_buildings(struct baked_level *level);
+
+const struct baked_element *
+baked_level_buildings(struct baked_level *level);
+
+const char *
+baked_level_element_name(struct baked_level *level,
+                         const struct baked_element *element);
+
+const char *
+baked_level_background_name(struct baked_level *level);
+
+int
+baked_level_background_size(struct baked_level *level,
+                            unsigned int *width,
+                            unsigned int *height,
+                            unsigned int *tile_size);
+
+const uint16_t *
+baked_level_background_tile(struct baked_level *level,
+                            unsigned int tile_x,
+                            unsigned int tile_y);
+
+#endif /* __LEVEL_BAKE_H__ */
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bake.h"
+
+int
+main(int argc, char **argv)
+{
+    int err = 0;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <dvd file> <output file> [dvm file]\n",
+                argv[0]);
+        return EINVAL;
+    }
+
+    if ((err = bake_level(argv[1], argc > 3 ? argv[3] : NULL, argv[2]))) {
+        fprintf(stderr,
+                "error: cannot bake %s: %s (%d)\n",
+                argv[1],
+                strerror(err),
+                err);
+        return err;
+    }
+
+    return 0;
+}
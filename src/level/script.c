@@ -0,0 +1,870 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * SCRP entry format
+ * =================
+ *
+ * struct dvd_scrp_header header;
+ * for(header.num_triggers) {
+ *   struct scrp_trigger_header trigger;
+ *   binary code[trigger.code_size];
+ * }
+ *
+ * The code is a stack machine program. Every instruction is one opcode
+ * byte followed by its operands:
+ *
+ * 0x01 push int     int32 value
+ * 0x02 push string  uint16 length, char string[length]
+ * 0x03 load         uint16 length, char variable[length]
+ * 0x04 store        uint16 length, char variable[length]
+ * 0x05 pop
+ * 0x10 - 0x1a       add, sub, mul, div, eq, ne, lt, gt, not, and, or
+ * 0x20 jump         int16 offset relative to the next instruction
+ * 0x21 jump if not  int16 offset relative to the next instruction
+ * 0x30 call         uint16 length, char function[length], uint8 num_args
+ * 0xff end
+ *
+ * The layout is our best guess at the original format.
+ *
+ * bytecode
+ * ========
+ *
+ * The code gets compiled into 32 bit words, an enum script_op followed by
+ * its operands. Strings and variable names are interned into a strtab at
+ * compile time, strings become ids referencing the mapping, variables
+ * become slots indexed by their id and functions get resolved to builtins.
+ * Jump targets and the stack depth of every instruction are verified once,
+ * the interpreter does not check anything at run time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <endian.h>
+#include <time.h>
+
+#include "script.h"
+#include "strtab.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) \
+      do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+#define __PACKED__ __attribute__ ((__packed__))
+
+/* source opcodes */
+#define SCRP_OP_PUSH_INT    0x01
+#define SCRP_OP_PUSH_STRING 0x02
+#define SCRP_OP_LOAD        0x03
+#define SCRP_OP_STORE       0x04
+#define SCRP_OP_POP         0x05
+#define SCRP_OP_ADD         0x10
+#define SCRP_OP_OR          0x1a
+#define SCRP_OP_JUMP        0x20
+#define SCRP_OP_JUMP_IF_NOT 0x21
+#define SCRP_OP_CALL        0x30
+#define SCRP_OP_END         0xff
+
+/**
+ * SCRP trigger header
+ */
+struct __PACKED__ scrp_trigger_header {
+    /* trigger id */
+    uint32_t id;
+    /* size of the code in bytes */
+    uint32_t code_size;
+};
+
+struct script_trigger {
+    uint32_t id;
+    /* first word of the trigger in code */
+    uint32_t entry;
+    /* deepest stack the trigger can reach */
+    uint32_t max_stack;
+};
+
+struct script_program {
+    unsigned int num_triggers;
+    struct script_trigger *triggers;
+    size_t code_size;
+    uint32_t *code;
+    struct strtab *strings;
+    /* variable slots are indexed by symbol id */
+    struct strtab *symbols;
+    script_builtin_func *builtins;
+};
+
+struct script_vm {
+    struct script_program *program;
+    void *user_data;
+    struct script_value stack[SCRIPT_STACK_SIZE];
+    struct script_value *variables;
+    int profiling;
+    uint64_t op_counts[SCRIPT_NUM_OPS];
+    struct script_trigger_profile *profiles;
+};
+
+struct script_compiler {
+    const uint8_t *data;
+    unsigned int size;
+    uint32_t *code;
+    size_t code_size;
+    size_t code_alloc;
+    struct strtab *strings;
+    struct strtab *symbols;
+    const struct script_builtin *builtins;
+    unsigned int num_builtins;
+};
+
+static const char *script_op_names[SCRIPT_NUM_OPS] = {
+    "push_int", "push_string", "load", "store", "pop",
+    "add", "sub", "mul", "div", "eq", "ne", "lt", "gt",
+    "not", "and", "or", "jump", "jump_if_not", "call", "end"
+};
+
+/* number of operand words of every op */
+static const uint8_t script_op_operands[SCRIPT_NUM_OPS] = {
+    1, 1, 1, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 1, 1, 2, 0
+};
+
+__SYM_EXPORT__ const char *
+script_op_name(enum script_op op)
+{
+    if (op >= SCRIPT_NUM_OPS)
+        return "invalid";
+    return script_op_names[op];
+}
+
+/**
+ * returns the id of the string, adding it if needed
+ */
+static int
+script_intern(struct strtab *tab,
+              const char *str,
+              uint32_t len,
+              uint32_t *id)
+{
+    *id = strtab_intern(tab, str, len);
+    return *id == STRTAB_NO_ID ? ENOMEM : 0;
+}
+
+static int
+script_emit(struct script_compiler *c, uint32_t word)
+{
+    if (c->code_size == c->code_alloc) {
+        size_t alloc = c->code_alloc ? c->code_alloc * 2 : 256;
+        uint32_t *code = realloc(c->code, sizeof(*code) * alloc);
+        if (!code)
+            return ENOMEM;
+        c->code = code;
+        c->code_alloc = alloc;
+    }
+
+    c->code[c->code_size++] = word;
+    return 0;
+}
+
+/**
+ * reads size bytes at *pos if they lie before end
+ */
+static int
+script_read(struct script_compiler *c,
+            unsigned int *pos,
+            unsigned int end,
+            void *dest,
+            unsigned int size)
+{
+    if (*pos > end || end - *pos < size)
+        return EILSEQ;
+    memcpy(dest, c->data + *pos, size);
+    *pos += size;
+    return 0;
+}
+
+/**
+ * reads a length prefixed name and returns a reference to it
+ */
+static int
+script_read_name(struct script_compiler *c,
+                 unsigned int *pos,
+                 unsigned int end,
+                 const char **name,
+                 uint32_t *len)
+{
+    uint16_t name_len;
+    int err;
+
+    if ((err = script_read(c, pos, end, &name_len, sizeof(name_len))))
+        return err;
+    *len = le16toh(name_len);
+    if (*len > end - *pos)
+        return EILSEQ;
+
+    *name = (const char *)c->data + *pos;
+    *pos += *len;
+    return 0;
+}
+
+static int
+script_resolve_builtin(struct script_compiler *c,
+                       const char *name,
+                       uint32_t len,
+                       uint32_t *index)
+{
+    unsigned int i;
+
+    for (i = 0; i < c->num_builtins; i++) {
+        if (strlen(c->builtins[i].name) == len &&
+            !memcmp(c->builtins[i].name, name, len)) {
+            *index = i;
+            return 0;
+        }
+    }
+
+    DEBUG_ERROR("unknown function %.*s\n", (int)len, name);
+    return ENOENT;
+}
+
+/**
+ * follows every path through the trigger and makes sure the stack never
+ * underflows, overflows or differs where paths meet
+ */
+static int
+script_verify_stack(struct script_compiler *c,
+                    uint32_t entry,
+                    uint32_t end,
+                    uint32_t *max_stack)
+{
+    int32_t *depth = malloc(sizeof(*depth) * (end - entry));
+    uint32_t *work = malloc(sizeof(*work) * (end - entry));
+    unsigned int num_work = 0;
+    int err = 0;
+
+    if (!depth || !work) {
+        err = ENOMEM;
+        goto exit;
+    }
+    memset(depth, 0xff, sizeof(*depth) * (end - entry));
+
+    *max_stack = 0;
+    depth[0] = 0;
+    work[num_work++] = entry;
+
+    while (num_work) {
+        uint32_t pc = work[--num_work];
+        int32_t d = depth[pc - entry];
+        uint32_t op = c->code[pc];
+        uint32_t next = pc + 1 + script_op_operands[op];
+        uint32_t succ[2];
+        unsigned int num_succ = 0, i;
+        int need = 0, effect = 0;
+
+        switch (op) {
+            case SCRIPT_OP_PUSH_INT:
+            case SCRIPT_OP_PUSH_STRING:
+            case SCRIPT_OP_LOAD:
+                effect = 1;
+                break;
+            case SCRIPT_OP_STORE:
+            case SCRIPT_OP_POP:
+                need = 1;
+                effect = -1;
+                break;
+            case SCRIPT_OP_NOT:
+                need = 1;
+                break;
+            case SCRIPT_OP_JUMP:
+            case SCRIPT_OP_END:
+                break;
+            case SCRIPT_OP_JUMP_IF_NOT:
+                need = 1;
+                effect = -1;
+                break;
+            case SCRIPT_OP_CALL:
+                need = c->code[pc + 2];
+                effect = 1 - need;
+                break;
+            default:
+                need = 2;
+                effect = -1;
+                break;
+        }
+
+        if (d < need || d + effect > SCRIPT_STACK_SIZE) {
+            DEBUG_ERROR("stack check failed at %u\n", pc - entry);
+            err = EILSEQ;
+            goto exit;
+        }
+        d += effect;
+        if (d > *max_stack)
+            *max_stack = d;
+
+        if (op == SCRIPT_OP_JUMP) {
+            succ[num_succ++] = c->code[pc + 1];
+        }
+        else if (op == SCRIPT_OP_JUMP_IF_NOT) {
+            succ[num_succ++] = c->code[pc + 1];
+            succ[num_succ++] = next;
+        }
+        else if (op != SCRIPT_OP_END) {
+            succ[num_succ++] = next;
+        }
+
+        for (i = 0; i < num_succ; i++) {
+            if (depth[succ[i] - entry] < 0) {
+                depth[succ[i] - entry] = d;
+                work[num_work++] = succ[i];
+            }
+            else if (depth[succ[i] - entry] != d) {
+                DEBUG_ERROR("stack depth differs at %u\n", succ[i] - entry);
+                err = EILSEQ;
+                goto exit;
+            }
+        }
+    }
+
+exit:
+    free(depth);
+    free(work);
+    return err;
+}
+
+/**
+ * compiles the code of one trigger starting at pos
+ */
+static int
+script_compile_trigger(struct script_compiler *c,
+                       unsigned int pos,
+                       unsigned int code_size,
+                       struct script_trigger *trigger)
+{
+    unsigned int start = pos, end = pos + code_size, num_fixups = 0, i;
+    uint32_t *offsets = malloc(sizeof(*offsets) * (code_size + 1));
+    uint32_t *fixups = malloc(sizeof(*fixups) * 2 * (code_size / 3 + 1));
+    int err = 0;
+
+    if (!offsets || !fixups) {
+        err = ENOMEM;
+        goto exit;
+    }
+    memset(offsets, 0xff, sizeof(*offsets) * (code_size + 1));
+
+    trigger->entry = c->code_size;
+
+    while (!err && pos < end) {
+        uint8_t op = c->data[pos];
+        const char *name;
+        uint32_t len, id;
+        int32_t value;
+        int16_t rel;
+        uint8_t num_args;
+
+        offsets[pos - start] = c->code_size;
+        pos++;
+
+        switch (op) {
+            case SCRP_OP_PUSH_INT:
+                if (!(err = script_read(c, &pos, end, &value, sizeof(value))) &&
+                    !(err = script_emit(c, SCRIPT_OP_PUSH_INT)))
+                    err = script_emit(c, (uint32_t)le32toh(value));
+                break;
+            case SCRP_OP_PUSH_STRING:
+                if (!(err = script_read_name(c, &pos, end, &name, &len)) &&
+                    !(err = script_intern(c->strings, name, len, &id)) &&
+                    !(err = script_emit(c, SCRIPT_OP_PUSH_STRING)))
+                    err = script_emit(c, id);
+                break;
+            case SCRP_OP_LOAD:
+            case SCRP_OP_STORE:
+                if (!(err = script_read_name(c, &pos, end, &name, &len)) &&
+                    !(err = script_intern(c->symbols, name, len, &id)) &&
+                    !(err = script_emit(c, op == SCRP_OP_LOAD
+                                               ? SCRIPT_OP_LOAD
+                                               : SCRIPT_OP_STORE)))
+                    err = script_emit(c, id);
+                break;
+            case SCRP_OP_POP:
+                err = script_emit(c, SCRIPT_OP_POP);
+                break;
+            case SCRP_OP_JUMP:
+            case SCRP_OP_JUMP_IF_NOT:
+                if ((err = script_read(c, &pos, end, &rel, sizeof(rel))))
+                    break;
+                rel = (int16_t)le16toh(rel);
+                if ((int)(pos - start) + rel < 0 ||
+                    (int)(pos - start) + rel > (int)code_size) {
+                    err = EILSEQ;
+                    break;
+                }
+                if ((err = script_emit(c, op == SCRP_OP_JUMP
+                                            ? SCRIPT_OP_JUMP
+                                            : SCRIPT_OP_JUMP_IF_NOT)))
+                    break;
+                fixups[num_fixups * 2] = c->code_size;
+                fixups[num_fixups * 2 + 1] = pos - start + rel;
+                num_fixups++;
+                err = script_emit(c, 0);
+                break;
+            case SCRP_OP_CALL:
+                if (!(err = script_read_name(c, &pos, end, &name, &len)) &&
+                    !(err = script_read(c, &pos, end,
+                                        &num_args, sizeof(num_args))) &&
+                    !(err = script_resolve_builtin(c, name, len, &id)) &&
+                    !(err = script_emit(c, SCRIPT_OP_CALL)) &&
+                    !(err = script_emit(c, id)))
+                    err = script_emit(c, num_args);
+                break;
+            case SCRP_OP_END:
+                err = script_emit(c, SCRIPT_OP_END);
+                break;
+            default:
+                if (op >= SCRP_OP_ADD && op <= SCRP_OP_OR) {
+                    err = script_emit(c, SCRIPT_OP_ADD + (op - SCRP_OP_ADD));
+                    break;
+                }
+                DEBUG_ERROR("unknown opcode 0x%02x\n", op);
+                err = EILSEQ;
+                break;
+        }
+    }
+
+    /* falling off the end of a trigger ends it */
+    offsets[code_size] = c->code_size;
+    if (!err)
+        err = script_emit(c, SCRIPT_OP_END);
+
+    for (i = 0; !err && i < num_fixups; i++) {
+        uint32_t target = offsets[fixups[i * 2 + 1]];
+        if (target == UINT32_MAX) {
+            DEBUG_ERROR("jump into an instruction\n");
+            err = EILSEQ;
+            break;
+        }
+        c->code[fixups[i * 2]] = target;
+    }
+
+    if (!err)
+        err = script_verify_stack(c,
+                                  trigger->entry,
+                                  c->code_size,
+                                  &trigger->max_stack);
+
+exit:
+    free(offsets);
+    free(fixups);
+    return err;
+}
+
+/**
+ * compiles the triggers of a SCRP entry
+ * strings of the program reference the mapping of the dvd file, the file
+ * has to stay open while the program is in use
+ *
+ * returns a struct script_program on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct script_program *
+script_program_compile(const struct dvd_entry_scrp *scrp,
+                       const struct script_builtin *builtins,
+                       unsigned int num_builtins,
+                       int *err_out)
+{
+    struct script_compiler c;
+    unsigned int pos = 0, i;
+    int err = 0;
+
+    memset(&c, 0, sizeof(c));
+    c.data = scrp->data;
+    c.size = scrp->size;
+    c.builtins = builtins;
+    c.num_builtins = num_builtins;
+
+    struct script_program *program = malloc(sizeof(*program));
+    if (!program) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(program, 0, sizeof(*program));
+
+    if (!(c.strings = strtab_new(&err)) || !(c.symbols = strtab_new(&err)))
+        goto error;
+
+    if (scrp->num_triggers > scrp->size / sizeof(struct scrp_trigger_header)) {
+        DEBUG_ERROR("scrp entry is malformed\n");
+        err = EILSEQ;
+        goto error;
+    }
+
+    program->triggers = malloc(sizeof(*program->triggers) *
+                               (scrp->num_triggers + 1));
+    program->builtins = malloc(sizeof(*program->builtins) *
+                               (num_builtins + 1));
+    if (!program->triggers || !program->builtins) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+
+    for (i = 0; i < num_builtins; i++)
+        program->builtins[i] = builtins[i].func;
+
+    for (i = 0; i < scrp->num_triggers; i++) {
+        struct scrp_trigger_header header;
+
+        if ((err = script_read(&c, &pos, c.size, &header, sizeof(header))))
+            goto error;
+        header.code_size = le32toh(header.code_size);
+        if (header.code_size > c.size - pos) {
+            err = EILSEQ;
+            goto error;
+        }
+
+        program->triggers[i].id = le32toh(header.id);
+        if ((err = script_compile_trigger(&c,
+                                          pos,
+                                          header.code_size,
+                                          &program->triggers[i])))
+            goto error;
+
+        pos += header.code_size;
+        program->num_triggers++;
+    }
+
+    program->code = c.code;
+    program->code_size = c.code_size;
+    program->strings = c.strings;
+    program->symbols = c.symbols;
+
+    DEBUG_LOG("compiled %u triggers into %zu words\n",
+              program->num_triggers,
+              program->code_size);
+
+    return program;
+
+error:
+    free(c.code);
+    strtab_free(c.strings);
+    strtab_free(c.symbols);
+    script_program_free(program);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+__SYM_EXPORT__ void
+script_program_free(struct script_program *program)
+{
+    if (!program)
+        return;
+
+    free(program->triggers);
+    free(program->code);
+    strtab_free(program->strings);
+    strtab_free(program->symbols);
+    free(program->builtins);
+    free(program);
+}
+
+__SYM_EXPORT__ unsigned int
+script_program_num_triggers(struct script_program *program)
+{
+    return program->num_triggers;
+}
+
+__SYM_EXPORT__ uint32_t
+script_program_trigger_id(struct script_program *program,
+                          unsigned int trigger)
+{
+    return program->triggers[trigger].id;
+}
+
+/**
+ * returns a reference to the string with the id, it is not null terminated
+ */
+__SYM_EXPORT__ const char *
+script_program_string(struct script_program *program,
+                      uint32_t id,
+                      unsigned int *len)
+{
+    return strtab_string(program->strings, id, len);
+}
+
+/**
+ * creates a vm with its own variables for the program
+ * user_data is passed to builtins
+ */
+__SYM_EXPORT__ struct script_vm *
+script_vm_new(struct script_program *program, void *user_data, int *err_out)
+{
+    int err = 0;
+
+    struct script_vm *vm = malloc(sizeof(*vm));
+    if (!vm) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(vm, 0, sizeof(*vm));
+
+    vm->program = program;
+    vm->user_data = user_data;
+    vm->variables = calloc(strtab_num_strings(program->symbols) + 1,
+                           sizeof(*vm->variables));
+    vm->profiles = calloc(program->num_triggers + 1, sizeof(*vm->profiles));
+    if (!vm->variables || !vm->profiles) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+
+    return vm;
+
+error:
+    script_vm_free(vm);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+__SYM_EXPORT__ void
+script_vm_free(struct script_vm *vm)
+{
+    if (!vm)
+        return;
+
+    free(vm->variables);
+    free(vm->profiles);
+    free(vm);
+}
+
+/**
+ * runs a trigger
+ * result gets the value on top of the stack when the trigger ends
+ *
+ * returns 0 on success, EDOM on division by zero or the error of a builtin
+ */
+__SYM_EXPORT__ int
+script_vm_run(struct script_vm *vm,
+              unsigned int trigger,
+              struct script_value *result)
+{
+    static void *const labels[SCRIPT_NUM_OPS] = {
+        &&op_push_int, &&op_push_string, &&op_load, &&op_store, &&op_pop,
+        &&op_add, &&op_sub, &&op_mul, &&op_div,
+        &&op_eq, &&op_ne, &&op_lt, &&op_gt,
+        &&op_not, &&op_and, &&op_or,
+        &&op_jump, &&op_jump_if_not, &&op_call, &&op_end
+    };
+    static void *const profile_labels[SCRIPT_NUM_OPS] = {
+        [0 ... SCRIPT_NUM_OPS - 1] = &&op_profile
+    };
+
+    struct script_program *program = vm->program;
+    const uint32_t *code = program->code;
+    const uint32_t *pc = code + program->triggers[trigger].entry;
+    struct script_value *sp = vm->stack;
+    struct script_value *vars = vm->variables;
+    void *const *dispatch = vm->profiling ? profile_labels : labels;
+    uint64_t instructions = 0;
+    struct timespec start, stop;
+    struct script_value ret;
+    uint32_t index, num_args;
+    int32_t a, b, a_type, b_type;
+    int err = 0;
+
+#define DISPATCH() goto *dispatch[*pc++]
+/* EXPR sees the operands as a, b and their types as a_type, b_type, the
+ * result slot is only written after it */
+#define BINARY(EXPR) \
+    do { \
+        sp--; \
+        a = sp[-1].value; \
+        a_type = sp[-1].type; \
+        b = sp->value; \
+        b_type = sp->type; \
+        sp[-1].value = (EXPR); \
+        sp[-1].type = SCRIPT_VALUE_INT; \
+        DISPATCH(); \
+    } while (0)
+
+    if (vm->profiling)
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+    DISPATCH();
+
+op_profile:
+    vm->op_counts[pc[-1]]++;
+    instructions++;
+    goto *labels[pc[-1]];
+
+op_push_int:
+    sp->type = SCRIPT_VALUE_INT;
+    sp->value = (int32_t)*pc++;
+    sp++;
+    DISPATCH();
+
+op_push_string:
+    sp->type = SCRIPT_VALUE_STRING;
+    sp->value = (int32_t)*pc++;
+    sp++;
+    DISPATCH();
+
+op_load:
+    *sp++ = vars[*pc++];
+    DISPATCH();
+
+op_store:
+    vars[*pc++] = *--sp;
+    DISPATCH();
+
+op_pop:
+    sp--;
+    DISPATCH();
+
+op_add:
+    BINARY((int32_t)((uint32_t)a + (uint32_t)b));
+op_sub:
+    BINARY((int32_t)((uint32_t)a - (uint32_t)b));
+op_mul:
+    BINARY((int32_t)((uint32_t)a * (uint32_t)b));
+op_div:
+    if (!sp[-1].value) {
+        err = EDOM;
+        goto exit;
+    }
+    BINARY(b == -1 ? (int32_t)(0u - (uint32_t)a) : a / b);
+op_eq:
+    BINARY(a_type == b_type && a == b);
+op_ne:
+    BINARY(a_type != b_type || a != b);
+op_lt:
+    BINARY(a < b);
+op_gt:
+    BINARY(a > b);
+op_and:
+    BINARY(a && b);
+op_or:
+    BINARY(a || b);
+
+op_not:
+    sp[-1].type = SCRIPT_VALUE_INT;
+    sp[-1].value = !sp[-1].value;
+    DISPATCH();
+
+op_jump:
+    pc = code + *pc;
+    DISPATCH();
+
+op_jump_if_not:
+    sp--;
+    if (!sp->value)
+        pc = code + *pc;
+    else
+        pc++;
+    DISPATCH();
+
+op_call:
+    index = pc[0];
+    num_args = pc[1];
+    pc += 2;
+    sp -= num_args;
+    ret.type = SCRIPT_VALUE_INT;
+    ret.value = 0;
+    if ((err = program->builtins[index](vm, sp, num_args, &ret, vm->user_data)))
+        goto exit;
+    *sp++ = ret;
+    DISPATCH();
+
+op_end:
+    if (result) {
+        if (sp > vm->stack) {
+            *result = sp[-1];
+        }
+        else {
+            result->type = SCRIPT_VALUE_INT;
+            result->value = 0;
+        }
+    }
+
+exit:
+    if (vm->profiling) {
+        struct script_trigger_profile *profile = &vm->profiles[trigger];
+
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        profile->runs++;
+        profile->instructions += instructions;
+        profile->nsec += (uint64_t)(stop.tv_sec - start.tv_sec) * 1000000000 +
+                         stop.tv_nsec - start.tv_nsec;
+    }
+
+#undef BINARY
+#undef DISPATCH
+
+    return err;
+}
+
+/**
+ * enables or disables counting of instructions and time
+ * disabled profiling costs nothing
+ */
+__SYM_EXPORT__ void
+script_vm_set_profiling(struct script_vm *vm, int enabled)
+{
+    vm->profiling = enabled;
+}
+
+__SYM_EXPORT__ void
+script_vm_reset_profile(struct script_vm *vm)
+{
+    memset(vm->op_counts, 0, sizeof(vm->op_counts));
+    memset(vm->profiles,
+           0,
+           sizeof(*vm->profiles) * vm->program->num_triggers);
+}
+
+/**
+ * returns how often op was executed while profiling
+ */
+__SYM_EXPORT__ uint64_t
+script_vm_op_count(struct script_vm *vm, enum script_op op)
+{
+    if (op >= SCRIPT_NUM_OPS)
+        return 0;
+    return vm->op_counts[op];
+}
+
+__SYM_EXPORT__ void
+script_vm_trigger_profile(struct script_vm *vm,
+                          unsigned int trigger,
+                          struct script_trigger_profile *profile)
+{
+    *profile = vm->profiles[trigger];
+}
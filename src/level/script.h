@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LEVEL_SCRIPT_H__
+#define __LEVEL_SCRIPT_H__
+
+#include <stdint.h>
+
+#include "dvd.h"
+
+/* number of values a script can push at once */
+#define SCRIPT_STACK_SIZE 256
+
+#define SCRIPT_VALUE_INT 0
+#define SCRIPT_VALUE_STRING 1
+
+/**
+ * internal opcodes
+ */
+enum script_op {
+    SCRIPT_OP_PUSH_INT,
+    SCRIPT_OP_PUSH_STRING,
+    SCRIPT_OP_LOAD,
+    SCRIPT_OP_STORE,
+    SCRIPT_OP_POP,
+    SCRIPT_OP_ADD,
+    SCRIPT_OP_SUB,
+    SCRIPT_OP_MUL,
+    SCRIPT_OP_DIV,
+    SCRIPT_OP_EQ,
+    SCRIPT_OP_NE,
+    SCRIPT_OP_LT,
+    SCRIPT_OP_GT,
+    SCRIPT_OP_NOT,
+    SCRIPT_OP_AND,
+    SCRIPT_OP_OR,
+    SCRIPT_OP_JUMP,
+    SCRIPT_OP_JUMP_IF_NOT,
+    SCRIPT_OP_CALL,
+    SCRIPT_OP_END,
+    SCRIPT_NUM_OPS
+};
+
+/**
+ * a script value
+ * strings are interned, equal strings have the same id
+ */
+struct script_value {
+    int32_t type;
+    int32_t value;
+};
+
+struct script_program;
+struct script_vm;
+
+/**
+ * a function scripts can call
+ * returns 0 on success, an error stops the script
+ */
+typedef int (*script_builtin_func)(struct script_vm *vm,
+                                   const struct script_value *args,
+                                   unsigned int num_args,
+                                   struct script_value *result,
+                                   void *user_data);
+
+struct script_builtin {
+    const char *name;
+    script_builtin_func func;
+};
+
+/**
+ * profile of a single trigger
+ */
+struct script_trigger_profile {
+    uint64_t runs;
+    uint64_t instructions;
+    uint64_t nsec;
+};
+
+struct script_program *
+script_program_compile(const struct dvd_entry_scrp *scrp,
+                       const struct script_builtin *builtins,
+                       unsigned int num_builtins,
+                       int *err_out);
+
+void
+script_program_free(struct script_program *program);
+
+unsigned int
+script_program_num_triggers(struct script_program *program);
+
+uint32_t
+script_program_trigger_id(struct script_program *program,
+                          unsigned int trigger);
+
+const char *
+script_program_string(struct script_program *program,
+                      uint32_t id,
+                      unsigned int *len);
+
+const char *
+script_op_name(enum script_op op);
+
+struct script_vm *
+script_vm_new(struct script_program *program, void *user_data, int *err_out);
+
+void
+script_vm_free(struct script_vm *vm);
+
+int
+script_vm_run(struct script_vm *vm,
+              unsigned int trigger,
+              struct script_value *result);
+
+void
+script_vm_set_profiling(struct script_vm *vm, int enabled);
+
+void
+script_vm_reset_profile(struct script_vm *vm);
+
+uint64_t
+script_vm_op_count(struct script_vm *vm, enum script_op op);
+
+void
+script_vm_trigger_profile(struct script_vm *vm,
+                          unsigned int trigger,
+                          struct script_trigger_profile *profile);
+
+#endif /* __LEVEL_SCRIPT_H__ */
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+#include <script.h>
+
+static int failures = 0;
+
+#define CHECK(cond, what) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL: %s\n", what); \
+            failures++; \
+        } \
+    } while(0)
+
+/**
+ * a SCRP trigger put together in memory
+ */
+struct code {
+    uint8_t data[256];
+    unsigned int size;
+};
+
+static void
+code_begin(struct code *code)
+{
+    /* room for the trigger header, filled in by code_end */
+    code->size = 8;
+}
+
+static void
+code_int(struct code *code, int32_t value)
+{
+    uint32_t le = htole32((uint32_t)value);
+
+    code->data[code->size++] = 0x01;
+    memcpy(code->data + code->size, &le, sizeof(le));
+    code->size += sizeof(le);
+}
+
+static void
+code_string(struct code *code, const char *str)
+{
+    uint16_t len = strlen(str);
+    uint16_t le = htole16(len);
+
+    code->data[code->size++] = 0x02;
+    memcpy(code->data + code->size, &le, sizeof(le));
+    code->size += sizeof(le);
+    memcpy(code->data + code->size, str, len);
+    code->size += len;
+}
+
+static void
+code_end(struct code *code, uint8_t op)
+{
+    uint32_t id = htole32(1);
+    uint32_t code_size = htole32(code->size - 8 + 2);
+
+    code->data[code->size++] = op;
+    code->data[code->size++] = 0xff;
+    memcpy(code->data, &id, sizeof(id));
+    memcpy(code->data + 4, &code_size, sizeof(code_size));
+}
+
+/**
+ * runs the single trigger in code, returns -1 if it does not run
+ */
+static int
+run(struct code *code)
+{
+    struct dvd_entry_scrp scrp = {
+        .num_triggers = 1,
+        .data = code->data,
+        .size = code->size
+    };
+    struct script_value result;
+    int err = 0, ret = -1;
+
+    struct script_program *program =
+      script_program_compile(&scrp, NULL, 0, &err);
+    if (!program)
+        return -1;
+
+    struct script_vm *vm = script_vm_new(program, NULL, &err);
+    if (vm && !script_vm_run(vm, 0, &result) &&
+        result.type == SCRIPT_VALUE_INT)
+        ret = result.value;
+
+    script_vm_free(vm);
+    script_program_free(program);
+    return ret;
+}
+
+/**
+ * compares two strings with op, equal strings are interned to one id
+ */
+static int
+compare_strings(const char *a, const char *b, uint8_t op)
+{
+    struct code code;
+
+    code_begin(&code);
+    code_string(&code, a);
+    code_string(&code, b);
+    code_end(&code, op);
+    return run(&code);
+}
+
+/**
+ * compares an int with a string whose id can be the same value
+ */
+static int
+compare_mixed(int32_t a, const char *b, uint8_t op)
+{
+    struct code code;
+
+    code_begin(&code);
+    code_int(&code, a);
+    code_string(&code, b);
+    code_end(&code, op);
+    return run(&code);
+}
+
+static int
+compare_ints(int32_t a, int32_t b, uint8_t op)
+{
+    struct code code;
+
+    code_begin(&code);
+    code_int(&code, a);
+    code_int(&code, b);
+    code_end(&code, op);
+    return run(&code);
+}
+
+#define OP_EQ 0x14
+#define OP_NE 0x15
+
+int
+main(void)
+{
+    unsigned int i;
+
+    CHECK(compare_ints(3, 3, OP_EQ) == 1, "3 == 3");
+    CHECK(compare_ints(3, 4, OP_EQ) == 0, "3 == 4");
+    CHECK(compare_ints(3, 3, OP_NE) == 0, "3 != 3");
+    CHECK(compare_ints(3, 4, OP_NE) == 1, "3 != 4");
+
+    CHECK(compare_strings("ab", "ab", OP_EQ) == 1, "\"ab\" == \"ab\"");
+    CHECK(compare_strings("ab", "cd", OP_EQ) == 0, "\"ab\" == \"cd\"");
+    CHECK(compare_strings("ab", "ab", OP_NE) == 0, "\"ab\" != \"ab\"");
+    CHECK(compare_strings("ab", "cd", OP_NE) == 1, "\"ab\" != \"cd\"");
+
+    /* whatever id the string got, an int is never equal to it */
+    for (i = 0; i < 4; i++) {
+        CHECK(compare_mixed(i, "ab", OP_EQ) == 0, "int == \"ab\"");
+        CHECK(compare_mixed(i, "ab", OP_NE) == 1, "int != \"ab\"");
+    }
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
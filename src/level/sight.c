@@ -0,0 +1,578 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * line of sight
+ * =============
+ *
+ * The SGHT entry is turned into a bit packed grid, one bit per cell and
+ * 32 cells per word. Lines are walked with a fixed point DDA (16.16) which
+ * steps once per cell along the major axis. Batches of rays are walked in
+ * lock step, SIGHT_LANES rays at a time, using the gcc vector extensions so
+ * the stepping compiles to SSE2/AVX2 and the grid lookup uses a gather
+ * instruction when available.
+ *
+ * The start and end cell of a ray are never tested, units standing in a
+ * blocking cell can still see and be seen.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "sight.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+#define SIGHT_LANES 8
+#define SIGHT_FIXED_ONE 65536
+#define SIGHT_FIXED_HALF 32768
+/* number of viewer/target pairs collected before a batch gets walked */
+#define SIGHT_PAIR_CHUNK 256
+
+typedef int32_t sight_vec __attribute__ ((vector_size (SIGHT_LANES * 4)));
+
+/**
+ * bit packed blocker grid
+ */
+struct sight_map {
+    unsigned int width;
+    unsigned int height;
+    /* words per row */
+    unsigned int stride;
+    /* stride * height words, bit x % 32 of word x / 32 is cell x */
+    uint32_t *bits;
+    /* bits reference memory owned by someone else, e.g. a baked level */
+    int borrowed;
+};
+
+/**
+ * serialized sight map header, followed by the bits
+ */
+struct sight_map_serialized {
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t padding;
+};
+
+static inline int
+sight_map_inside(struct sight_map *map, int x, int y)
+{
+    return x >= 0 && y >= 0 &&
+           (unsigned int)x < map->width &&
+           (unsigned int)y < map->height;
+}
+
+static inline int
+sight_cell_blocked(struct sight_map *map, int x, int y)
+{
+    return (map->bits[y * map->stride + (x >> 5)] >> (x & 31)) & 1;
+}
+
+/**
+ * creates an empty sight map where no cell blocks sight
+ *
+ * returns a struct sight_map on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct sight_map *
+sight_map_new(unsigned int width, unsigned int height, int *err_out)
+{
+    int err = 0;
+    struct sight_map *map = malloc(sizeof(*map));
+    if (!map) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(map, 0, sizeof(*map));
+
+    map->width = width;
+    map->height = height;
+    map->stride = (width + 31) / 32;
+    map->bits = calloc((size_t)map->stride * height + 1, sizeof(*map->bits));
+    if (!map->bits) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+
+    return map;
+
+error:
+    sight_map_free(map);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+/**
+ * creates a sight map from a decoded SGHT entry
+ * the entry is not referenced after the call
+ */
+__SYM_EXPORT__ struct sight_map *
+sight_map_new_from_sght(const struct dvd_entry_sght *sght, int *err_out)
+{
+    unsigned int x, y;
+    struct sight_map *map = sight_map_new(sght->width, sght->height, err_out);
+    if (!map)
+        return NULL;
+
+    for (y = 0; y < sght->height; y++) {
+        const uint8_t *row = sght->cells + y * sght->width;
+        uint32_t *bits = map->bits + y * map->stride;
+        for (x = 0; x < sght->width; x++) {
+            if (row[x])
+                bits[x >> 5] |= 1u << (x & 31);
+        }
+    }
+
+    return map;
+}
+
+/**
+ * returns the number of bytes sight_map_serialize writes
+ */
+__SYM_EXPORT__ size_t
+sight_map_serialized_size(struct sight_map *map)
+{
+    return sizeof(struct sight_map_serialized) +
+           sizeof(*map->bits) * map->stride * map->height;
+}
+
+/**
+ * writes the map to data which has to hold sight_map_serialized_size bytes
+ * and be 4 byte aligned
+ */
+__SYM_EXPORT__ void
+sight_map_serialize(struct sight_map *map, void *data)
+{
+    struct sight_map_serialized *header = data;
+
+    header->width = map->width;
+    header->height = map->height;
+    header->stride = map->stride;
+    header->padding = 0;
+    memcpy(header + 1,
+           map->bits,
+           sizeof(*map->bits) * map->stride * map->height);
+}
+
+/**
+ * creates a sight map which references serialized data directly
+ * the data has to stay valid and unchanged until the map gets freed
+ */
+__SYM_EXPORT__ struct sight_map *
+sight_map_new_from_serialized(const void *data, size_t size, int *err_out)
+{
+    const struct sight_map_serialized *header = data;
+    int err = 0;
+
+    if (size < sizeof(*header) ||
+        header->stride != (header->width + 31) / 32 ||
+        (size - sizeof(*header)) / sizeof(uint32_t) <
+          (size_t)header->stride * header->height) {
+        DEBUG_ERROR("serialized sight map is malformed\n");
+        err = EILSEQ;
+        goto error;
+    }
+
+    struct sight_map *map = malloc(sizeof(*map));
+    if (!map) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+
+    map->width = header->width;
+    map->height = header->height;
+    map->stride = header->stride;
+    map->bits = (uint32_t *)(header + 1);
+    map->borrowed = 1;
+
+    return map;
+
+error:
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+__SYM_EXPORT__ void
+sight_map_free(struct sight_map *map)
+{
+    if (!map)
+        return;
+
+    if (!map->borrowed)
+        free(map->bits);
+    free(map);
+}
+
+__SYM_EXPORT__ void
+sight_map_size(struct sight_map *map,
+               unsigned int *width,
+               unsigned int *height)
+{
+    *width = map->width;
+    *height = map->height;
+}
+
+/**
+ * returns 1 if the cell blocks sight, cells outside of the map always do
+ */
+__SYM_EXPORT__ int
+sight_map_blocked(struct sight_map *map, int x, int y)
+{
+    if (!sight_map_inside(map, x, y))
+        return 1;
+    return sight_cell_blocked(map, x, y);
+}
+
+/**
+ * changes a cell, maps created from serialized data are read only
+ */
+__SYM_EXPORT__ void
+sight_map_set_blocked(struct sight_map *map, int x, int y, int blocked)
+{
+    if (map->borrowed || !sight_map_inside(map, x, y))
+        return;
+
+    uint32_t *word = &map->bits[y * map->stride + (x >> 5)];
+    if (blocked)
+        *word |= 1u << (x & 31);
+    else
+        *word &= ~(1u << (x & 31));
+}
+
+/**
+ * sets up the fixed point walk from (x0, y0) to (x1, y1)
+ * returns the number of steps
+ */
+static inline int
+sight_dda_setup(int x0, int y0, int x1, int y1,
+                int32_t *x, int32_t *y,
+                int32_t *step_x, int32_t *step_y)
+{
+    int dx = x1 - x0;
+    int dy = y1 - y0;
+    int len = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+
+    *x = x0 * SIGHT_FIXED_ONE + SIGHT_FIXED_HALF;
+    *y = y0 * SIGHT_FIXED_ONE + SIGHT_FIXED_HALF;
+    *step_x = len ? dx * SIGHT_FIXED_ONE / len : 0;
+    *step_y = len ? dy * SIGHT_FIXED_ONE / len : 0;
+
+    return len;
+}
+
+/**
+ * returns 1 if nothing blocks the line between the two cells
+ */
+__SYM_EXPORT__ int
+sight_line_of_sight(struct sight_map *map, int x0, int y0, int x1, int y1)
+{
+    int32_t x, y, step_x, step_y;
+    int i, len;
+
+    if (!sight_map_inside(map, x0, y0) || !sight_map_inside(map, x1, y1))
+        return 0;
+
+    len = sight_dda_setup(x0, y0, x1, y1, &x, &y, &step_x, &step_y);
+    for (i = 1; i < len; i++) {
+        x += step_x;
+        y += step_y;
+        if (sight_cell_blocked(map, x >> 16, y >> 16))
+            return 0;
+    }
+
+    return 1;
+}
+
+static inline void
+sight_gather(struct sight_map *map,
+             const sight_vec *index,
+             const sight_vec *mask,
+             sight_vec *words)
+{
+#ifdef __AVX2__
+    *words = (sight_vec)_mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+                                                    (const int *)map->bits,
+                                                    (__m256i)*index,
+                                                    (__m256i)*mask,
+                                                    4);
+#else
+    int i;
+    for (i = 0; i < SIGHT_LANES; i++)
+        (*words)[i] = (*mask)[i] ? (int32_t)map->bits[(*index)[i]] : 0;
+#endif
+}
+
+static inline int
+sight_vec_any(const sight_vec *v)
+{
+    int i, any = 0;
+    for (i = 0; i < SIGHT_LANES; i++)
+        any |= (*v)[i];
+    return any;
+}
+
+/**
+ * walks up to SIGHT_LANES rays in lock step
+ */
+static void
+sight_batch_lanes(struct sight_map *map,
+                  const struct sight_ray *rays,
+                  unsigned int num_rays,
+                  uint8_t *visible)
+{
+    sight_vec x, y, step_x, step_y, steps, hit, step;
+    sight_vec stride, active, index, words;
+    int i, len, max_steps = 0;
+
+    for (i = 0; i < SIGHT_LANES; i++) {
+        x[i] = y[i] = step_x[i] = step_y[i] = 0;
+        steps[i] = 0;
+        hit[i] = 0;
+        stride[i] = map->stride;
+        step[i] = 1;
+
+        if (i >= num_rays)
+            continue;
+
+        const struct sight_ray *ray = &rays[i];
+        if (!sight_map_inside(map, ray->x0, ray->y0) ||
+            !sight_map_inside(map, ray->x1, ray->y1)) {
+            hit[i] = -1;
+            continue;
+        }
+
+        len = sight_dda_setup(ray->x0, ray->y0, ray->x1, ray->y1,
+                              &x[i], &y[i], &step_x[i], &step_y[i]);
+        steps[i] = len;
+        if (len > max_steps)
+            max_steps = len;
+    }
+
+    for (i = 1; i < max_steps; i++) {
+        active = (step < steps) & ~hit;
+        if (!sight_vec_any(&active))
+            break;
+
+        x += step_x;
+        y += step_y;
+        index = ((y >> 16) * stride + ((x >> 16) >> 5)) & active;
+        sight_gather(map, &index, &active, &words);
+        hit |= -((words >> ((x >> 16) & 31)) & 1) & active;
+        step += 1;
+    }
+
+    for (i = 0; i < num_rays && i < SIGHT_LANES; i++)
+        visible[i] = !hit[i];
+}
+
+/**
+ * tests num_rays lines of sight at once
+ * visible[i] is set to 1 if nothing blocks rays[i], 0 otherwise
+ */
+__SYM_EXPORT__ void
+sight_line_of_sight_batch(struct sight_map *map,
+                          const struct sight_ray *rays,
+                          unsigned int num_rays,
+                          uint8_t *visible)
+{
+    unsigned int i;
+    for (i = 0; i < num_rays; i += SIGHT_LANES)
+        sight_batch_lanes(map, rays + i, num_rays - i, visible + i);
+}
+
+/**
+ * returns 1 if the direction (dx, dy) lies within the opening angle of the
+ * viewer
+ */
+static inline int
+sight_in_angle(const struct sight_viewer *viewer, int dx, int dy)
+{
+    float dist2 = (float)dx * dx + (float)dy * dy;
+    float dot = dx * viewer->dir_x + dy * viewer->dir_y;
+    float cos2 = viewer->cos_half_fov * viewer->cos_half_fov * dist2;
+
+    if (dist2 == 0)
+        return 1;
+    if (viewer->cos_half_fov >= 0)
+        return dot > 0 && dot * dot >= cos2;
+    return dot >= 0 || dot * dot <= cos2;
+}
+
+/**
+ * returns 1 if the offset (dx, dy) lies within range and the opening angle
+ * of the viewer
+ */
+static inline int
+sight_in_cone(const struct sight_viewer *viewer, int dx, int dy)
+{
+    float dist2 = (float)dx * dx + (float)dy * dy;
+    float range2 = (float)viewer->range * viewer->range;
+
+    return dist2 <= range2 && sight_in_angle(viewer, dx, dy);
+}
+
+/**
+ * checks every viewer against every target
+ * visible[v * num_targets + t] is set to 1 if target t is within the view
+ * cone of viewer v and nothing blocks the line of sight, 0 otherwise
+ *
+ * returns the number of visible pairs
+ */
+__SYM_EXPORT__ unsigned int
+sight_viewers_check(struct sight_map *map,
+                    const struct sight_viewer *viewers,
+                    unsigned int num_viewers,
+                    const struct sight_target *targets,
+                    unsigned int num_targets,
+                    uint8_t *visible)
+{
+    struct sight_ray rays[SIGHT_PAIR_CHUNK];
+    unsigned int pairs[SIGHT_PAIR_CHUNK];
+    uint8_t results[SIGHT_PAIR_CHUNK];
+    unsigned int v, t, i, num_pairs = 0, num_visible = 0;
+
+    memset(visible, 0, (size_t)num_viewers * num_targets);
+
+    for (v = 0; v < num_viewers; v++) {
+        const struct sight_viewer *viewer = &viewers[v];
+        for (t = 0; t < num_targets; t++) {
+            if (!sight_in_cone(viewer,
+                               targets[t].x - viewer->x,
+                               targets[t].y - viewer->y))
+                continue;
+
+            rays[num_pairs].x0 = viewer->x;
+            rays[num_pairs].y0 = viewer->y;
+            rays[num_pairs].x1 = targets[t].x;
+            rays[num_pairs].y1 = targets[t].y;
+            pairs[num_pairs] = v * num_targets + t;
+            num_pairs++;
+
+            if (num_pairs < SIGHT_PAIR_CHUNK)
+                continue;
+
+            sight_line_of_sight_batch(map, rays, num_pairs, results);
+            for (i = 0; i < num_pairs; i++) {
+                visible[pairs[i]] = results[i];
+                num_visible += results[i];
+            }
+            num_pairs = 0;
+        }
+    }
+
+    if (!num_pairs)
+        return num_visible;
+
+    sight_line_of_sight_batch(map, rays, num_pairs, results);
+    for (i = 0; i < num_pairs; i++) {
+        visible[pairs[i]] = results[i];
+        num_visible += results[i];
+    }
+
+    return num_visible;
+}
+
+/**
+ * marks the cells on the walk from the viewer to (x1, y1) until sight gets
+ * blocked or the range is left, the blocking cell itself is visible
+ */
+static void
+sight_cone_walk(struct sight_map *map,
+                const struct sight_viewer *viewer,
+                int x1, int y1,
+                uint8_t *mask,
+                unsigned int stride)
+{
+    int32_t x, y, step_x, step_y;
+    int i, len, cx, cy;
+    int range2 = viewer->range * viewer->range;
+
+    if (!sight_in_angle(viewer, x1 - viewer->x, y1 - viewer->y))
+        return;
+
+    len = sight_dda_setup(viewer->x, viewer->y, x1, y1,
+                          &x, &y, &step_x, &step_y);
+    for (i = 1; i <= len; i++) {
+        x += step_x;
+        y += step_y;
+        cx = x >> 16;
+        cy = y >> 16;
+
+        if (!sight_map_inside(map, cx, cy))
+            return;
+        if ((cx - viewer->x) * (cx - viewer->x) +
+            (cy - viewer->y) * (cy - viewer->y) > range2)
+            return;
+
+        mask[cy * stride + cx] = 1;
+        if (sight_cell_blocked(map, cx, cy))
+            return;
+    }
+}
+
+/**
+ * rasterizes the view cone of the viewer into mask
+ * visible cells are set to 1, other cells are left untouched so multiple
+ * cones can be accumulated into the same mask
+ * mask has to hold height rows of stride bytes
+ */
+__SYM_EXPORT__ void
+sight_cone_fill(struct sight_map *map,
+                const struct sight_viewer *viewer,
+                uint8_t *mask,
+                unsigned int stride)
+{
+    int r = viewer->range, i;
+
+    if (!sight_map_inside(map, viewer->x, viewer->y))
+        return;
+
+    mask[viewer->y * stride + viewer->x] = 1;
+
+    /* one ray to every cell on the border of the bounding square */
+    for (i = -r; i <= r; i++) {
+        sight_cone_walk(map, viewer, viewer->x + i, viewer->y - r, mask, stride);
+        sight_cone_walk(map, viewer, viewer->x + i, viewer->y + r, mask, stride);
+    }
+    for (i = -r + 1; i < r; i++) {
+        sight_cone_walk(map, viewer, viewer->x - r, viewer->y + i, mask, stride);
+        sight_cone_walk(map, viewer, viewer->x + r, viewer->y + i, mask, stride);
+    }
+}
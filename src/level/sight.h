@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LEVEL_SIGHT_H__
+#define __LEVEL_SIGHT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dvd.h"
+
+struct sight_map;
+
+/**
+ * line of sight query between two cells
+ */
+struct sight_ray {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+/**
+ * a view cone
+ * dir_x/dir_y have to be normalized, cos_half_fov is the cosine of half of
+ * the opening angle and range is given in cells
+ */
+struct sight_viewer {
+    int x;
+    int y;
+    float dir_x;
+    float dir_y;
+    float cos_half_fov;
+    unsigned int range;
+};
+
+struct sight_target {
+    int x;
+    int y;
+};
+
+struct sight_map *
+sight_map_new(unsigned int width, unsigned int height, int *err_out);
+
+struct sight_map *
+sight_map_new_from_sght(const struct dvd_entry_sght *sght, int *err_out);
+
+struct sight_map *
+sight_map_new_from_serialized(const void *data, size_t size, int *err_out);
+
+void
+sight_map_free(struct sight_map *map);
+
+size_t
+sight_map_serialized_size(struct sight_map *map);
+
+void
+sight_map_serialize(struct sight_map *map, void *data);
+
+void
+sight_map_size(struct sight_map *map,
+               unsigned int *width,
+               unsigned int *height);
+
+int
+sight_map_blocked(struct sight_map *map, int x, int y);
+
+void
+sight_map_set_blocked(struct sight_map *map, int x, int y, int blocked);
+
+int
+sight_line_of_sight(struct sight_map *map, int x0, int y0, int x1, int y1);
+
+void
+sight_line_of_sight_batch(struct sight_map *map,
+                          const struct sight_ray *rays,
+                          unsigned int num_rays,
+                          uint8_t *visible);
+
+unsigned int
+sight_viewers_check(struct sight_map *map,
+                    const struct sight_viewer *viewers,
+                    unsigned int num_viewers,
+                    const struct sight_target *targets,
+                    unsigned int num_targets,
+                    uint8_t *visible);
+
+void
+sight_cone_fill(struct sight_map *map,
+                const struct sight_viewer *viewer,
+                uint8_t *mask,
+                unsigned int stride);
+
+#endif /* __LEVEL_SIGHT_H__ */
@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * line of sight benchmark
+ * =======================
+ *
+ * Times sight_viewers_check with every enemy against every player, the
+ * per frame query of the game, and compares the median with the budget
+ * of SIGHTBENCH_BUDGET_MSEC. The blocker grid comes from the SGHT entry
+ * of a dvd file or is made up of random walls.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "stats.h"
+#include "dvd.h"
+#include "sight.h"
+
+#define SIGHTBENCH_REPETITIONS 101
+#define SIGHTBENCH_BUDGET_MSEC 1.0
+#define SIGHTBENCH_RANGE 40
+/* cos(45 degrees), a quarter circle in front of the viewer */
+#define SIGHTBENCH_COS_HALF_FOV 0.7071f
+
+/* the eight directions a unit can face */
+static const float directions[8][2] = {
+    { 1.0f, 0.0f }, { 0.7071f, 0.7071f }, { 0.0f, 1.0f },
+    { -0.7071f, 0.7071f }, { -1.0f, 0.0f }, { -0.7071f, -0.7071f },
+    { 0.0f, -1.0f }, { 0.7071f, -0.7071f },
+};
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-r repetitions] [-e enemies] [-p players] "
+            "[-s WxH] [level.dvd]\n",
+            name);
+}
+
+static int
+sightbench_u64_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * returns the blocker grid of the first SGHT entry of file_name
+ */
+static struct sight_map *
+sightbench_load(const char *file_name, int *err_out)
+{
+    struct sight_map *map = NULL;
+    union dvd_entry entry;
+    int err = 0;
+
+    struct dvd_file *file = dvd_file_open((char *)file_name, &err);
+    if (!file)
+        goto out;
+
+    while (!map && dvd_file_has_next(file)) {
+        if ((err = dvd_file_get_next(file, &entry)))
+            break;
+        if (entry.type == DVD_ENTRY_TYPE_SGHT)
+            map = sight_map_new_from_sght(&entry.sght, &err);
+        dvd_entry_done(&entry);
+    }
+    dvd_file_close(file);
+
+    if (!map && !err)
+        err = ENOENT;
+
+out:
+    if (!map && err_out)
+        *err_out = err;
+    return map;
+}
+
+/**
+ * makes a map of random horizontal and vertical walls
+ */
+static struct sight_map *
+sightbench_generate(unsigned int width, unsigned int height, int *err_out)
+{
+    unsigned int i, j, num_walls = width * height / 256;
+
+    struct sight_map *map = sight_map_new(width, height, err_out);
+    if (!map)
+        return NULL;
+
+    for (i = 0; i < num_walls; i++) {
+        int x = rand() % width, y = rand() % height;
+        int horizontal = rand() % 2;
+        unsigned int length = 4 + rand() % 16;
+
+        for (j = 0; j < length; j++)
+            sight_map_set_blocked(map,
+                                  horizontal ? x + j : x,
+                                  horizontal ? y : y + j,
+                                  1);
+    }
+
+    return map;
+}
+
+/**
+ * puts a unit on a free cell close to a random spot
+ */
+static void
+sightbench_place(struct sight_map *map,
+                 unsigned int width,
+                 unsigned int height,
+                 int *x,
+                 int *y)
+{
+    unsigned int tries;
+
+    for (tries = 0; tries < 64; tries++) {
+        *x = rand() % width;
+        *y = rand() % height;
+        if (!sight_map_blocked(map, *x, *y))
+            return;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt, err = 0;
+    unsigned int repetitions = SIGHTBENCH_REPETITIONS;
+    unsigned int num_enemies = 200, num_players = 8;
+    unsigned int width = 512, height = 512, i;
+    struct sight_map *map;
+
+    while ((opt = getopt(argc, argv, "r:e:p:s:")) != -1) {
+        switch (opt) {
+            case 'r':
+                repetitions = atoi(optarg);
+                break;
+            case 'e':
+                num_enemies = atoi(optarg);
+                break;
+            case 'p':
+                num_players = atoi(optarg);
+                break;
+            case 's':
+                if (sscanf(optarg, "%ux%u", &width, &height) != 2) {
+                    usage(argv[0]);
+                    return EINVAL;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EINVAL;
+        }
+    }
+
+    if (!repetitions || !num_enemies || !num_players ||
+        !width || !height || optind + 1 < argc) {
+        usage(argv[0]);
+        return EINVAL;
+    }
+
+    srand(1);
+    if (optind < argc)
+        map = sightbench_load(argv[optind], &err);
+    else
+        map = sightbench_generate(width, height, &err);
+    if (!map) {
+        fprintf(stderr,
+                "error: cannot get a sight map: %s (%d)\n",
+                strerror(err),
+                err);
+        return err;
+    }
+    sight_map_size(map, &width, &height);
+
+    struct sight_viewer *enemies = calloc(num_enemies, sizeof(*enemies));
+    struct sight_target *players = calloc(num_players, sizeof(*players));
+    uint8_t *visible = malloc((size_t)num_enemies * num_players);
+    uint64_t *samples = malloc(sizeof(*samples) * repetitions);
+    if (!enemies || !players || !visible || !samples) {
+        fprintf(stderr, "error: out of memory\n");
+        return ENOMEM;
+    }
+
+    /* players stay in one part of the map so some enemies see them */
+    for (i = 0; i < num_players; i++)
+        sightbench_place(map,
+                         width < 128 ? width : 128,
+                         height < 128 ? height : 128,
+                         &players[i].x,
+                         &players[i].y);
+
+    unsigned int num_visible = 0;
+    for (i = 0; i < repetitions; i++) {
+        unsigned int e;
+
+        /* enemies patrol, every frame finds them somewhere else */
+        for (e = 0; e < num_enemies; e++) {
+            const float *dir = directions[rand() % 8];
+
+            sightbench_place(map,
+                             width < 192 ? width : 192,
+                             height < 192 ? height : 192,
+                             &enemies[e].x,
+                             &enemies[e].y);
+            enemies[e].dir_x = dir[0];
+            enemies[e].dir_y = dir[1];
+            enemies[e].cos_half_fov = SIGHTBENCH_COS_HALF_FOV;
+            enemies[e].range = SIGHTBENCH_RANGE;
+        }
+
+        uint64_t start = file_stats_now();
+        num_visible += sight_viewers_check(map,
+                                           enemies,
+                                           num_enemies,
+                                           players,
+                                           num_players,
+                                           visible);
+        samples[i] = file_stats_now() - start;
+    }
+
+    qsort(samples, repetitions, sizeof(*samples), sightbench_u64_cmp);
+    double median = samples[repetitions / 2] / 1e6;
+
+    printf("%ux%u map, %u enemies x %u players: median %.3f ms, "
+           "max %.3f ms, %.1f visible pairs per frame, %s %.1f ms budget\n",
+           width,
+           height,
+           num_enemies,
+           num_players,
+           median,
+           samples[repetitions - 1] / 1e6,
+           (double)num_visible / repetitions,
+           median <= SIGHTBENCH_BUDGET_MSEC ? "within" : "OVER",
+           SIGHTBENCH_BUDGET_MSEC);
+
+    free(samples);
+    free(visible);
+    free(players);
+    free(enemies);
+    sight_map_free(map);
+
+    return 0;
+}
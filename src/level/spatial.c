@@ -0,0 +1,513 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * spatial index
+ * =============
+ *
+ * A static R-tree packed with the sort-tile-recursive algorithm. Items and
+ * nodes live in two contiguous arrays and reference each other by index
+ * only. The nodes of a level are stored one after another, the children of
+ * a node are always a contiguous range and the root is the last node.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "spatial.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+/* children per node */
+#define SPATIAL_FANOUT 16
+/* deepest tree accepted, 16^16 items are more than a level can hold */
+#define SPATIAL_MAX_DEPTH 16
+/* a walk keeps the siblings of the nodes on the path to the current one */
+#define SPATIAL_STACK_SIZE (SPATIAL_MAX_DEPTH * (SPATIAL_FANOUT - 1) + 1)
+/* depth flag used while validating serialized nodes */
+#define SPATIAL_HAS_PARENT 0x80
+
+/**
+ * r-tree node
+ * starts with the same box as struct spatial_item so both can be sorted by
+ * the same functions
+ */
+struct spatial_node {
+    int32_t x0;
+    int32_t y0;
+    int32_t x1;
+    int32_t y1;
+    /* first child, an index into items for leaves and into nodes otherwise */
+    uint32_t first;
+    uint16_t count;
+    uint16_t leaf;
+};
+
+struct spatial_index {
+    unsigned int num_items;
+    struct spatial_item *items;
+    unsigned int num_nodes;
+    struct spatial_node *nodes;
+    /* items and nodes reference memory owned by someone else */
+    int borrowed;
+};
+
+/**
+ * serialized index header, followed by the items and the nodes
+ */
+struct spatial_index_serialized {
+    uint32_t num_items;
+    uint32_t num_nodes;
+};
+
+static int
+spatial_cmp_x(const void *a, const void *b)
+{
+    const int32_t *box_a = a, *box_b = b;
+    int64_t ca = (int64_t)box_a[0] + box_a[2];
+    int64_t cb = (int64_t)box_b[0] + box_b[2];
+    return (ca > cb) - (ca < cb);
+}
+
+static int
+spatial_cmp_y(const void *a, const void *b)
+{
+    const int32_t *box_a = a, *box_b = b;
+    int64_t ca = (int64_t)box_a[1] + box_a[3];
+    int64_t cb = (int64_t)box_b[1] + box_b[3];
+    return (ca > cb) - (ca < cb);
+}
+
+/**
+ * orders num boxes of size bytes each into vertical slices sorted by y
+ */
+static void
+spatial_str_sort(void *boxes, unsigned int num, size_t size)
+{
+    unsigned int num_leaves = (num + SPATIAL_FANOUT - 1) / SPATIAL_FANOUT;
+    unsigned int num_slices = 1, slice_len, i;
+
+    while (num_slices * num_slices < num_leaves)
+        num_slices++;
+    slice_len = num_slices * SPATIAL_FANOUT;
+
+    qsort(boxes, num, size, spatial_cmp_x);
+    for (i = 0; i < num; i += slice_len) {
+        qsort((char *)boxes + i * size,
+              num - i < slice_len ? num - i : slice_len,
+              size,
+              spatial_cmp_y);
+    }
+}
+
+static void
+spatial_node_extend(struct spatial_node *node, const int32_t *box)
+{
+    if (box[0] < node->x0)
+        node->x0 = box[0];
+    if (box[1] < node->y0)
+        node->y0 = box[1];
+    if (box[2] > node->x1)
+        node->x1 = box[2];
+    if (box[3] > node->y1)
+        node->y1 = box[3];
+}
+
+/**
+ * creates parent nodes for num boxes of size bytes each
+ * returns the number of nodes written to nodes
+ */
+static unsigned int
+spatial_pack_level(const void *boxes,
+                   unsigned int num,
+                   size_t size,
+                   uint32_t first,
+                   int leaf,
+                   struct spatial_node *nodes)
+{
+    unsigned int i, j, count, num_nodes = 0;
+
+    for (i = 0; i < num; i += SPATIAL_FANOUT) {
+        struct spatial_node *node = &nodes[num_nodes++];
+        const int32_t *box = (const int32_t *)((const char *)boxes + i * size);
+
+        count = num - i < SPATIAL_FANOUT ? num - i : SPATIAL_FANOUT;
+        node->x0 = box[0];
+        node->y0 = box[1];
+        node->x1 = box[2];
+        node->y1 = box[3];
+        node->first = first + i;
+        node->count = count;
+        node->leaf = leaf;
+
+        for (j = 1; j < count; j++)
+            spatial_node_extend(node,
+                                (const int32_t *)((const char *)box + j * size));
+    }
+
+    return num_nodes;
+}
+
+/**
+ * builds an index over a copy of the items
+ *
+ * returns a struct spatial_index on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct spatial_index *
+spatial_index_new(const struct spatial_item *items,
+                  unsigned int num_items,
+                  int *err_out)
+{
+    int err = 0;
+    unsigned int num, num_nodes = 0, level_start, level_len;
+
+    struct spatial_index *index = malloc(sizeof(*index));
+    if (!index) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(index, 0, sizeof(*index));
+
+    index->num_items = num_items;
+    index->items = malloc(sizeof(*index->items) * (num_items ? num_items : 1));
+    if (!index->items) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    if (!num_items)
+        return index;
+
+    memcpy(index->items, items, sizeof(*index->items) * num_items);
+
+    for (num = num_items; num > 1; ) {
+        num = (num + SPATIAL_FANOUT - 1) / SPATIAL_FANOUT;
+        num_nodes += num;
+    }
+    if (num_items == 1)
+        num_nodes = 1;
+
+    index->nodes = malloc(sizeof(*index->nodes) * num_nodes);
+    if (!index->nodes) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+
+    spatial_str_sort(index->items, num_items, sizeof(*index->items));
+    level_len = spatial_pack_level(index->items,
+                                   num_items,
+                                   sizeof(*index->items),
+                                   0,
+                                   1,
+                                   index->nodes);
+    level_start = 0;
+    index->num_nodes = level_len;
+
+    while (level_len > 1) {
+        struct spatial_node *level = index->nodes + level_start;
+
+        spatial_str_sort(level, level_len, sizeof(*level));
+        level_start = index->num_nodes;
+        level_len = spatial_pack_level(level,
+                                       level_len,
+                                       sizeof(*level),
+                                       level - index->nodes,
+                                       0,
+                                       index->nodes + level_start);
+        index->num_nodes += level_len;
+    }
+
+    return index;
+
+error:
+    spatial_index_free(index);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+static void
+spatial_item_from_element(struct spatial_item *item,
+                          const struct dvd_element *element,
+                          uint32_t id)
+{
+    item->x0 = element->x;
+    item->y0 = element->y;
+    item->x1 = element->x + (element->width ? element->width : 1);
+    item->y1 = element->y + (element->height ? element->height : 1);
+    item->id = id;
+}
+
+/**
+ * builds an index over the elements and buildings of a level
+ * ids are SPATIAL_ID_ELEM(i) and SPATIAL_ID_BUIL(i), either entry can be NULL
+ */
+__SYM_EXPORT__ struct spatial_index *
+spatial_index_new_from_level(const struct dvd_entry_elem *elem,
+                             const struct dvd_entry_buil *buil,
+                             int *err_out)
+{
+    unsigned int num_elem = elem ? elem->num_elements : 0;
+    unsigned int num_buil = buil ? buil->num_buildings : 0;
+    unsigned int i;
+
+    struct spatial_item *items = malloc(sizeof(*items) *
+                                        (num_elem + num_buil + 1));
+    if (!items) {
+        DEBUG_ERROR("out of memory\n");
+        if (err_out)
+            *err_out = ENOMEM;
+        return NULL;
+    }
+
+    for (i = 0; i < num_elem; i++)
+        spatial_item_from_element(&items[i],
+                                  &elem->elements[i],
+                                  SPATIAL_ID_ELEM(i));
+    for (i = 0; i < num_buil; i++)
+        spatial_item_from_element(&items[num_elem + i],
+                                  &buil->buildings[i],
+                                  SPATIAL_ID_BUIL(i));
+
+    struct spatial_index *index = spatial_index_new(items,
+                                                    num_elem + num_buil,
+                                                    err_out);
+    free(items);
+    return index;
+}
+
+/**
+ * returns the number of bytes spatial_index_serialize writes
+ */
+__SYM_EXPORT__ size_t
+spatial_index_serialized_size(struct spatial_index *index)
+{
+    return sizeof(struct spatial_index_serialized) +
+           sizeof(*index->items) * index->num_items +
+           sizeof(*index->nodes) * index->num_nodes;
+}
+
+/**
+ * writes the index to data which has to hold spatial_index_serialized_size
+ * bytes and be 4 byte aligned
+ */
+__SYM_EXPORT__ void
+spatial_index_serialize(struct spatial_index *index, void *data)
+{
+    struct spatial_index_serialized *header = data;
+    char *items = (char *)(header + 1);
+    char *nodes = items + sizeof(*index->items) * index->num_items;
+
+    header->num_items = index->num_items;
+    header->num_nodes = index->num_nodes;
+    /* an empty index might have no buffers to copy from */
+    if (index->num_items)
+        memcpy(items, index->items, sizeof(*index->items) * index->num_items);
+    if (index->num_nodes)
+        memcpy(nodes, index->nodes, sizeof(*index->nodes) * index->num_nodes);
+}
+
+/**
+ * creates an index which references serialized data directly
+ * the data has to stay valid and unchanged until the index gets freed
+ */
+__SYM_EXPORT__ struct spatial_index *
+spatial_index_new_from_serialized(const void *data, size_t size, int *err_out)
+{
+    const struct spatial_index_serialized *header = data;
+    unsigned int i;
+    int err = 0;
+
+    if (size < sizeof(*header) ||
+        size - sizeof(*header) <
+          sizeof(struct spatial_item) * (size_t)header->num_items +
+          sizeof(struct spatial_node) * (size_t)header->num_nodes) {
+        DEBUG_ERROR("serialized spatial index is malformed\n");
+        err = EILSEQ;
+        goto error;
+    }
+
+    struct spatial_index *index = malloc(sizeof(*index));
+    if (!index) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+
+    index->num_items = header->num_items;
+    index->items = (struct spatial_item *)(header + 1);
+    index->num_nodes = header->num_nodes;
+    index->nodes = (struct spatial_node *)(index->items + index->num_items);
+    index->borrowed = 1;
+
+    uint8_t *depths = malloc(index->num_nodes ? index->num_nodes : 1);
+    if (!depths) {
+        DEBUG_ERROR("out of memory\n");
+        free(index);
+        err = ENOMEM;
+        goto error;
+    }
+
+    /* queries trust the child ranges and the depth, which bounds their
+     * stack; children come before their parent and have only one, so a
+     * walk cannot visit nodes more than once */
+    for (i = 0; i < index->num_nodes; i++) {
+        const struct spatial_node *node = &index->nodes[i];
+        unsigned int j, depth = 1;
+
+        if (node->count > SPATIAL_FANOUT ||
+            (uint64_t)node->first + node->count >
+              (node->leaf ? index->num_items : i)) {
+            DEBUG_ERROR("serialized spatial index is malformed\n");
+            err = EILSEQ;
+            break;
+        }
+
+        for (j = 0; !node->leaf && j < node->count; j++) {
+            uint8_t *child = &depths[node->first + j];
+
+            if (*child & SPATIAL_HAS_PARENT)
+                break;
+            *child |= SPATIAL_HAS_PARENT;
+            if ((*child & ~SPATIAL_HAS_PARENT) + 1u > depth)
+                depth = (*child & ~SPATIAL_HAS_PARENT) + 1u;
+        }
+        if (!node->leaf && j < node->count) {
+            DEBUG_ERROR("serialized spatial index shares nodes\n");
+            err = EILSEQ;
+            break;
+        }
+        if (depth > SPATIAL_MAX_DEPTH) {
+            DEBUG_ERROR("serialized spatial index is too deep\n");
+            err = EILSEQ;
+            break;
+        }
+        depths[i] = depth;
+    }
+
+    free(depths);
+    if (err) {
+        free(index);
+        goto error;
+    }
+
+    return index;
+
+error:
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+__SYM_EXPORT__ void
+spatial_index_free(struct spatial_index *index)
+{
+    if (!index)
+        return;
+
+    if (!index->borrowed) {
+        free(index->items);
+        free(index->nodes);
+    }
+    free(index);
+}
+
+__SYM_EXPORT__ unsigned int
+spatial_index_num_items(struct spatial_index *index)
+{
+    return index->num_items;
+}
+
+static inline int
+spatial_overlaps(const int32_t *box, int x0, int y0, int x1, int y1)
+{
+    return box[0] < x1 && x0 < box[2] && box[1] < y1 && y0 < box[3];
+}
+
+/**
+ * writes the ids of all items overlapping the rectangle to ids
+ * x1 and y1 are exclusive, at most max_ids ids are written
+ *
+ * returns the number of overlapping items which can be larger than max_ids
+ */
+__SYM_EXPORT__ unsigned int
+spatial_index_query_rect(struct spatial_index *index,
+                         int x0, int y0, int x1, int y1,
+                         uint32_t *ids,
+                         unsigned int max_ids)
+{
+    uint32_t stack[SPATIAL_STACK_SIZE];
+    unsigned int top = 0, count = 0, i;
+
+    if (!index->num_nodes)
+        return 0;
+
+    stack[top++] = index->num_nodes - 1;
+    while (top) {
+        const struct spatial_node *node = &index->nodes[stack[--top]];
+
+        if (!spatial_overlaps(&node->x0, x0, y0, x1, y1))
+            continue;
+
+        if (!node->leaf) {
+            for (i = 0; i < node->count; i++)
+                stack[top++] = node->first + i;
+            continue;
+        }
+
+        for (i = 0; i < node->count; i++) {
+            const struct spatial_item *item = &index->items[node->first + i];
+            if (!spatial_overlaps(&item->x0, x0, y0, x1, y1))
+                continue;
+            if (count < max_ids)
+                ids[count] = item->id;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * writes the ids of all items containing the point to ids
+ *
+ * returns the number of items which can be larger than max_ids
+ */
+__SYM_EXPORT__ unsigned int
+spatial_index_query_point(struct spatial_index *index,
+                          int x, int y,
+                          uint32_t *ids,
+                          unsigned int max_ids)
+{
+    return spatial_index_query_rect(index, x, y, x + 1, y + 1, ids, max_ids);
+}
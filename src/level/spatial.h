@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LEVEL_SPATIAL_H__
+#define __LEVEL_SPATIAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dvd.h"
+
+/* ids handed out by spatial_index_new_from_level */
+#define SPATIAL_ID_BUIL_FLAG 0x80000000u
+#define SPATIAL_ID_ELEM(INDEX) ((uint32_t)(INDEX))
+#define SPATIAL_ID_BUIL(INDEX) ((uint32_t)(INDEX) | SPATIAL_ID_BUIL_FLAG)
+#define SPATIAL_ID_IS_BUIL(ID) (((ID) & SPATIAL_ID_BUIL_FLAG) != 0)
+#define SPATIAL_ID_INDEX(ID) ((ID) & ~SPATIAL_ID_BUIL_FLAG)
+
+/**
+ * an axis aligned box, x1 and y1 are exclusive
+ */
+struct spatial_item {
+    int32_t x0;
+    int32_t y0;
+    int32_t x1;
+    int32_t y1;
+    uint32_t id;
+};
+
+struct spatial_index;
+
+struct spatial_index *
+spatial_index_new(const struct spatial_item *items,
+                  unsigned int num_items,
+                  int *err_out);
+
+struct spatial_index *
+spatial_index_new_from_level(const struct dvd_entry_elem *elem,
+                             const struct dvd_entry_buil *buil,
+                             int *err_out);
+
+struct spatial_index *
+spatial_index_new_from_serialized(const void *data, size_t size, int *err_out);
+
+void
+spatial_index_free(struct spatial_index *index);
+
+size_t
+spatial_index_serialized_size(struct spatial_index *index);
+
+void
+spatial_index_serialize(struct spatial_index *index, void *data);
+
+unsigned int
+spatial_index_num_items(struct spatial_index *index);
+
+unsigned int
+spatial_index_query_rect(struct spatial_index *index,
+                         int x0, int y0, int x1, int y1,
+                         uint32_t *ids,
+                         unsigned int max_ids);
+
+unsigned int
+spatial_index_query_point(struct spatial_index *index,
+                          int x, int y,
+                          uint32_t *ids,
+                          unsigned int max_ids);
+
+#endif /* __LEVEL_SPATIAL_H__ */
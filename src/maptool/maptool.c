@@ -1,8 +1,13 @@
 
+#include <errno.h>
 #include <stdio.h>
 #include <SDL.h>
 #include <dvm.h>
+#include <pixmap.h>
+#include <trace.h>
 #include <dvd.h>
+#include <sight.h>
+#include <bake.h>
 
 int
 main(int argc, char **argv)
@@ -12,10 +17,28 @@ main(int argc, char **argv)
 
     char dvd_filename[MAX_PATH];
     char dvm_filename[MAX_PATH];
+    char bake_filename[MAX_PATH];
     snprintf(dvd_filename, MAX_PATH-1, "%s.dvd", argv[1]);
     snprintf(dvm_filename, MAX_PATH-1, "%s.dvm", argv[1]);
+    snprintf(bake_filename, MAX_PATH-1, "%s.bake", argv[1]);
 
     int err = 0;
+
+    /* a baked level only needs to be mapped, unless the level changed */
+    struct baked_level *baked = baked_level_open(bake_filename,
+                                                 dvd_filename,
+                                                 dvm_filename,
+                                                 &err);
+    if (!baked && err == ESTALE)
+        printf("%s is stale, parsing the level\n", bake_filename);
+    if (baked) {
+        printf("baked level: %u elements, %u buildings\n",
+               baked_level_num_elements(baked),
+               baked_level_num_buildings(baked));
+        baked_level_close(baked);
+        return 0;
+    }
+
     struct dvd_file *file = dvd_file_open(dvd_filename, &err);
     if (!file) {
         fprintf(stderr, "dvd_file_open failed\n");
@@ -23,6 +46,7 @@ main(int argc, char **argv)
     }
 
     union dvd_entry entry;
+    struct sight_map *sight = NULL;
     while (dvd_file_has_next(file)) {
         if ((err = dvd_file_get_next(file, &entry))) {
             fprintf(stderr, "dvd_file_get_next failed\n");
@@ -33,6 +57,22 @@ main(int argc, char **argv)
             case DVD_ENTRY_TYPE_MISC:
                 printf("misc entry: size %d\n", entry.misc.size);
                 break;
+            case DVD_ENTRY_TYPE_SGHT:
+                printf("sght entry: %ux%u\n",
+                       entry.sght.width,
+                       entry.sght.height);
+                sight_map_free(sight);
+                sight = sight_map_new_from_sght(&entry.sght, NULL);
+                break;
+            case DVD_ENTRY_TYPE_SCRP:
+                printf("scrp entry: %u triggers\n", entry.scrp.num_triggers);
+                break;
+            case DVD_ENTRY_TYPE_ELEM:
+                printf("elem entry: %u elements\n", entry.elem.num_elements);
+                break;
+            case DVD_ENTRY_TYPE_BUIL:
+                printf("buil entry: %u buildings\n", entry.buil.num_buildings);
+                break;
             case DVD_ENTRY_TYPE_UNKN:
             default:
                 break;
@@ -42,6 +82,7 @@ main(int argc, char **argv)
     }
 
     dvd_file_close(file);
+    sight_map_free(sight);
 
     return 0;
 
@@ -62,15 +103,15 @@ main(int argc, char **argv)
                                      SDL_WINDOW_FULLSCREEN_DESKTOP);
     SDL_Renderer *renderer = SDL_CreateRenderer(w, -1, SDL_RENDERER_ACCELERATED);
 
-    SDL_Surface *surface = SDL_CreateRGBSurface(0,
+    SDL_Surface *surface = SDL_CreateRGBSurfaceFrom(pixmap,
                            width,
                            height,
-                           16, 0, 0, 0, 0);
-    surface->pixels = pixmap;
+                           16, width * 2, 0, 0, 0, 0);
 
     SDL_Texture *tex = SDL_CreateTextureFromSurface(renderer,
                                                     surface);
     SDL_FreeSurface(surface);
+    pixmap_free(pixmap);
 
     SDL_Rect rect;
     rect.x = 0;
@@ -82,6 +123,7 @@ main(int argc, char **argv)
     int offset_x, offset_y;
     SDL_Event event;
     while (1) {
+        TRACE_ZONE("frame");
         while(SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 goto exit;
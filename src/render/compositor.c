@@ -0,0 +1,777 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * software compositor
+ * ===================
+ *
+ * Draws a region of a background map and sprite instances into a
+ * B8G8R8A8 framebuffer without a GPU. The target is split into
+ * COMPOSITOR_TILE_SIZE tiles:
+ *
+ * 1. sprites get ordered by depth (see depthsort.c), ties keep the order
+ *    they were given in
+ * 2. every sprite is binned into the tiles it overlaps, in that order
+ * 3. the tiles are handed out to the workers through a shared counter,
+ *    each tile gets its background converted and its bin blended back to
+ *    front
+ *
+ * Tiles never share pixels so the workers need no locking. Blending works
+ * on four pixels at a time using the gcc vector extensions, fully opaque
+ * and fully transparent groups are copied or skipped. Scratch memory is
+ * kept between draws.
+ *
+ * compositor_draw_rects only hands out the tiles touching a set of
+ * rectangles (see dirty.c) and recomposes just those parts of them.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "compositor.h"
+#include "depthsort.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+typedef uint8_t compositor_u8x16 __attribute__ ((vector_size (16)));
+typedef uint16_t compositor_u16x16 __attribute__ ((vector_size (32)));
+
+struct compositor {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    unsigned int num_workers;
+    pthread_t workers[COMPOSITOR_MAX_THREADS];
+    int quit;
+    /* bumped for every draw, workers wait for it to change */
+    unsigned int generation;
+    unsigned int busy_workers;
+    unsigned int next_tile;
+
+    /* the draw in progress */
+    const struct compositor_target *target;
+    const struct compositor_background *background;
+    const struct compositor_sprite *sprites;
+    int view_x;
+    int view_y;
+    unsigned int tiles_x;
+    unsigned int num_tiles;
+    /* only these parts of the target get drawn if num_rects is not 0 */
+    const struct compositor_rect *rects;
+    unsigned int num_rects;
+    /* the tiles touched by rects, handed out instead of all tiles */
+    unsigned int *tiles;
+    unsigned int tiles_alloc;
+    unsigned int num_jobs;
+
+    /* the depth of every sprite and the sprites sorted by it */
+    uint32_t *depths;
+    unsigned int depths_alloc;
+    struct depth_sort *sort;
+    const unsigned int *order;
+    /* bins[bin_start[tile]..bin_start[tile + 1]) are the sprites of tile */
+    unsigned int *bin_start;
+    unsigned int bin_start_alloc;
+    unsigned int *bins;
+    unsigned int bins_alloc;
+};
+
+/**
+ * grows a scratch array to hold at least num elements
+ */
+static int
+compositor_reserve(void **array,
+                   unsigned int *alloc,
+                   unsigned int num,
+                   size_t size)
+{
+    if (num <= *alloc)
+        return 0;
+
+    unsigned int new_alloc = *alloc ? *alloc : 256;
+    while (new_alloc < num)
+        new_alloc *= 2;
+
+    void *new_array = realloc(*array, new_alloc * size);
+    if (!new_array)
+        return ENOMEM;
+
+    *array = new_array;
+    *alloc = new_alloc;
+    return 0;
+}
+
+static inline unsigned int
+compositor_div255(unsigned int x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+/**
+ * src over dst for one pixel
+ */
+static inline void
+compositor_blend1(uint8_t *dst, const uint8_t *src)
+{
+    unsigned int a = src[3];
+
+    if (a == 255) {
+        memcpy(dst, src, 4);
+    } else if (a) {
+        dst[0] = compositor_div255(src[0] * a + dst[0] * (255 - a));
+        dst[1] = compositor_div255(src[1] * a + dst[1] * (255 - a));
+        dst[2] = compositor_div255(src[2] * a + dst[2] * (255 - a));
+        dst[3] = compositor_div255(src[3] * 255 + dst[3] * (255 - a));
+    }
+}
+
+/**
+ * src over dst for four pixels
+ */
+static inline void
+compositor_blend4(uint8_t *dst, const uint8_t *src)
+{
+    static const compositor_u8x16 alpha_index = {
+        3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15
+    };
+    static const compositor_u16x16 alpha_lanes = {
+        0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255
+    };
+    compositor_u8x16 s, d;
+
+    if ((src[3] & src[7] & src[11] & src[15]) == 255) {
+        memcpy(dst, src, 16);
+        return;
+    }
+    if ((src[3] | src[7] | src[11] | src[15]) == 0)
+        return;
+
+    memcpy(&s, src, 16);
+    memcpy(&d, dst, 16);
+
+    /* the alpha of each pixel in all four of its lanes */
+    compositor_u8x16 a8 = __builtin_shuffle(s, alpha_index);
+    compositor_u16x16 a = __builtin_convertvector(a8, compositor_u16x16);
+    compositor_u16x16 s16 = __builtin_convertvector(s, compositor_u16x16);
+    compositor_u16x16 d16 = __builtin_convertvector(d, compositor_u16x16);
+
+    /* the alpha lanes come out as src_a + dst_a * (1 - src_a) */
+    compositor_u16x16 x = s16 * (a | alpha_lanes) + d16 * (255 - a) + 128;
+    x = (x + (x >> 8)) >> 8;
+
+    d = __builtin_convertvector(x, compositor_u8x16);
+    memcpy(dst, &d, 16);
+}
+
+static void
+compositor_blend_row(uint8_t *dst, const uint8_t *src, unsigned int n)
+{
+    unsigned int i = 0;
+
+    for (; i + 4 <= n; i += 4)
+        compositor_blend4(dst + i * 4, src + i * 4);
+    for (; i < n; i++)
+        compositor_blend1(dst + i * 4, src + i * 4);
+}
+
+/**
+ * converts the background under columns x0..x1 of screen row y
+ */
+static void
+compositor_background_row(struct compositor *compositor,
+                          uint8_t *dst,
+                          int y,
+                          int x0,
+                          int x1)
+{
+    const struct compositor_background *background = compositor->background;
+    int map_y = compositor->view_y + y;
+    int x;
+
+    if (!background) {
+        memset(dst, 0, (x1 - x0) * 4);
+        return;
+    }
+
+    const uint16_t *row = map_y >= 0 && map_y < (int)background->height ?
+        (const uint16_t *)((const uint8_t *)background->pixels +
+                           (size_t)background->pitch * map_y) :
+        NULL;
+
+    for (x = x0; x < x1; x++, dst += 4) {
+        int map_x = compositor->view_x + x;
+
+        if (!row || map_x < 0 || map_x >= (int)background->width) {
+            dst[0] = dst[1] = dst[2] = 0;
+            dst[3] = 255;
+            continue;
+        }
+
+        unsigned int color = row[map_x];
+        unsigned int r = (color >> 11) & 0x1f;
+        unsigned int g = (color >> 5) & 0x3f;
+        unsigned int b = color & 0x1f;
+
+        dst[0] = b * 8 + b / 4;
+        dst[1] = g * 4 + g / 16;
+        dst[2] = r * 8 + r / 4;
+        dst[3] = 255;
+    }
+}
+
+/**
+ * returns the screen rectangle of the sprite clipped to the target
+ * returns 0 if nothing of it is visible
+ */
+static int
+compositor_sprite_rect(struct compositor *compositor,
+                       const struct compositor_sprite *sprite,
+                       int *x0,
+                       int *y0,
+                       int *x1,
+                       int *y1)
+{
+    int x = sprite->x + sprite->offset_x - compositor->view_x;
+    int y = sprite->y + sprite->offset_y - compositor->view_y;
+
+    *x0 = x > 0 ? x : 0;
+    *y0 = y > 0 ? y : 0;
+    *x1 = x + (int)sprite->width;
+    *y1 = y + (int)sprite->height;
+    if (*x1 > (int)compositor->target->width)
+        *x1 = compositor->target->width;
+    if (*y1 > (int)compositor->target->height)
+        *y1 = compositor->target->height;
+
+    return *x0 < *x1 && *y0 < *y1;
+}
+
+/**
+ * draws the part tx0, ty0 - tx1, ty1 of a tile
+ */
+static void
+compositor_draw_region(struct compositor *compositor,
+                       unsigned int tile,
+                       int tx0,
+                       int ty0,
+                       int tx1,
+                       int ty1)
+{
+    const struct compositor_target *target = compositor->target;
+    unsigned int i;
+    int y;
+
+    for (y = ty0; y < ty1; y++) {
+        compositor_background_row(compositor,
+                                  target->pixels +
+                                  (size_t)target->pitch * y + tx0 * 4,
+                                  y,
+                                  tx0,
+                                  tx1);
+    }
+
+    for (i = compositor->bin_start[tile];
+         i < compositor->bin_start[tile + 1];
+         i++) {
+        const struct compositor_sprite *sprite =
+            &compositor->sprites[compositor->bins[i]];
+        int x0, y0, x1, y1;
+
+        compositor_sprite_rect(compositor, sprite, &x0, &y0, &x1, &y1);
+        if (x0 < tx0)
+            x0 = tx0;
+        if (y0 < ty0)
+            y0 = ty0;
+        if (x1 > tx1)
+            x1 = tx1;
+        if (y1 > ty1)
+            y1 = ty1;
+        /* binned by tile, it can still miss the region */
+        if (x0 >= x1 || y0 >= y1)
+            continue;
+
+        int sx = sprite->x + sprite->offset_x - compositor->view_x;
+        int sy = sprite->y + sprite->offset_y - compositor->view_y;
+
+        for (y = y0; y < y1; y++) {
+            compositor_blend_row(target->pixels +
+                                 (size_t)target->pitch * y + x0 * 4,
+                                 sprite->pixels +
+                                 (size_t)sprite->pitch * (y - sy) +
+                                 (x0 - sx) * 4,
+                                 x1 - x0);
+        }
+    }
+}
+
+static void
+compositor_draw_tile(struct compositor *compositor, unsigned int tile)
+{
+    const struct compositor_target *target = compositor->target;
+    int tx0 = tile % compositor->tiles_x * COMPOSITOR_TILE_SIZE;
+    int ty0 = tile / compositor->tiles_x * COMPOSITOR_TILE_SIZE;
+    int tx1 = tx0 + COMPOSITOR_TILE_SIZE;
+    int ty1 = ty0 + COMPOSITOR_TILE_SIZE;
+    unsigned int i;
+
+    if (tx1 > (int)target->width)
+        tx1 = target->width;
+    if (ty1 > (int)target->height)
+        ty1 = target->height;
+
+    if (!compositor->num_rects) {
+        compositor_draw_region(compositor, tile, tx0, ty0, tx1, ty1);
+        return;
+    }
+
+    /* every region is recomposed from the background, so rectangles
+     * overlapping each other only cost time */
+    for (i = 0; i < compositor->num_rects; i++) {
+        const struct compositor_rect *rect = &compositor->rects[i];
+        int x0 = rect->x0 > tx0 ? rect->x0 : tx0;
+        int y0 = rect->y0 > ty0 ? rect->y0 : ty0;
+        int x1 = rect->x1 < tx1 ? rect->x1 : tx1;
+        int y1 = rect->y1 < ty1 ? rect->y1 : ty1;
+
+        if (x0 < x1 && y0 < y1)
+            compositor_draw_region(compositor, tile, x0, y0, x1, y1);
+    }
+}
+
+/**
+ * draws tiles until none are left
+ */
+static void
+compositor_run_tiles(struct compositor *compositor)
+{
+    TRACE_ZONE("compositor_tiles");
+    unsigned int job;
+
+    while ((job = __atomic_fetch_add(&compositor->next_tile,
+                                     1,
+                                     __ATOMIC_RELAXED)) <
+           compositor->num_jobs)
+        compositor_draw_tile(compositor,
+                             compositor->num_rects ?
+                             compositor->tiles[job] :
+                             job);
+}
+
+static void *
+compositor_thread(void *data)
+{
+    struct compositor *compositor = data;
+    unsigned int generation = 0;
+
+    trace_set_thread_name("compositor");
+
+    pthread_mutex_lock(&compositor->mutex);
+    for (;;) {
+        while (!compositor->quit && compositor->generation == generation)
+            pthread_cond_wait(&compositor->work_cond, &compositor->mutex);
+        if (compositor->quit)
+            break;
+        generation = compositor->generation;
+        pthread_mutex_unlock(&compositor->mutex);
+
+        compositor_run_tiles(compositor);
+
+        pthread_mutex_lock(&compositor->mutex);
+        if (--compositor->busy_workers == 0)
+            pthread_cond_signal(&compositor->done_cond);
+    }
+    pthread_mutex_unlock(&compositor->mutex);
+
+    return NULL;
+}
+
+/**
+ * sorts the sprites by depth and bins them into the tiles
+ */
+static int
+compositor_bin(struct compositor *compositor, unsigned int num_sprites)
+{
+    TRACE_ZONE("compositor_bin");
+    unsigned int i, tx, ty, num_entries = 0;
+    int x0, y0, x1, y1;
+
+    if (compositor_reserve((void **)&compositor->depths,
+                           &compositor->depths_alloc,
+                           num_sprites,
+                           sizeof(*compositor->depths)) ||
+        compositor_reserve((void **)&compositor->bin_start,
+                           &compositor->bin_start_alloc,
+                           compositor->num_tiles + 1,
+                           sizeof(*compositor->bin_start)))
+        return ENOMEM;
+
+    /* the sort is stable, equal depths stay in the given order */
+    for (i = 0; i < num_sprites; i++)
+        compositor->depths[i] = compositor->sprites[i].depth;
+    compositor->order = depth_sort(compositor->sort,
+                                   compositor->depths,
+                                   NULL,
+                                   num_sprites);
+    if (!compositor->order)
+        return ENOMEM;
+
+    /* count, then turn the counts into start offsets, then fill, the
+     * visible rects are clipped to the target and never negative */
+    memset(compositor->bin_start,
+           0,
+           sizeof(*compositor->bin_start) * (compositor->num_tiles + 1));
+
+    for (i = 0; i < num_sprites; i++) {
+        if (!compositor_sprite_rect(compositor,
+                                    &compositor->sprites[i],
+                                    &x0, &y0, &x1, &y1))
+            continue;
+
+        for (ty = (unsigned int)y0 / COMPOSITOR_TILE_SIZE;
+             ty <= (unsigned int)(y1 - 1) / COMPOSITOR_TILE_SIZE;
+             ty++) {
+            for (tx = (unsigned int)x0 / COMPOSITOR_TILE_SIZE;
+                 tx <= (unsigned int)(x1 - 1) / COMPOSITOR_TILE_SIZE;
+                 tx++) {
+                compositor->bin_start[ty * compositor->tiles_x + tx + 1]++;
+                num_entries++;
+            }
+        }
+    }
+
+    for (i = 0; i < compositor->num_tiles; i++)
+        compositor->bin_start[i + 1] += compositor->bin_start[i];
+
+    if (compositor_reserve((void **)&compositor->bins,
+                           &compositor->bins_alloc,
+                           num_entries,
+                           sizeof(*compositor->bins)))
+        return ENOMEM;
+
+    /* bin_start[tile] is used as fill position and ends up at the next
+     * tile's start, it gets shifted back below */
+    for (i = 0; i < num_sprites; i++) {
+        unsigned int index = compositor->order[i];
+
+        if (!compositor_sprite_rect(compositor,
+                                    &compositor->sprites[index],
+                                    &x0, &y0, &x1, &y1))
+            continue;
+
+        for (ty = (unsigned int)y0 / COMPOSITOR_TILE_SIZE;
+             ty <= (unsigned int)(y1 - 1) / COMPOSITOR_TILE_SIZE;
+             ty++) {
+            for (tx = (unsigned int)x0 / COMPOSITOR_TILE_SIZE;
+                 tx <= (unsigned int)(x1 - 1) / COMPOSITOR_TILE_SIZE;
+                 tx++) {
+                unsigned int tile = ty * compositor->tiles_x + tx;
+                compositor->bins[compositor->bin_start[tile]++] = index;
+            }
+        }
+    }
+
+    for (i = compositor->num_tiles; i > 0; i--)
+        compositor->bin_start[i] = compositor->bin_start[i - 1];
+    compositor->bin_start[0] = 0;
+
+    return 0;
+}
+
+/**
+ * creates a compositor drawing with num_threads threads including the
+ * caller of compositor_draw, zero picks the number of online cpus
+ *
+ * returns a struct compositor on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct compositor *
+compositor_new(unsigned int num_threads, int *err_out)
+{
+    int err = 0;
+
+    if (num_threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 0 ? cpus : 1;
+    }
+    if (num_threads > COMPOSITOR_MAX_THREADS)
+        num_threads = COMPOSITOR_MAX_THREADS;
+
+    struct compositor *compositor = malloc(sizeof(*compositor));
+    if (!compositor) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(compositor, 0, sizeof(*compositor));
+
+    pthread_mutex_init(&compositor->mutex, NULL);
+    pthread_cond_init(&compositor->work_cond, NULL);
+    pthread_cond_init(&compositor->done_cond, NULL);
+
+    compositor->sort = depth_sort_new(&err);
+    if (!compositor->sort)
+        goto error;
+
+    for (; compositor->num_workers < num_threads - 1;
+         compositor->num_workers++) {
+        err = pthread_create(&compositor->workers[compositor->num_workers],
+                             NULL,
+                             compositor_thread,
+                             compositor);
+        if (err) {
+            DEBUG_ERROR("cannot create thread: %s\n", strerror(err));
+            goto error;
+        }
+    }
+
+    return compositor;
+
+error:
+    compositor_free(compositor);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+__SYM_EXPORT__ void
+compositor_free(struct compositor *compositor)
+{
+    unsigned int i;
+
+    if (!compositor)
+        return;
+
+    pthread_mutex_lock(&compositor->mutex);
+    compositor->quit = 1;
+    pthread_cond_broadcast(&compositor->work_cond);
+    pthread_mutex_unlock(&compositor->mutex);
+
+    for (i = 0; i < compositor->num_workers; i++)
+        pthread_join(compositor->workers[i], NULL);
+
+    pthread_cond_destroy(&compositor->done_cond);
+    pthread_cond_destroy(&compositor->work_cond);
+    pthread_mutex_destroy(&compositor->mutex);
+
+    free(compositor->tiles);
+    free(compositor->bins);
+    free(compositor->bin_start);
+    depth_sort_free(compositor->sort);
+    free(compositor->depths);
+    free(compositor);
+}
+
+/**
+ * returns the number of threads drawing, including the caller
+ */
+__SYM_EXPORT__ unsigned int
+compositor_num_threads(struct compositor *compositor)
+{
+    return compositor->num_workers + 1;
+}
+
+/**
+ * sets up sprite to draw the decoded pixels of frame for an object at x, y
+ * the frame offset comes from the frame itself
+ */
+__SYM_EXPORT__ void
+compositor_sprite_from_frame(struct compositor_sprite *sprite,
+                             struct dvf_frame *frame,
+                             const void *pixels,
+                             int x,
+                             int y,
+                             uint32_t depth)
+{
+    unsigned int offset_x, offset_y;
+
+    dvf_frame_size(frame, &sprite->width, &sprite->height);
+    dvf_frame_unknown(frame, NULL, NULL, &offset_x, &offset_y, NULL, NULL);
+
+    sprite->pixels = pixels;
+    sprite->pitch = sprite->width * 4;
+    sprite->x = x;
+    sprite->y = y;
+    sprite->offset_x = (int16_t)offset_x;
+    sprite->offset_y = (int16_t)offset_y;
+    sprite->depth = depth;
+}
+
+/**
+ * collects the tiles touched by the rectangles
+ */
+static int
+compositor_collect_tiles(struct compositor *compositor)
+{
+    unsigned int tile, i;
+
+    if (compositor_reserve((void **)&compositor->tiles,
+                           &compositor->tiles_alloc,
+                           compositor->num_tiles,
+                           sizeof(*compositor->tiles)))
+        return ENOMEM;
+
+    compositor->num_jobs = 0;
+    for (tile = 0; tile < compositor->num_tiles; tile++) {
+        int tx0 = tile % compositor->tiles_x * COMPOSITOR_TILE_SIZE;
+        int ty0 = tile / compositor->tiles_x * COMPOSITOR_TILE_SIZE;
+
+        for (i = 0; i < compositor->num_rects; i++) {
+            const struct compositor_rect *rect = &compositor->rects[i];
+
+            if (rect->x0 < tx0 + COMPOSITOR_TILE_SIZE && rect->x1 > tx0 &&
+                rect->y0 < ty0 + COMPOSITOR_TILE_SIZE && rect->y1 > ty0) {
+                compositor->tiles[compositor->num_jobs++] = tile;
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+compositor_run(struct compositor *compositor,
+               const struct compositor_target *target,
+               int view_x,
+               int view_y,
+               const struct compositor_background *background,
+               const struct compositor_sprite *sprites,
+               unsigned int num_sprites,
+               const struct compositor_rect *rects,
+               unsigned int num_rects)
+{
+    int err = 0;
+
+    if (!target || !target->pixels)
+        return EINVAL;
+
+    compositor->target = target;
+    compositor->background = background;
+    compositor->sprites = sprites;
+    compositor->view_x = view_x;
+    compositor->view_y = view_y;
+    compositor->tiles_x = (target->width + COMPOSITOR_TILE_SIZE - 1) /
+                          COMPOSITOR_TILE_SIZE;
+    compositor->num_tiles = compositor->tiles_x *
+                            ((target->height + COMPOSITOR_TILE_SIZE - 1) /
+                             COMPOSITOR_TILE_SIZE);
+    compositor->rects = rects;
+    compositor->num_rects = num_rects;
+    compositor->num_jobs = compositor->num_tiles;
+
+    if (num_rects && (err = compositor_collect_tiles(compositor)))
+        return err;
+    if ((err = compositor_bin(compositor, num_sprites)))
+        return err;
+
+    pthread_mutex_lock(&compositor->mutex);
+    compositor->next_tile = 0;
+    compositor->busy_workers = compositor->num_workers;
+    compositor->generation++;
+    pthread_cond_broadcast(&compositor->work_cond);
+    pthread_mutex_unlock(&compositor->mutex);
+
+    compositor_run_tiles(compositor);
+
+    pthread_mutex_lock(&compositor->mutex);
+    while (compositor->busy_workers)
+        pthread_cond_wait(&compositor->done_cond, &compositor->mutex);
+    pthread_mutex_unlock(&compositor->mutex);
+
+    return 0;
+}
+
+/**
+ * draws the background and the sprites into target, the top left pixel
+ * of the target shows view_x, view_y of the map
+ * without a background the target gets cleared to transparent black
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+compositor_draw(struct compositor *compositor,
+                const struct compositor_target *target,
+                int view_x,
+                int view_y,
+                const struct compositor_background *background,
+                const struct compositor_sprite *sprites,
+                unsigned int num_sprites)
+{
+    TRACE_ZONE("compositor_draw");
+
+    return compositor_run(compositor,
+                          target,
+                          view_x,
+                          view_y,
+                          background,
+                          sprites,
+                          num_sprites,
+                          NULL,
+                          0);
+}
+
+/**
+ * like compositor_draw but only redraws the given rectangles of target,
+ * the rest keeps what the previous draw left there
+ * no rectangles means nothing to do
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+compositor_draw_rects(struct compositor *compositor,
+                      const struct compositor_target *target,
+                      int view_x,
+                      int view_y,
+                      const struct compositor_background *background,
+                      const struct compositor_sprite *sprites,
+                      unsigned int num_sprites,
+                      const struct compositor_rect *rects,
+                      unsigned int num_rects)
+{
+    TRACE_ZONE("compositor_draw_rects");
+
+    if (!num_rects)
+        return 0;
+
+    return compositor_run(compositor,
+                          target,
+                          view_x,
+                          view_y,
+                          background,
+                          sprites,
+                          num_sprites,
+                          rects,
+                          num_rects);
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __RENDER_COMPOSITOR_H__
+#define __RENDER_COMPOSITOR_H__
+
+#include <stdint.h>
+
+#include "dvf.h"
+
+/* edge length of the screen tiles the work is split into */
+#define COMPOSITOR_TILE_SIZE 64
+#define COMPOSITOR_MAX_THREADS 64
+
+struct compositor;
+
+/**
+ * pixels x0 <= x < x1, y0 <= y < y1
+ */
+struct compositor_rect {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+/**
+ * B8G8R8A8 framebuffer drawn into
+ */
+struct compositor_target {
+    uint8_t *pixels;
+    unsigned int width;
+    unsigned int height;
+    /* bytes between rows */
+    unsigned int pitch;
+};
+
+/**
+ * R5G6B5 map as returned by dvm_file_get_pixmap
+ */
+struct compositor_background {
+    const uint16_t *pixels;
+    unsigned int width;
+    unsigned int height;
+    unsigned int pitch;
+};
+
+/**
+ * an instance of a B8G8R8A8 sprite as returned by dvf_frame_pixmap
+ * it is drawn at x + offset_x, y + offset_y in map coordinates, sprites
+ * with a higher depth cover those with a lower one
+ */
+struct compositor_sprite {
+    const uint8_t *pixels;
+    unsigned int width;
+    unsigned int height;
+    unsigned int pitch;
+    int x;
+    int y;
+    /* offset of the frame relative to the position of the object */
+    int offset_x;
+    int offset_y;
+    uint32_t depth;
+};
+
+struct compositor *
+compositor_new(unsigned int num_threads, int *err_out);
+
+void
+compositor_free(struct compositor *compositor);
+
+unsigned int
+compositor_num_threads(struct compositor *compositor);
+
+void
+compositor_sprite_from_frame(struct compositor_sprite *sprite,
+                             struct dvf_frame *frame,
+                             const void *pixels,
+                             int x,
+                             int y,
+                             uint32_t depth);
+
+int
+compositor_draw(struct compositor *compositor,
+                const struct compositor_target *target,
+                int view_x,
+                int view_y,
+                const struct compositor_background *background,
+                const struct compositor_sprite *sprites,
+                unsigned int num_sprites);
+
+int
+compositor_draw_rects(struct compositor *compositor,
+                      const struct compositor_target *target,
+                      int view_x,
+                      int view_y,
+                      const struct compositor_background *background,
+                      const struct compositor_sprite *sprites,
+                      unsigned int num_sprites,
+                      const struct compositor_rect *rects,
+                      unsigned int num_rects);
+
+#endif /* __RENDER_COMPOSITOR_H__ */
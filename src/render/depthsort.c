@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * depth sort
+ * ==========
+ *
+ * Orders the instances of a frame back to front by a 32 bit key. This is
+ * a least significant digit radix sort with 8 bit digits: the counts of
+ * all four digits are taken in one pass over the keys, then every digit
+ * scatters keys and indices from one buffer into the other. Digits which
+ * are the same for all keys (like the layer in most scenes) are skipped.
+ * Every pass is stable, so equal keys keep their order.
+ *
+ * The buffers only grow, a frame with no more instances than one before
+ * does not allocate.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "trace.h"
+#include "depthsort.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+#define DEPTH_SORT_DIGITS 4
+#define DEPTH_SORT_RADIX 256
+
+struct depth_sort {
+    /* the passes go back and forth between the two */
+    uint32_t *keys[2];
+    unsigned int *index[2];
+    unsigned int alloc;
+};
+
+/**
+ * creates a depth sort without any buffers
+ *
+ * returns a struct depth_sort on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct depth_sort *
+depth_sort_new(int *err_out)
+{
+    int err = 0;
+
+    struct depth_sort *sort = malloc(sizeof(*sort));
+    if (!sort) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(sort, 0, sizeof(*sort));
+
+    return sort;
+
+error:
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+__SYM_EXPORT__ void
+depth_sort_free(struct depth_sort *sort)
+{
+    if (!sort)
+        return;
+
+    free(sort->keys[0]);
+    free(sort->keys[1]);
+    free(sort->index[0]);
+    free(sort->index[1]);
+    free(sort);
+}
+
+/**
+ * makes sure num instances can be sorted without allocating
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+depth_sort_reserve(struct depth_sort *sort, unsigned int num)
+{
+    unsigned int i;
+
+    if (num <= sort->alloc)
+        return 0;
+
+    unsigned int alloc = sort->alloc ? sort->alloc : 256;
+    while (alloc < num)
+        alloc *= 2;
+
+    /* a failure leaves some buffers bigger, alloc stays what all have */
+    for (i = 0; i < 2; i++) {
+        uint32_t *keys = realloc(sort->keys[i], sizeof(*keys) * alloc);
+        if (!keys)
+            return ENOMEM;
+        sort->keys[i] = keys;
+
+        unsigned int *index = realloc(sort->index[i], sizeof(*index) * alloc);
+        if (!index)
+            return ENOMEM;
+        sort->index[i] = index;
+    }
+
+    sort->alloc = alloc;
+    return 0;
+}
+
+/**
+ * sorts num instances by keys[instance], instances with equal keys stay
+ * in the order they come in
+ * they come in as listed in order, or 0..num - 1 if it is NULL; order
+ * can be the result of a previous call, which sorts by two keys, it is
+ * followed if the buffers have to grow
+ *
+ * returns the instances sorted, valid until the next call, or NULL if
+ * the buffers cannot grow
+ */
+__SYM_EXPORT__ const unsigned int *
+depth_sort(struct depth_sort *sort,
+           const uint32_t *keys,
+           const unsigned int *order,
+           unsigned int num)
+{
+    TRACE_ZONE("depth_sort");
+    unsigned int counts[DEPTH_SORT_DIGITS][DEPTH_SORT_RADIX];
+    unsigned int i, digit, src = 0;
+    int order_buffer = -1;
+
+    /* growing moves the index buffers, a previous result moves along */
+    for (i = 0; i < 2; i++) {
+        if (order && order == sort->index[i])
+            order_buffer = i;
+    }
+
+    if (depth_sort_reserve(sort, num ? num : 1)) {
+        DEBUG_ERROR("out of memory\n");
+        return NULL;
+    }
+
+    if (order_buffer >= 0)
+        order = sort->index[order_buffer];
+
+    memset(counts, 0, sizeof(counts));
+
+    /* order is read completely before the first pass writes, so it may
+     * be one of the index buffers */
+    for (i = 0; i < num; i++) {
+        unsigned int instance = order ? order[i] : i;
+        uint32_t key = keys[instance];
+
+        sort->keys[0][i] = key;
+        sort->index[0][i] = instance;
+        counts[0][key & 0xff]++;
+        counts[1][(key >> 8) & 0xff]++;
+        counts[2][(key >> 16) & 0xff]++;
+        counts[3][key >> 24]++;
+    }
+
+    for (digit = 0; digit < DEPTH_SORT_DIGITS && num; digit++) {
+        unsigned int shift = digit * 8, offset = 0, bucket;
+        unsigned int *count = counts[digit];
+
+        if (count[(sort->keys[src][0] >> shift) & 0xff] == num)
+            continue;
+
+        /* counts become start offsets */
+        for (bucket = 0; bucket < DEPTH_SORT_RADIX; bucket++) {
+            unsigned int n = count[bucket];
+            count[bucket] = offset;
+            offset += n;
+        }
+
+        const uint32_t *src_keys = sort->keys[src];
+        const unsigned int *src_index = sort->index[src];
+        uint32_t *dst_keys = sort->keys[src ^ 1];
+        unsigned int *dst_index = sort->index[src ^ 1];
+
+        for (i = 0; i < num; i++) {
+            uint32_t key = src_keys[i];
+            unsigned int pos = count[(key >> shift) & 0xff]++;
+
+            dst_keys[pos] = key;
+            dst_index[pos] = src_index[i];
+        }
+
+        src ^= 1;
+    }
+
+    return sort->index[src];
+}
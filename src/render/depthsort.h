@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __RENDER_DEPTHSORT_H__
+#define __RENDER_DEPTHSORT_H__
+
+#include <stdint.h>
+
+struct depth_sort;
+
+/* y is stored biased so that negative y sort before positive y */
+#define DEPTH_SORT_Y_BIAS 0x800000
+
+/**
+ * packs a layer and the y of the foot point into a key, layers cover
+ * each other before y is looked at, y outside of 24 bits is clamped
+ */
+static inline uint32_t
+depth_sort_key(unsigned int layer, int y)
+{
+    if (y < -DEPTH_SORT_Y_BIAS)
+        y = -DEPTH_SORT_Y_BIAS;
+    else if (y >= DEPTH_SORT_Y_BIAS)
+        y = DEPTH_SORT_Y_BIAS - 1;
+
+    return (uint32_t)layer << 24 | (uint32_t)(y + DEPTH_SORT_Y_BIAS);
+}
+
+/**
+ * returns the y a key was packed with
+ */
+static inline int
+depth_sort_key_y(uint32_t key)
+{
+    return (int)(key & 0xffffff) - DEPTH_SORT_Y_BIAS;
+}
+
+struct depth_sort *
+depth_sort_new(int *err_out);
+
+void
+depth_sort_free(struct depth_sort *sort);
+
+int
+depth_sort_reserve(struct depth_sort *sort, unsigned int num);
+
+const unsigned int *
+depth_sort(struct depth_sort *sort,
+           const uint32_t *keys,
+           const unsigned int *order,
+           unsigned int num);
+
+#endif /* __RENDER_DEPTHSORT_H__ */
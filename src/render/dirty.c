@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * dirty rectangles
+ * ================
+ *
+ * Most of a frame is the same background as the frame before, only the
+ * sprites that moved, changed their frame or went away leave something
+ * to redraw. For every such sprite both the rectangle it covered and the
+ * one it covers now get marked. dirty_end clips the marks to the view and
+ * merges them into a few rectangles which can be passed to
+ * compositor_draw_rects and then uploaded one by one.
+ *
+ * Two rectangles get merged as long as their bounding box costs no more
+ * than drawing them separately, each rectangle counting as
+ * DIRTY_RECT_COST extra pixels. If that leaves too many, the pairs
+ * growing the least get merged. Scrolling, resizing or marking most of
+ * the view turns the whole view dirty.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "trace.h"
+#include "dirty.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+/* per rectangle overhead of a draw and upload, in pixels */
+#define DIRTY_RECT_COST 1024
+
+struct dirty {
+    int view_x;
+    int view_y;
+    unsigned int width;
+    unsigned int height;
+    /* begin was called before, so the view is comparable */
+    int valid;
+    /* everything has to be redrawn */
+    int full;
+    struct compositor_rect view;
+
+    /* in screen coordinates */
+    struct compositor_rect *rects;
+    unsigned int num_rects;
+    unsigned int rects_alloc;
+};
+
+static inline int64_t
+dirty_area(const struct compositor_rect *rect)
+{
+    return (int64_t)(rect->x1 - rect->x0) * (rect->y1 - rect->y0);
+}
+
+static inline void
+dirty_union(struct compositor_rect *out,
+            const struct compositor_rect *a,
+            const struct compositor_rect *b)
+{
+    out->x0 = a->x0 < b->x0 ? a->x0 : b->x0;
+    out->y0 = a->y0 < b->y0 ? a->y0 : b->y0;
+    out->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+    out->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+}
+
+/**
+ * returns how many pixels merging a and b adds
+ */
+static inline int64_t
+dirty_merge_cost(const struct compositor_rect *a,
+                 const struct compositor_rect *b)
+{
+    struct compositor_rect u;
+
+    dirty_union(&u, a, b);
+    return dirty_area(&u) - dirty_area(a) - dirty_area(b);
+}
+
+static void
+dirty_merge(struct dirty *dirty, unsigned int i, unsigned int j)
+{
+    dirty_union(&dirty->rects[i], &dirty->rects[i], &dirty->rects[j]);
+    dirty->rects[j] = dirty->rects[--dirty->num_rects];
+}
+
+/**
+ * merges rectangles as long as that is cheaper than keeping them apart
+ */
+static void
+dirty_coalesce(struct dirty *dirty)
+{
+    unsigned int i, j;
+    int merged;
+
+    do {
+        merged = 0;
+        for (i = 0; i < dirty->num_rects; i++) {
+            for (j = i + 1; j < dirty->num_rects; ) {
+                if (dirty_merge_cost(&dirty->rects[i], &dirty->rects[j]) <=
+                    DIRTY_RECT_COST) {
+                    dirty_merge(dirty, i, j);
+                    merged = 1;
+                } else {
+                    j++;
+                }
+            }
+        }
+    } while (merged);
+}
+
+/**
+ * merges the cheapest pairs until at most DIRTY_MAX_RECTS are left
+ */
+static void
+dirty_reduce(struct dirty *dirty)
+{
+    while (dirty->num_rects > DIRTY_MAX_RECTS) {
+        unsigned int i, j, best_i = 0, best_j = 1;
+        int64_t best = INT64_MAX;
+
+        for (i = 0; i < dirty->num_rects; i++) {
+            for (j = i + 1; j < dirty->num_rects; j++) {
+                int64_t cost = dirty_merge_cost(&dirty->rects[i],
+                                                &dirty->rects[j]);
+                if (cost < best) {
+                    best = cost;
+                    best_i = i;
+                    best_j = j;
+                }
+            }
+        }
+
+        dirty_merge(dirty, best_i, best_j);
+    }
+}
+
+/**
+ * creates an empty dirty rectangle tracker
+ * the first frame is always fully dirty
+ *
+ * returns a struct dirty on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct dirty *
+dirty_new(int *err_out)
+{
+    int err = 0;
+
+    struct dirty *dirty = malloc(sizeof(*dirty));
+    if (!dirty) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(dirty, 0, sizeof(*dirty));
+
+    return dirty;
+
+error:
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+__SYM_EXPORT__ void
+dirty_free(struct dirty *dirty)
+{
+    if (!dirty)
+        return;
+
+    free(dirty->rects);
+    free(dirty);
+}
+
+/**
+ * starts collecting the changes of a frame showing width x height pixels
+ * from view_x, view_y of the map
+ * a view different from the one of the previous frame is fully dirty
+ */
+__SYM_EXPORT__ void
+dirty_begin(struct dirty *dirty,
+            int view_x,
+            int view_y,
+            unsigned int width,
+            unsigned int height)
+{
+    dirty->full = !dirty->valid ||
+                  dirty->view_x != view_x ||
+                  dirty->view_y != view_y ||
+                  dirty->width != width ||
+                  dirty->height != height;
+    dirty->valid = 1;
+    dirty->view_x = view_x;
+    dirty->view_y = view_y;
+    dirty->width = width;
+    dirty->height = height;
+    dirty->num_rects = 0;
+}
+
+/**
+ * marks a rectangle of the map as dirty
+ * if it cannot be remembered the whole view gets dirty
+ */
+__SYM_EXPORT__ void
+dirty_add(struct dirty *dirty, const struct compositor_rect *rect)
+{
+    struct compositor_rect screen = {
+        rect->x0 - dirty->view_x,
+        rect->y0 - dirty->view_y,
+        rect->x1 - dirty->view_x,
+        rect->y1 - dirty->view_y
+    };
+
+    if (dirty->full)
+        return;
+
+    /* coalescing is quadratic in the marks, past this many a full redraw
+     * is cheaper than finding out what to draw */
+    if (dirty->num_rects >= DIRTY_MAX_MARKS) {
+        dirty->full = 1;
+        return;
+    }
+
+    if (screen.x0 < 0)
+        screen.x0 = 0;
+    if (screen.y0 < 0)
+        screen.y0 = 0;
+    if (screen.x1 > (int)dirty->width)
+        screen.x1 = dirty->width;
+    if (screen.y1 > (int)dirty->height)
+        screen.y1 = dirty->height;
+    if (screen.x0 >= screen.x1 || screen.y0 >= screen.y1)
+        return;
+
+    if (dirty->num_rects == dirty->rects_alloc) {
+        unsigned int alloc = dirty->rects_alloc ? dirty->rects_alloc * 2 : 64;
+        struct compositor_rect *rects = realloc(dirty->rects,
+                                                sizeof(*rects) * alloc);
+        if (!rects) {
+            DEBUG_ERROR("out of memory, redrawing everything\n");
+            dirty->full = 1;
+            return;
+        }
+        dirty->rects = rects;
+        dirty->rects_alloc = alloc;
+    }
+
+    dirty->rects[dirty->num_rects++] = screen;
+}
+
+/**
+ * marks the whole view as dirty
+ */
+__SYM_EXPORT__ void
+dirty_add_all(struct dirty *dirty)
+{
+    dirty->full = 1;
+}
+
+/**
+ * sets rect to the area any frame of an object at x, y can cover
+ */
+__SYM_EXPORT__ void
+dirty_object_rect(struct dvf_object *obj,
+                  int x,
+                  int y,
+                  struct compositor_rect *rect)
+{
+    unsigned int width, height;
+
+    dvf_object_size(obj, &width, &height);
+
+    rect->x0 = x;
+    rect->y0 = y;
+    rect->x1 = x + (int)width;
+    rect->y1 = y + (int)height;
+}
+
+/**
+ * sets rect to the area a frame of an object at x, y covers
+ */
+__SYM_EXPORT__ void
+dirty_frame_rect(struct dvf_frame *frame,
+                 int x,
+                 int y,
+                 struct compositor_rect *rect)
+{
+    unsigned int width, height, offset_x, offset_y;
+
+    dvf_frame_size(frame, &width, &height);
+    dvf_frame_unknown(frame, NULL, NULL, &offset_x, &offset_y, NULL, NULL);
+
+    rect->x0 = x + (int16_t)offset_x;
+    rect->y0 = y + (int16_t)offset_y;
+    rect->x1 = rect->x0 + (int)width;
+    rect->y1 = rect->y0 + (int)height;
+}
+
+/**
+ * compares a sprite with what was drawn for it last frame and marks the
+ * old and the new area if it moved, changed its frame or its depth
+ */
+__SYM_EXPORT__ void
+dirty_update_sprite(struct dirty *dirty,
+                    struct dirty_sprite *state,
+                    const struct compositor_sprite *sprite)
+{
+    struct compositor_rect rect;
+
+    rect.x0 = sprite->x + sprite->offset_x;
+    rect.y0 = sprite->y + sprite->offset_y;
+    rect.x1 = rect.x0 + (int)sprite->width;
+    rect.y1 = rect.y0 + (int)sprite->height;
+
+    if (state->drawn &&
+        state->pixels == sprite->pixels &&
+        state->depth == sprite->depth &&
+        !memcmp(&state->rect, &rect, sizeof(rect)))
+        return;
+
+    if (state->drawn)
+        dirty_add(dirty, &state->rect);
+    dirty_add(dirty, &rect);
+
+    state->rect = rect;
+    state->pixels = sprite->pixels;
+    state->depth = sprite->depth;
+    state->drawn = 1;
+}
+
+/**
+ * marks the area of a sprite that is not drawn anymore
+ */
+__SYM_EXPORT__ void
+dirty_remove_sprite(struct dirty *dirty, struct dirty_sprite *state)
+{
+    if (state->drawn)
+        dirty_add(dirty, &state->rect);
+    state->drawn = 0;
+}
+
+/**
+ * merges the marks of the frame
+ *
+ * returns the rectangles of the view to redraw, in screen coordinates
+ * and clipped to the view, valid until the next dirty_begin
+ */
+__SYM_EXPORT__ const struct compositor_rect *
+dirty_end(struct dirty *dirty, unsigned int *num_rects)
+{
+    TRACE_ZONE("dirty_end");
+    int64_t area = 0;
+    unsigned int i;
+
+    if (!dirty->full) {
+        dirty_coalesce(dirty);
+
+        /* reducing is quadratic per merge, scattered marks are better
+         * served by a full redraw anyway */
+        if (dirty->num_rects > DIRTY_MAX_RECTS * 4)
+            dirty->full = 1;
+        else
+            dirty_reduce(dirty);
+
+        for (i = 0; i < dirty->num_rects; i++)
+            area += dirty_area(&dirty->rects[i]);
+
+        /* one big draw is cheaper than many covering the same */
+        if (area * 4 >= (int64_t)dirty->width * dirty->height * 3)
+            dirty->full = 1;
+    }
+
+    if (dirty->full) {
+        dirty->view.x0 = 0;
+        dirty->view.y0 = 0;
+        dirty->view.x1 = dirty->width;
+        dirty->view.y1 = dirty->height;
+        DEBUG_LOG("full redraw\n");
+
+        *num_rects = 1;
+        return &dirty->view;
+    }
+
+    DEBUG_LOG("%u dirty rectangles, %lld pixels\n",
+              dirty->num_rects,
+              (long long)area);
+
+    *num_rects = dirty->num_rects;
+    return dirty->rects;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __RENDER_DIRTY_H__
+#define __RENDER_DIRTY_H__
+
+#include <stdint.h>
+
+#include "dvf.h"
+#include "compositor.h"
+
+/* more rectangles than this get merged further */
+#define DIRTY_MAX_RECTS 32
+/* more marks than this in a frame turn into a full redraw before merging */
+#define DIRTY_MAX_MARKS (DIRTY_MAX_RECTS * 16)
+
+struct dirty;
+
+/**
+ * what got drawn for a sprite instance in the last frame
+ * kept by the caller for every instance, zero initialized
+ */
+struct dirty_sprite {
+    /* in map coordinates */
+    struct compositor_rect rect;
+    const void *pixels;
+    uint32_t depth;
+    int drawn;
+};
+
+struct dirty *
+dirty_new(int *err_out);
+
+void
+dirty_free(struct dirty *dirty);
+
+void
+dirty_begin(struct dirty *dirty,
+            int view_x,
+            int view_y,
+            unsigned int width,
+            unsigned int height);
+
+void
+dirty_add(struct dirty *dirty, const struct compositor_rect *rect);
+
+void
+dirty_add_all(struct dirty *dirty);
+
+void
+dirty_object_rect(struct dvf_object *obj,
+                  int x,
+                  int y,
+                  struct compositor_rect *rect);
+
+void
+dirty_frame_rect(struct dvf_frame *frame,
+                 int x,
+                 int y,
+                 struct compositor_rect *rect);
+
+void
+dirty_update_sprite(struct dirty *dirty,
+                    struct dirty_sprite *state,
+                    const struct compositor_sprite *sprite);
+
+void
+dirty_remove_sprite(struct dirty *dirty, struct dirty_sprite *state);
+
+const struct compositor_rect *
+dirty_end(struct dirty *dirty, unsigned int *num_rects);
+
+#endif /* __RENDER_DIRTY_H__ */
@@ -0,0 +1,513 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * batched SDL drawing
+ * ===================
+ *
+ * Sprites, fills and outlines are recorded into a list instead of being
+ * drawn right away. drawlist_submit orders the list by layer, depth and
+ * texture (see depthsort.c) and hands every run of commands sharing a
+ * texture to SDL_RenderGeometry as one batch of quads. Fills carry their
+ * color in the vertices and are drawn without a texture, so neither draw
+ * color nor texture changes per command.
+ *
+ * Commands with the same layer and depth are grouped by texture, content
+ * which does not overlap (ground, interface) should use one depth so it
+ * takes one batch per texture. Equal keys keep the order they were
+ * recorded in. All arrays are kept between frames.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "trace.h"
+#include "drawlist.h"
+#include "depthsort.h"
+
+#define DEBUG 0
+#if DEBUG
+  #define DEBUG_LOG(...) do { fprintf(stdout,  __VA_ARGS__ ); } while(0)
+  #define DEBUG_ERROR(...) do { fprintf(stderr,  "error: " __VA_ARGS__ ); } while(0)
+#else
+  #define DEBUG_LOG(...)
+  #define DEBUG_ERROR(...)
+#endif
+
+#define __SYM_EXPORT__ __attribute__ ((visibility ("default")))
+
+/* page 0 stands for untextured fills */
+#define DRAWLIST_MAX_PAGES 0xffff
+
+struct drawlist_page {
+    SDL_Texture *texture;
+    int width;
+    int height;
+};
+
+struct drawlist_command {
+    SDL_Rect src;
+    SDL_Rect dst;
+    SDL_Color color;
+    unsigned int page;
+};
+
+struct drawlist {
+    SDL_Renderer *renderer;
+
+    /* the sort key is layer << 56 | depth << 24 | page << 8, split in
+     * two halves sorted one after the other */
+    struct drawlist_command *commands;
+    uint32_t *keys_high;
+    uint32_t *keys_low;
+    unsigned int num_commands;
+    unsigned int commands_alloc;
+    struct depth_sort *sort;
+
+    /* textures used since the last submit */
+    struct drawlist_page *pages;
+    unsigned int num_pages;
+    unsigned int pages_alloc;
+    unsigned int last_page;
+
+    SDL_Vertex *vertices;
+    unsigned int vertices_alloc;
+    int *indices;
+    unsigned int indices_alloc;
+};
+
+/**
+ * grows a scratch array to hold at least num elements
+ */
+static int
+drawlist_reserve(void **array,
+                 unsigned int *alloc,
+                 unsigned int num,
+                 size_t size)
+{
+    if (num <= *alloc)
+        return 0;
+
+    unsigned int new_alloc = *alloc ? *alloc : 256;
+    while (new_alloc < num)
+        new_alloc *= 2;
+
+    void *new_array = realloc(*array, new_alloc * size);
+    if (!new_array)
+        return ENOMEM;
+
+    *array = new_array;
+    *alloc = new_alloc;
+    return 0;
+}
+
+static void
+drawlist_reset(struct drawlist *drawlist)
+{
+    drawlist->num_commands = 0;
+    drawlist->num_pages = 1;
+    drawlist->last_page = 0;
+}
+
+/**
+ * looks up the page of a texture, adding it if it is new
+ */
+static int
+drawlist_page(struct drawlist *drawlist,
+              SDL_Texture *texture,
+              unsigned int *page_out)
+{
+    struct drawlist_page *page;
+    unsigned int i;
+
+    if (drawlist->pages[drawlist->last_page].texture == texture) {
+        *page_out = drawlist->last_page;
+        return 0;
+    }
+
+    for (i = 1; i < drawlist->num_pages; i++) {
+        if (drawlist->pages[i].texture == texture) {
+            *page_out = drawlist->last_page = i;
+            return 0;
+        }
+    }
+
+    if (drawlist->num_pages == DRAWLIST_MAX_PAGES)
+        return ENOSPC;
+
+    if (drawlist_reserve((void **)&drawlist->pages,
+                         &drawlist->pages_alloc,
+                         drawlist->num_pages + 1,
+                         sizeof(*drawlist->pages)))
+        return ENOMEM;
+
+    page = &drawlist->pages[drawlist->num_pages];
+    if (SDL_QueryTexture(texture, NULL, NULL, &page->width, &page->height)) {
+        DEBUG_ERROR("cannot query texture: %s\n", SDL_GetError());
+        return EINVAL;
+    }
+    page->texture = texture;
+
+    *page_out = drawlist->last_page = drawlist->num_pages++;
+    return 0;
+}
+
+static int
+drawlist_push(struct drawlist *drawlist,
+              uint8_t layer,
+              uint32_t depth,
+              unsigned int page,
+              const SDL_Rect *src,
+              const SDL_Rect *dst,
+              SDL_Color color)
+{
+    /* commands and keys grow together, commands_alloc is updated last */
+    unsigned int alloc_commands = drawlist->commands_alloc;
+    unsigned int alloc_high = drawlist->commands_alloc;
+
+    if (drawlist_reserve((void **)&drawlist->commands,
+                         &alloc_commands,
+                         drawlist->num_commands + 1,
+                         sizeof(*drawlist->commands)) ||
+        drawlist_reserve((void **)&drawlist->keys_high,
+                         &alloc_high,
+                         drawlist->num_commands + 1,
+                         sizeof(*drawlist->keys_high)) ||
+        drawlist_reserve((void **)&drawlist->keys_low,
+                         &drawlist->commands_alloc,
+                         drawlist->num_commands + 1,
+                         sizeof(*drawlist->keys_low)))
+        return ENOMEM;
+
+    unsigned int index = drawlist->num_commands++;
+    struct drawlist_command *command = &drawlist->commands[index];
+
+    command->src = *src;
+    command->dst = *dst;
+    command->color = color;
+    command->page = page;
+
+    drawlist->keys_high[index] = (uint32_t)layer << 24 | depth >> 8;
+    drawlist->keys_low[index] = (depth & 0xff) << 24 | page << 8;
+
+    return 0;
+}
+
+/**
+ * draws vertices first_vertex..num_vertices with texture of page
+ */
+static int
+drawlist_flush(struct drawlist *drawlist,
+               unsigned int page,
+               unsigned int first_vertex,
+               unsigned int num_vertices)
+{
+    if (num_vertices == first_vertex)
+        return 0;
+
+    /* indices are relative to the first vertex of the batch */
+    if (SDL_RenderGeometry(drawlist->renderer,
+                           drawlist->pages[page].texture,
+                           drawlist->vertices + first_vertex,
+                           num_vertices - first_vertex,
+                           drawlist->indices,
+                           (num_vertices - first_vertex) / 4 * 6)) {
+        DEBUG_ERROR("cannot render geometry: %s\n", SDL_GetError());
+        return EIO;
+    }
+
+    return 0;
+}
+
+/**
+ * creates an empty draw list drawing with renderer
+ *
+ * returns a struct drawlist on success, otherwise NULL and err gets set
+ */
+__SYM_EXPORT__ struct drawlist *
+drawlist_new(SDL_Renderer *renderer, int *err_out)
+{
+    int err = 0;
+
+    struct drawlist *drawlist = malloc(sizeof(*drawlist));
+    if (!drawlist) {
+        DEBUG_ERROR("out of memory\n");
+        err = ENOMEM;
+        goto error;
+    }
+    memset(drawlist, 0, sizeof(*drawlist));
+    drawlist->renderer = renderer;
+
+    drawlist->sort = depth_sort_new(&err);
+    if (!drawlist->sort)
+        goto error;
+
+    if ((err = drawlist_reserve((void **)&drawlist->pages,
+                                &drawlist->pages_alloc,
+                                1,
+                                sizeof(*drawlist->pages)))) {
+        DEBUG_ERROR("out of memory\n");
+        goto error;
+    }
+    drawlist->pages[0].texture = NULL;
+    drawlist->pages[0].width = 1;
+    drawlist->pages[0].height = 1;
+    drawlist_reset(drawlist);
+
+    return drawlist;
+
+error:
+    drawlist_free(drawlist);
+    if (err_out)
+        *err_out = err;
+    return NULL;
+}
+
+__SYM_EXPORT__ void
+drawlist_free(struct drawlist *drawlist)
+{
+    if (!drawlist)
+        return;
+
+    free(drawlist->indices);
+    free(drawlist->vertices);
+    free(drawlist->pages);
+    free(drawlist->keys_low);
+    free(drawlist->keys_high);
+    free(drawlist->commands);
+    depth_sort_free(drawlist->sort);
+    free(drawlist);
+}
+
+/**
+ * records src of texture drawn to dst, a NULL src is the whole texture
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+drawlist_sprite(struct drawlist *drawlist,
+                uint8_t layer,
+                uint32_t depth,
+                SDL_Texture *texture,
+                const SDL_Rect *src,
+                const SDL_Rect *dst)
+{
+    static const SDL_Color white = { 255, 255, 255, 255 };
+    unsigned int page;
+    int err = 0;
+
+    if (!texture)
+        return EINVAL;
+    if ((err = drawlist_page(drawlist, texture, &page)))
+        return err;
+
+    SDL_Rect whole = {
+        0, 0, drawlist->pages[page].width, drawlist->pages[page].height
+    };
+
+    return drawlist_push(drawlist,
+                         layer,
+                         depth,
+                         page,
+                         src ? src : &whole,
+                         dst,
+                         white);
+}
+
+/**
+ * records a filled rectangle
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+drawlist_fill(struct drawlist *drawlist,
+              uint8_t layer,
+              uint32_t depth,
+              const SDL_Rect *rect,
+              SDL_Color color)
+{
+    static const SDL_Rect none = { 0, 0, 0, 0 };
+
+    if (rect->w <= 0 || rect->h <= 0)
+        return 0;
+
+    return drawlist_push(drawlist, layer, depth, 0, &none, rect, color);
+}
+
+/**
+ * records the one pixel wide outline SDL_RenderDrawRect would draw
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+drawlist_outline(struct drawlist *drawlist,
+                 uint8_t layer,
+                 uint32_t depth,
+                 const SDL_Rect *rect,
+                 SDL_Color color)
+{
+    SDL_Rect edges[4] = {
+        { rect->x, rect->y, rect->w, 1 },
+        { rect->x, rect->y + rect->h - 1, rect->w, 1 },
+        { rect->x, rect->y + 1, 1, rect->h - 2 },
+        { rect->x + rect->w - 1, rect->y + 1, 1, rect->h - 2 },
+    };
+    unsigned int i, num_edges = 4;
+    int err = 0;
+
+    if (rect->w <= 0 || rect->h <= 0)
+        return 0;
+    /* a single row or column would be drawn twice */
+    if (rect->h == 1)
+        num_edges = 1;
+    else if (rect->w == 1)
+        num_edges = 3;
+
+    for (i = 0; i < num_edges; i++) {
+        if ((err = drawlist_fill(drawlist, layer, depth, &edges[i], color)))
+            return err;
+    }
+
+    return 0;
+}
+
+/**
+ * draws everything recorded since the last submit and empties the list
+ * stats can be NULL
+ *
+ * returns 0 on success
+ */
+__SYM_EXPORT__ int
+drawlist_submit(struct drawlist *drawlist, struct drawlist_stats *stats)
+{
+    TRACE_ZONE("drawlist_submit");
+    unsigned int i, num_vertices = 0, batch_start = 0, batch_page = 0;
+    unsigned int num_batches = 0;
+    int err = 0;
+
+    if (drawlist_reserve((void **)&drawlist->vertices,
+                         &drawlist->vertices_alloc,
+                         drawlist->num_commands * 4,
+                         sizeof(*drawlist->vertices))) {
+        err = ENOMEM;
+        goto out;
+    }
+
+    /* the index pattern of the quads is the same for every batch */
+    unsigned int old_indices = drawlist->indices_alloc / 6 * 6;
+    if (drawlist_reserve((void **)&drawlist->indices,
+                         &drawlist->indices_alloc,
+                         drawlist->num_commands * 6,
+                         sizeof(*drawlist->indices))) {
+        err = ENOMEM;
+        goto out;
+    }
+    for (i = old_indices; i + 6 <= drawlist->indices_alloc; i += 6) {
+        int v = i / 6 * 4;
+        drawlist->indices[i + 0] = v + 0;
+        drawlist->indices[i + 1] = v + 1;
+        drawlist->indices[i + 2] = v + 2;
+        drawlist->indices[i + 3] = v + 2;
+        drawlist->indices[i + 4] = v + 1;
+        drawlist->indices[i + 5] = v + 3;
+    }
+
+    /* the low half first, the stable sort by the high half keeps it */
+    const unsigned int *order = depth_sort(drawlist->sort,
+                                           drawlist->keys_low,
+                                           NULL,
+                                           drawlist->num_commands);
+    if (order)
+        order = depth_sort(drawlist->sort,
+                           drawlist->keys_high,
+                           order,
+                           drawlist->num_commands);
+    if (!order) {
+        err = ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < drawlist->num_commands; i++) {
+        const struct drawlist_command *command =
+            &drawlist->commands[order[i]];
+        const struct drawlist_page *page = &drawlist->pages[command->page];
+        SDL_Vertex *vertex = &drawlist->vertices[num_vertices];
+
+        if (command->page != batch_page) {
+            if (num_vertices != batch_start)
+                num_batches++;
+            if ((err = drawlist_flush(drawlist,
+                                      batch_page,
+                                      batch_start,
+                                      num_vertices)))
+                goto out;
+            batch_page = command->page;
+            batch_start = num_vertices;
+        }
+
+        float x0 = command->dst.x, x1 = command->dst.x + command->dst.w;
+        float y0 = command->dst.y, y1 = command->dst.y + command->dst.h;
+        float u0 = (float)command->src.x / page->width;
+        float u1 = (float)(command->src.x + command->src.w) / page->width;
+        float v0 = (float)command->src.y / page->height;
+        float v1 = (float)(command->src.y + command->src.h) / page->height;
+
+        /* top left, top right, bottom left, bottom right */
+        vertex[0].position.x = x0;
+        vertex[0].position.y = y0;
+        vertex[0].tex_coord.x = u0;
+        vertex[0].tex_coord.y = v0;
+        vertex[1].position.x = x1;
+        vertex[1].position.y = y0;
+        vertex[1].tex_coord.x = u1;
+        vertex[1].tex_coord.y = v0;
+        vertex[2].position.x = x0;
+        vertex[2].position.y = y1;
+        vertex[2].tex_coord.x = u0;
+        vertex[2].tex_coord.y = v1;
+        vertex[3].position.x = x1;
+        vertex[3].position.y = y1;
+        vertex[3].tex_coord.x = u1;
+        vertex[3].tex_coord.y = v1;
+        vertex[0].color = vertex[1].color = command->color;
+        vertex[2].color = vertex[3].color = command->color;
+        num_vertices += 4;
+    }
+
+    if (num_vertices != batch_start)
+        num_batches++;
+    err = drawlist_flush(drawlist, batch_page, batch_start, num_vertices);
+
+out:
+    if (stats) {
+        stats->num_commands = drawlist->num_commands;
+        stats->num_batches = num_batches;
+        stats->num_pages = drawlist->num_pages;
+    }
+    DEBUG_LOG("%u commands in %u batches\n",
+              drawlist->num_commands,
+              num_batches);
+
+    drawlist_reset(drawlist);
+    return err;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __RENDER_DRAWLIST_H__
+#define __RENDER_DRAWLIST_H__
+
+#include <stdint.h>
+#include <SDL.h>
+
+struct drawlist;
+
+/**
+ * what the last drawlist_submit did
+ */
+struct drawlist_stats {
+    unsigned int num_commands;
+    /* SDL_RenderGeometry calls */
+    unsigned int num_batches;
+    /* distinct textures, fills count as one */
+    unsigned int num_pages;
+};
+
+struct drawlist *
+drawlist_new(SDL_Renderer *renderer, int *err_out);
+
+void
+drawlist_free(struct drawlist *drawlist);
+
+int
+drawlist_sprite(struct drawlist *drawlist,
+                uint8_t layer,
+                uint32_t depth,
+                SDL_Texture *texture,
+                const SDL_Rect *src,
+                const SDL_Rect *dst);
+
+int
+drawlist_fill(struct drawlist *drawlist,
+              uint8_t layer,
+              uint32_t depth,
+              const SDL_Rect *rect,
+              SDL_Color color);
+
+int
+drawlist_outline(struct drawlist *drawlist,
+                 uint8_t layer,
+                 uint32_t depth,
+                 const SDL_Rect *rect,
+                 SDL_Color color);
+
+int
+drawlist_submit(struct drawlist *drawlist, struct drawlist_stats *stats);
+
+#endif /* __RENDER_DRAWLIST_H__ */
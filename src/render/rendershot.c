@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * headless scene screenshots
+ * ==========================
+ *
+ * Composes a dvm background with random instances of the frames of a dvf
+ * file using the software compositor and writes the result as png. The
+ * draw is repeated and timed, so this doubles as compositor benchmark.
+ *
+ * With -a the scene is animated afterwards: every frame some of the
+ * sprites step or switch their frame and only the dirty rectangles get
+ * recomposed. The result is checked against a full redraw.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "stats.h"
+#include "pixmap.h"
+#include "png.h"
+#include "dvf.h"
+#include "dvm.h"
+#include "compositor.h"
+#include "dirty.h"
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-j threads] [-n sprites] [-s WxH] [-v X,Y] "
+            "[-r repetitions]\n"
+            "       [-a frames] [-m moving %%] "
+            "<map.dvm> <sprites.dvf> <out.png>\n",
+            name);
+}
+
+/**
+ * collects the decoded pixmaps of all valid frames
+ */
+static int
+load_frames(struct dvf_file *file,
+            struct dvf_frame ***frames_out,
+            void ***pixmaps_out,
+            unsigned int *num_out)
+{
+    unsigned int i, j, k, width, height, num = 0, alloc = 0;
+    struct dvf_frame **frames = NULL;
+    void **pixmaps = NULL;
+
+    for (i = 0; i < dvf_file_num_objects(file); i++) {
+        struct dvf_object *obj = dvf_file_get_object(file, i);
+
+        for (j = 0; j < dvf_object_num_animations(obj); j++) {
+            struct dvf_animation *anim = dvf_object_get_animation(obj, j);
+
+            for (k = 0; k < dvf_animation_num_frames(anim); k++) {
+                struct dvf_frame *frame = dvf_animation_get_frame(anim, k);
+                if (!dvf_frame_valid(frame))
+                    continue;
+
+                if (num == alloc) {
+                    alloc = alloc ? alloc * 2 : 64;
+                    frames = realloc(frames, sizeof(*frames) * alloc);
+                    pixmaps = realloc(pixmaps, sizeof(*pixmaps) * alloc);
+                    if (!frames || !pixmaps)
+                        return ENOMEM;
+                }
+
+                frames[num] = frame;
+                pixmaps[num] = dvf_frame_pixmap(frame, &width, &height);
+                if (!pixmaps[num])
+                    return ENOMEM;
+                num++;
+            }
+        }
+    }
+
+    *frames_out = frames;
+    *pixmaps_out = pixmaps;
+    *num_out = num;
+    return num ? 0 : EILSEQ;
+}
+
+static void
+place_sprite(struct compositor_sprite *sprite,
+             struct dvf_frame *frame,
+             void *pixmap,
+             int x,
+             int y)
+{
+    unsigned int width, height;
+
+    dvf_frame_size(frame, &width, &height);
+    compositor_sprite_from_frame(sprite, frame, pixmap, x, y, y + height);
+}
+
+/**
+ * moves or animates moving percent of the sprites for num_frames frames
+ * and redraws only what changed
+ */
+static int
+animate(struct compositor *compositor,
+        const struct compositor_target *target,
+        int view_x,
+        int view_y,
+        const struct compositor_background *background,
+        struct compositor_sprite *sprites,
+        unsigned int num_sprites,
+        struct dvf_frame **frames,
+        void **pixmaps,
+        unsigned int num_frames,
+        unsigned int num_anim_frames,
+        unsigned int moving)
+{
+    unsigned int i, j, num_rects;
+    uint64_t total = 0, pixels = 0;
+    int err = 0;
+
+    struct dirty_sprite *states = calloc(num_sprites ? num_sprites : 1,
+                                         sizeof(*states));
+    unsigned int *frame_index = calloc(num_sprites ? num_sprites : 1,
+                                       sizeof(*frame_index));
+    uint8_t *check = malloc((size_t)target->pitch * target->height);
+    struct dirty *dirty = dirty_new(&err);
+    if (!states || !frame_index || !check || !dirty) {
+        err = ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < num_sprites; i++) {
+        for (j = 0; j < num_frames; j++)
+            if (pixmaps[j] == sprites[i].pixels)
+                frame_index[i] = j;
+    }
+
+    /* the target holds the last full draw, let the tracker know */
+    dirty_begin(dirty, view_x, view_y, target->width, target->height);
+    for (i = 0; i < num_sprites; i++)
+        dirty_update_sprite(dirty, &states[i], &sprites[i]);
+    dirty_end(dirty, &num_rects);
+
+    for (j = 0; j < num_anim_frames; j++) {
+        for (i = 0; i < num_sprites; i++) {
+            if ((unsigned int)rand() % 100 >= moving)
+                continue;
+
+            if (rand() % 2) {
+                frame_index[i] = (frame_index[i] + 1) % num_frames;
+            } else {
+                sprites[i].x += rand() % 9 - 4;
+                sprites[i].y += rand() % 9 - 4;
+            }
+            place_sprite(&sprites[i],
+                         frames[frame_index[i]],
+                         pixmaps[frame_index[i]],
+                         sprites[i].x,
+                         sprites[i].y);
+        }
+
+        uint64_t start = file_stats_now();
+        dirty_begin(dirty, view_x, view_y, target->width, target->height);
+        for (i = 0; i < num_sprites; i++)
+            dirty_update_sprite(dirty, &states[i], &sprites[i]);
+        const struct compositor_rect *rects = dirty_end(dirty, &num_rects);
+
+        err = compositor_draw_rects(compositor,
+                                    target,
+                                    view_x,
+                                    view_y,
+                                    background,
+                                    sprites,
+                                    num_sprites,
+                                    rects,
+                                    num_rects);
+        total += file_stats_now() - start;
+        if (err)
+            goto out;
+
+        for (i = 0; i < num_rects; i++)
+            pixels += (uint64_t)(rects[i].x1 - rects[i].x0) *
+                      (rects[i].y1 - rects[i].y0);
+    }
+
+    struct compositor_target full = *target;
+    full.pixels = check;
+    if ((err = compositor_draw(compositor,
+                               &full,
+                               view_x,
+                               view_y,
+                               background,
+                               sprites,
+                               num_sprites)))
+        goto out;
+
+    printf("%u frames, %u%% moving: mean %.3f ms, %.1f%% of the view "
+           "redrawn, %s\n",
+           num_anim_frames,
+           moving,
+           total / 1e6 / num_anim_frames,
+           100.0 * pixels / num_anim_frames /
+           ((double)target->width * target->height),
+           memcmp(check, target->pixels,
+                  (size_t)target->pitch * target->height) ?
+           "MISMATCH with full redraw" : "same as full redraw");
+
+out:
+    dirty_free(dirty);
+    free(check);
+    free(frame_index);
+    free(states);
+    return err;
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt, err = 0;
+    unsigned int num_threads = 0, num_sprites = 1000, repetitions = 10;
+    unsigned int width = 1024, height = 768, i;
+    unsigned int num_anim_frames = 0, moving = 5;
+    int view_x = 0, view_y = 0;
+    unsigned int map_width, map_height, num_frames = 0;
+    struct dvf_frame **frames = NULL;
+    void **pixmaps = NULL;
+
+    while ((opt = getopt(argc, argv, "j:n:s:v:r:a:m:")) != -1) {
+        switch (opt) {
+            case 'j':
+                num_threads = atoi(optarg);
+                break;
+            case 'n':
+                num_sprites = atoi(optarg);
+                break;
+            case 's':
+                if (sscanf(optarg, "%ux%u", &width, &height) != 2) {
+                    usage(argv[0]);
+                    return EINVAL;
+                }
+                break;
+            case 'v':
+                if (sscanf(optarg, "%d,%d", &view_x, &view_y) != 2) {
+                    usage(argv[0]);
+                    return EINVAL;
+                }
+                break;
+            case 'r':
+                repetitions = atoi(optarg);
+                break;
+            case 'a':
+                num_anim_frames = atoi(optarg);
+                break;
+            case 'm':
+                moving = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return EINVAL;
+        }
+    }
+
+    if (optind + 3 != argc || !width || !height || !repetitions) {
+        usage(argv[0]);
+        return EINVAL;
+    }
+
+    const char *map_file_name = argv[optind];
+    const char *dvf_file_name = argv[optind + 1];
+    const char *out_file_name = argv[optind + 2];
+
+    uint16_t *map = dvm_file_get_pixmap(map_file_name,
+                                        &map_width,
+                                        &map_height,
+                                        &err);
+    if (!map) {
+        fprintf(stderr,
+                "error: cannot read map %s: %s (%d)\n",
+                map_file_name,
+                strerror(err),
+                err);
+        return err;
+    }
+
+    struct dvf_file *file = dvf_file_open((char *)dvf_file_name, &err);
+    if (!file || (err = dvf_file_init(file)) ||
+        (err = load_frames(file, &frames, &pixmaps, &num_frames))) {
+        fprintf(stderr,
+                "error: cannot read sprites %s: %s (%d)\n",
+                dvf_file_name,
+                strerror(err),
+                err);
+        return err;
+    }
+
+    /* units stand anywhere on the map and are sorted by their feet */
+    struct compositor_sprite *sprites = calloc(num_sprites ? num_sprites : 1,
+                                               sizeof(*sprites));
+    uint8_t *pixels = malloc((size_t)width * height * 4);
+    if (!sprites || !pixels) {
+        fprintf(stderr, "error: out of memory\n");
+        return ENOMEM;
+    }
+
+    srand(1);
+    for (i = 0; i < num_sprites; i++) {
+        unsigned int frame = rand() % num_frames;
+        int x = rand() % map_width;
+        int y = rand() % map_height;
+
+        place_sprite(&sprites[i], frames[frame], pixmaps[frame], x, y);
+    }
+
+    struct compositor_target target = { pixels, width, height, width * 4 };
+    struct compositor_background background = {
+        map, map_width, map_height, map_width * 2
+    };
+
+    struct compositor *compositor = compositor_new(num_threads, &err);
+    if (!compositor) {
+        fprintf(stderr,
+                "error: cannot create compositor: %s (%d)\n",
+                strerror(err),
+                err);
+        return err;
+    }
+
+    uint64_t best = UINT64_MAX, total = 0;
+    for (i = 0; i < repetitions; i++) {
+        uint64_t start = file_stats_now();
+        err = compositor_draw(compositor,
+                              &target,
+                              view_x,
+                              view_y,
+                              &background,
+                              sprites,
+                              num_sprites);
+        uint64_t elapsed = file_stats_now() - start;
+        if (err) {
+            fprintf(stderr,
+                    "error: cannot draw: %s (%d)\n",
+                    strerror(err),
+                    err);
+            return err;
+        }
+
+        total += elapsed;
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    printf("%ux%u, %u sprites, %u threads: best %.3f ms, mean %.3f ms\n",
+           width,
+           height,
+           num_sprites,
+           compositor_num_threads(compositor),
+           best / 1e6,
+           total / 1e6 / repetitions);
+
+    if ((err = png_write(out_file_name,
+                         pixels,
+                         width,
+                         height,
+                         width * 4,
+                         PNG_FORMAT_B8G8R8A8,
+                         6,
+                         NULL))) {
+        fprintf(stderr,
+                "error: cannot write %s: %s (%d)\n",
+                out_file_name,
+                strerror(err),
+                err);
+        return err;
+    }
+
+    if (num_anim_frames &&
+        (err = animate(compositor,
+                       &target,
+                       view_x,
+                       view_y,
+                       &background,
+                       sprites,
+                       num_sprites,
+                       frames,
+                       pixmaps,
+                       num_frames,
+                       num_anim_frames,
+                       moving))) {
+        fprintf(stderr,
+                "error: cannot animate: %s (%d)\n",
+                strerror(err),
+                err);
+        return err;
+    }
+
+    compositor_free(compositor);
+    for (i = 0; i < num_frames; i++)
+        pixmap_free(pixmaps[i]);
+    free(pixmaps);
+    free(frames);
+    free(sprites);
+    free(pixels);
+    pixmap_free(map);
+    dvf_file_cleanup(file);
+    dvf_file_close(file);
+
+    return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2014 Sebastian Wick <sebastian@sebastianwick.net>
+ *
+ * This file is part of Despandos.
+ *
+ * Despandos is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Despandos is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Despandos.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * depth sort benchmark
+ * ====================
+ *
+ * Sorts keys like those of a scene, a layer and the y of the foot point
+ * of every instance, with depth_sort and with qsort on the key and index
+ * packed into 64 bits, the way the compositor sorted before. Two kinds of
+ * frames are timed for every instance count:
+ *
+ *   random    all instances placed anew
+ *   coherent  the previous frame with a few instances moved a little
+ *
+ * Both sorts have to agree, the times are the median over the
+ * repetitions in milliseconds and nanoseconds per instance.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "stats.h"
+#include "depthsort.h"
+
+#define SORTBENCH_REPETITIONS 21
+#define SORTBENCH_LAYERS 4
+#define SORTBENCH_MAP_HEIGHT 4096
+
+static const unsigned int default_counts[] = { 1000, 10000, 100000 };
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-r repetitions] [instances...]\n"
+            "times depth_sort against qsort, default 1000 10000 100000\n",
+            name);
+}
+
+static int
+sortbench_u64_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void
+sortbench_place(uint32_t *keys, unsigned int num, int coherent)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        if (!coherent) {
+            keys[i] = depth_sort_key(rand() % SORTBENCH_LAYERS,
+                                     rand() % SORTBENCH_MAP_HEIGHT);
+        } else if (rand() % 10 == 0) {
+            /* one in ten walks a few pixels up or down */
+            int y = depth_sort_key_y(keys[i]) + rand() % 9 - 4;
+            keys[i] = depth_sort_key(keys[i] >> 24,
+                                     (y + SORTBENCH_MAP_HEIGHT) %
+                                     SORTBENCH_MAP_HEIGHT);
+        }
+    }
+}
+
+static uint64_t
+sortbench_median(uint64_t *samples, unsigned int num)
+{
+    qsort(samples, num, sizeof(*samples), sortbench_u64_cmp);
+    return samples[num / 2];
+}
+
+static int
+sortbench_run(struct depth_sort *sort,
+              unsigned int num,
+              unsigned int repetitions,
+              int coherent)
+{
+    uint32_t *keys = malloc(sizeof(*keys) * (num ? num : 1));
+    uint64_t *packed = malloc(sizeof(*packed) * (num ? num : 1));
+    uint64_t *radix_samples = malloc(sizeof(uint64_t) * repetitions);
+    uint64_t *qsort_samples = malloc(sizeof(uint64_t) * repetitions);
+    unsigned int i, j;
+    int err = 0;
+
+    if (!keys || !packed || !radix_samples || !qsort_samples) {
+        err = ENOMEM;
+        goto out;
+    }
+
+    sortbench_place(keys, num, 0);
+
+    /* grow the buffers once, like after the first frame */
+    if ((err = depth_sort_reserve(sort, num)))
+        goto out;
+
+    for (j = 0; j < repetitions; j++) {
+        sortbench_place(keys, num, coherent);
+
+        uint64_t start = file_stats_now();
+        const unsigned int *order = depth_sort(sort, keys, NULL, num);
+        radix_samples[j] = file_stats_now() - start;
+        if (!order) {
+            err = ENOMEM;
+            goto out;
+        }
+
+        start = file_stats_now();
+        for (i = 0; i < num; i++)
+            packed[i] = (uint64_t)keys[i] << 32 | i;
+        qsort(packed, num, sizeof(*packed), sortbench_u64_cmp);
+        qsort_samples[j] = file_stats_now() - start;
+
+        for (i = 0; i < num; i++) {
+            if (order[i] != (packed[i] & 0xffffffff)) {
+                fprintf(stderr,
+                        "error: sorts disagree at %u of %u\n",
+                        i,
+                        num);
+                err = EILSEQ;
+                goto out;
+            }
+        }
+    }
+
+    uint64_t radix = sortbench_median(radix_samples, repetitions);
+    uint64_t quick = sortbench_median(qsort_samples, repetitions);
+
+    printf("%9u  %-8s  %9.3f  %7.2f  %9.3f  %7.2f  %6.1fx\n",
+           num,
+           coherent ? "coherent" : "random",
+           radix / 1e6,
+           num ? (double)radix / num : 0.0,
+           quick / 1e6,
+           num ? (double)quick / num : 0.0,
+           radix ? (double)quick / radix : 0.0);
+
+out:
+    free(qsort_samples);
+    free(radix_samples);
+    free(packed);
+    free(keys);
+    return err;
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt, err = 0, coherent;
+    unsigned int repetitions = SORTBENCH_REPETITIONS;
+    unsigned int i, num_counts;
+
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        switch (opt) {
+            case 'r':
+                repetitions = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return EINVAL;
+        }
+    }
+
+    if (!repetitions) {
+        usage(argv[0]);
+        return EINVAL;
+    }
+
+    num_counts = optind < argc ?
+                 (unsigned int)(argc - optind) :
+                 sizeof(default_counts) / sizeof(*default_counts);
+
+    struct depth_sort *sort = depth_sort_new(&err);
+    if (!sort) {
+        fprintf(stderr,
+                "error: cannot create depth sort: %s (%d)\n",
+                strerror(err),
+                err);
+        return err;
+    }
+
+    printf("%9s  %-8s  %9s  %7s  %9s  %7s  %7s\n",
+           "instances", "frames", "radix ms", "ns/inst",
+           "qsort ms", "ns/inst", "speedup");
+
+    srand(1);
+    for (i = 0; i < num_counts && !err; i++) {
+        unsigned int num = optind < argc ?
+                           (unsigned int)atoi(argv[optind + i]) :
+                           default_counts[i];
+
+        for (coherent = 0; coherent < 2 && !err; coherent++)
+            err = sortbench_run(sort, num, repetitions, coherent);
+    }
+
+    depth_sort_free(sort);
+
+    return err;
+}